@@ -1,20 +1,134 @@
 #include "command.h"
 
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
 #include <unistd.h>
+#include <vector>
 #include <sys/reboot.h>
 
+#include "rapidjson/reader.h"
+
 #include "control.h"
 #include "input.h"
 #include "logger.h"
 #include "notification.h"
+#include "reactor.h"
 #include "reports.h"
 #include "schedule.h"
+#include "trace.h"
 
 #define DATADIR		AM_DATADIR
 
 // Constants
 //
 
+// The number of slots in the token name hash table. This must be a power of two, and larger than the
+// number of token names.
+#define COMMAND_TOKEN_HASH_SLOT_COUNT		(64)
+
+// How much of a command is spelled out when it can't be understood.
+#define COMMAND_DESCRIPTION_CAPACITY		(128)
+
+// Types
+//
+
+// A slot of an intent. The name and value point into the message that was parsed.
+struct CommandIntentSlot
+{
+	// The name of the slot.
+	std::string_view	m_Name;
+
+	// The words that were spoken for it.
+	std::string_view	m_Value;
+};
+
+// Reads an intent message as it is parsed, keeping only the parts that commands are made from: the
+// intent name, the session ID, and the name and raw value of each slot. The message must be parsed
+// in place, and must outlive the reader, since nothing is copied out of it.
+class CommandIntentReader : 
+	public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, CommandIntentReader>
+{
+	public:
+
+		// Constants.
+		static constexpr unsigned int ms_SlotCapacity = CommandTokenList::ms_Capacity;
+
+		// Handlers called by the parser. Everything else is skipped by the base handler.
+
+		bool StartObject();
+		bool EndObject(rapidjson::SizeType p_MemberCount);
+		bool StartArray();
+		bool EndArray(rapidjson::SizeType p_ElementCount);
+		bool Key(char const* p_String, rapidjson::SizeType p_Length, bool p_Copy);
+		bool String(char const* p_String, rapidjson::SizeType p_Length, bool p_Copy);
+
+		// Accessors.
+
+		char const* GetIntentName() const
+		{
+			return m_IntentName;
+		}
+
+		char const* GetSessionID() const
+		{
+			return m_SessionID;
+		}
+
+		unsigned int GetSlotCount() const
+		{
+			return m_SlotCount;
+		}
+
+		CommandIntentSlot const& GetSlot(unsigned int p_Index) const
+		{
+			return m_Slots[p_Index];
+		}
+
+		bool HasTooManySlots() const
+		{
+			return m_TooManySlots;
+		}
+
+	private:
+
+		// The members we look for.
+		enum Keys
+		{
+			KEY_OTHER = 0,
+			KEY_INTENT,				// The intent object of the message.
+			KEY_INTENT_NAME,		// The name of the intent, in the intent object.
+			KEY_SESSION_ID,		// The session ID of the message.
+			KEY_SLOTS,				// The slots array of the message.
+			KEY_SLOT_NAME,			// The name of a slot, in a slot object.
+			KEY_RAW_VALUE,			// The raw value of a slot, in a slot object.
+		};
+
+		// How many objects and arrays deep the parser is. The message itself is 1.
+		unsigned int		m_Depth = 0;
+
+		// The member of the message being read, and the member of the intent or slot being read.
+		Keys					m_MessageKey = KEY_OTHER;
+		Keys					m_Key = KEY_OTHER;
+
+		// The name of the intent and the session ID, or null if they weren't found.
+		char const*			m_IntentName = nullptr;
+		char const*			m_SessionID = nullptr;
+
+		// The slots, of which only the first m_SlotCount are in use.
+		CommandIntentSlot	m_Slots[ms_SlotCapacity];
+		unsigned int		m_SlotCount = 0;
+
+		// The slot being read.
+		CommandIntentSlot	m_Slot;
+
+		// Whether there were more slots than fit.
+		bool					m_TooManySlots = false;
+};
 
 // Locals
 //
@@ -34,12 +148,24 @@ static char const* const s_CommandTokenNames[] =
 	"reboot", 		// TYPE_REBOOT
 	"yes", 			// TYPE_YES
 	"no", 			// TYPE_NO
+	"and", 			// TYPE_AND
 	
 	"integer", 		// TYPE_INTEGER
+	"posture", 		// TYPE_POSTURE
+};
+
+static_assert(sizeof(s_CommandTokenNames) / sizeof(s_CommandTokenNames[0]) == 
+	CommandToken::TYPE_COUNT, "Every command token needs a name.");
+
+// A token name and the token type it stands for.
+struct CommandTokenNameType
+{
+	char const*				m_Name;
+	CommandToken::Types	m_Type;
 };
 
-// A mapping between token names and token type.
-static const std::map<std::string, CommandToken::Types>	s_CommandTokenNameToTypeMap = 
+// A mapping between token names and token type. Names must be lowercase.
+static constexpr CommandTokenNameType s_CommandTokenNameToTypeMap[] = 
 {
 	{ "back", 		CommandToken::TYPE_BACK }, 
 	{ "legs",		CommandToken::TYPE_LEGS },
@@ -55,10 +181,15 @@ static const std::map<std::string, CommandToken::Types>	s_CommandTokenNameToType
 	{ "reboot", 	CommandToken::TYPE_REBOOT }, 
 	{ "yes", 		CommandToken::TYPE_YES }, 
 	{ "no", 			CommandToken::TYPE_NO },
+	{ "and", 		CommandToken::TYPE_AND },
+	{ "then", 		CommandToken::TYPE_AND },	// Alternative.
 
 	// "integer", 	TYPE_INTEGER
 };
 
+static constexpr unsigned int s_CommandTokenNameCount = 
+	sizeof(s_CommandTokenNameToTypeMap) / sizeof(s_CommandTokenNameToTypeMap[0]);
+
 // Keep handles to the controls.
 static ControlHandle s_BackControlHandle;
 static ControlHandle s_LegsControlHandle;
@@ -73,12 +204,150 @@ static bool s_Rebooting = false;
 // Keep track of when we started the reboot process so we can time the delay.
 static Time s_RebootDelayStartTime;
 
+// Fires if we have waited too long for the notification before rebooting.
+static TimerHandle s_RebootDelayTimer;
+
+// CommandIntentReader members
+
+// Handle the start of an object.
+//
+// Returns:	True to keep parsing.
+//
+bool CommandIntentReader::StartObject()
+{
+	m_Depth++;
+
+	// Each object in the slots array is a slot.
+	if ((m_Depth == 3) && (m_MessageKey == KEY_SLOTS))
+	{
+		m_Slot = CommandIntentSlot();
+	}
+
+	return true;
+}
+
+// Handle the end of an object.
+//
+// p_MemberCount:	The number of members it had.
+//
+// Returns:	True to keep parsing.
+//
+bool CommandIntentReader::EndObject(rapidjson::SizeType p_MemberCount)
+{
+	if ((m_Depth == 3) && (m_MessageKey == KEY_SLOTS))
+	{
+		if (m_SlotCount < ms_SlotCapacity)
+		{
+			m_Slots[m_SlotCount] = m_Slot;
+			m_SlotCount++;
+		}
+		else
+		{
+			m_TooManySlots = true;
+		}
+	}
+
+	m_Depth--;
+	return true;
+}
+
+// Handle the start of an array.
+//
+// Returns:	True to keep parsing.
+//
+bool CommandIntentReader::StartArray()
+{
+	m_Depth++;
+	return true;
+}
+
+// Handle the end of an array.
+//
+// p_ElementCount:	The number of elements it had.
+//
+// Returns:	True to keep parsing.
+//
+bool CommandIntentReader::EndArray(rapidjson::SizeType p_ElementCount)
+{
+	m_Depth--;
+	return true;
+}
+
+// Handle the name of a member.
+//
+// p_String:	The name, which is terminated in place.
+// p_Length:	The length of the name.
+// p_Copy:		Whether the name has to be copied to be kept. It doesn't when parsing in place.
+//
+// Returns:	True to keep parsing.
+//
+bool CommandIntentReader::Key(char const* p_String, rapidjson::SizeType p_Length, bool p_Copy)
+{
+	std::string_view const l_Name(p_String, p_Length);
+
+	if (m_Depth == 1)
+	{
+		m_MessageKey = (l_Name == "intent") ? KEY_INTENT : (l_Name == "sessionId") ? KEY_SESSION_ID :
+			(l_Name == "slots") ? KEY_SLOTS : KEY_OTHER;
+	}
+	else if ((m_Depth == 2) && (m_MessageKey == KEY_INTENT))
+	{
+		m_Key = (l_Name == "intentName") ? KEY_INTENT_NAME : KEY_OTHER;
+	}
+	else if ((m_Depth == 3) && (m_MessageKey == KEY_SLOTS))
+	{
+		m_Key = (l_Name == "slotName") ? KEY_SLOT_NAME : (l_Name == "rawValue") ? KEY_RAW_VALUE : 
+			KEY_OTHER;
+	}
+
+	return true;
+}
+
+// Handle a string value.
+//
+// p_String:	The string, which is terminated in place.
+// p_Length:	The length of the string.
+// p_Copy:		Whether the string has to be copied to be kept. It doesn't when parsing in place.
+//
+// Returns:	True to keep parsing.
+//
+bool CommandIntentReader::String(char const* p_String, rapidjson::SizeType p_Length, bool p_Copy)
+{
+	if (m_Depth == 1)
+	{
+		if (m_MessageKey == KEY_SESSION_ID)
+		{
+			m_SessionID = p_String;
+		}
+	}
+	else if ((m_Depth == 2) && (m_MessageKey == KEY_INTENT))
+	{
+		if (m_Key == KEY_INTENT_NAME)
+		{
+			m_IntentName = p_String;
+		}
+	}
+	else if ((m_Depth == 3) && (m_MessageKey == KEY_SLOTS))
+	{
+		if (m_Key == KEY_SLOT_NAME)
+		{
+			m_Slot.m_Name = std::string_view(p_String, p_Length);
+		}
+		else if (m_Key == KEY_RAW_VALUE)
+		{
+			m_Slot.m_Value = std::string_view(p_String, p_Length);
+		}
+	}
+
+	return true;
+}
+
 // Functions
 //
 
 // Initialize the system.
 //
-// p_Input:	The input device.
+// p_Input:	The input devices.
 //
 void CommandInitialize(Input const& p_Input)
 {
@@ -92,80 +361,163 @@ void CommandUninitialize()
 	s_Input = nullptr;
 }
 
+// Actually reboot.
+//
+static void CommandReboot()
+{
+	s_Rebooting = false;
+	ReactorGetTimerService().Cancel(s_RebootDelayTimer);
+
+	LoggerAddMessage("Rebooting!");
+
+	sync();
+	reboot(RB_AUTOBOOT);
+}
+
 // Process the system.
 //
 void CommandProcess()
 {
-	// At the moment we only have per frame processing for rebooting.
+	// At the moment we only have regular processing for rebooting.
 	if (s_Rebooting == false)
 	{
 		return;
 	}
 
-	// I don't really want to make a whole function for this, but will call it from multiple code 
-	// paths.
-	auto l_DoReboot = []()
-	{
-		s_Rebooting = false;
-
-		LoggerAddMessage("Rebooting!");
-
-		sync();
-		reboot(RB_AUTOBOOT);
-	};
-
 	// If the notification is done, we can stop waiting.
 	Time l_NotificationFinishedTime;
 	NotificationGetLastPlayFinishedTime(l_NotificationFinishedTime);
 
 	if (l_NotificationFinishedTime > s_RebootDelayStartTime) 
 	{
-		l_DoReboot();
-		return;
+		CommandReboot();
 	}
+}
 
-	// Wait for a maximum amount of time regardless.
-	Time l_RebootDelayCurrentTime;
-	TimerGetCurrent(l_RebootDelayCurrentTime);
-	
-	float const l_DurationMS = TimerGetElapsedMilliseconds(s_RebootDelayStartTime, 
-		l_RebootDelayCurrentTime);
-	auto const l_DurationSeconds = static_cast<unsigned long>(l_DurationMS) / 
-		1000;
-	
-	static constexpr unsigned long l_DelayDurationSeconds = 60;
-	
-	if (l_DurationSeconds >= l_DelayDurationSeconds)
+// Get the control that a command token names.
+//
+// p_Type:	The type of the token.
+//
+// Returns:	The control, or null if the token doesn't name one or it doesn't exist.
+//
+static Control* CommandGetControl(CommandToken::Types p_Type)
+{
+	switch (p_Type)
 	{
-		l_DoReboot();
+		case CommandToken::TYPE_BACK:
+		{
+			// Try to find the control.
+			if (s_BackControlHandle.IsValid() == false)
+			{
+				s_BackControlHandle = Control::GetHandle("back");
+			}
+			
+			return Control::GetFromHandle(s_BackControlHandle);
+		}
+		
+		case CommandToken::TYPE_LEGS:
+		{
+			// Try to find the control.
+			if (s_LegsControlHandle.IsValid() == false)
+			{
+				s_LegsControlHandle = Control::GetHandle("legs");
+			}
+			
+			return Control::GetFromHandle(s_LegsControlHandle);
+		}
+		
+		case CommandToken::TYPE_ELEVATION:
+		{
+			// Try to find the control.
+			if (s_ElevationControlHandle.IsValid() == false)
+			{
+				s_ElevationControlHandle = Control::GetHandle("elev");
+			}
+
+			return Control::GetFromHandle(s_ElevationControlHandle);
+		}
+		
+		default:
+		{
+		}
+		break;
 	}
+
+	return nullptr;
 }
 
-// Parse the command tokens into commands.
+// Get the action that a command token asks for.
 //
-// p_CommandTokens:	All of the potential tokens for the command.
+// p_Type:	The type of the token.
 //
-// Returns:	A value signifying the result of the parsing.
+// Returns:	The action, or stopped if the token isn't one.
 //
-CommandParseTokensReturnTypes CommandParseTokens(std::vector<CommandToken> const& p_CommandTokens)
+static Control::Actions CommandGetAction(CommandToken::Types p_Type)
 {
-	char const* l_ConfirmationText = nullptr;
-	return CommandParseTokens(l_ConfirmationText, p_CommandTokens);
+	if (p_Type == CommandToken::TYPE_RAISE)
+	{
+		return Control::ACTION_MOVING_UP;
+	}
+	
+	if (p_Type == CommandToken::TYPE_LOWER)
+	{
+		return Control::ACTION_MOVING_DOWN;
+	}
+
+	return Control::ACTION_STOPPED;
+}
+
+// Move a control for a percentage of its moving duration, which is the next token if that is a 
+// number, or all of it otherwise.
+//
+// p_TokenIndex:		(Input/Output) The index of the last token of the movement so far. If the
+//							percentage is used, this is moved on to it.
+// p_Control:			The control to move.
+// p_Action:			The direction to move it in.
+// p_Origin:			Where the command came from.
+// p_CommandTokens:	All of the tokens for the command.
+//
+static void CommandMoveControl(unsigned int& p_TokenIndex, Control& p_Control, 
+	Control::Actions p_Action, ControlOrigin const& p_Origin, CommandTokenList const& p_CommandTokens)
+{
+	// Determine the duration percent.
+	unsigned int l_DurationPercent = 100;
+	
+	// Peak at the next token.
+	auto const l_NextTokenIndex = p_TokenIndex + 1;
+	if (l_NextTokenIndex < p_CommandTokens.GetCount())
+	{
+		auto const l_NextToken = p_CommandTokens[l_NextTokenIndex];
+		
+		if (l_NextToken.m_Type == CommandToken::TYPE_INTEGER)
+		{
+			l_DurationPercent = l_NextToken.m_Parameter;
+			
+			// Actually consume this token.
+			p_TokenIndex++;
+		}
+	}
+	
+	p_Control.SetDesiredAction(p_Action, Control::MODE_TIMED, p_Origin, l_DurationPercent);
 }
 
-// Parse the command tokens into commands.
+// Parse each of the clauses of a command.
 //
 // p_ConfirmationText:	(Output) In cases with missing confirmation, this is the confirmation 
 // 	 						prompt.
+// p_Origin:				Where the command came from.
 // p_CommandTokens:		All of the potential tokens for the command.
 //
-// Returns:	A value signifying the result of the parsing.
+// Returns:	A value signifying the result of the parsing, which is a success if any clause was.
 //
-CommandParseTokensReturnTypes CommandParseTokens(char const*& p_ConfirmationText, 
-	std::vector<CommandToken> const& p_CommandTokens)
+static CommandParseTokensReturnTypes CommandParseClauses(char const*& p_ConfirmationText, 
+	ControlOrigin const& p_Origin, CommandTokenList const& p_CommandTokens)
 {
-	// Parse command tokens.
-	auto const l_TokenCount = static_cast<unsigned int>(p_CommandTokens.size());
+	auto l_Result = CommandParseTokensReturnTypes::INVALID;
+
+	// Parse command tokens. Each clause that is understood is acted on, and then we go on to the 
+	// next, so anything between them, such as "and", is skipped.
+	auto const l_TokenCount = p_CommandTokens.GetCount();
 	for (unsigned int l_TokenIndex = 0; l_TokenIndex < l_TokenCount; l_TokenIndex++)
 	{
 		// Parse commands.
@@ -177,53 +529,7 @@ CommandParseTokensReturnTypes CommandParseTokens(char const*& p_ConfirmationText
 			case CommandToken::TYPE_ELEVATION:	
 			{
 				// Try to access the control corresponding to the command token.
-				Control* l_Control = nullptr;
-				
-				switch (l_Token.m_Type)
-				{
-					case CommandToken::TYPE_BACK:
-					{
-						// Try to find the control.
-						if (s_BackControlHandle.IsValid() == false)
-						{
-							s_BackControlHandle = Control::GetHandle("back");
-						}
-						
-						l_Control = Control::GetFromHandle(s_BackControlHandle);
-					}
-					break;
-					
-					case CommandToken::TYPE_LEGS:
-					{
-						// Try to find the control.
-						if (s_LegsControlHandle.IsValid() == false)
-						{
-							s_LegsControlHandle = Control::GetHandle("legs");
-						}
-						
-						l_Control = Control::GetFromHandle(s_LegsControlHandle);
-					}
-					break;
-					
-					case CommandToken::TYPE_ELEVATION:
-					{
-						// Try to find the control.
-						if (s_ElevationControlHandle.IsValid() == false)
-						{
-							s_ElevationControlHandle = Control::GetHandle("elev");
-						}
-			
-						l_Control = Control::GetFromHandle(s_ElevationControlHandle);
-					}
-					break;
-					
-					default:
-					{
-						LoggerAddMessage("Unrecognized token \"%s\" trying to process a control movement "
-							"command.", s_CommandTokenNames[l_Token.m_Type]);
-					}
-					break;
-				}
+				auto* const l_Control = CommandGetControl(l_Token.m_Type);
 			
 				if (l_Control == nullptr)
 				{
@@ -238,57 +544,74 @@ CommandParseTokensReturnTypes CommandParseTokens(char const*& p_ConfirmationText
 				}
 				
 				l_Token = p_CommandTokens[l_TokenIndex];
+
+				// A number on its own is a position to go to.
+				if (l_Token.m_Type == CommandToken::TYPE_INTEGER)
+				{
+					l_Control->SetDesiredPosition(std::max(l_Token.m_Parameter, 0), p_Origin);
+					l_Result = CommandParseTokensReturnTypes::SUCCESS;
+					break;
+				}
 				
 				// Try to get the action which should be performed on the control.
-				auto l_Action = Control::ACTION_STOPPED;
+				auto const l_Action = CommandGetAction(l_Token.m_Type);
 				
-				if (l_Token.m_Type == CommandToken::TYPE_RAISE)
-				{
-					l_Action = Control::ACTION_MOVING_UP;
-				}
-				else if (l_Token.m_Type == CommandToken::TYPE_LOWER)
+				if (l_Action == Control::ACTION_STOPPED)
 				{
-					l_Action = Control::ACTION_MOVING_DOWN;
+					break;
 				}
 				
-				if (l_Action == Control::ACTION_STOPPED)
+				CommandMoveControl(l_TokenIndex, *l_Control, l_Action, p_Origin, p_CommandTokens);
+				l_Result = CommandParseTokensReturnTypes::SUCCESS;
+			}
+			break;
+
+			case CommandToken::TYPE_RAISE:			// Fall through...
+			case CommandToken::TYPE_LOWER:
+			{
+				// The action can also come before the control, as in "raise back".
+				auto const l_Action = CommandGetAction(l_Token.m_Type);
+
+				// Next token.
+				l_TokenIndex++;
+				if (l_TokenIndex >= l_TokenCount)
 				{
 					break;
 				}
 				
-				// Determine the duration percent.
-				unsigned int l_DurationPercent = 100;
-				
-				// Peak at the next token.
-				auto const l_NextTokenIndex = l_TokenIndex + 1;
-				if (l_NextTokenIndex < l_TokenCount)
+				l_Token = p_CommandTokens[l_TokenIndex];
+
+				auto* const l_Control = CommandGetControl(l_Token.m_Type);
+			
+				if (l_Control == nullptr)
 				{
-					auto const l_NextToken = p_CommandTokens[l_NextTokenIndex];
-					
-					if (l_NextToken.m_Type == CommandToken::TYPE_INTEGER)
-					{
-						l_DurationPercent = l_NextToken.m_Parameter;
-						
-						// Actually consume this token.
-						l_TokenIndex++;
-					}
+					break;
 				}
-				
-				
-				l_Control->SetDesiredAction(l_Action, Control::MODE_TIMED, l_DurationPercent);
 
-				ReportsAddControlItem(l_Control->GetName(), l_Action, "command");
-				return CommandParseTokensReturnTypes::SUCCESS;
+				CommandMoveControl(l_TokenIndex, *l_Control, l_Action, p_Origin, p_CommandTokens);
+				l_Result = CommandParseTokensReturnTypes::SUCCESS;
 			}
+			break;
 			
+			case CommandToken::TYPE_POSTURE:
+			{
+				// Move all of the controls in the posture.
+				if (ControlsMoveToPosture(l_Token.m_Parameter, p_Origin) == false)
+				{
+					break;
+				}
+
+				l_Result = CommandParseTokensReturnTypes::SUCCESS;
+			}
+			break;
+
 			case CommandToken::TYPE_STOP:
 			{
 				// Stop controls.
-				ControlsStopAll();			
-
-				ReportsAddControlItem("all", Control::ACTION_STOPPED, "command");
-				return CommandParseTokensReturnTypes::SUCCESS;
+				ControlsStopAll(p_Origin);
+				l_Result = CommandParseTokensReturnTypes::SUCCESS;
 			}
+			break;
 			
 			case CommandToken::TYPE_SCHEDULE:
 			{
@@ -304,12 +627,12 @@ CommandParseTokensReturnTypes CommandParseTokens(char const*& p_ConfirmationText
 				if (l_Token.m_Type == CommandToken::TYPE_START)
 				{
 					ScheduleStart();
-					return CommandParseTokensReturnTypes::SUCCESS;
+					l_Result = CommandParseTokensReturnTypes::SUCCESS;
 				}
 				else if (l_Token.m_Type == CommandToken::TYPE_STOP)
 				{
 					ScheduleStop();
-					return CommandParseTokensReturnTypes::SUCCESS;
+					l_Result = CommandParseTokensReturnTypes::SUCCESS;
 				}			
 			}
 			break;
@@ -330,11 +653,21 @@ CommandParseTokensReturnTypes CommandParseTokens(char const*& p_ConfirmationText
 				}
 
 				ReportsAddStatusItem();
-				return CommandParseTokensReturnTypes::SUCCESS;
+				l_Result = CommandParseTokensReturnTypes::SUCCESS;
 			}
+			break;
 
 			case CommandToken::TYPE_REBOOT:
 			{
+				// Rebooting can't follow anything else, since it would be cut short, and asking for 
+				// confirmation would have it done again.
+				if (l_Result == CommandParseTokensReturnTypes::SUCCESS)
+				{
+					LoggerAddMessage("Ignoring reboot command because it was combined with other "
+						"commands.");
+					break;
+				}
+
 				// Next token.
 				l_TokenIndex++;
 				if (l_TokenIndex >= l_TokenCount)
@@ -351,13 +684,19 @@ CommandParseTokensReturnTypes CommandParseTokens(char const*& p_ConfirmationText
 					LoggerAddMessage("Ignoring reboot command because it was not followed by a positive "
 						"confirmation.");
 					NotificationPlay("canceled");
-					break;
+					return CommandParseTokensReturnTypes::INVALID;
 				}
 
 				// Kick off the reboot.
 				s_Rebooting = true;
 				TimerGetCurrent(s_RebootDelayStartTime);
 
+				// Wait for a maximum amount of time regardless.
+				static constexpr Duration l_DelayDuration = 60s;
+
+				ReactorGetTimerService().Arm(s_RebootDelayTimer, 
+					s_RebootDelayStartTime + l_DelayDuration, CommandReboot);
+
 				LoggerAddMessage("Reboot starting!");
 				NotificationPlay("restarting");
 
@@ -371,218 +710,351 @@ CommandParseTokensReturnTypes CommandParseTokens(char const*& p_ConfirmationText
 		}
 	}
 
-	return CommandParseTokensReturnTypes::INVALID;
+	return l_Result;
 }
 
-// Take a token string and convert it into a token type, if possible.
+// Spell out a command by the names of its tokens, for logging.
 //
-// p_TokenString:	The string to attempt to convert.
-// 
-// Returns:	The corresponding token type or invalid if one couldn't be found.
-// 
-static CommandToken::Types CommandConvertStringToTokenType(std::string const& p_TokenString)
+// p_Description:			(Output) The command, with unknown words as "?" and parameters as 
+//								their values. It is cut short if it doesn't fit.
+// p_DescriptionCapacity:	The size of the output buffer.
+// p_CommandTokens:		The tokens of the command.
+//
+static void CommandDescribeTokens(char* p_Description, unsigned int p_DescriptionCapacity, 
+	CommandTokenList const& p_CommandTokens)
 {
-	// Try to find it in the map.
-	auto const l_ResultIterator = s_CommandTokenNameToTypeMap.find(p_TokenString);
+	unsigned int l_Length = 0;
+	p_Description[0] = '\0';
 
-	if (l_ResultIterator == s_CommandTokenNameToTypeMap.end()) 
-	{		
-		// No match.
-		return CommandToken::TYPE_INVALID;
+	auto const l_TokenCount = p_CommandTokens.GetCount();
+	for (unsigned int l_TokenIndex = 0; l_TokenIndex < l_TokenCount; l_TokenIndex++)
+	{
+		if (l_Length >= p_DescriptionCapacity)
+		{
+			return;
+		}
+
+		auto const& l_Token = p_CommandTokens[l_TokenIndex];
+		auto const* l_Separator = (l_TokenIndex > 0) ? " " : "";
+		auto* l_End = p_Description + l_Length;
+		auto const l_Remaining = p_DescriptionCapacity - l_Length;
+		auto l_Written = 0;
+
+		if (l_Token.m_Type == CommandToken::TYPE_INVALID)
+		{
+			l_Written = snprintf(l_End, l_Remaining, "%s?", l_Separator);
+		}
+		else if (l_Token.m_Type == CommandToken::TYPE_INTEGER)
+		{
+			l_Written = snprintf(l_End, l_Remaining, "%s%d", l_Separator, l_Token.m_Parameter);
+		}
+		else
+		{
+			l_Written = snprintf(l_End, l_Remaining, "%s%s", l_Separator, 
+				s_CommandTokenNames[l_Token.m_Type]);
+		}
+
+		if (l_Written < 0)
+		{
+			return;
+		}
+
+		l_Length += static_cast<unsigned int>(l_Written);
 	}
+}
 
-	// Found it!
-	return l_ResultIterator->second;
+// Parse the command tokens into commands. A command may have several clauses, one after another or
+// joined with "and", such as "raise back 50 and lower legs". The controls they move all start 
+// together.
+//
+// p_Origin:			Where the command came from.
+// p_CommandTokens:	All of the potential tokens for the command.
+//
+// Returns:	A value signifying the result of the parsing, which is a success if any clause was.
+//
+CommandParseTokensReturnTypes CommandParseTokens(ControlOrigin const& p_Origin, 
+	CommandTokenList const& p_CommandTokens)
+{
+	char const* l_ConfirmationText = nullptr;
+	return CommandParseTokens(l_ConfirmationText, p_Origin, p_CommandTokens);
 }
 
-// Take a command string and turn it into a list of tokens.
+// Parse the command tokens into commands. A command may have several clauses, one after another or
+// joined with "and", such as "raise back 50 and lower legs". The controls they move all start 
+// together.
 //
-// p_CommandTokens:	(Output) The resulting command tokens, in order.
-// p_CommandString:	The command string to tokenize.
+// p_ConfirmationText:	(Output) In cases with missing confirmation, this is the confirmation 
+// 	 						prompt.
+// p_Origin:				Where the command came from.
+// p_CommandTokens:		All of the potential tokens for the command.
 //
-void CommandTokenizeString(std::vector<CommandToken>& p_CommandTokens, 
-	std::string const& p_CommandString)
+// Returns:	A value signifying the result of the parsing, which is a success if any clause was.
+//
+CommandParseTokensReturnTypes CommandParseTokens(char const*& p_ConfirmationText, 
+	ControlOrigin const& p_Origin, CommandTokenList const& p_CommandTokens)
 {
-	// Get the first token string start.
-	auto l_NextTokenStringStart = std::string::size_type{0};
+	TraceScope l_TraceScope("Command tokens parsed");
 
-	while (l_NextTokenStringStart != std::string::npos)
+	// Reject the whole command rather than carry out the clauses that happened to fit.
+	if (p_CommandTokens.HasOverflowed() == true)
 	{
-		// Get the next token string end.
-		auto const l_NextTokenStringEnd = p_CommandString.find(' ', l_NextTokenStringStart);
+		LoggerAddMessage("Command is too long to parse.");
+		return CommandParseTokensReturnTypes::INVALID;
+	}
 
-		// Get the token string.
-		auto const l_TokenStringLength = (l_NextTokenStringEnd != std::string::npos) ? 
-			(l_NextTokenStringEnd - l_NextTokenStringStart) : p_CommandString.size();
-		auto l_TokenString = p_CommandString.substr(l_NextTokenStringStart, l_TokenStringLength);
+	// Hand everything the command asks for to the controls at once, so that they start together.
+	ControlsBeginCommandBatch();
+	auto const l_Result = CommandParseClauses(p_ConfirmationText, p_Origin, p_CommandTokens);
 
-		// Make sure the token string is lowercase.
-		for (auto& l_Character : l_TokenString)
-		{
-			l_Character = std::tolower(l_Character);
-		}
+	// A command that didn't all reach the controls isn't done, even if some of it was.
+	if (ControlsEndCommandBatch() == false)
+	{
+		LoggerAddMessage("Command didn't reach the controls.");
+		return CommandParseTokensReturnTypes::DROPPED;
+	}
 
-		// Match the token string to a token (with no parameter) if possible.
-		CommandToken l_Token;
-		l_Token.m_Type = CommandConvertStringToTokenType(l_TokenString);
+	if (l_Result == CommandParseTokensReturnTypes::INVALID)
+	{
+		char l_Description[COMMAND_DESCRIPTION_CAPACITY];
+		CommandDescribeTokens(l_Description, sizeof(l_Description), p_CommandTokens);
 
-		// If we couldn't turn it into a plain old token, see if it is a parameter token.
-		if (l_Token.m_Type == CommandToken::TYPE_INVALID)
+		LoggerAddMessage("Couldn't understand command \"%s\".", l_Description);
+	}
+
+	return l_Result;
+}
+
+// Lowercase a character, in a way that can be done at compile time.
+//
+// p_Character:	The character.
+//
+// Returns:			The lowercase character.
+//
+static constexpr char CommandToLower(char p_Character)
+{
+	return ((p_Character >= 'A') && (p_Character <= 'Z')) ? (p_Character - 'A' + 'a') : p_Character;
+}
+
+// Hash a token name, regardless of case, into a slot of the token name hash table.
+//
+// p_Name:	The name.
+// p_Seed:	Varies the hash, so that a seed can be found that puts every name in its own slot.
+//
+// Returns:	The slot.
+//
+static constexpr unsigned int CommandHashTokenName(std::string_view p_Name, uint32_t p_Seed)
+{
+	// FNV-1a.
+	auto l_Hash = static_cast<uint32_t>(2166136261u ^ p_Seed);
+
+	for (auto const l_Character : p_Name)
+	{
+		l_Hash ^= static_cast<unsigned char>(CommandToLower(l_Character));
+		l_Hash *= 16777619u;
+	}
+
+	return (l_Hash ^ (l_Hash >> 16)) & (COMMAND_TOKEN_HASH_SLOT_COUNT - 1);
+}
+
+// Find a seed that hashes every token name into a slot of its own. This runs at compile time.
+//
+// Returns:	The seed, or 0 if there isn't one.
+//
+static constexpr uint32_t CommandFindTokenHashSeed()
+{
+	for (uint32_t l_Seed = 1; l_Seed < 10000; l_Seed++)
+	{
+		bool l_SlotIsUsed[COMMAND_TOKEN_HASH_SLOT_COUNT] = {};
+		auto l_HasCollision = false;
+
+		for (unsigned int l_NameIndex = 0; l_NameIndex < s_CommandTokenNameCount; l_NameIndex++)
 		{
-			// First, determine whether the string is numeric.
-			auto l_IsNumeric = true;
+			auto const l_Slot = CommandHashTokenName(s_CommandTokenNameToTypeMap[l_NameIndex].m_Name, 
+				l_Seed);
 
-			for (const auto& l_Character : l_TokenString)
+			if (l_SlotIsUsed[l_Slot] == true)
 			{
-				l_IsNumeric = l_IsNumeric && std::isdigit(l_Character);
+				l_HasCollision = true;
+				break;
 			}
-			
-			if (l_IsNumeric == true)
-			{
-				l_Token.m_Parameter = std::stoul(l_TokenString);
-				l_Token.m_Type = CommandToken::TYPE_INTEGER;
-			}
-		}
-		
-		// Add the token to the list.
-		p_CommandTokens.push_back(l_Token);
 
-		// Get the next token string start (skip delimiter).
-		l_NextTokenStringStart = l_NextTokenStringEnd;
+			l_SlotIsUsed[l_Slot] = true;
+		}
 
-		if (l_NextTokenStringEnd != std::string::npos)
+		if (l_HasCollision == false)
 		{
-			l_NextTokenStringStart++;
+			return l_Seed;
 		}
 	}
+
+	return 0;
 }
 
-// Just a simple structure to store a slot name/value pair.
-//
-struct SlotNameValue
+static constexpr uint32_t s_CommandTokenHashSeed = CommandFindTokenHashSeed();
+static_assert(s_CommandTokenHashSeed != 0, "No perfect hash was found for the command tokens.");
+
+// The token name hash table, which holds the index of the name in each slot, or -1 for none.
+struct CommandTokenHashTable
 {
-	std::string	m_Name;
-	std::string	m_Value;
+	signed char m_NameIndices[COMMAND_TOKEN_HASH_SLOT_COUNT];
 };
 
-// Extract the slots from a JSON document.
+// Build the token name hash table. This runs at compile time.
 //
-// p_ExtractedSlots:		(Output) The slot name/value pairs that we found.
-// p_CommandDocument:	The command document to get the slots for.
+// Returns:	The table.
 //
-static void CommandExtractSlotsFromJSONDocument(std::vector<SlotNameValue>& p_ExtractedSlots, 
-	rapidjson::Document const& p_CommandDocument)
+static constexpr CommandTokenHashTable CommandBuildTokenHashTable()
 {
-	auto const l_SlotsIterator = p_CommandDocument.FindMember("slots");
+	CommandTokenHashTable l_Table = {};
 
-	if (l_SlotsIterator == p_CommandDocument.MemberEnd())
+	for (auto& l_NameIndex : l_Table.m_NameIndices)
 	{
-		return;
+		l_NameIndex = -1;
 	}
 
-	auto const& l_Slots = l_SlotsIterator->value;
+	for (unsigned int l_NameIndex = 0; l_NameIndex < s_CommandTokenNameCount; l_NameIndex++)
+	{
+		auto const l_Slot = CommandHashTokenName(s_CommandTokenNameToTypeMap[l_NameIndex].m_Name, 
+			s_CommandTokenHashSeed);
+		l_Table.m_NameIndices[l_Slot] = static_cast<signed char>(l_NameIndex);
+	}
+
+	return l_Table;
+}
+
+static constexpr CommandTokenHashTable s_CommandTokenHashTable = CommandBuildTokenHashTable();
 
-	if (l_Slots.IsArray() == false)
+// Take a token string and convert it into a token type, if possible.
+//
+// p_TokenString:	The string to attempt to convert, in any case.
+// 
+// Returns:	The corresponding token type or invalid if one couldn't be found.
+// 
+static CommandToken::Types CommandConvertStringToTokenType(std::string_view p_TokenString)
+{
+	// Only one name can be in the slot, but it may not be this one.
+	auto const l_NameIndex = s_CommandTokenHashTable.m_NameIndices[CommandHashTokenName(
+		p_TokenString, s_CommandTokenHashSeed)];
+
+	if (l_NameIndex < 0)
 	{
-		return;
+		return CommandToken::TYPE_INVALID;
 	}
 
-	// Now extract each slot individually.
-	for (auto const& l_Slot : l_Slots.GetArray())
+	auto const& l_Entry = s_CommandTokenNameToTypeMap[l_NameIndex];
+
+	if ((strlen(l_Entry.m_Name) != p_TokenString.size()) || 
+		(strncasecmp(l_Entry.m_Name, p_TokenString.data(), p_TokenString.size()) != 0))
 	{
-		if (l_Slot.IsObject() == false) 
-		{
-			continue;
-		}
+		return CommandToken::TYPE_INVALID;
+	}
 
-		// Try to find the slot name.
-		auto const l_SlotNameIterator = l_Slot.FindMember("slotName");
+	return l_Entry.m_Type;
+}
 
-		if (l_SlotNameIterator == l_Slot.MemberEnd()) 
-		{
-			continue;
-		}
+// Take a command string and turn it into a list of tokens. Words are split on spaces and matched
+// without regard to case. If there are more words than fit, the list is marked as overflowed, so
+// that the command is rejected rather than mistaken for a shorter one.
+//
+// p_CommandTokens:	(Output) The resulting command tokens, in order.
+// p_CommandString:	The command string to tokenize.
+//
+void CommandTokenizeString(CommandTokenList& p_CommandTokens, std::string_view p_CommandString)
+{
+	while (p_CommandString.empty() == false)
+	{
+		// Split off the next word.
+		auto const l_TokenStringEnd = p_CommandString.find(' ');
+		auto const l_TokenString = p_CommandString.substr(0, l_TokenStringEnd);
 
-		auto const& l_SlotName = l_SlotNameIterator->value;
+		p_CommandString.remove_prefix((l_TokenStringEnd != std::string_view::npos) ? 
+			(l_TokenStringEnd + 1) : p_CommandString.size());
 
-		if (l_SlotName.IsString() == false) 
+		// Runs of spaces don't make words.
+		if (l_TokenString.empty() == true)
 		{
 			continue;
 		}
 
-		// Now try to find the value.
-		auto const l_SlotValueIterator = l_Slot.FindMember("rawValue");
+		// Match the token string to a token (with no parameter) if possible.
+		CommandToken l_Token;
+		l_Token.m_Type = CommandConvertStringToTokenType(l_TokenString);
 
-		if (l_SlotValueIterator == l_Slot.MemberEnd()) 
+		// If we couldn't turn it into a plain old token, see if it is a parameter token.
+		if (l_Token.m_Type == CommandToken::TYPE_INVALID)
 		{
-			continue;
-		}
+			// First, see whether the whole string is a number that fits.
+			unsigned int l_Value = 0;
+			auto const* l_DigitsEnd = l_TokenString.data() + l_TokenString.size();
+			auto const l_Result = std::from_chars(l_TokenString.data(), l_DigitsEnd, l_Value);
 
-		auto const& l_SlotValue = l_SlotValueIterator->value;
+			if ((l_Result.ec == std::errc()) && (l_Result.ptr == l_DigitsEnd) && 
+				(l_Value <= INT_MAX))
+			{
+				l_Token.m_Parameter = static_cast<int>(l_Value);
+				l_Token.m_Type = CommandToken::TYPE_INTEGER;
+			}
+			else
+			{
+				// Otherwise, it may be the name of a posture.
+				auto const l_PostureIndex = ControlsGetPostureIndex(l_TokenString);
 
-		if (l_SlotValue.IsString() == false) 
-		{
-			continue;
+				if (l_PostureIndex >= 0)
+				{
+					l_Token.m_Parameter = l_PostureIndex;
+					l_Token.m_Type = CommandToken::TYPE_POSTURE;
+				}
+			}
 		}
 		
-		// Now that we found the name and the value, we can add it to the output.
-		SlotNameValue l_ExtractedSlot;
-		l_ExtractedSlot.m_Name = l_SlotName.GetString();
-		l_ExtractedSlot.m_Value = l_SlotValue.GetString();
-
-		p_ExtractedSlots.push_back(l_ExtractedSlot);
+		// Add the token to the list. If it doesn't fit, the command is too long to be one we know, 
+		// and the list remembers that, so that none of it is carried out.
+		if (p_CommandTokens.Add(l_Token) == false)
+		{
+			return;
+		}
 	}
 }
 
-// Take a command JSON document and turn it into a list of tokens.
+// Turn an intent into a list of tokens.
 //
-// p_CommandTokens:		(Input/Output) The resulting command tokens, in order. If there was a 
-// 							command pending confirmation, the corresponding tokens will be passed in.
-// p_CommandDocument:	The command document to tokenize.
+// p_CommandTokens:	(Input/Output) The resulting command tokens, in order. If there was a command 
+// 						pending confirmation, the corresponding tokens will be passed in.
+// p_Reader:			The intent, as it was read from its message.
 //
-void CommandTokenizeJSONDocument(std::vector<CommandToken>& p_CommandTokens, 
-	rapidjson::Document const& p_CommandDocument)
+static void CommandTokenizeIntent(CommandTokenList& p_CommandTokens, 
+	CommandIntentReader const& p_Reader)
 {
-	// First we need the intent, then the name of the intent.
-	auto const l_IntentIterator = p_CommandDocument.FindMember("intent");
-
-	if (l_IntentIterator == p_CommandDocument.MemberEnd())
-	{
-		return;
-	}
-
-	auto const l_IntentNameIterator = l_IntentIterator->value.FindMember("intentName");
+	// First we need the name of the intent.
+	auto const* const l_IntentName = p_Reader.GetIntentName();
 
-	if (l_IntentNameIterator == p_CommandDocument.MemberEnd())
+	if (l_IntentName == nullptr)
 	{
 		return;
 	}
 
-	// Now, try to recognize the intent.
-	auto const l_IntentName = l_IntentNameIterator->value.GetString();
+	auto const l_SlotCount = p_Reader.GetSlotCount();
 
 	// We handle confirmations first so we can short-circuit more easily.
 	if (strcmp(l_IntentName, "ConfirmationResponse") == 0)
 	{
 		// We can ignore this if we are not waiting for confirmation.
-		if (p_CommandTokens.empty() == true)
+		if (p_CommandTokens.IsEmpty() == true)
 		{
 			LoggerAddMessage("Received a confirmation response, but wasn't waiting for confirmation. "
 				"Ignoring.");
 			return;
 		}
 
-		// We need to get the slots so that we can get the necessary parameters.
-		std::vector<SlotNameValue> l_Slots;
-		CommandExtractSlotsFromJSONDocument(l_Slots, p_CommandDocument);
-
 		// We are looking to fill out one token, the response. 
 		CommandToken l_ResponseToken;
 
-		for (auto const& l_Slot : l_Slots)
-		{			
+		for (unsigned int l_SlotIndex = 0; l_SlotIndex < l_SlotCount; l_SlotIndex++)
+		{
+			auto const& l_Slot = p_Reader.GetSlot(l_SlotIndex);
+
 			// This is the response slot.
-			if (l_Slot.m_Name.compare("response") == 0)
+			if (l_Slot.m_Name == "response")
 			{
 				l_ResponseToken.m_Type = CommandConvertStringToTokenType(l_Slot.m_Value);
 			}		
@@ -592,7 +1064,7 @@ void CommandTokenizeJSONDocument(std::vector<CommandToken>& p_CommandTokens,
 		{
 			// It's important in this case that we clear the command tokens so that we don't attempt 
 			// to process the pending command.
-			p_CommandTokens.clear();
+			p_CommandTokens.Clear();
 
 			LoggerAddMessage("Couldn't recognize a %s intent because of invalid parameters.", 
 				l_IntentName);
@@ -602,13 +1074,13 @@ void CommandTokenizeJSONDocument(std::vector<CommandToken>& p_CommandTokens,
 		LoggerAddMessage("Recognized a %s intent.", l_IntentName);
 
 		// Now that we theoretically have a set of valid tokens, add them to the output.
-		p_CommandTokens.push_back(l_ResponseToken);
+		p_CommandTokens.Add(l_ResponseToken);
 		return;
 	}
-	else if (p_CommandTokens.empty() == false)
+	else if (p_CommandTokens.IsEmpty() == false)
 	{
 		// If we were waiting on confirmation but got something else instead, ignore it.
-		p_CommandTokens.clear();
+		p_CommandTokens.Clear();
 
 		LoggerAddMessage("Ignoring intent %s because there was a command pending confirmation.", 
 			l_IntentName);
@@ -623,69 +1095,104 @@ void CommandTokenizeJSONDocument(std::vector<CommandToken>& p_CommandTokens,
 		CommandToken l_Token;
 		l_Token.m_Type = CommandToken::TYPE_STATUS;
 
-		p_CommandTokens.push_back(l_Token);
+		p_CommandTokens.Add(l_Token);
 		return;
 	}
 
 	if (strcmp(l_IntentName, "MovePart") == 0)
 	{
-		// We need to get the slots so that we can get the necessary parameters.
-		std::vector<SlotNameValue> l_Slots;
-		CommandExtractSlotsFromJSONDocument(l_Slots, p_CommandDocument);
+		// We are looking to fill out two tokens for each part that is moved, the part and the 
+		// direction. A compound request, such as "raise the back and lower the legs", repeats the slots,
+		// and the first direction goes with the first part, and so on.
+		CommandTokenList l_PartTokens;
+		CommandTokenList l_DirectionTokens;
+		auto l_TooManySlots = p_Reader.HasTooManySlots();
+
+		for (unsigned int l_SlotIndex = 0; l_SlotIndex < l_SlotCount; l_SlotIndex++)
+		{
+			auto const& l_Slot = p_Reader.GetSlot(l_SlotIndex);
 
-		// We are looking to fill out two tokens, the part and the direction.
-		CommandToken l_PartToken;
-		CommandToken l_DirectionToken;
+			CommandToken l_Token;
+			l_Token.m_Type = CommandConvertStringToTokenType(l_Slot.m_Value);
 
-		for (auto const& l_Slot : l_Slots)
-		{
 			// This is the part slot.
-			if (l_Slot.m_Name.compare("name") == 0)
+			if (l_Slot.m_Name == "name")
 			{
-				l_PartToken.m_Type = CommandConvertStringToTokenType(l_Slot.m_Value);
+				l_TooManySlots |= (l_PartTokens.Add(l_Token) == false);
 				continue;
 			}
 
 			// This is the direction slot.
-			if (l_Slot.m_Name.compare("direction") == 0)
+			if (l_Slot.m_Name == "direction")
 			{
-				l_DirectionToken.m_Type = CommandConvertStringToTokenType(l_Slot.m_Value);
+				l_TooManySlots |= (l_DirectionTokens.Add(l_Token) == false);
 				continue;
 			}			
 		}	
 
-		if ((l_PartToken.m_Type == CommandToken::TYPE_INVALID) || 
-			(l_DirectionToken.m_Type == CommandToken::TYPE_INVALID))
+		auto l_HasInvalidToken = false;
+
+		for (auto const& l_Token : l_PartTokens)
+		{
+			l_HasInvalidToken |= (l_Token.m_Type == CommandToken::TYPE_INVALID);
+		}
+
+		for (auto const& l_Token : l_DirectionTokens)
+		{
+			l_HasInvalidToken |= (l_Token.m_Type == CommandToken::TYPE_INVALID);
+		}
+
+		if ((l_PartTokens.IsEmpty() == true) || 
+			(l_PartTokens.GetCount() != l_DirectionTokens.GetCount()) || 
+			(l_HasInvalidToken == true) || (l_TooManySlots == true))
 		{
 			LoggerAddMessage("Couldn't recognize a %s intent because of invalid parameters.", 
 				l_IntentName);
 			return;
 		}
 
+		// Each part, its direction, and "and" before the next part have to fit.
+		if ((l_PartTokens.GetCount() * 3) - 1 > CommandTokenList::ms_Capacity)
+		{
+			LoggerAddMessage("Couldn't recognize a %s intent because it moves too many parts.", 
+				l_IntentName);
+			return;
+		}
+
 		LoggerAddMessage("Recognized a %s intent.", l_IntentName);
 
 		// Now that we theoretically have a set of valid tokens, add them to the output.
-		p_CommandTokens.push_back(l_PartToken);
-		p_CommandTokens.push_back(l_DirectionToken);
+		CommandToken l_AndToken;
+		l_AndToken.m_Type = CommandToken::TYPE_AND;
+
+		for (unsigned int l_PartIndex = 0; l_PartIndex < l_PartTokens.GetCount(); l_PartIndex++)
+		{
+			if (l_PartIndex > 0)
+			{
+				p_CommandTokens.Add(l_AndToken);
+			}
+
+			p_CommandTokens.Add(l_PartTokens[l_PartIndex]);
+			p_CommandTokens.Add(l_DirectionTokens[l_PartIndex]);
+		}
+
 		return;
 	}
 
 	if (strcmp(l_IntentName, "SetSchedule") == 0)
 	{
-		// We need to get the slots so that we can get the necessary parameters.
-		std::vector<SlotNameValue> l_Slots;
-		CommandExtractSlotsFromJSONDocument(l_Slots, p_CommandDocument);
-
 		// We are looking to fill out one token, what to do to the schedule.
 		CommandToken l_ScheduleToken;
 		l_ScheduleToken.m_Type = CommandToken::TYPE_SCHEDULE;
 
 		CommandToken l_ActionToken;
 
-		for (auto const& l_Slot : l_Slots)
+		for (unsigned int l_SlotIndex = 0; l_SlotIndex < l_SlotCount; l_SlotIndex++)
 		{
+			auto const& l_Slot = p_Reader.GetSlot(l_SlotIndex);
+
 			// This is the action slot.
-			if (l_Slot.m_Name.compare("action") == 0)
+			if (l_Slot.m_Name == "action")
 			{
 				l_ActionToken.m_Type = CommandConvertStringToTokenType(l_Slot.m_Value);
 				continue;
@@ -702,8 +1209,46 @@ void CommandTokenizeJSONDocument(std::vector<CommandToken>& p_CommandTokens,
 		LoggerAddMessage("Recognized a %s intent.", l_IntentName);
 
 		// Now that we theoretically have a set of valid tokens, add them to the output.
-		p_CommandTokens.push_back(l_ScheduleToken);
-		p_CommandTokens.push_back(l_ActionToken);
+		p_CommandTokens.Add(l_ScheduleToken);
+		p_CommandTokens.Add(l_ActionToken);
+		return;
+	}
+
+	if (strcmp(l_IntentName, "SetPosture") == 0)
+	{
+		// We are looking to fill out one token, the posture.
+		CommandToken l_PostureToken;
+
+		for (unsigned int l_SlotIndex = 0; l_SlotIndex < l_SlotCount; l_SlotIndex++)
+		{
+			auto const& l_Slot = p_Reader.GetSlot(l_SlotIndex);
+
+			// This is the posture slot.
+			if (l_Slot.m_Name == "name")
+			{
+				auto const l_PostureIndex = ControlsGetPostureIndex(l_Slot.m_Value);
+
+				if (l_PostureIndex >= 0)
+				{
+					l_PostureToken.m_Type = CommandToken::TYPE_POSTURE;
+					l_PostureToken.m_Parameter = l_PostureIndex;
+				}
+
+				continue;
+			}
+		}
+
+		if (l_PostureToken.m_Type == CommandToken::TYPE_INVALID)
+		{
+			LoggerAddMessage("Couldn't recognize a %s intent because of invalid parameters.", 
+				l_IntentName);
+			return;
+		}
+
+		LoggerAddMessage("Recognized a %s intent.", l_IntentName);
+
+		// Now that we theoretically have a set of valid tokens, add them to the output.
+		p_CommandTokens.Add(l_PostureToken);
 		return;
 	}
 
@@ -715,10 +1260,48 @@ void CommandTokenizeJSONDocument(std::vector<CommandToken>& p_CommandTokens,
 		CommandToken l_Token;
 		l_Token.m_Type = CommandToken::TYPE_REBOOT;
 
-		p_CommandTokens.push_back(l_Token);
+		p_CommandTokens.Add(l_Token);
 		return;
 	}
 
 	LoggerAddMessage("Unrecognized intent named %s.", l_IntentName);
 }
 
+
+// Parse an intent message in place and turn it into a list of tokens. Only the intent name, the 
+// session ID and the slots are looked at, and nothing is copied out of the message.
+//
+// p_CommandTokens:	(Input/Output) The resulting command tokens, in order. If there was a command 
+// 						pending confirmation, the corresponding tokens will be passed in. These are
+//							left alone if the message can't be parsed.
+// p_SessionID:		(Output) The ID of the dialogue session that the intent is part of, or null if the
+//							message doesn't say. This points into the message.
+// p_Message:			The intent message, which is overwritten by parsing it.
+//
+// Returns:				True if the message was parsed, false otherwise.
+//
+bool CommandTokenizeIntentMessage(CommandTokenList& p_CommandTokens, char const*& p_SessionID, 
+	char* p_Message)
+{
+	TraceScope l_TraceScope("Command JSON tokenized");
+
+	CommandIntentReader l_IntentReader;
+
+	{
+		TraceScope l_ParseTraceScope("MQTT JSON parsed");
+
+		rapidjson::InsituStringStream l_MessageStream(p_Message);
+		rapidjson::Reader l_Parser;
+
+		if (l_Parser.Parse<rapidjson::kParseInsituFlag>(l_MessageStream, l_IntentReader).IsError() == 
+			true)
+		{
+			return false;
+		}
+	}
+
+	p_SessionID = l_IntentReader.GetSessionID();
+
+	CommandTokenizeIntent(p_CommandTokens, l_IntentReader);
+	return true;
+}
@@ -1,9 +1,8 @@
 #pragma once
 
-#include <string>
-#include <vector>
+#include <string_view>
 
-#include "rapidjson/document.h"
+#include "control.h"
 
 // Types
 //
@@ -28,11 +27,13 @@ struct CommandToken
 		TYPE_REBOOT, 
 		TYPE_YES, 
 		TYPE_NO, 
+		TYPE_AND,	// Separates the clauses of a compound command.
 		
 		TYPE_NOT_PARAMETER_COUNT, 
 		
 		// The following command tokens are parameters.
 		TYPE_INTEGER = TYPE_NOT_PARAMETER_COUNT, 
+		TYPE_POSTURE,	// The parameter is the index of the posture.
 		
 		TYPE_COUNT,
 	};
@@ -40,16 +41,104 @@ struct CommandToken
 	// The type of the token.
 	Types	m_Type = TYPE_INVALID;
 	
-	// The value of the integer parameter, if relevant.
+	// The value of the integer or posture parameter, if relevant.
 	int   m_Parameter = 0;
 };
 
+// A list of command tokens, held inline so that tokenizing a command doesn't allocate.
+class CommandTokenList
+{
+	public:
+
+		// Constants.
+		static constexpr unsigned int ms_Capacity = 16;
+
+		// Add a token to the end of the list.
+		//
+		// p_Token:	The token to add.
+		//
+		// Returns:	True if the token was added, false if the list is full. A list that something 
+		//				didn't fit in is never parsed, so that a command is never partly carried out.
+		//
+		bool Add(CommandToken const& p_Token)
+		{
+			if (m_Count == ms_Capacity)
+			{
+				m_Overflowed = true;
+				return false;
+			}
+
+			m_Tokens[m_Count] = p_Token;
+			m_Count++;
+			return true;
+		}
+
+		// Remove all of the tokens.
+		//
+		void Clear()
+		{
+			m_Count = 0;
+			m_Overflowed = false;
+		}
+
+		// Accessors.
+
+		unsigned int GetCount() const
+		{
+			return m_Count;
+		}
+
+		bool IsEmpty() const
+		{
+			return (m_Count == 0);
+		}
+
+		bool HasOverflowed() const
+		{
+			return m_Overflowed;
+		}
+
+		CommandToken const& operator[](unsigned int p_Index) const
+		{
+			return m_Tokens[p_Index];
+		}
+
+		CommandToken& operator[](unsigned int p_Index)
+		{
+			return m_Tokens[p_Index];
+		}
+
+		// For range-based for loops.
+
+		CommandToken const* begin() const
+		{
+			return m_Tokens;
+		}
+
+		CommandToken const* end() const
+		{
+			return m_Tokens + m_Count;
+		}
+
+	private:
+
+		// The tokens, of which only the first m_Count are in use.
+		CommandToken m_Tokens[ms_Capacity];
+
+		// The number of tokens in the list.
+		unsigned int m_Count = 0;
+
+		// Whether a token was left out because the list was full.
+		bool m_Overflowed = false;
+};
+
 // Potential return values from parsing tokens.
 enum class CommandParseTokensReturnTypes
 {
 	INVALID = 0, 
 	SUCCESS, 
 	MISSING_CONFIRMATION, 
+	DROPPED,
 };
 
 // Functions
@@ -57,7 +146,7 @@ enum class CommandParseTokensReturnTypes
 
 // Initialize the system.
 //
-// p_Input:	The input device.
+// p_Input:	The input devices.
 //
 void CommandInitialize(class Input const& p_Input);
 
@@ -69,38 +158,52 @@ void CommandUninitialize();
 //
 void CommandProcess();
 
-// Parse the command tokens into commands.
+// Parse the command tokens into commands. A command may have several clauses, one after another or
+// joined with "and", such as "raise back 50 and lower legs". The controls they move all start 
+// together.
 //
+// p_Origin:			Where the command came from.
 // p_CommandTokens:	All of the potential tokens for the command.
 //
-// Returns:	A value signifying the result of the parsing.
+// Returns:	A value signifying the result of the parsing, which is a success if any clause was.
 //
-CommandParseTokensReturnTypes CommandParseTokens(std::vector<CommandToken> const& p_CommandTokens);
+CommandParseTokensReturnTypes CommandParseTokens(ControlOrigin const& p_Origin, 
+	CommandTokenList const& p_CommandTokens);
 
-// Parse the command tokens into commands.
+// Parse the command tokens into commands. A command may have several clauses, one after another or
+// joined with "and", such as "raise back 50 and lower legs". The controls they move all start 
+// together.
 //
 // p_ConfirmationText:	(Output) In cases with missing confirmation, this is the confirmation 
 // 	 						prompt.
+// p_Origin:				Where the command came from.
 // p_CommandTokens:		All of the potential tokens for the command.
 //
-// Returns:	A value signifying the result of the parsing.
+// Returns:	A value signifying the result of the parsing, which is a success if any clause was.
 //
 CommandParseTokensReturnTypes CommandParseTokens(char const*& p_ConfirmationText, 
-	std::vector<CommandToken> const& p_CommandTokens);
+	ControlOrigin const& p_Origin, CommandTokenList const& p_CommandTokens);
 
-// Take a command string and turn it into a list of tokens.
+// Take a command string and turn it into a list of tokens. Words are split on spaces and matched
+// without regard to case. If there are more words than fit, the list is marked as overflowed, so
+// that the command is rejected rather than mistaken for a shorter one.
 //
 // p_CommandTokens:	(Output) The resulting command tokens, in order.
 // p_CommandString:	The command string to tokenize.
 //
-void CommandTokenizeString(std::vector<CommandToken>& p_CommandTokens, 
-	std::string const& p_CommandString);
+void CommandTokenizeString(CommandTokenList& p_CommandTokens, std::string_view p_CommandString);
 
-// Take a command JSON document and turn it into a list of tokens.
+// Parse an intent message in place and turn it into a list of tokens. Only the intent name, the 
+// session ID and the slots are looked at, and nothing is copied out of the message.
+//
+// p_CommandTokens:	(Input/Output) The resulting command tokens, in order. If there was a command 
+// 						pending confirmation, the corresponding tokens will be passed in. These are
+//							left alone if the message can't be parsed.
+// p_SessionID:		(Output) The ID of the dialogue session that the intent is part of, or null if the
+//							message doesn't say. This points into the message.
+// p_Message:			The intent message, which is overwritten by parsing it.
 //
-// p_CommandTokens:		(Input/Output) The resulting command tokens, in order. If there was a 
-// 							command pending confirmation, the corresponding tokens will be passed in.
-// p_CommandDocument:	The command document to tokenize.
+// Returns:				True if the message was parsed, false otherwise.
 //
-void CommandTokenizeJSONDocument(std::vector<CommandToken>& p_CommandTokens, 
-	rapidjson::Document const& p_CommandDocument);
\ No newline at end of file
+bool CommandTokenizeIntentMessage(CommandTokenList& p_CommandTokens, char const*& p_SessionID, 
+	char* p_Message);
\ No newline at end of file
@@ -0,0 +1,206 @@
+// Measures how long it takes to tokenize command strings, compared with the tokenizer that came
+// before, which split and lowercased copies of each word and looked them up in a map. Build it with
+// "make commandbenchmark".
+
+#include <stdio.h>
+
+#include <cctype>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "command.h"
+
+// Constants
+//
+
+// How many times to tokenize each command.
+#define BENCHMARK_ITERATION_COUNT	(200000)
+
+// Locals
+//
+
+// A mapping between token names and token type, as the old tokenizer had it.
+static const std::map<std::string, CommandToken::Types>	s_BenchmarkTokenNameToTypeMap =
+{
+	{ "back", 		CommandToken::TYPE_BACK },
+	{ "legs",		CommandToken::TYPE_LEGS },
+	{ "elevation",	CommandToken::TYPE_ELEVATION },
+	{ "raise",		CommandToken::TYPE_RAISE },
+	{ "up",			CommandToken::TYPE_RAISE },
+	{ "lower",		CommandToken::TYPE_LOWER },
+	{ "down",		CommandToken::TYPE_LOWER },
+	{ "stop",		CommandToken::TYPE_STOP },
+	{ "schedule",	CommandToken::TYPE_SCHEDULE },
+	{ "start",		CommandToken::TYPE_START },
+	{ "status",		CommandToken::TYPE_STATUS },
+	{ "reboot", 	CommandToken::TYPE_REBOOT },
+	{ "yes", 		CommandToken::TYPE_YES },
+	{ "no", 			CommandToken::TYPE_NO },
+};
+
+// Commands like the ones that come in from the keyboard, the socket and voice.
+static char const* const s_BenchmarkCommands[] =
+{
+	"back raise",
+	"Legs Lower 50",
+	"elevation stop",
+	"schedule start",
+	"status",
+	"back 40",
+	"chair",
+	"bogus words here",
+};
+
+// Functions
+//
+
+// Tokenize a command string the way the old tokenizer did.
+//
+// p_CommandTokens:	(Output) The resulting command tokens, in order.
+// p_CommandString:	The command string to tokenize.
+//
+static void BenchmarkTokenizeStringWithMap(std::vector<CommandToken>& p_CommandTokens,
+	std::string const& p_CommandString)
+{
+	auto l_NextTokenStringStart = std::string::size_type{0};
+
+	while (l_NextTokenStringStart != std::string::npos)
+	{
+		auto const l_NextTokenStringEnd = p_CommandString.find(' ', l_NextTokenStringStart);
+
+		auto const l_TokenStringLength = (l_NextTokenStringEnd != std::string::npos) ?
+			(l_NextTokenStringEnd - l_NextTokenStringStart) : p_CommandString.size();
+		auto l_TokenString = p_CommandString.substr(l_NextTokenStringStart, l_TokenStringLength);
+
+		for (auto& l_Character : l_TokenString)
+		{
+			l_Character = std::tolower(l_Character);
+		}
+
+		CommandToken l_Token;
+		auto const l_ResultIterator = s_BenchmarkTokenNameToTypeMap.find(l_TokenString);
+
+		if (l_ResultIterator != s_BenchmarkTokenNameToTypeMap.end())
+		{
+			l_Token.m_Type = l_ResultIterator->second;
+		}
+		else
+		{
+			auto l_IsNumeric = true;
+
+			for (const auto& l_Character : l_TokenString)
+			{
+				l_IsNumeric = l_IsNumeric && std::isdigit(l_Character);
+			}
+
+			if (l_IsNumeric == true)
+			{
+				l_Token.m_Parameter = std::stoul(l_TokenString);
+				l_Token.m_Type = CommandToken::TYPE_INTEGER;
+			}
+			else
+			{
+				auto const l_PostureIndex = ControlsGetPostureIndex(l_TokenString.c_str());
+
+				if (l_PostureIndex >= 0)
+				{
+					l_Token.m_Parameter = l_PostureIndex;
+					l_Token.m_Type = CommandToken::TYPE_POSTURE;
+				}
+			}
+		}
+
+		p_CommandTokens.push_back(l_Token);
+
+		l_NextTokenStringStart = l_NextTokenStringEnd;
+
+		if (l_NextTokenStringEnd != std::string::npos)
+		{
+			l_NextTokenStringStart++;
+		}
+	}
+}
+
+// Tokenize every command many times with one of the tokenizers.
+//
+// p_Name:			The name of the tokenizer, for printing.
+// p_Tokenize:		Tokenizes one command, returning the number of tokens.
+//
+// Returns:			The number of tokens made, so that the work can't be optimized away.
+//
+template <typename TokenizeType>
+static unsigned int BenchmarkRun(char const* p_Name, TokenizeType p_Tokenize)
+{
+	static constexpr unsigned int s_CommandCount =
+		sizeof(s_BenchmarkCommands) / sizeof(s_BenchmarkCommands[0]);
+
+	unsigned int l_TokenCount = 0;
+	auto const l_StartTime = std::chrono::steady_clock::now();
+
+	for (unsigned int l_Iteration = 0; l_Iteration < BENCHMARK_ITERATION_COUNT; l_Iteration++)
+	{
+		for (auto const* l_Command : s_BenchmarkCommands)
+		{
+			l_TokenCount += p_Tokenize(l_Command);
+		}
+	}
+
+	auto const l_Elapsed = std::chrono::steady_clock::now() - l_StartTime;
+	auto const l_ElapsedNS = std::chrono::duration_cast<std::chrono::nanoseconds>(l_Elapsed).count();
+
+	printf("%-8s %8.1f ns per command\n", p_Name, static_cast<double>(l_ElapsedNS) /
+		(static_cast<double>(BENCHMARK_ITERATION_COUNT) * s_CommandCount));
+
+	return l_TokenCount;
+}
+
+// Program entry point.
+//
+int main()
+{
+	// Make sure that both tokenizers agree before timing them.
+	for (auto const* l_Command : s_BenchmarkCommands)
+	{
+		std::vector<CommandToken> l_MapTokens;
+		BenchmarkTokenizeStringWithMap(l_MapTokens, l_Command);
+
+		CommandTokenList l_Tokens;
+		CommandTokenizeString(l_Tokens, l_Command);
+
+		auto l_Agrees = (l_Tokens.GetCount() == l_MapTokens.size());
+
+		for (unsigned int l_TokenIndex = 0; (l_Agrees == true) && (l_TokenIndex < l_Tokens.GetCount());
+			l_TokenIndex++)
+		{
+			l_Agrees = (l_Tokens[l_TokenIndex].m_Type == l_MapTokens[l_TokenIndex].m_Type) &&
+				(l_Tokens[l_TokenIndex].m_Parameter == l_MapTokens[l_TokenIndex].m_Parameter);
+		}
+
+		if (l_Agrees == false)
+		{
+			printf("The tokenizers disagree about \"%s\".\n", l_Command);
+			return 1;
+		}
+	}
+
+	unsigned int l_TokenCount = 0;
+
+	l_TokenCount += BenchmarkRun("map", [](char const* p_Command)
+	{
+		std::vector<CommandToken> l_CommandTokens;
+		BenchmarkTokenizeStringWithMap(l_CommandTokens, p_Command);
+		return static_cast<unsigned int>(l_CommandTokens.size());
+	});
+
+	l_TokenCount += BenchmarkRun("hash", [](char const* p_Command)
+	{
+		CommandTokenList l_CommandTokens;
+		CommandTokenizeString(l_CommandTokens, p_Command);
+		return l_CommandTokens.GetCount();
+	});
+
+	printf("(%u tokens)\n", l_TokenCount);
+	return 0;
+}
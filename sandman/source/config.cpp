@@ -19,11 +19,6 @@
 
 // Config members
 
-Config::Config()
-{
-	m_InputDeviceName[0] = '\0';
-}
-
 // Read the configuration from a file.
 // 
 // p_ConfigFileName:	The name of the config file.
@@ -63,59 +58,19 @@ bool Config::ReadFromFile(char const* p_ConfigFileName)
 		
 	if (l_InputSettingsNode != nullptr)
 	{
-		// Let's go through the input settings and look for ones we recognize.
-		auto l_SettingNode = l_InputSettingsNode->xmlChildrenNode;
-		for (; l_SettingNode != nullptr; l_SettingNode = l_SettingNode->next)
+		// Read every input device we can.
+		static auto const* s_InputDeviceNodeName = "InputDevice";
+		XMLForEachNodeNamed(l_InputSettingsNode->xmlChildrenNode, s_InputDeviceNodeName, 
+			[&](xmlNodePtr p_Node)
 		{
-			// See if this is an input device.
-			static auto const* s_InputDeviceNodeName = "InputDevice";
-			if (XMLIsNodeNamed(l_SettingNode, s_InputDeviceNodeName) == false)
-			{				
-				continue;
-			}
-			
-			// Let's go through the input device settings and try to load those in.
-			auto l_InputDeviceNode = l_SettingNode->xmlChildrenNode;
-			for (; l_InputDeviceNode != nullptr; l_InputDeviceNode = l_InputDeviceNode->next)
+			InputDeviceConfig l_InputDeviceConfig;
+			if (l_InputDeviceConfig.ReadFromXML(l_ConfigDocument, p_Node) == false)
 			{
-				// See if this is the device name.
-				static auto const* s_DeviceNameNodeName = "DeviceName";
-				if (XMLIsNodeNamed(l_InputDeviceNode, s_DeviceNameNodeName) == true)
-				{			
-					// Load the text from the node.
-					XMLCopyNodeText(m_InputDeviceName, ms_InputDeviceNameCapacity, l_ConfigDocument, 
-						l_InputDeviceNode);
-					continue;
-				}
-				
-				// See if this is a set of input bindings.
-				static auto const* s_BindingsNodeName = "Bindings";
-				if (XMLIsNodeNamed(l_InputDeviceNode, s_BindingsNodeName) == true)
-				{
-					// Clear the list so that if there are multiple sets of bindings, we always take the 
-					// last ones.
-					m_InputBindings.clear();
-		
-					// Let's go through the bindings and try to load those in.
-					static auto const* s_BindingNodeName = "Binding";
-					XMLForEachNodeNamed(l_InputDeviceNode->xmlChildrenNode, s_BindingNodeName, 
-						[&](xmlNodePtr p_Node)
-					{						
-						// Try to read the binding.
-						InputBinding l_Binding;
-						if (l_Binding.ReadFromXML(l_ConfigDocument, p_Node) == false)
-						{
-							return;
-						}
-						
-						// If we successfully read a binding, add it to the list.
-						m_InputBindings.push_back(l_Binding);
-					});				
-	
-					continue;
-				}
+				return;
 			}
-		}
+
+			m_InputDeviceConfigs.push_back(l_InputDeviceConfig);
+		});
 	}
 	
 	// Try to find the control settings node.
@@ -150,6 +105,18 @@ bool Config::ReadFromFile(char const* p_ConfigFileName)
 				
 				continue;
 			}
+
+			// See if this is the limit on controls moving at once.
+			static auto const* s_MaxMovingControlsNodeName = "MaxMovingControls";
+			if (XMLIsNodeNamed(l_SettingNode, s_MaxMovingControlsNodeName) == true)
+			{
+				// Load the value from the node.
+				auto const l_MaxMovingControls = XMLGetNodeTextAsInteger(l_ConfigDocument, 
+					l_SettingNode);
+				m_ControlMaxMovingControls = (l_MaxMovingControls > 0) ? l_MaxMovingControls : 0;
+				
+				continue;
+			}
 			
 			// See if this is a set of control configs.
 			static auto const* s_ControlConfigsNodeName = "ControlConfigs";
@@ -175,9 +142,69 @@ bool Config::ReadFromFile(char const* p_ConfigFileName)
 
 				continue;
 			}
+
+			// See if this is a set of postures.
+			static auto const* s_PosturesNodeName = "Postures";
+			if (XMLIsNodeNamed(l_SettingNode, s_PosturesNodeName) == true)
+			{
+				// Clear the list so that if there are multiple sets, we always take the last ones.
+				m_ControlPostureConfigs.clear();
+		
+				static auto const* s_PostureNodeName = "Posture";
+				XMLForEachNodeNamed(l_SettingNode->xmlChildrenNode, s_PostureNodeName, 
+					[&](xmlNodePtr p_Node)
+				{								
+					// Try to read the posture.
+					ControlPostureConfig l_PostureConfig;
+					if (l_PostureConfig.ReadFromXML(l_ConfigDocument, p_Node) == false)
+					{
+						return;
+					}
+					
+					// If we successfully read a posture, add it to the list.
+					m_ControlPostureConfigs.push_back(l_PostureConfig);
+				});		
+
+				continue;
+			}
 		}
 	}
 	
+	// Try to find the real-time settings node.
+	static auto const* s_RealtimeSettingsNodeName = "RealtimeSettings";
+	auto* l_RealtimeSettingsNode = XMLFindNextNodeByName(l_RootNode->xmlChildrenNode, 
+		s_RealtimeSettingsNodeName);
+
+	if (l_RealtimeSettingsNode != nullptr)
+	{
+		m_RealtimeConfig.ReadFromXML(l_ConfigDocument, l_RealtimeSettingsNode);
+	}
+
+	// Try to find the GPIO settings node.
+	static auto const* s_GPIOSettingsNodeName = "GPIOSettings";
+	auto* l_GPIOSettingsNode = XMLFindNextNodeByName(l_RootNode->xmlChildrenNode, 
+		s_GPIOSettingsNodeName);
+
+	if (l_GPIOSettingsNode != nullptr)
+	{
+		if (m_GPIOConfig.ReadFromXML(l_ConfigDocument, l_GPIOSettingsNode) == false)
+		{
+			LoggerAddMessage("Failed to read the GPIO settings.");
+			xmlFreeDoc(l_ConfigDocument);
+			return false;
+		}
+	}
+
+	// Try to find the simulation settings node.
+	static auto const* s_SimulationSettingsNodeName = "SimulationSettings";
+	auto* l_SimulationSettingsNode = XMLFindNextNodeByName(l_RootNode->xmlChildrenNode, 
+		s_SimulationSettingsNodeName);
+
+	if (l_SimulationSettingsNode != nullptr)
+	{
+		m_SimulationConfig.ReadFromXML(l_ConfigDocument, l_SimulationSettingsNode);
+	}
+
 	// "Close" the config file.
 	xmlFreeDoc(l_ConfigDocument);
 	
@@ -1,6 +1,9 @@
 #pragma once
 
+#include "gpio.h"
 #include "input.h"
+#include "realtime.h"
+#include "simulation.h"
 
 // Types
 //
@@ -10,8 +13,6 @@
 class Config
 {
 	public:
-	
-		Config();
 		
 		// Read the configuration from a file.
 		// 
@@ -23,14 +24,9 @@ class Config
 		
 		// Accessors.
 		
-		char const* GetInputDeviceName() const
-		{
-			return m_InputDeviceName;
-		}
-		
-		std::vector<InputBinding> const& GetInputBindings() const
+		std::vector<InputDeviceConfig> const& GetInputDeviceConfigs() const
 		{
-			return m_InputBindings;
+			return m_InputDeviceConfigs;
 		}
 		
 		unsigned int GetControlMaxMovingDurationMS() const
@@ -47,17 +43,36 @@ class Config
 		{
 			return m_ControlConfigs;
 		}
+
+		unsigned int GetControlMaxMovingControls() const
+		{
+			return m_ControlMaxMovingControls;
+		}
+
+		std::vector<ControlPostureConfig> const& GetControlPostureConfigs() const
+		{
+			return m_ControlPostureConfigs;
+		}
+
+		RealtimeConfig const& GetRealtimeConfig() const
+		{
+			return m_RealtimeConfig;
+		}
+
+		GPIOConfig const& GetGPIOConfig() const
+		{
+			return m_GPIOConfig;
+		}
+
+		SimulationConfig const& GetSimulationConfig() const
+		{
+			return m_SimulationConfig;
+		}
 		
 	private:
 	
-		// Constants.
-		static constexpr unsigned int ms_InputDeviceNameCapacity = 64;
-		
-		// The name of the input device.
-		char m_InputDeviceName[ms_InputDeviceNameCapacity];
-							
-		// The list of input bindings.
-		std::vector<InputBinding> m_InputBindings;
+		// The list of input devices.
+		std::vector<InputDeviceConfig> m_InputDeviceConfigs;
 		
 		// The maximum duration a control can move for (in milliseconds).
 		unsigned int m_ControlMaxMovingDurationMS = 100000;
@@ -67,5 +82,20 @@ class Config
 		
 		// The list of control configs.
 		std::vector<ControlConfig> m_ControlConfigs;
+
+		// How many controls may make timed movements or move to positions at once (0 for no limit).
+		unsigned int m_ControlMaxMovingControls = 0;
+
+		// The list of postures.
+		std::vector<ControlPostureConfig> m_ControlPostureConfigs;
+
+		// The real-time settings.
+		RealtimeConfig m_RealtimeConfig;
+
+		// The GPIO settings.
+		GPIOConfig m_GPIOConfig;
+
+		// The settings for simulating the bed.
+		SimulationConfig m_SimulationConfig;
 };
 
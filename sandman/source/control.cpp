@@ -1,13 +1,27 @@
 #include "control.h"
 
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
+#include <string>
 #include <string.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
-#include <pigpio.h>
-
+#include "gpio.h"
 #include "logger.h"
 #include "notification.h"
+#include "queue.h"
+#include "reactor.h"
+#include "reports.h"
+#include "stats.h"
+#include "trace.h"
 #include "timer.h"
 #include "xml.h"
 
@@ -16,15 +30,29 @@
 // Constants
 //
 
+// The longest the main thread waits for the control thread to catch up with its commands.
+#define CONTROL_FLUSH_TIMEOUT_MS			(100)
+
 // Maximum duration of the moving state.
-#define MAX_MOVING_STATE_DURATION_MS		(100 * 1000) // 100 sec.
+#define MAX_MOVING_STATE_DURATION		(100s)
 
 // Maximum duration of the cool down state.
-#define MAX_COOL_DOWN_STATE_DURATION_MS	(50 * 1000) // 50 sec.
+#define MAX_COOL_DOWN_STATE_DURATION	(50s)
 
 // Time between commands.
 //#define COMMAND_INTERVAL_MS				(2 * 1000) // 2 sec.
 
+// How much longer than a hardware timed movement to wait before ending it in software. The pins
+// should already be off by then, so this only matters if the hardware timing fails.
+#define CONTROL_PULSE_GRACE_DURATION		(50ms)
+
+// Movements to a position that would be shorter than this aren't worth making.
+#define CONTROL_POSITION_TOLERANCE			(100ms)
+
+// How far past an end to keep going, as a percentage of the full travel, when moving to that end from
+// a known position. This makes up for any drift in the estimated position.
+#define CONTROL_END_OVERRUN_PERCENT			(10)
+
 // The pin to use for enabling controls.
 #define ENABLE_GPIO_PIN							(7)
 
@@ -32,6 +60,133 @@
 #define CONTROL_ON_GPIO_VALUE					(0)
 #define CONTROL_OFF_GPIO_VALUE				(1)
 
+// How many commands can be waiting for the control thread.
+#define CONTROL_COMMAND_QUEUE_CAPACITY		(64)
+
+// How many events can be waiting for the main thread.
+#define CONTROL_EVENT_QUEUE_CAPACITY		(256)
+
+// How many controls a posture can move.
+#define CONTROL_POSTURE_CAPACITY				(8)
+
+// Types
+//
+
+// Where one control should go as part of a posture, once its name has been looked up.
+struct ControlPostureTarget
+{
+	// The control.
+	ControlHandle	m_Handle;
+
+	// The desired position, as a percentage.
+	unsigned int	m_PositionPercent;
+};
+
+// A request from the main thread to the control thread.
+struct ControlCommand
+{
+	// Things the control thread can be asked to do.
+	enum Types
+	{
+		TYPE_SET_DESIRED_ACTION = 0,
+		TYPE_SET_DESIRED_POSITION,
+		TYPE_SET_POSTURE,
+		TYPE_STOP_ALL,
+	};
+
+	// What to do.
+	Types					m_Type;
+
+	// The control to do it to, unless it is for all of them.
+	ControlHandle		m_Handle;
+
+	// The desired action.
+	Control::Actions	m_Action;
+
+	// The mode of the action.
+	Control::Modes		m_Mode;
+
+	// How long to move for.
+	Duration				m_MovingDuration;
+
+	// The desired position, as a percentage.
+	unsigned int		m_PositionPercent;
+
+	// Where each control should go for a posture.
+	ControlPostureTarget	m_PostureTargets[CONTROL_POSTURE_CAPACITY];
+	unsigned int		m_PostureTargetCount;
+
+	// Where the command came from.
+	ControlOrigin		m_Origin;
+
+	// When the command was sent to the control thread.
+	Time					m_SetTime;
+};
+
+// Carries commands from one other thread to the control thread.
+using ControlCommandQueue = SPSCQueue<ControlCommand, CONTROL_COMMAND_QUEUE_CAPACITY>;
+
+// Something the control thread reports back to the main thread.
+struct ControlEvent
+{
+	// Things the control thread can report.
+	enum Types
+	{
+		TYPE_STATE_CHANGED = 0,
+		TYPE_STATUS_CHANGED,
+		TYPE_WAKE_LATENCY,
+		TYPE_COMMAND_APPLIED,
+	};
+
+	// What happened.
+	Types					m_Type;
+
+	// The control it happened to, or an invalid handle if it happened to all of them.
+	ControlHandle		m_Handle;
+
+	// The state before and after a state change.
+	Control::State		m_OldState;
+	Control::State		m_NewState;
+
+	// The mode the control was in.
+	Control::Modes		m_Mode;
+
+	// The desired action after a state or status change.
+	Control::Actions	m_DesiredAction;
+
+	// When the time limit for the new state runs out.
+	Time					m_StateEndTime;
+
+	// The estimated position after a state or status change, as a percentage, whether it is known, 
+	// and when it was estimated.
+	unsigned int		m_PositionPercent;
+	bool					m_PositionKnown;
+	Time					m_PositionTime;
+
+	// How late the control thread woke up for a timer.
+	Duration				m_WakeLatency;
+
+	// The action that was applied.
+	Control::Actions	m_Action;
+
+	// Where the applied command came from.
+	ControlOrigin		m_Origin;
+
+	// When the applied command was sent to the control thread, and when the control thread was done 
+	// with it.
+	Time					m_SetTime;
+	Time					m_AppliedTime;
+
+	// How long the applied command asked to move for.
+	Duration				m_MovingDuration;
+
+	// Whether applying the command drove the pins.
+	bool					m_DrovePins;
+
+	// Whether the command's move is waiting for a motor to be free, rather than started.
+	bool					m_Queued;
+};
+
 // Locals
 //
 
@@ -43,6 +198,9 @@ static char const* const s_ControlActionNames[] =
 	"moving down",	// ACTION_MOVING_DOWN
 };
 
+static_assert(sizeof(s_ControlActionNames) / sizeof(s_ControlActionNames[0]) == 
+	Control::NUM_ACTIONS, "Every action needs a name.");
+
 // The names of the modes.
 static char const* const s_ControlModeNames[] =
 {
@@ -50,6 +208,37 @@ static char const* const s_ControlModeNames[] =
 	"timed",		// MODE_TIMED
 };
 
+static_assert(sizeof(s_ControlModeNames) / sizeof(s_ControlModeNames[0]) == Control::NUM_MODES, 
+	"Every mode needs a name.");
+
+// The names of the origin sources.
+static char const* const s_ControlSourceNames[] =
+{
+	"internal",		// SOURCE_INTERNAL
+	"voice",			// SOURCE_VOICE
+	"button",		// SOURCE_BUTTON
+	"socket",		// SOURCE_SOCKET
+	"keyboard",		// SOURCE_KEYBOARD
+	"schedule",		// SOURCE_SCHEDULE
+};
+
+static_assert(sizeof(s_ControlSourceNames) / sizeof(s_ControlSourceNames[0]) == 
+	ControlOrigin::NUM_SOURCES, "Every source needs a name.");
+
+// The probes that measure latency for each origin source.
+static StatsProbes const s_ControlSourceLatencyProbes[] =
+{
+	NUM_STATS_PROBES,					// SOURCE_INTERNAL, which isn't measured.
+	STATS_PROBE_VOICE_LATENCY,		// SOURCE_VOICE
+	STATS_PROBE_BUTTON_LATENCY,	// SOURCE_BUTTON
+	STATS_PROBE_SOCKET_LATENCY,	// SOURCE_SOCKET
+	STATS_PROBE_KEYBOARD_LATENCY,	// SOURCE_KEYBOARD
+	STATS_PROBE_SCHEDULE_LATENCY,	// SOURCE_SCHEDULE
+};
+
+static_assert(sizeof(s_ControlSourceLatencyProbes) / sizeof(s_ControlSourceLatencyProbes[0]) == 
+	ControlOrigin::NUM_SOURCES, "Every source needs a probe.");
+
 // The names of the states.
 static char const* const s_ControlStateNames[] =
 {
@@ -59,6 +248,9 @@ static char const* const s_ControlStateNames[] =
 	"cool down",	// STATE_COOL_DOWN
 };
 
+static_assert(sizeof(s_ControlStateNames) / sizeof(s_ControlStateNames[0]) == Control::NUM_STATES, 
+	"Every state needs a name.");
+
 // The notification names of the states.
 static char const* const s_ControlStateNotificationNames[] =
 {
@@ -68,33 +260,277 @@ static char const* const s_ControlStateNotificationNames[] =
 	"stop",			// STATE_COOL_DOWN
 };
 
-// A list of registered controls.
+static_assert(sizeof(s_ControlStateNotificationNames) / 
+	sizeof(s_ControlStateNotificationNames[0]) == Control::NUM_STATES, 
+	"Every state needs a notification name.");
+
+// A list of registered controls. This must not change while the control thread is running.
 static std::vector<Control> s_Controls;
 
+// The thread that drives the relays.
+static std::thread s_ControlThread;
+
+// Tells the control thread to exit.
+static std::atomic<bool> s_ControlThreadQuit(false);
+
+// Commands from the main thread to the control thread.
+static ControlCommandQueue s_ControlCommandQueue;
+
+// Commands from the input thread to the control thread. Each queue can only have one producer.
+static ControlCommandQueue s_ControlInputCommandQueue;
+
+// Events from the control thread to the main thread.
+static SPSCQueue<ControlEvent, CONTROL_EVENT_QUEUE_CAPACITY> s_ControlEventQueue;
+
+// Counts events that didn't fit in the queue, so the main thread can say so.
+static std::atomic<unsigned int> s_ControlDroppedEventCount(0);
+
+// Counts held actions that didn't fit in the input command queue, so the main thread can say so.
+static std::atomic<unsigned int> s_ControlDroppedInputCommandCount(0);
+
+// Wakes the control thread when there are commands.
+static int s_ControlCommandEventFileDescriptor = -1;
+
+// Wakes the main thread when there are events.
+static int s_ControlEventEventFileDescriptor = -1;
+
+// How many command batches the main thread has open, whether it sent anything while they were, and
+// whether anything it sent was dropped. Only the main thread may use these.
+static unsigned int s_ControlCommandBatchDepth = 0;
+static bool s_ControlCommandBatchSent = false;
+static bool s_ControlCommandBatchDropped = false;
+
+// How many commands the main thread has sent, and how many of those the control thread has handled
+// and reported back on, so that the main thread can wait for it to catch up.
+static unsigned int s_ControlCommandSentCount = 0;
+static std::atomic<unsigned int> s_ControlCommandHandledCount(0);
+
+// Whether events have been posted since the main thread was last woken. Only the control thread may
+// use this.
+static bool s_ControlEventWakePending = false;
+
+// Notifications for the state changes handled in one go, so that they can be played as one. Only 
+// the main thread may use this.
+static std::vector<std::string> s_ControlPendingNotificationIDs;
+
+// Wakes the control thread when its earliest timer is due.
+static int s_ControlTimerFileDescriptor = -1;
+
+// The timers for the control states. Only the control thread may use these.
+static TimerService s_ControlTimerService;
+
+// Pins waiting to be switched on or off together. Only the control thread may use these.
+static GPIOPinSet s_ControlPendingOnPins = 0;
+static GPIOPinSet s_ControlPendingOffPins = 0;
+
+// Whether pins were driven outside of the pending writes, by starting a pulse. Only the control
+// thread may use this.
+static bool s_ControlStartedPulse = false;
+
+// Whether the control thread's work is done by whoever calls ControlsStep, instead of by the thread.
+static bool s_ControlsStepped = false;
+
+// Called for each command the control thread has applied.
+static ControlCommandAppliedCallback s_ControlCommandAppliedCallback;
+
+// The postures the controls can be moved to. Only the main thread may use these.
+static std::vector<ControlPostureConfig> s_ControlPostures;
+
 // Control members
 
-unsigned int Control::ms_MaxMovingDurationMS = MAX_MOVING_STATE_DURATION_MS;
-unsigned int Control::ms_CoolDownDurationMS = MAX_COOL_DOWN_STATE_DURATION_MS;
+Duration Control::ms_MaxMovingDuration = MAX_MOVING_STATE_DURATION;
+Duration Control::ms_CoolDownDuration = MAX_COOL_DOWN_STATE_DURATION;
+unsigned int Control::ms_MaxMovingControls = 0;
 
 // Functions
 //
 
-// Set the given GPIO pin to the "on" value.
+// Get the levels that switch pins on or off.
+//
+// p_OnPins:	The pins to switch on.
+// p_OffPins:	The pins to switch off.
+//
+// Returns:		The levels.
+//
+static GPIOPinSet ControlsGetPinLevels(GPIOPinSet p_OnPins, GPIOPinSet p_OffPins)
+{
+	return ((CONTROL_ON_GPIO_VALUE != 0) ? p_OnPins : 0) | 
+		((CONTROL_OFF_GPIO_VALUE != 0) ? p_OffPins : 0);
+}
+
+// Switch pins on with the next write.
+//
+// p_Pins:	The pins to switch on.
+//
+static void ControlsSetPinsOn(GPIOPinSet p_Pins)
+{
+	s_ControlPendingOnPins |= p_Pins;
+	s_ControlPendingOffPins &= ~p_Pins;
+}
+
+// Switch pins off with the next write.
+//
+// p_Pins:	The pins to switch off.
+//
+static void ControlsSetPinsOff(GPIOPinSet p_Pins)
+{
+	s_ControlPendingOffPins |= p_Pins;
+	s_ControlPendingOnPins &= ~p_Pins;
+}
+
+// Switch all of the pending pins on or off in one write. Only the control thread may call this.
+//
+// Returns:	True if any pins were written, false otherwise.
+//
+static bool ControlsWritePins()
+{
+	auto const l_Pins = s_ControlPendingOnPins | s_ControlPendingOffPins;
+
+	if (l_Pins == 0)
+	{
+		return false;
+	}
+
+	{
+		TraceScope l_TraceScope("GPIO write");
+		GPIOWrite(l_Pins, ControlsGetPinLevels(s_ControlPendingOnPins, s_ControlPendingOffPins));
+	}
+
+	s_ControlPendingOnPins = 0;
+	s_ControlPendingOffPins = 0;
+
+	return true;
+}
+
+// Wake up the control thread, if there is one, to act on a command.
+//
+static void ControlsWakeForCommand()
+{
+	// Without a thread, the command waits for the next step.
+	if (s_ControlsStepped == true)
+	{
+		return;
+	}
+
+	uint64_t const l_Increment = 1;
+
+	if (write(s_ControlCommandEventFileDescriptor, &l_Increment, sizeof(l_Increment)) < 0)
+	{
+		LoggerAddMessage("Failed to wake the control thread with error %d.", errno);
+	}
+}
+
+// Send a command from the main thread to the control thread.
+//
+// p_Command:	(Input/Output) The command to send. The time it was sent is filled in.
+//
+// Returns:		True if the command was sent, false if it was dropped.
+//
+static bool ControlsSendCommand(ControlCommand& p_Command)
+{
+	TimerGetCurrent(p_Command.m_SetTime);
+
+	auto const l_IsStop = (p_Command.m_Type == ControlCommand::TYPE_STOP_ALL) || 
+		((p_Command.m_Type == ControlCommand::TYPE_SET_DESIRED_ACTION) && 
+		(p_Command.m_Action == Control::ACTION_STOPPED));
+
+	// A stop has to get through, and the control thread empties the queue as soon as it wakes, so 
+	// wait for room, even in the middle of a batch. Anything else is dropped, and the caller told.
+	while (s_ControlCommandQueue.Push(p_Command) == false)
+	{
+		if ((l_IsStop == false) || (s_ControlThread.joinable() == false))
+		{
+			LoggerAddMessage("Dropped a control command because the command queue is full.");
+
+			if (s_ControlCommandBatchDepth > 0)
+			{
+				s_ControlCommandBatchDropped = true;
+			}
+
+			return false;
+		}
+
+		ControlsWakeForCommand();
+		std::this_thread::yield();
+	}
+
+	s_ControlCommandSentCount++;
+
+	// A batch wakes the control thread once, when it ends.
+	if (s_ControlCommandBatchDepth > 0)
+	{
+		s_ControlCommandBatchSent = true;
+		return true;
+	}
+
+	ControlsWakeForCommand();
+	return true;
+}
+
+// Send a command from the input thread to the control thread.
 //
-// p_Pin:	The GPIO pin to set the value of.
+// p_Command:	(Input/Output) The command to send. The time it was sent is filled in.
 //
-void SetGPIOPinOn(int p_Pin)
+// Returns:		True if the command was sent, false if it was dropped.
+//
+static bool ControlsSendInputCommand(ControlCommand& p_Command)
 {
-	gpioWrite(p_Pin, CONTROL_ON_GPIO_VALUE);
+	TimerGetCurrent(p_Command.m_SetTime);
+
+	// A stop has to get through, and the control thread empties the queue as soon as it wakes, so 
+	// wait for room. Anything else is dropped, since the button will have been let go by the time
+	// there's room for it.
+	while (s_ControlInputCommandQueue.Push(p_Command) == false)
+	{
+		if ((p_Command.m_Action != Control::ACTION_STOPPED) || (s_ControlThread.joinable() == false))
+		{
+			return false;
+		}
+
+		ControlsWakeForCommand();
+		std::this_thread::yield();
+	}
+
+	ControlsWakeForCommand();
+	return true;
 }
 
-// Set the given GPIO pin to the "off" value.
+// Send an event from the control thread to the main thread.
+//
+// p_Event:	The event to send.
 //
-// p_Pin:	The GPIO pin to set the value of.
+static void ControlsPostEvent(ControlEvent const& p_Event)
+{
+	if (s_ControlEventQueue.Push(p_Event) == false)
+	{
+		s_ControlDroppedEventCount.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	// The main thread is woken once the work that posted it is done, so that it sees everything that
+	// happened together at once.
+	s_ControlEventWakePending = true;
+}
+
+// Wake up the main thread if events have been posted since it was last woken. 
 //
-void SetGPIOPinOff(int p_Pin)
+static void ControlsWakeForEvents()
 {
-	gpioWrite(p_Pin, CONTROL_OFF_GPIO_VALUE);
+	if (s_ControlEventWakePending == false)
+	{
+		return;
+	}
+
+	s_ControlEventWakePending = false;
+
+	// Without a thread, the events are handled at the end of the step.
+	if (s_ControlsStepped == true)
+	{
+		return;
+	}
+
+	uint64_t const l_Increment = 1;
+	write(s_ControlEventEventFileDescriptor, &l_Increment, sizeof(l_Increment));
 }
 
 // ControlHandle members
@@ -141,6 +577,13 @@ bool ControlConfig::ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node)
 	
 	// Read the up pin from the node.
 	m_UpGPIOPin = XMLGetNodeTextAsInteger(p_Document, l_UpPinNode);
+
+	if (GPIOIsValidPin(m_UpGPIOPin) == false)
+	{
+		LoggerAddMessage("Control \"%s\" has up pin %d, which isn't a GPIO pin.", m_Name, 
+			m_UpGPIOPin);
+		return false;
+	}
 			
 	// We must have a down pin.
 	static auto const* s_DownPinNodeName = "DownPin";
@@ -153,6 +596,13 @@ bool ControlConfig::ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node)
 	
 	// Read the down pin from the node.
 	m_DownGPIOPin = XMLGetNodeTextAsInteger(p_Document, l_DownPinNode);
+
+	if (GPIOIsValidPin(m_DownGPIOPin) == false)
+	{
+		LoggerAddMessage("Control \"%s\" has down pin %d, which isn't a GPIO pin.", m_Name, 
+			m_DownGPIOPin);
+		return false;
+	}
 		
 	// We must have a moving duration.
 	static auto const* s_MovingDurationNodeName = "MovingDurationMS";
@@ -168,6 +618,109 @@ bool ControlConfig::ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node)
 		
 	return true;
 }
+
+// ControlPosition members
+
+// Read a control position from XML. 
+//
+// p_Document:	The XML document that the node belongs to.
+// p_Node:		The XML node to read the control position from.
+//	
+// Returns:		True if the position was read successfully, false otherwise.
+//
+bool ControlPosition::ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node)
+{
+	// We must have a control name.
+	static auto const* s_ControlNameNodeName = "ControlName";
+	auto* l_ControlNameNode = XMLFindNextNodeByName(p_Node->xmlChildrenNode, s_ControlNameNodeName);
+	
+	if (l_ControlNameNode == nullptr) 
+	{
+		return false;
+	}
+	
+	if (XMLCopyNodeText(m_ControlName, ms_ControlNameCapacity, p_Document, l_ControlNameNode) == false)
+	{
+		return false;
+	}
+
+	// We must also have a position.
+	static auto const* s_PercentNodeName = "Percent";
+	auto* l_PercentNode = XMLFindNextNodeByName(p_Node->xmlChildrenNode, s_PercentNodeName);
+	
+	if (l_PercentNode == nullptr) 
+	{
+		return false;
+	}
+
+	auto const l_Percent = XMLGetNodeTextAsInteger(p_Document, l_PercentNode);
+
+	if ((l_Percent < 0) || (l_Percent > 100))
+	{
+		LoggerAddMessage("Position %i%% for control \"%s\" is out of range.", l_Percent, 
+			m_ControlName);
+		return false;
+	}
+
+	m_PositionPercent = l_Percent;
+	return true;
+}
+
+// ControlPostureConfig members
+
+// Read a posture config from XML. 
+//
+// p_Document:	The XML document that the node belongs to.
+// p_Node:		The XML node to read the posture config from.
+//	
+// Returns:		True if the config was read successfully, false otherwise.
+//
+bool ControlPostureConfig::ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node)
+{
+	// We must have a name.
+	static auto const* s_NameNodeName = "Name";
+	auto* l_NameNode = XMLFindNextNodeByName(p_Node->xmlChildrenNode, s_NameNodeName);
+	
+	if (l_NameNode == nullptr) 
+	{
+		return false;
+	}
+	
+	if (XMLCopyNodeText(m_Name, ms_NameCapacity, p_Document, l_NameNode) == false)
+	{
+		return false;
+	}
+
+	// Then read every position we can.
+	m_Positions.clear();
+
+	static auto const* s_PositionNodeName = "Position";
+	XMLForEachNodeNamed(p_Node->xmlChildrenNode, s_PositionNodeName, [&](xmlNodePtr p_PositionNode)
+	{
+		ControlPosition l_Position;
+		if (l_Position.ReadFromXML(p_Document, p_PositionNode) == false)
+		{
+			return;
+		}
+
+		m_Positions.push_back(l_Position);
+	});
+
+	if (m_Positions.empty() == true)
+	{
+		LoggerAddMessage("Posture \"%s\" doesn't have any positions.", m_Name);
+		return false;
+	}
+
+	if (m_Positions.size() > CONTROL_POSTURE_CAPACITY)
+	{
+		LoggerAddMessage("Posture \"%s\" has more than %u positions.", m_Name, 
+			CONTROL_POSTURE_CAPACITY);
+		return false;
+	}
+
+	return true;
+}
 	
 // Control members
 
@@ -181,33 +734,45 @@ void Control::Initialize(ControlConfig const& p_Config)
 	strncpy(m_Name, p_Config.m_Name, ms_NameCapacity - 1);
 	m_Name[ms_NameCapacity - 1] = '\0';
 	
+	// Keep our own handle around so that timers can find us again.
+	m_Handle = GetHandle(m_Name);
+
 	m_State = STATE_IDLE;
 	TimerGetCurrent(m_StateStartTime);
+	m_StateEndTime = m_StateStartTime;
 	m_DesiredAction = ACTION_STOPPED;
+	m_PulseInHardware = false;
+
+	// There's no telling where the control is until it reaches an end.
+	m_Position = Duration::zero();
+	m_PositionKnown = false;
+	m_PositionTime = m_StateStartTime;
+	m_MovementRunDuration = Duration::zero();
+	m_HasPendingMove = false;
 
 	// Setup the pins and set them to off.
 	m_UpGPIOPin = p_Config.m_UpGPIOPin;
-	gpioSetMode(m_UpGPIOPin, PI_OUTPUT);
-	SetGPIOPinOff(m_UpGPIOPin);
-	
 	m_DownGPIOPin = p_Config.m_DownGPIOPin;
-	gpioSetMode(m_DownGPIOPin, PI_OUTPUT);
-	SetGPIOPinOff(m_DownGPIOPin);
+
+	auto const l_Pins = GPIOGetPinSet(m_UpGPIOPin) | GPIOGetPinSet(m_DownGPIOPin);
+	GPIOSetOutputs(l_Pins, ControlsGetPinLevels(0, l_Pins));
 	
 	// Set the individual control moving duration.
-	m_StandardMovingDurationMS = p_Config.m_MovingDurationMS;
+	m_StandardMovingDuration = std::chrono::milliseconds(p_Config.m_MovingDurationMS);
 	
 	LoggerAddMessage("Initialized control \'%s\' with GPIO pins (up %i, "
-		"down %i) and duration %i ms.", m_Name, m_UpGPIOPin, m_DownGPIOPin, m_StandardMovingDurationMS);
+		"down %i) and duration %i ms.", m_Name, m_UpGPIOPin, m_DownGPIOPin, 
+		p_Config.m_MovingDurationMS);
 }
 
 // Handle uninitialization.
 //
 void Control::Uninitialize()
 {
+	s_ControlTimerService.Cancel(m_StateTimer);
+
 	// Revert to input.
-	gpioSetMode(m_UpGPIOPin, PI_INPUT);
-	gpioSetMode (m_DownGPIOPin, PI_INPUT);
+	GPIOSetInputs(GPIOGetPinSet(m_UpGPIOPin) | GPIOGetPinSet(m_DownGPIOPin));
 }
 
 // Process a tick.
@@ -225,41 +790,24 @@ void Control::Process()
 			}
 
 			// Transition to moving.
-			if (m_DesiredAction == ACTION_MOVING_UP)
-			{
-				m_State = STATE_MOVING_UP;
-
-				// Set the pin to on.
-				SetGPIOPinOn(m_UpGPIOPin);
-			}
-			else
-			{
-				m_State = STATE_MOVING_DOWN;
+			m_State = (m_DesiredAction == ACTION_MOVING_UP) ? STATE_MOVING_UP : STATE_MOVING_DOWN;
 
-				// Set the pin to on.
-				SetGPIOPinOn(m_DownGPIOPin);
-			}
-			
-			// Play the notification.
-			PlayNotification();
+			// Set the pin to on.
+			auto const l_StateDuration = StartMoving((m_State == STATE_MOVING_UP) ? m_UpGPIOPin : 
+				m_DownGPIOPin);
 			
 			// Record when the state transition timer began.
 			TimerGetCurrent(m_StateStartTime);
+			StartTrackingMovement(m_StateStartTime);
+			ArmStateTimer(l_StateDuration);
 
-			LoggerAddMessage("Control \"%s\": State transition from \"%s\" to \"%s\" triggered.", 
-				m_Name, s_ControlStateNames[STATE_IDLE], s_ControlStateNames[m_State]);
+			PostStateChange(STATE_IDLE);
 		}
 		break;
 
 		case STATE_MOVING_UP:	// Fall through...
 		case STATE_MOVING_DOWN:
 		{
-			// Get elapsed time since state start.
-			Time l_CurrentTime;
-			TimerGetCurrent(l_CurrentTime);
-
-			auto const l_ElapsedTimeMS = TimerGetElapsedMilliseconds(m_StateStartTime, l_CurrentTime);
-
 			// Get the action corresponding to this state, as well as the one for the opposite state.
 			auto const l_MatchingAction = (m_State == STATE_MOVING_UP) ? ACTION_MOVING_UP : 
 				ACTION_MOVING_DOWN;
@@ -267,13 +815,22 @@ void Control::Process()
 				ACTION_MOVING_UP;
 			
 			// Wait until the desired action no longer matches or the time limit has run out.
-			if ((m_DesiredAction == l_MatchingAction) && (l_ElapsedTimeMS < m_MovingDurationMS))
+			if ((m_DesiredAction == l_MatchingAction) && 
+				(s_ControlTimerService.IsPending(m_StateTimer) == true))
 			{
 				break;
 			}
 
 			// We are about to change the state, so keep track of the old one.
 			auto const l_OldState = m_State;
+
+			// Account for the movement so far, while we still know how it was timed.
+			Time l_CurrentTime;
+			TimerGetCurrent(l_CurrentTime);
+			UpdatePosition(l_CurrentTime);
+
+			// Whatever happens next is timed in software.
+			m_PulseInHardware = false;
 			
 			if (m_DesiredAction == l_OppositeAction)
 			{
@@ -287,27 +844,25 @@ void Control::Process()
 					m_DownGPIOPin;
 				auto const l_NewStatePin = (m_State == STATE_MOVING_DOWN) ? m_DownGPIOPin : 
 					m_UpGPIOPin;
-				SetGPIOPinOff(l_OldStatePin);
-				SetGPIOPinOn(l_NewStatePin);
+				ControlsSetPinsOff(GPIOGetPinSet(l_OldStatePin));
+				ControlsSetPinsOn(GPIOGetPinSet(l_NewStatePin));
 			}
 			else
 			{
-				// Transition to cool down.
+				// Transition to cool down. Whatever was desired is over.
 				m_State = STATE_COOL_DOWN;
+				m_DesiredAction = ACTION_STOPPED;
 
 				// Set the pins to off.
-				SetGPIOPinOff(m_UpGPIOPin);
-				SetGPIOPinOff(m_DownGPIOPin);
+				ControlsSetPinsOff(GPIOGetPinSet(m_UpGPIOPin) | GPIOGetPinSet(m_DownGPIOPin));
 			}
 			
-			// Play the notification.
-			PlayNotification();
-			
 			// Record when the state transition timer began.
-			TimerGetCurrent(m_StateStartTime);
+			m_StateStartTime = l_CurrentTime;
+			StartTrackingMovement(m_StateStartTime);
+			ArmStateTimer((m_State == STATE_COOL_DOWN) ? ms_CoolDownDuration : m_MovingDuration);
 
-			LoggerAddMessage("Control \"%s\": State transition from \"%s\" to \"%s\" triggered.", 
-				m_Name, s_ControlStateNames[l_OldState], s_ControlStateNames[m_State]);
+			PostStateChange(l_OldState);
 		}
 		break;
 
@@ -316,14 +871,8 @@ void Control::Process()
 			// Clear the desired action.
 			m_DesiredAction = ACTION_STOPPED;
 
-			// Get elapsed time since state start.
-			Time l_CurrentTime;
-			TimerGetCurrent(l_CurrentTime);
-
-			auto const l_ElapsedTimeMS = TimerGetElapsedMilliseconds(m_StateStartTime, l_CurrentTime);
-
 			// Wait until the time limit has run out.
-			if (l_ElapsedTimeMS < ms_CoolDownDurationMS)
+			if (s_ControlTimerService.IsPending(m_StateTimer) == true)
 			{
 				break;
 			}
@@ -332,50 +881,553 @@ void Control::Process()
 			m_State = STATE_IDLE;
 
 			// Set the pins to off.
-			SetGPIOPinOff(m_UpGPIOPin);
-			SetGPIOPinOff(m_DownGPIOPin);
+			ControlsSetPinsOff(GPIOGetPinSet(m_UpGPIOPin) | GPIOGetPinSet(m_DownGPIOPin));
 
-			LoggerAddMessage("Control \"%s\": State transition from \"%s\" to \"%s\" triggered.", 
-				m_Name, s_ControlStateNames[STATE_COOL_DOWN], s_ControlStateNames[m_State]);
+			PostStateChange(STATE_COOL_DOWN);
 		}
 		break;
 
 		default:
 		{
-			LoggerAddMessage("Control \"%s\": Unrecognized state %d in Process()", m_State, m_Name);
+			// There is no logging on the control thread, so just get back to a known state.
+			auto const l_OldState = m_State;
+			m_State = STATE_IDLE;
+			m_PulseInHardware = false;
+			m_PositionKnown = false;
+			m_HasPendingMove = false;
+
+			ControlsSetPinsOff(GPIOGetPinSet(m_UpGPIOPin) | GPIOGetPinSet(m_DownGPIOPin));
+
+			PostStateChange(l_OldState);
 		}
 		break;
 	}
 }
 
-// Set the desired action.
+// Switch on the pin for a movement. Timed movements are handed to the GPIO hardware if it can time
+// them, so that they last exactly as long as they should. Only the control thread may call this.
+//
+// p_Pin:	The pin to switch on.
+//
+// Returns:	How long to wait before ending the movement in software.
+//
+Duration Control::StartMoving(int p_Pin)
+{
+	auto const l_Pins = GPIOGetPinSet(p_Pin);
+
+	m_PulseInHardware = false;
+
+	if (m_Mode == MODE_TIMED)
+	{
+		// Anything pending has to go out first, so that it doesn't cut the pulse short.
+		ControlsWritePins();
+
+		TraceScope l_TraceScope("GPIO pulse");
+
+		m_PulseInHardware = GPIOStartPulse(l_Pins, ControlsGetPinLevels(l_Pins, 0), 
+			ControlsGetPinLevels(0, l_Pins), m_MovingDuration);
+	}
+
+	if (m_PulseInHardware == true)
+	{
+		s_ControlStartedPulse = true;
+
+		// The hardware switches the pin off, so the state timer is only a backstop.
+		return m_MovingDuration + CONTROL_PULSE_GRACE_DURATION;
+	}
+
+	ControlsSetPinsOn(l_Pins);
+	return m_MovingDuration;
+}
+
+// Take over timing the current movement in software, if the GPIO hardware was timing it. Only the
+// control thread may call this.
+//
+// p_Pin:	The pin for the current movement.
+//
+void Control::StopHardwareTiming(int p_Pin)
+{
+	if (m_PulseInHardware == false)
+	{
+		return;
+	}
+
+	// Writing the pin again stops the pulse and leaves the pin on.
+	ControlsSetPinsOn(GPIOGetPinSet(p_Pin));
+	m_PulseInHardware = false;
+}
+
+// Start keeping track of a new movement. Only the control thread may call this.
+//
+// p_CurrentTime:	The current time.
+//
+void Control::StartTrackingMovement(Time const& p_CurrentTime)
+{
+	m_PositionTime = p_CurrentTime;
+	m_MovementRunDuration = Duration::zero();
+}
+
+// Move the estimated position along with however long the motor has run since it was last updated.
+// Only the control thread may call this.
+//
+// p_CurrentTime:	The current time.
+//
+void Control::UpdatePosition(Time const& p_CurrentTime)
+{
+	if ((m_State != STATE_MOVING_UP) && (m_State != STATE_MOVING_DOWN))
+	{
+		m_PositionTime = p_CurrentTime;
+		return;
+	}
+
+	// The hardware switches the pin off at the end of a pulse, even if we haven't caught up yet.
+	auto l_EndTime = p_CurrentTime;
+
+	if (m_PulseInHardware == true)
+	{
+		l_EndTime = std::min(l_EndTime, m_StateStartTime + m_MovingDuration);
+	}
+
+	if (l_EndTime > m_PositionTime)
+	{
+		auto const l_RunDuration = l_EndTime - m_PositionTime;
+		m_MovementRunDuration += l_RunDuration;
+
+		if (m_State == STATE_MOVING_UP)
+		{
+			m_Position = std::min(m_Position + l_RunDuration, m_StandardMovingDuration);
+		}
+		else
+		{
+			m_Position = std::max(m_Position - l_RunDuration, Duration::zero());
+		}
+
+		// Running the full travel one way has to end up at the end, wherever it started from.
+		if (m_MovementRunDuration >= m_StandardMovingDuration)
+		{
+			m_Position = (m_State == STATE_MOVING_UP) ? m_StandardMovingDuration : Duration::zero();
+			m_PositionKnown = true;
+		}
+	}
+
+	m_PositionTime = p_CurrentTime;
+}
+
+// Get the estimated position as a percentage.
+//
+// Returns:	The position, from 0 (all the way down) to 100 (all the way up) percent.
+//
+unsigned int Control::GetPositionPercent() const
+{
+	if (m_StandardMovingDuration <= Duration::zero())
+	{
+		return 0;
+	}
+
+	// Round to the nearest percent.
+	return static_cast<unsigned int>(((m_Position * 100) + (m_StandardMovingDuration / 2)) / 
+		m_StandardMovingDuration);
+}
+
+// Set the desired action. This sends the action to the control thread, which will act on it 
+// shortly.
 //
 // p_DesiredAction:		The desired action.
 // p_Mode:					The mode of the action.
+// p_Origin:				Where the request came from.
 // p_DurationPercent:	(Optional) The percent of the normal duration to perform the action 
 //								for.
 //
-void Control::SetDesiredAction(Actions p_DesiredAction, Modes p_Mode, 
+// Returns:					True if the action was sent, false if the control thread is too far behind to
+//								take it.
+//
+bool Control::SetDesiredAction(Actions p_DesiredAction, Modes p_Mode, ControlOrigin const& p_Origin,
 	unsigned int p_DurationPercent /* = 100 */)
 {
-	m_DesiredAction = p_DesiredAction;
-	m_Mode = p_Mode;
-	
-	if (m_Mode == MODE_TIMED) 
+	TraceScope l_TraceScope("Desired action set");
+
+	ControlCommand l_Command;
+	l_Command.m_Type = ControlCommand::TYPE_SET_DESIRED_ACTION;
+	l_Command.m_Handle = m_Handle;
+	l_Command.m_Action = p_DesiredAction;
+	l_Command.m_Mode = p_Mode;
+	l_Command.m_Origin = p_Origin;
+
+	// The durations don't change once the control thread is running, so we can work out the moving 
+	// duration here.
+	if (p_Mode == MODE_TIMED) 
 	{
 		// Set the current moving duration based on the requested percentage of the standard amount.
-		auto const l_DurationFraction = std::min(p_DurationPercent, 100u) / 100.0f;
-		m_MovingDurationMS = static_cast<unsigned int>(m_StandardMovingDurationMS * 
-			l_DurationFraction);
+		l_Command.m_MovingDuration = (m_StandardMovingDuration * std::min(p_DurationPercent, 100u)) / 
+			100;
 	}
 	else
 	{
-		m_MovingDurationMS = ms_MaxMovingDurationMS;
+		l_Command.m_MovingDuration = ms_MaxMovingDuration;
 	}
 
+	auto const l_MovingDurationUS = std::chrono::duration_cast<std::chrono::microseconds>(
+		l_Command.m_MovingDuration).count();
+
 	LoggerAddMessage("Control \"%s\": Setting desired action to \"%s\" with mode \"%s\" and "
-		"duration %i ms.", m_Name, s_ControlActionNames[p_DesiredAction], 
-		s_ControlModeNames[p_Mode], m_MovingDurationMS);
+		"duration %lld.%03lld ms.", m_Name, s_ControlActionNames[p_DesiredAction], 
+		s_ControlModeNames[p_Mode], static_cast<long long>(l_MovingDurationUS / 1000), 
+		static_cast<long long>(l_MovingDurationUS % 1000));
+
+	return ControlsSendCommand(l_Command);
+}
+
+// Set the desired action while a button is held. Only the input thread may call this. The action 
+// goes to the control thread on a queue of its own, so it doesn't wait behind the main thread, and a
+// stop is never dropped, so that letting go of a button always stops the control.
+//
+// p_DesiredAction:		The desired action.
+// p_Origin:				Where the request came from.
+//
+void Control::SetHeldAction(Actions p_DesiredAction, ControlOrigin const& p_Origin)
+{
+	TraceScope l_TraceScope("Held action set");
+
+	ControlCommand l_Command;
+	l_Command.m_Type = ControlCommand::TYPE_SET_DESIRED_ACTION;
+	l_Command.m_Handle = m_Handle;
+	l_Command.m_Action = p_DesiredAction;
+	l_Command.m_Mode = MODE_MANUAL;
+	l_Command.m_Origin = p_Origin;
+
+	// Holding a button still can't move a control for longer than this.
+	l_Command.m_MovingDuration = ms_MaxMovingDuration;
+
+	// Nothing is logged here, since logging takes a lock and writes the file. The main thread logs
+	// the action once the control thread reports it applied, and says if any were dropped.
+	if (ControlsSendInputCommand(l_Command) == false)
+	{
+		s_ControlDroppedInputCommandCount.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+// Set the desired position. This sends the position to the control thread, which will move the 
+// control from where it thinks it is to there.
+//
+// p_PositionPercent:	The desired position, from 0 (all the way down) to 100 (all the way up) 
+//								percent.
+// p_Origin:				Where the request came from.
+//
+// Returns:					True if the position was sent, false if the control thread is too far behind
+//								to take it.
+//
+bool Control::SetDesiredPosition(unsigned int p_PositionPercent, ControlOrigin const& p_Origin)
+{
+	TraceScope l_TraceScope("Desired position set");
+
+	ControlCommand l_Command;
+	l_Command.m_Type = ControlCommand::TYPE_SET_DESIRED_POSITION;
+	l_Command.m_Handle = m_Handle;
+	l_Command.m_Action = ACTION_STOPPED;
+	l_Command.m_Mode = MODE_TIMED;
+	l_Command.m_MovingDuration = Duration::zero();
+	l_Command.m_PositionPercent = std::min(p_PositionPercent, 100u);
+	l_Command.m_Origin = p_Origin;
+
+	LoggerAddMessage("Control \"%s\": Setting desired position to %u%%.", m_Name, 
+		l_Command.m_PositionPercent);
+
+	return ControlsSendCommand(l_Command);
+}
+
+// Act on a desired action. Only the control thread may call this.
+//
+// p_DesiredAction:	The desired action.
+// p_Mode:				The mode of the action.
+// p_MovingDuration:	How long to move for.
+//
+void Control::ApplyDesiredAction(Actions p_DesiredAction, Modes p_Mode, Duration p_MovingDuration)
+{
+	TraceScope l_TraceScope("Desired action applied");
+
+	// Account for the movement so far, before its timing changes.
+	Time l_CurrentTime;
+	TimerGetCurrent(l_CurrentTime);
+	UpdatePosition(l_CurrentTime);
+
+	// Any position we were on the way to has been overridden.
+	m_HasPendingMove = false;
+
+	m_DesiredAction = p_DesiredAction;
+	m_Mode = p_Mode;
+	m_MovingDuration = p_MovingDuration;
+
+	// If we are already moving, the time limit for the current movement has changed.
+	auto const l_OldState = m_State;
+
+	if ((m_State == STATE_MOVING_UP) || (m_State == STATE_MOVING_DOWN))
+	{
+		StopHardwareTiming((m_State == STATE_MOVING_UP) ? m_UpGPIOPin : m_DownGPIOPin);
+		ArmStateTimer(m_MovingDuration);
+	}
+
+	Process();
+
+	// A state change has already told the main thread about the new action and timing.
+	if (m_State == l_OldState)
+	{
+		PostStatusChange();
+	}
+}
+
+// Work out the movement that takes the control from its estimated position to a desired one. Only
+// the control thread may call this.
+//
+// p_RunDuration:			(Output) How long to move for.
+// p_PositionPercent:	The desired position.
+//
+// Returns:					The action to take, or stopped if the control is close enough already.
+//
+Control::Actions Control::PlanMove(Duration& p_RunDuration, unsigned int p_PositionPercent) const
+{
+	auto const l_TargetPosition = (m_StandardMovingDuration * p_PositionPercent) / 100;
+	auto const l_Distance = (l_TargetPosition > m_Position) ? (l_TargetPosition - m_Position) : 
+		(m_Position - l_TargetPosition);
+
+	if ((p_PositionPercent == 0) || (p_PositionPercent == 100))
+	{
+		// Going a little past the end puts us right on it, which also corrects any drift.
+		p_RunDuration = (m_PositionKnown == true) ? std::min(l_Distance + 
+			((m_StandardMovingDuration * CONTROL_END_OVERRUN_PERCENT) / 100), m_StandardMovingDuration) : 
+			m_StandardMovingDuration;
+
+		return (p_PositionPercent == 100) ? ACTION_MOVING_UP : ACTION_MOVING_DOWN;
+	}
+
+	if (m_PositionKnown == false)
+	{
+		// Find out where we are by going all the way to the end nearest the target first.
+		p_RunDuration = m_StandardMovingDuration;
+		return (p_PositionPercent < 50) ? ACTION_MOVING_DOWN : ACTION_MOVING_UP;
+	}
+
+	if ((l_Distance > CONTROL_POSITION_TOLERANCE) == false)
+	{
+		p_RunDuration = Duration::zero();
+		return ACTION_STOPPED;
+	}
+
+	p_RunDuration = l_Distance;
+	return (l_TargetPosition > m_Position) ? ACTION_MOVING_UP : ACTION_MOVING_DOWN;
+}
+
+// Act on a desired position. Only the control thread may call this.
+//
+// p_Action:				(Output) The action taken to get there.
+// p_MovingDuration:		(Output) How long the action moves for, counted from the start of the current
+//								movement.
+// p_PositionPercent:	The desired position.
+//
+void Control::ApplyDesiredPosition(Actions& p_Action, Duration& p_MovingDuration, 
+	unsigned int p_PositionPercent)
+{
+	TraceScope l_TraceScope("Desired position applied");
+
+	p_Action = ACTION_STOPPED;
+	p_MovingDuration = Duration::zero();
+
+	auto const l_PositionPercent = std::min(p_PositionPercent, 100u);
+	m_HasPendingMove = false;
+
+	// Nothing moves during cool down, so wait for it to end.
+	if (m_State == STATE_COOL_DOWN)
+	{
+		m_HasPendingMove = true;
+		m_PendingPositionPercent = l_PositionPercent;
+		m_PendingAction = ACTION_STOPPED;
+		return;
+	}
+
+	Time l_CurrentTime;
+	TimerGetCurrent(l_CurrentTime);
+	UpdatePosition(l_CurrentTime);
+
+	auto l_RunDuration = Duration::zero();
+	p_Action = PlanMove(l_RunDuration, l_PositionPercent);
+
+	// Close enough, so just stop if we are moving.
+	if (p_Action == ACTION_STOPPED)
+	{
+		if ((m_State == STATE_MOVING_UP) || (m_State == STATE_MOVING_DOWN))
+		{
+			ApplyDesiredAction(ACTION_STOPPED, m_Mode, Duration::zero());
+		}
+
+		return;
+	}
+
+	// Movements are timed from when they started, so keep going if we already are.
+	auto const l_MovingState = (p_Action == ACTION_MOVING_UP) ? STATE_MOVING_UP : STATE_MOVING_DOWN;
+	p_MovingDuration = l_RunDuration;
+
+	if (m_State == l_MovingState)
+	{
+		p_MovingDuration += l_CurrentTime - m_StateStartTime;
+	}
+
+	ApplyDesiredAction(p_Action, MODE_TIMED, p_MovingDuration);
+
+	// Finding the position was only the first leg.
+	if ((m_PositionKnown == false) && (l_PositionPercent > 0) && (l_PositionPercent < 100))
+	{
+		m_HasPendingMove = true;
+		m_PendingPositionPercent = l_PositionPercent;
+		m_PendingAction = ACTION_STOPPED;
+	}
+}
+
+// Get ready to move to a position when there is a motor free for it, stopping first if the control
+// is moving. Only the control thread may call this.
+//
+// p_PositionPercent:	The desired position.
+//
+void Control::QueueDesiredPosition(unsigned int p_PositionPercent)
+{
+	if (IsMoving() == true)
+	{
+		ApplyDesiredAction(ACTION_STOPPED, m_Mode, Duration::zero());
+	}
+
+	m_HasPendingMove = true;
+	m_PendingPositionPercent = std::min(p_PositionPercent, 100u);
+	m_PendingAction = ACTION_STOPPED;
+}
+
+// Get ready to take a timed action when there is a motor free for it. Only the control thread may
+// call this.
+//
+// p_DesiredAction:	The desired action.
+// p_MovingDuration:	How long to move for, once it starts.
+//
+void Control::QueueDesiredAction(Actions p_DesiredAction, Duration p_MovingDuration)
+{
+	m_HasPendingMove = true;
+	m_PendingAction = p_DesiredAction;
+	m_PendingMovingDuration = p_MovingDuration;
+}
+
+// Start the move the control is waiting for. Only the control thread may call this.
+//
+void Control::StartPendingMove()
+{
+	if (m_HasPendingMove == false)
+	{
+		return;
+	}
+
+	// Starting the action clears it.
+	if (m_PendingAction != ACTION_STOPPED)
+	{
+		ApplyDesiredAction(m_PendingAction, MODE_TIMED, m_PendingMovingDuration);
+		return;
+	}
+
+	auto l_Action = ACTION_STOPPED;
+	auto l_MovingDuration = Duration::zero();
+	ApplyDesiredPosition(l_Action, l_MovingDuration, m_PendingPositionPercent);
+}
+
+// Estimate how long the motor needs to run for the move the control is waiting to make. Only the
+// control thread may call this.
+//
+// Returns:	The total run time.
+//
+Duration Control::GetPendingMoveDuration() const
+{
+	if (m_HasPendingMove == false)
+	{
+		return Duration::zero();
+	}
+
+	if (m_PendingAction != ACTION_STOPPED)
+	{
+		return m_PendingMovingDuration;
+	}
+
+	auto l_RunDuration = Duration::zero();
+	PlanMove(l_RunDuration, m_PendingPositionPercent);
+
+	// Finding the position first means coming back from the end.
+	if ((m_PositionKnown == false) && (m_PendingPositionPercent > 0) && 
+		(m_PendingPositionPercent < 100))
+	{
+		auto const l_EndPercent = (m_PendingPositionPercent < 50) ? m_PendingPositionPercent : 
+			(100 - m_PendingPositionPercent);
+		l_RunDuration += (m_StandardMovingDuration * l_EndPercent) / 100;
+	}
+
+	return l_RunDuration;
+}
+
+// Get what the control is doing, as of the last report from the control thread. Only the main
+// thread may call this.
+//
+// p_Status:		(Output) The status.
+// p_CurrentTime:	The current time, used to count down the current state and to move the position
+//						along with a movement in progress.
+//
+void Control::GetStatus(ControlStatus& p_Status, Time const& p_CurrentTime) const
+{
+	p_Status.m_State = m_ReportedState;
+	p_Status.m_DesiredAction = m_ReportedDesiredAction;
+	p_Status.m_Mode = m_ReportedMode;
+	p_Status.m_PositionPercent = m_ReportedPositionPercent;
+	p_Status.m_PositionKnown = m_ReportedPositionKnown;
+
+	// Being idle has no time limit.
+	p_Status.m_StateRemainingDuration = Duration::zero();
+
+	if ((m_ReportedState != STATE_IDLE) && (m_ReportedStateEndTime > p_CurrentTime))
+	{
+		p_Status.m_StateRemainingDuration = m_ReportedStateEndTime - p_CurrentTime;
+	}
+
+	if (((m_ReportedState != STATE_MOVING_UP) && (m_ReportedState != STATE_MOVING_DOWN)) ||
+		(m_StandardMovingDuration <= Duration::zero()))
+	{
+		return;
+	}
+
+	// Move the position along with the movement, up to when it is due to end.
+	auto const l_EndTime = std::min(p_CurrentTime, m_ReportedStateEndTime);
+
+	if (l_EndTime <= m_ReportedPositionTime)
+	{
+		return;
+	}
+
+	auto const l_RunPercent = static_cast<unsigned int>(((l_EndTime - m_ReportedPositionTime) * 100) /
+		m_StandardMovingDuration);
+
+	if (m_ReportedState == STATE_MOVING_UP)
+	{
+		p_Status.m_PositionPercent = std::min(m_ReportedPositionPercent + l_RunPercent, 100u);
+	}
+	else
+	{
+		p_Status.m_PositionPercent = (m_ReportedPositionPercent > l_RunPercent) ? 
+			(m_ReportedPositionPercent - l_RunPercent) : 0;
+	}
+}
+
+// Remember what the control thread said the control was doing. Only the main thread may call this.
+//
+// p_Event:	The state change or status change event from the control thread.
+//
+void Control::SetReportedStatus(ControlEvent const& p_Event)
+{
+	m_ReportedState = p_Event.m_NewState;
+	m_ReportedDesiredAction = p_Event.m_DesiredAction;
+	m_ReportedMode = p_Event.m_Mode;
+	m_ReportedStateEndTime = p_Event.m_StateEndTime;
+	m_ReportedPositionPercent = p_Event.m_PositionPercent;
+	m_ReportedPositionKnown = p_Event.m_PositionKnown;
+	m_ReportedPositionTime = p_Event.m_PositionTime;
 }
 
 // Enable or disable all controls.
@@ -403,15 +1455,32 @@ void Control::Enable(bool p_Enable)
 
 // Set the durations.
 //
-// p_MovingDurationMS:		Duration of the moving state (in milliseconds).
-// p_CoolDownDurationMS:	Duration of the cool down state (in milliseconds).
+// p_MovingDuration:		Maximum duration of the moving state.
+// p_CoolDownDuration:	Duration of the cool down state.
 //
-void Control::SetDurations(unsigned int p_MovingDurationMS, unsigned int p_CoolDownDurationMS)
+void Control::SetDurations(Duration p_MovingDuration, Duration p_CoolDownDuration)
 {
-	ms_MaxMovingDurationMS = p_MovingDurationMS;
-	ms_CoolDownDurationMS = p_CoolDownDurationMS;
+	ms_MaxMovingDuration = p_MovingDuration;
+	ms_CoolDownDuration = p_CoolDownDuration;
 	
-	LoggerAddMessage("Control durations set to moving - %i ms, cool down - %i ms.", p_MovingDurationMS, p_CoolDownDurationMS);
+	LoggerAddMessage("Control durations set to moving - %lld ms, cool down - %lld ms.", 
+		static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+		p_MovingDuration).count()), 
+		static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+		p_CoolDownDuration).count()));
+}
+
+// Set how many controls may make timed movements or move to positions at the same time, so that the
+// power supply isn't overloaded. Held buttons aren't kept waiting, but do count. This must be called
+// before the control thread starts.
+//
+// p_MaxMovingControls:	The limit, or 0 for no limit.
+//
+void Control::SetMaxMovingControls(unsigned int p_MaxMovingControls)
+{
+	ms_MaxMovingControls = p_MaxMovingControls;
+
+	LoggerAddMessage("Controls moving at once limited to %u.", p_MaxMovingControls);
 }
 
 // Attempt to get the handle of a control based on its name.
@@ -468,23 +1537,67 @@ Control* Control::GetFromHandle(ControlHandle const& p_Handle)
 	return &(s_Controls[p_Handle.m_UID]);
 }
 		
-// Play a notification for the state.
+// Arm the timer for the current state, so that it ends after a duration since the state began.
+//
+// p_Duration:	The duration of the state.
 //
-void Control::PlayNotification()
+void Control::ArmStateTimer(Duration p_Duration)
 {
-	// Do not play a notification if the mode is manual.
-	if (m_Mode == MODE_MANUAL)
+	m_StateEndTime = m_StateStartTime + p_Duration;
+
+	// Process the control when the time runs out.
+	auto const l_Handle = m_Handle;
+	s_ControlTimerService.Arm(m_StateTimer, m_StateEndTime, [l_Handle]()
 	{
-		return;
-	}
-	
-	// Build the notification name.
-	static constexpr unsigned int l_NotificationNameCapacity = 128;
-	char l_NotificationName[l_NotificationNameCapacity];
-	snprintf(l_NotificationName, l_NotificationNameCapacity, "%s_%s", m_Name,
-		s_ControlStateNotificationNames[m_State]);
+		auto* const l_Control = GetFromHandle(l_Handle);
+
+		if (l_Control != nullptr)
+		{
+			l_Control->Process();
+		}
+	});
+}
+
+// Let the main thread know that the state changed, so that it can be logged and notified.
+//
+// p_OldState:	The state before the change.
+//
+void Control::PostStateChange(State p_OldState)
+{
+	ControlEvent l_Event;
+	GetStatusEvent(l_Event);
+	l_Event.m_Type = ControlEvent::TYPE_STATE_CHANGED;
+	l_Event.m_OldState = p_OldState;
+
+	ControlsPostEvent(l_Event);
+}
 
-	NotificationPlay(l_NotificationName);
+// Let the main thread know what the control is doing, when that changed without the state changing.
+//
+void Control::PostStatusChange()
+{
+	ControlEvent l_Event;
+	GetStatusEvent(l_Event);
+
+	ControlsPostEvent(l_Event);
+}
+
+// Fill in what the control is doing, for the main thread.
+//
+// p_Event:	(Output) The event to fill in.
+//
+void Control::GetStatusEvent(ControlEvent& p_Event) const
+{
+	p_Event.m_Type = ControlEvent::TYPE_STATUS_CHANGED;
+	p_Event.m_Handle = m_Handle;
+	p_Event.m_OldState = m_State;
+	p_Event.m_NewState = m_State;
+	p_Event.m_Mode = m_Mode;
+	p_Event.m_DesiredAction = m_DesiredAction;
+	p_Event.m_StateEndTime = m_StateEndTime;
+	p_Event.m_PositionPercent = GetPositionPercent();
+	p_Event.m_PositionKnown = m_PositionKnown;
+	p_Event.m_PositionTime = m_PositionTime;
 }
 
 // ControlAction members
@@ -650,22 +1763,598 @@ Control* ControlAction::GetControl()
 // Functions
 //
 
+// Close an eventfd or timerfd, if it is open.
+//
+// p_FileDescriptor:	(Input/Output) The file descriptor to close. It is set to -1.
+//
+static void ControlsCloseFileDescriptor(int& p_FileDescriptor)
+{
+	if (p_FileDescriptor < 0)
+	{
+		return;
+	}
+
+	close(p_FileDescriptor);
+	p_FileDescriptor = -1;
+}
+
+// Read the count out of an eventfd or timerfd, so that it stops being readable.
+//
+// p_FileDescriptor:	The file descriptor to drain.
+//
+static void ControlsDrainFileDescriptor(int p_FileDescriptor)
+{
+	uint64_t l_Count = 0;
+	read(p_FileDescriptor, &l_Count, sizeof(l_Count));
+}
+
+// Count the controls whose motors are running. Only the control thread may call this.
+//
+// Returns:	The number of controls.
+//
+static unsigned int ControlsGetMovingControlCount()
+{
+	unsigned int l_MovingControlCount = 0;
+
+	for (auto const& l_Control : s_Controls)
+	{
+		if (l_Control.IsMoving() == true)
+		{
+			l_MovingControlCount++;
+		}
+	}
+
+	return l_MovingControlCount;
+}
+
+// Determine whether a control may start moving now, or has to wait for a motor to be free. Only the
+// control thread may call this.
+//
+// p_Control:	The control.
+//
+// Returns:		True if the control is already moving or there is a motor free, false otherwise.
+//
+static bool ControlsCanStartMoving(Control const& p_Control)
+{
+	auto const l_MaxMovingControls = Control::GetMaxMovingControls();
+
+	return (l_MaxMovingControls == 0) || (p_Control.IsMoving() == true) || 
+		(ControlsGetMovingControlCount() < l_MaxMovingControls);
+}
+
+// Start controls making the moves they are waiting for, as long as there are motors free. The ones
+// with the furthest to go start first, so that the slowest sets the total time. Only the control
+// thread may call this.
+//
+static void ControlsStartPendingMoves()
+{
+	auto const l_MaxMovingControls = Control::GetMaxMovingControls();
+	auto l_MovingControlCount = ControlsGetMovingControlCount();
+
+	while ((l_MaxMovingControls == 0) || (l_MovingControlCount < l_MaxMovingControls))
+	{
+		// Find the waiting control with the longest way to go.
+		Control* l_NextControl = nullptr;
+		auto l_NextMoveDuration = Duration::zero();
+
+		for (auto& l_Control : s_Controls)
+		{
+			if (l_Control.IsWaitingToMove() == false)
+			{
+				continue;
+			}
+
+			auto const l_MoveDuration = l_Control.GetPendingMoveDuration();
+
+			if ((l_NextControl == nullptr) || (l_MoveDuration > l_NextMoveDuration))
+			{
+				l_NextControl = &l_Control;
+				l_NextMoveDuration = l_MoveDuration;
+			}
+		}
+
+		if (l_NextControl == nullptr)
+		{
+			break;
+		}
+
+		// It may already be where it needs to be.
+		l_NextControl->StartPendingMove();
+
+		if (l_NextControl->IsMoving() == true)
+		{
+			l_MovingControlCount++;
+		}
+	}
+}
+
+// Act on all of the commands from another thread. Only the control thread may call this.
+//
+// p_Queue:	The queue the commands come from.
+//
+// Returns:	How many commands were taken off the queue.
+//
+static unsigned int ControlsHandleCommands(ControlCommandQueue& p_Queue)
+{
+	ControlCommand l_Command;
+	unsigned int l_HandledCount = 0;
+
+	while (p_Queue.Pop(l_Command) == true)
+	{
+		l_HandledCount++;
+
+		auto l_Queued = false;
+
+		switch (l_Command.m_Type)
+		{
+			case ControlCommand::TYPE_SET_DESIRED_ACTION:
+			{
+				auto* const l_Control = Control::GetFromHandle(l_Command.m_Handle);
+
+				if (l_Control == nullptr)
+				{
+					continue;
+				}
+
+				// Timed movements count against the limit on motors running at once, so that a command 
+				// that moves several controls doesn't overload the power supply. Held buttons go 
+				// straight through.
+				if ((l_Command.m_Mode == Control::MODE_TIMED) && 
+					(l_Command.m_Action != Control::ACTION_STOPPED) && 
+					(ControlsCanStartMoving(*l_Control) == false))
+				{
+					l_Control->QueueDesiredAction(l_Command.m_Action, l_Command.m_MovingDuration);
+					l_Queued = true;
+					break;
+				}
+
+				l_Control->ApplyDesiredAction(l_Command.m_Action, l_Command.m_Mode, 
+					l_Command.m_MovingDuration);
+			}
+			break;
+
+			case ControlCommand::TYPE_SET_DESIRED_POSITION:
+			{
+				auto* const l_Control = Control::GetFromHandle(l_Command.m_Handle);
+
+				if (l_Control == nullptr)
+				{
+					continue;
+				}
+
+				// Wait for a motor to be free, like a timed movement.
+				if (ControlsCanStartMoving(*l_Control) == false)
+				{
+					l_Control->QueueDesiredPosition(l_Command.m_PositionPercent);
+					l_Queued = true;
+					break;
+				}
+
+				// Report the movement it turned into.
+				l_Control->ApplyDesiredPosition(l_Command.m_Action, l_Command.m_MovingDuration, 
+					l_Command.m_PositionPercent);
+			}
+			break;
+
+			case ControlCommand::TYPE_SET_POSTURE:
+			{
+				for (unsigned int l_TargetIndex = 0; l_TargetIndex < l_Command.m_PostureTargetCount; 
+					l_TargetIndex++)
+				{
+					auto const& l_Target = l_Command.m_PostureTargets[l_TargetIndex];
+					auto* const l_Control = Control::GetFromHandle(l_Target.m_Handle);
+
+					if (l_Control == nullptr)
+					{
+						continue;
+					}
+
+					l_Control->QueueDesiredPosition(l_Target.m_PositionPercent);
+				}
+
+				ControlsStartPendingMoves();
+			}
+			break;
+
+			case ControlCommand::TYPE_STOP_ALL:
+			{
+				for (auto& l_Control : s_Controls)
+				{
+					l_Control.ApplyDesiredAction(l_Command.m_Action, l_Command.m_Mode, 
+						l_Command.m_MovingDuration);
+				}
+			}
+			break;
+
+			default:
+			{
+				continue;
+			}
+		}
+
+		// Every pin this command changed is written at once, unless it started a pulse.
+		auto const l_DrovePins = (ControlsWritePins() == true) || (s_ControlStartedPulse == true);
+		s_ControlStartedPulse = false;
+
+		// Let the main thread know how long it took, from start to finish.
+		ControlEvent l_Event;
+		l_Event.m_Type = ControlEvent::TYPE_COMMAND_APPLIED;
+		l_Event.m_Handle = l_Command.m_Handle;
+		l_Event.m_Action = l_Command.m_Action;
+		l_Event.m_Mode = l_Command.m_Mode;
+		l_Event.m_Origin = l_Command.m_Origin;
+		l_Event.m_SetTime = l_Command.m_SetTime;
+		TimerGetCurrent(l_Event.m_AppliedTime);
+		l_Event.m_MovingDuration = l_Command.m_MovingDuration;
+		l_Event.m_DrovePins = l_DrovePins;
+		l_Event.m_Queued = l_Queued;
+
+		ControlsPostEvent(l_Event);
+	}
+
+	return l_HandledCount;
+}
+
+// Do one round of the control thread's work: act on commands, end any states whose time is up, and
+// write the pins.
+//
+static void ControlsDoWork()
+{
+	// Buttons go first, since a button being let go is the most urgent thing there is.
+	ControlsHandleCommands(s_ControlInputCommandQueue);
+	auto const l_HandledCount = ControlsHandleCommands(s_ControlCommandQueue);
+
+	// Ending a movement may free up a motor for a control that is waiting.
+	s_ControlTimerService.Process();
+	ControlsStartPendingMoves();
+
+	ControlsWritePins();
+	s_ControlStartedPulse = false;
+
+	// Only now that everything the commands did has been reported can they count as handled. The
+	// main thread is woken for them even if they reported nothing, since it may be waiting on them.
+	if (l_HandledCount > 0)
+	{
+		s_ControlCommandHandledCount.fetch_add(l_HandledCount, std::memory_order_release);
+		s_ControlEventWakePending = true;
+	}
+
+	ControlsWakeForEvents();
+}
+
+// The control thread. It sleeps until there are commands or a state timer is due, and does nothing
+// but drive the relays, so that nothing else the program does can delay them.
+//
+static void ControlsThreadMain()
+{
+	TraceSetThreadName("control");
+
+	pollfd l_PollFileDescriptors[2];
+	memset(l_PollFileDescriptors, 0, sizeof(l_PollFileDescriptors));
+
+	l_PollFileDescriptors[0].fd = s_ControlCommandEventFileDescriptor;
+	l_PollFileDescriptors[0].events = POLLIN;
+	l_PollFileDescriptors[1].fd = s_ControlTimerFileDescriptor;
+	l_PollFileDescriptors[1].events = POLLIN;
+
+	while (s_ControlThreadQuit.load(std::memory_order_acquire) == false)
+	{
+		// Arm the timer for the earliest deadline, or disarm it if there are no pending timers.
+		itimerspec l_TimerSpec;
+		memset(&l_TimerSpec, 0, sizeof(l_TimerSpec));
+
+		Time l_Deadline;
+		auto const l_HasDeadline = s_ControlTimerService.GetNextDeadline(l_Deadline);
+
+		if (l_HasDeadline == true)
+		{
+			auto const l_DeadlineNS = l_Deadline.time_since_epoch().count();
+			l_TimerSpec.it_value.tv_sec = l_DeadlineNS / 1000000000;
+			l_TimerSpec.it_value.tv_nsec = l_DeadlineNS % 1000000000;
+
+			// A zero value would disarm the timer instead of firing it right away.
+			if ((l_TimerSpec.it_value.tv_sec == 0) && (l_TimerSpec.it_value.tv_nsec == 0))
+			{
+				l_TimerSpec.it_value.tv_nsec = 1;
+			}
+		}
+
+		timerfd_settime(s_ControlTimerFileDescriptor, TFD_TIMER_ABSTIME, &l_TimerSpec, nullptr);
+
+		Time l_WaitTime;
+		TimerGetCurrent(l_WaitTime);
+
+		poll(l_PollFileDescriptors, 2, -1);
+
+		Time l_WakeTime;
+		TimerGetCurrent(l_WakeTime);
+
+		// If we were sleeping until a timer, let the main thread know how late we woke up for it.
+		if ((l_HasDeadline == true) && (l_Deadline > l_WaitTime) && ((l_Deadline > l_WakeTime) == false))
+		{
+			ControlEvent l_Event;
+			l_Event.m_Type = ControlEvent::TYPE_WAKE_LATENCY;
+			l_Event.m_WakeLatency = l_WakeTime - l_Deadline;
+
+			ControlsPostEvent(l_Event);
+		}
+
+		if ((l_PollFileDescriptors[0].revents & POLLIN) != 0)
+		{
+			ControlsDrainFileDescriptor(s_ControlCommandEventFileDescriptor);
+		}
+
+		if ((l_PollFileDescriptors[1].revents & POLLIN) != 0)
+		{
+			ControlsDrainFileDescriptor(s_ControlTimerFileDescriptor);
+		}
+
+		ControlsDoWork();
+	}
+}
+
+// Play a notification for a control's new state.
+//
+// p_Control:	The control.
+// p_Event:		The state change event.
+//
+static void ControlsPlayNotification(Control const& p_Control, ControlEvent const& p_Event)
+{
+	// Do not play a notification if the mode is manual.
+	if (p_Event.m_Mode == Control::MODE_MANUAL)
+	{
+		return;
+	}
+
+	// Nothing to say about becoming idle.
+	if (p_Event.m_NewState == Control::STATE_IDLE)
+	{
+		return;
+	}
+	
+	// Build the notification name.
+	static constexpr unsigned int l_NotificationNameCapacity = 128;
+	char l_NotificationName[l_NotificationNameCapacity];
+	snprintf(l_NotificationName, l_NotificationNameCapacity, "%s_%s", p_Control.GetName(),
+		s_ControlStateNotificationNames[p_Event.m_NewState]);
+
+	// Controls that change state together are announced together, once all of the events are in.
+	s_ControlPendingNotificationIDs.emplace_back(l_NotificationName);
+}
+
+// Convert a duration to microseconds for logging.
+//
+// p_Duration:	The duration.
+//
+// Returns:		The duration in microseconds.
+//
+static long long ControlsGetMicroseconds(Duration p_Duration)
+{
+	return static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(
+		p_Duration).count());
+}
+
+// Measure and record how long a command took to act on.
+//
+// p_ControlName:	The name of the control, or "all".
+// p_Event:			The command applied event.
+//
+static void ControlsRecordCommandLatency(char const* p_ControlName, ControlEvent const& p_Event)
+{
+	auto const& l_Origin = p_Event.m_Origin;
+
+	if ((l_Origin.m_Source < 0) || (l_Origin.m_Source >= ControlOrigin::NUM_SOURCES))
+	{
+		return;
+	}
+
+	auto const l_Latency = p_Event.m_AppliedTime - l_Origin.m_ArrivalTime;
+	auto const l_ControlLatency = p_Event.m_AppliedTime - p_Event.m_SetTime;
+
+	StatsRecord(s_ControlSourceLatencyProbes[l_Origin.m_Source], l_Latency);
+
+	auto const l_LatencyUS = ControlsGetMicroseconds(l_Latency);
+	auto const l_ControlLatencyUS = ControlsGetMicroseconds(l_ControlLatency);
+
+	LoggerAddMessage("Control \"%s\": %s \"%s\" from %s %lld.%03lld ms after it arrived "
+		"(%lld.%03lld ms after it was set).", p_ControlName, 
+		(p_Event.m_DrovePins == true) ? "Acted on" : "Took", s_ControlActionNames[p_Event.m_Action], 
+		s_ControlSourceNames[l_Origin.m_Source], l_LatencyUS / 1000, l_LatencyUS % 1000, 
+		l_ControlLatencyUS / 1000, l_ControlLatencyUS % 1000);
+
+	// Every button press and release would be an item, so only report requests from elsewhere.
+	if ((l_Origin.m_Source == ControlOrigin::SOURCE_INTERNAL) || 
+		(l_Origin.m_Source == ControlOrigin::SOURCE_BUTTON))
+	{
+		return;
+	}
+
+	ReportsAddControlItem(p_ControlName, p_Event.m_Action, 
+		s_ControlSourceNames[l_Origin.m_Source], l_Latency);
+}
+
+// Handle an event from the control thread.
+//
+// p_Event:	The event.
+//
+static void ControlsHandleEvent(ControlEvent const& p_Event)
+{
+	switch (p_Event.m_Type)
+	{
+		case ControlEvent::TYPE_STATE_CHANGED:
+		{
+			auto* l_Control = Control::GetFromHandle(p_Event.m_Handle);
+
+			if (l_Control == nullptr)
+			{
+				break;
+			}
+
+			l_Control->SetReportedStatus(p_Event);
+
+			ControlsPlayNotification(*l_Control, p_Event);
+
+			LoggerAddMessage("Control \"%s\": State transition from \"%s\" to \"%s\" triggered.", 
+				l_Control->GetName(), s_ControlStateNames[p_Event.m_OldState], 
+				s_ControlStateNames[p_Event.m_NewState]);
+
+			// Say where it ended up once it stops.
+			if (p_Event.m_NewState == Control::STATE_COOL_DOWN)
+			{
+				LoggerAddMessage("Control \"%s\": Estimated position is %u%%%s.", l_Control->GetName(), 
+					p_Event.m_PositionPercent, (p_Event.m_PositionKnown == true) ? "" : 
+					" (not found yet)");
+			}
+		}
+		break;
+
+		case ControlEvent::TYPE_STATUS_CHANGED:
+		{
+			auto* l_Control = Control::GetFromHandle(p_Event.m_Handle);
+
+			if (l_Control != nullptr)
+			{
+				l_Control->SetReportedStatus(p_Event);
+			}
+		}
+		break;
+
+		case ControlEvent::TYPE_WAKE_LATENCY:
+		{
+			StatsRecord(STATS_PROBE_CONTROL_WAKE_LATENCY, p_Event.m_WakeLatency);
+		}
+		break;
+
+		case ControlEvent::TYPE_COMMAND_APPLIED:
+		{
+			// Commands without a control were for all of them.
+			auto const* l_Control = Control::GetFromHandle(p_Event.m_Handle);
+
+			// Held actions are logged here rather than by the input thread that set them.
+			if ((l_Control != nullptr) && (p_Event.m_Origin.m_Source == ControlOrigin::SOURCE_BUTTON))
+			{
+				LoggerAddMessage("Control \"%s\": Set held action to \"%s\".", l_Control->GetName(), 
+					s_ControlActionNames[p_Event.m_Action]);
+			}
+
+			ControlsRecordCommandLatency((l_Control != nullptr) ? l_Control->GetName() : "all", 
+				p_Event);
+
+			// A move that is waiting for a motor starts later on its own, like the moves of a posture.
+			if ((l_Control != nullptr) && (p_Event.m_Queued == true))
+			{
+				LoggerAddMessage("Control \"%s\": Waiting for a motor to be free.", l_Control->GetName());
+				break;
+			}
+
+			if (s_ControlCommandAppliedCallback)
+			{
+				s_ControlCommandAppliedCallback(l_Control, p_Event.m_Action, p_Event.m_Mode, 
+					p_Event.m_MovingDuration, p_Event.m_Origin);
+			}
+		}
+		break;
+
+		default:
+		break;
+	}
+}
+
 // Initialize all of the controls.
 //
+// p_Configs:				Configuration parameters for the controls to add.
+// p_RealtimeConfig:	How to configure the control thread for real-time.
+//
+// Returns:					True if successful, false otherwise.
+//
+bool ControlsInitialize(std::vector<ControlConfig> const& p_Configs, 
+	RealtimeConfig const& p_RealtimeConfig)
+{
+	s_ControlCommandSentCount = 0;
+	s_ControlCommandHandledCount.store(0, std::memory_order_relaxed);
+
+	// Without these, there is no control thread to carry out commands, so give up before creating 
+	// any controls.
+	s_ControlCommandEventFileDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	s_ControlEventEventFileDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	s_ControlTimerFileDescriptor = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if ((s_ControlCommandEventFileDescriptor < 0) || (s_ControlEventEventFileDescriptor < 0) || 
+		(s_ControlTimerFileDescriptor < 0))
+	{
+		LoggerAddMessage("Failed to create the control thread's file descriptors.");
+
+		ControlsCloseFileDescriptor(s_ControlCommandEventFileDescriptor);
+		ControlsCloseFileDescriptor(s_ControlEventEventFileDescriptor);
+		ControlsCloseFileDescriptor(s_ControlTimerFileDescriptor);
+		return false;
+	}
+
+	// Handle events as soon as they come in.
+	if (ReactorAddFileDescriptor(s_ControlEventEventFileDescriptor, []()
+		{
+			ControlsDrainFileDescriptor(s_ControlEventEventFileDescriptor);
+			ControlsProcess();
+		}) == false)
+	{
+		LoggerAddMessage("Failed to watch for events from the control thread.");
+
+		ControlsCloseFileDescriptor(s_ControlCommandEventFileDescriptor);
+		ControlsCloseFileDescriptor(s_ControlEventEventFileDescriptor);
+		ControlsCloseFileDescriptor(s_ControlTimerFileDescriptor);
+		return false;
+	}
+
+	for (auto const& l_Config : p_Configs)
+	{
+		ControlsCreateControl(l_Config);
+	}
+
+	s_ControlThreadQuit.store(false, std::memory_order_release);
+	s_ControlThread = std::thread(ControlsThreadMain);
+
+	if (p_RealtimeConfig.m_Enabled == true)
+	{
+		RealtimeConfigureThread(s_ControlThread.native_handle(), p_RealtimeConfig);
+	}
+
+	return true;
+}
+
+// Initialize all of the controls without a control thread. The caller does the control thread's 
+// work by calling ControlsStep instead, so that the controls can run on virtual time.
+//
 // p_Configs:	Configuration parameters for the controls to add.
 //
-void ControlsInitialize(std::vector<ControlConfig> const& p_Configs)
+void ControlsInitializeStepped(std::vector<ControlConfig> const& p_Configs)
 {
 	for (auto const& l_Config : p_Configs)
 	{
 		ControlsCreateControl(l_Config);
 	}
+
+	s_ControlsStepped = true;
 }
 
 // Uninitialize all of the controls.
 //
 void ControlsUninitialize()
 {
+	s_ControlCommandBatchDepth = 0;
+	s_ControlCommandBatchSent = false;
+	s_ControlCommandBatchDropped = false;
+
+	// Stop the control thread before touching the controls.
+	if (s_ControlThread.joinable() == true)
+	{
+		s_ControlThreadQuit.store(true, std::memory_order_release);
+
+		uint64_t const l_Increment = 1;
+		write(s_ControlCommandEventFileDescriptor, &l_Increment, sizeof(l_Increment));
+
+		s_ControlThread.join();
+	}
+
 	for (auto& l_Control : s_Controls)
 	{
 		l_Control.Uninitialize();
@@ -673,16 +2362,176 @@ void ControlsUninitialize()
 	
 	// Get rid of all of the controls.
 	s_Controls.clear();
+	s_ControlPostures.clear();
+	s_ControlPendingNotificationIDs.clear();
+
+	if (s_ControlEventEventFileDescriptor >= 0)
+	{
+		ReactorRemoveFileDescriptor(s_ControlEventEventFileDescriptor);
+	}
+
+	ControlsCloseFileDescriptor(s_ControlEventEventFileDescriptor);
+	ControlsCloseFileDescriptor(s_ControlCommandEventFileDescriptor);
+	ControlsCloseFileDescriptor(s_ControlTimerFileDescriptor);
+
+	s_ControlsStepped = false;
+}
+
+// Do the control thread's work on the calling thread, then handle everything it reported back. This
+// is only for controls initialized with ControlsInitializeStepped.
+//
+void ControlsStep()
+{
+	if (s_ControlsStepped == false)
+	{
+		return;
+	}
+
+	ControlsDoWork();
+	ControlsProcess();
+}
+
+// Get when ControlsStep next needs to be called for a state to end. This is only for controls 
+// initialized with ControlsInitializeStepped.
+//
+// p_Deadline:	(Output) The earliest deadline.
+//
+// Returns:		True if any control is waiting on a deadline, false otherwise.
+//
+bool ControlsGetNextDeadline(Time& p_Deadline)
+{
+	if (s_ControlsStepped == false)
+	{
+		return false;
+	}
+
+	return s_ControlTimerService.GetNextDeadline(p_Deadline);
+}
+
+// Set the function to call for each command the control thread has applied.
+//
+// p_Callback:	The function, or an empty one for none.
+//
+void ControlsSetCommandAppliedCallback(ControlCommandAppliedCallback const& p_Callback)
+{
+	s_ControlCommandAppliedCallback = p_Callback;
+}
+
+// Determine which pins are switched on.
+//
+// p_Pins:		The pins.
+// p_Levels:	The level of each pin, high if its bit is set and low otherwise.
+//
+// Returns:		The pins that are switched on.
+//
+GPIOPinSet ControlsGetOnPins(GPIOPinSet p_Pins, GPIOPinSet p_Levels)
+{
+	return p_Pins & ((CONTROL_ON_GPIO_VALUE != 0) ? p_Levels : ~p_Levels);
 }
 
-// Process all of the controls.
+// Handle everything the control thread has reported back, such as state changes.
 //
 void ControlsProcess()
 {
-	for (auto& l_Control : s_Controls)
+	ControlEvent l_Event;
+
+	while (s_ControlEventQueue.Pop(l_Event) == true)
 	{
-		l_Control.Process();
-	}	
+		ControlsHandleEvent(l_Event);
+	}
+
+	// Announce the state changes together, such as all of the controls that a compound command moved.
+	if (s_ControlPendingNotificationIDs.empty() == false)
+	{
+		NotificationPlay(s_ControlPendingNotificationIDs);
+		s_ControlPendingNotificationIDs.clear();
+	}
+
+	// Mention it if the control thread couldn't tell us everything.
+	auto const l_DroppedEventCount = s_ControlDroppedEventCount.exchange(0, 
+		std::memory_order_relaxed);
+
+	if (l_DroppedEventCount > 0)
+	{
+		LoggerAddMessage("Dropped %u control events because the event queue was full.", 
+			l_DroppedEventCount);
+	}
+
+	auto const l_DroppedInputCommandCount = s_ControlDroppedInputCommandCount.exchange(0, 
+		std::memory_order_relaxed);
+
+	if (l_DroppedInputCommandCount > 0)
+	{
+		LoggerAddMessage("Dropped %u held actions because the input command queue was full.", 
+			l_DroppedInputCommandCount);
+	}
+}
+
+// Wait for the control thread to handle every command sent so far, then handle everything it 
+// reported back, so that what the controls report includes those commands. The control thread 
+// normally takes microseconds, but this gives up after a while rather than stall the main thread.
+// Only the main thread may call this.
+//
+// Returns:	True if every command was handled, false if it gave up waiting.
+//
+bool ControlsFlushCommands()
+{
+	// Without a thread, do its work now, as it would have.
+	if (s_ControlsStepped == true)
+	{
+		ControlsStep();
+		return true;
+	}
+
+	if (s_ControlThread.joinable() == false)
+	{
+		return false;
+	}
+
+	// Commands held back by a batch have to be handed over to be handled.
+	if (s_ControlCommandBatchSent == true)
+	{
+		s_ControlCommandBatchSent = false;
+		ControlsWakeForCommand();
+	}
+
+	Time l_StartTime;
+	TimerGetCurrent(l_StartTime);
+
+	auto l_Flushed = true;
+
+	// The control thread wakes us after handling commands, so sleep until it does rather than spin.
+	while (s_ControlCommandHandledCount.load(std::memory_order_acquire) != s_ControlCommandSentCount)
+	{
+		Time l_CurrentTime;
+		TimerGetCurrent(l_CurrentTime);
+
+		auto const l_ElapsedMS = std::chrono::duration_cast<std::chrono::milliseconds>(
+			l_CurrentTime - l_StartTime).count();
+
+		if (l_ElapsedMS >= CONTROL_FLUSH_TIMEOUT_MS)
+		{
+			l_Flushed = false;
+			break;
+		}
+
+		pollfd l_PollFileDescriptor;
+		l_PollFileDescriptor.fd = s_ControlEventEventFileDescriptor;
+		l_PollFileDescriptor.events = POLLIN;
+		l_PollFileDescriptor.revents = 0;
+
+		auto const l_RemainingMS = static_cast<int>(CONTROL_FLUSH_TIMEOUT_MS - l_ElapsedMS);
+
+		if (poll(&l_PollFileDescriptor, 1, l_RemainingMS) > 0)
+		{
+			// Handle what has been reported so far, since the reactor won't see this wake.
+			ControlsDrainFileDescriptor(s_ControlEventEventFileDescriptor);
+			ControlsProcess();
+		}
+	}
+
+	ControlsProcess();
+	return l_Flushed;
 }
 
 // Create a new control with the provided config. Control names must be unique.
@@ -710,12 +2559,195 @@ bool ControlsCreateControl(ControlConfig const& p_Config)
 	return true;
 }
 
-// Stop all of the controls.
+// Start a batch of commands. Commands sent until the batch ends are held back, then handed to the 
+// control thread together, so that it acts on all of them at once. Batches may be nested.
 //
-void ControlsStopAll()
+void ControlsBeginCommandBatch()
 {
-	for (auto& l_Control : s_Controls)
+	s_ControlCommandBatchDepth++;
+}
+
+// End a batch of commands, waking the control thread for them if it was the outermost batch.
+//
+// Returns:	True if every command sent since the outermost batch began was sent, false if any were
+//				dropped.
+//
+bool ControlsEndCommandBatch()
+{
+	if (s_ControlCommandBatchDepth == 0)
+	{
+		return true;
+	}
+
+	s_ControlCommandBatchDepth--;
+
+	auto const l_AllSent = (s_ControlCommandBatchDropped == false);
+
+	if (s_ControlCommandBatchDepth > 0)
+	{
+		return l_AllSent;
+	}
+
+	s_ControlCommandBatchDropped = false;
+
+	if (s_ControlCommandBatchSent == true)
+	{
+		s_ControlCommandBatchSent = false;
+		ControlsWakeForCommand();
+	}
+
+	return l_AllSent;
+}
+
+// Stop all of the controls. This waits for the control thread to make room for the stop, if it has
+// to.
+//
+// p_Origin:	Where the request came from.
+//
+// Returns:		True if the stop was sent, false if there is no control thread to take it.
+//
+bool ControlsStopAll(ControlOrigin const& p_Origin)
+{
+	LoggerAddMessage("Stopping all controls.");
+
+	// Send a single command, so that every pin is switched off in the same write.
+	ControlCommand l_Command;
+	l_Command.m_Type = ControlCommand::TYPE_STOP_ALL;
+	l_Command.m_Action = Control::ACTION_STOPPED;
+	l_Command.m_Mode = Control::MODE_MANUAL;
+	l_Command.m_Origin = p_Origin;
+
+	// Stopping doesn't move, so there is no moving duration.
+	l_Command.m_MovingDuration = Duration::zero();
+
+	return ControlsSendCommand(l_Command);
+}
+
+// Set the postures that the controls can be moved to.
+//
+// p_Configs:	The postures.
+//
+void ControlsSetPostures(std::vector<ControlPostureConfig> const& p_Configs)
+{
+	s_ControlPostures = p_Configs;
+
+	for (auto const& l_Posture : s_ControlPostures)
 	{
-		l_Control.SetDesiredAction(Control::ACTION_STOPPED, Control::MODE_MANUAL);
+		LoggerAddMessage("Added posture \"%s\" with %u positions.", l_Posture.m_Name, 
+			static_cast<unsigned int>(l_Posture.m_Positions.size()));
 	}
 }
+
+// Look up a posture by name, regardless of case.
+//
+// p_Name:	The name of the posture.
+//
+// Returns:	The index of the posture, or -1 if there isn't one with that name.
+//
+int ControlsGetPostureIndex(std::string_view p_Name)
+{
+	auto const l_PostureCount = static_cast<int>(s_ControlPostures.size());
+
+	for (int l_PostureIndex = 0; l_PostureIndex < l_PostureCount; l_PostureIndex++)
+	{
+		auto const* l_PostureName = s_ControlPostures[l_PostureIndex].m_Name;
+
+		if ((strlen(l_PostureName) == p_Name.size()) && 
+			(strncasecmp(l_PostureName, p_Name.data(), p_Name.size()) == 0))
+		{
+			return l_PostureIndex;
+		}
+	}
+
+	return -1;
+}
+
+// Move every control in a posture to its position. The controls that have the furthest to go start
+// first, and as many move at once as the limit allows, so that the posture is reached as soon as 
+// possible.
+//
+// p_PostureIndex:	The index of the posture.
+// p_Origin:			Where the request came from.
+//
+// Returns:				True if the posture exists and was sent, false otherwise.
+//
+bool ControlsMoveToPosture(int p_PostureIndex, ControlOrigin const& p_Origin)
+{
+	if ((p_PostureIndex < 0) || (p_PostureIndex >= static_cast<int>(s_ControlPostures.size())))
+	{
+		return false;
+	}
+
+	auto const& l_Posture = s_ControlPostures[p_PostureIndex];
+
+	TraceScope l_TraceScope("Posture set");
+
+	LoggerAddMessage("Moving to posture \"%s\".", l_Posture.m_Name);
+
+	// Send the whole posture at once, so that the control thread can plan all of it.
+	ControlCommand l_Command;
+	l_Command.m_Type = ControlCommand::TYPE_SET_POSTURE;
+	l_Command.m_Action = Control::ACTION_STOPPED;
+	l_Command.m_Mode = Control::MODE_TIMED;
+	l_Command.m_MovingDuration = Duration::zero();
+	l_Command.m_PostureTargetCount = 0;
+	l_Command.m_Origin = p_Origin;
+
+	for (auto const& l_Position : l_Posture.m_Positions)
+	{
+		auto const l_Handle = Control::GetHandle(l_Position.m_ControlName);
+
+		if (l_Handle.IsValid() == false)
+		{
+			LoggerAddMessage("Posture \"%s\" couldn't find control \"%s\".", l_Posture.m_Name, 
+				l_Position.m_ControlName);
+			continue;
+		}
+
+		auto& l_Target = l_Command.m_PostureTargets[l_Command.m_PostureTargetCount];
+		l_Target.m_Handle = l_Handle;
+		l_Target.m_PositionPercent = l_Position.m_PositionPercent;
+		l_Command.m_PostureTargetCount++;
+	}
+
+	return ControlsSendCommand(l_Command);
+}
+
+// Get how many controls there are.
+//
+// Returns:	The number of controls.
+//
+unsigned int ControlsGetCount()
+{
+	return static_cast<unsigned int>(s_Controls.size());
+}
+
+// Get a control by its index, so that every control can be listed.
+//
+// p_Index:	The index of the control.
+//
+// Returns:	The control, or null if there isn't one at that index.
+//
+Control const* ControlsGetControl(unsigned int p_Index)
+{
+	if (p_Index >= s_Controls.size())
+	{
+		return nullptr;
+	}
+
+	return &(s_Controls[p_Index]);
+}
+
+// Get how much work is waiting to be picked up between the threads. Any thread may call this.
+//
+// p_CommandCount:		(Output) Commands from the main thread waiting for the control thread.
+// p_InputCommandCount:	(Output) Commands from the input thread waiting for the control thread.
+// p_EventCount:			(Output) Events from the control thread waiting for the main thread.
+//
+void ControlsGetQueueDepths(unsigned int& p_CommandCount, unsigned int& p_InputCommandCount,
+	unsigned int& p_EventCount)
+{
+	p_CommandCount = s_ControlCommandQueue.GetSize();
+	p_InputCommandCount = s_ControlInputCommandQueue.GetSize();
+	p_EventCount = s_ControlEventQueue.GetSize();
+}
@@ -1,15 +1,25 @@
 #pragma once
 
+#include <functional>
+#include <string_view>
 #include <vector>
 
 #include <libxml/parser.h>
 #include "rapidjson/document.h"
 
+#include "gpio.h"
+#include "realtime.h"
 #include "timer.h"
 
 // Types
 //
 
+// Something the control thread reports to the main thread.
+struct ControlEvent;
+
+// What a control is doing, for status queries.
+struct ControlStatus;
+
 // A handle to a control.
 class ControlHandle
 {
@@ -65,6 +75,85 @@ struct ControlConfig
 	unsigned int m_MovingDurationMS;
 };
 
+// Where one control should be, as part of a posture.
+struct ControlPosition
+{
+	// Read a control position from XML. 
+	//
+	// p_Document:	The XML document that the node belongs to.
+	// p_Node:		The XML node to read the control position from.
+	//	
+	// Returns:		True if the position was read successfully, false otherwise.
+	//
+	bool ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node);
+
+	// Constants.
+	static constexpr unsigned int ms_ControlNameCapacity = 32;
+
+	// The name of the control.
+	char				m_ControlName[ms_ControlNameCapacity];
+
+	// The position, from 0 (all the way down) to 100 (all the way up) percent.
+	unsigned int	m_PositionPercent;
+};
+
+// A named posture, which moves several controls to their positions at once.
+struct ControlPostureConfig
+{
+	// Read a posture config from XML. 
+	//
+	// p_Document:	The XML document that the node belongs to.
+	// p_Node:		The XML node to read the posture config from.
+	//	
+	// Returns:		True if the config was read successfully, false otherwise.
+	//
+	bool ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node);
+
+	// Constants.
+	static constexpr unsigned int ms_NameCapacity = 32;
+
+	// The name of the posture, which is a single word so that it can be used as a command.
+	char									m_Name[ms_NameCapacity];
+
+	// Where each of the controls in the posture should be.
+	std::vector<ControlPosition>	m_Positions;
+};
+
+// Where a request to move a control came from and when, so that its latency can be measured.
+struct ControlOrigin
+{
+	// Where requests can come from.
+	enum Sources
+	{
+		SOURCE_INTERNAL = 0,	// Sandman itself, such as when shutting down.
+		SOURCE_VOICE,
+		SOURCE_BUTTON,
+		SOURCE_SOCKET,
+		SOURCE_KEYBOARD,
+		SOURCE_SCHEDULE,
+
+		NUM_SOURCES,
+	};
+
+	ControlOrigin() = default;
+
+	// Describe an origin.
+	//
+	// p_Source:		Where the request came from.
+	// p_ArrivalTime:	When the event that caused the request arrived.
+	//
+	ControlOrigin(Sources p_Source, Time const& p_ArrivalTime)
+		: m_Source(p_Source), m_ArrivalTime(p_ArrivalTime)
+	{
+	}
+
+	// Where the request came from.
+	Sources	m_Source = SOURCE_INTERNAL;
+
+	// When the event that caused the request arrived.
+	Time		m_ArrivalTime;
+};
+
 // An individual control.
 class Control
 {
@@ -85,6 +174,19 @@ class Control
 		{
 			MODE_MANUAL = 0, 
 			MODE_TIMED,
+
+			NUM_MODES,
+		};
+
+		// States a control may be in.
+		enum State
+		{
+			STATE_IDLE = 0,
+			STATE_MOVING_UP,
+			STATE_MOVING_DOWN,
+			STATE_COOL_DOWN,    // A delay after moving before moving can occur again.
+
+			NUM_STATES,
 		};
 		
 		// Handle initialization.
@@ -97,27 +199,144 @@ class Control
 		//
 		void Uninitialize();
 		
-		// Process a tick.
+		// Process a tick. Only the control thread may call this. Pin changes are held back so that 
+		// the control thread can write them all at once.
 		//
 		void Process();
 
-		// Set the desired action.
+		// Set the desired action. This sends the action to the control thread, which will act on it
+		// shortly.
 		//
 		// p_DesiredAction:		The desired action.
 		// p_Mode:					The mode of the action.
+		// p_Origin:				Where the request came from.
 		// p_DurationPercent:	(Optional) The percent of the normal duration to perform the action 
 		//								for.
 		//
-		void SetDesiredAction(Actions p_DesiredAction, Modes p_Mode, 
+		// Returns:					True if the action was sent, false if the control thread is too far 
+		//								behind to take it.
+		//
+		bool SetDesiredAction(Actions p_DesiredAction, Modes p_Mode, ControlOrigin const& p_Origin,
 			unsigned int p_DurationPercent = 100);
 
+		// Set the desired action while a button is held. Only the input thread may call this. The 
+		// action goes to the control thread on a queue of its own, so it doesn't wait behind the main
+		// thread, and a stop is never dropped, so that letting go of a button always stops the 
+		// control.
+		//
+		// p_DesiredAction:		The desired action.
+		// p_Origin:				Where the request came from.
+		//
+		void SetHeldAction(Actions p_DesiredAction, ControlOrigin const& p_Origin);
+
+		// Set the desired position. This sends the position to the control thread, which will move
+		// the control from where it thinks it is to there.
+		//
+		// p_PositionPercent:	The desired position, from 0 (all the way down) to 100 (all the way
+		//								up) percent.
+		// p_Origin:				Where the request came from.
+		//
+		// Returns:					True if the position was sent, false if the control thread is too far
+		//								behind to take it.
+		//
+		bool SetDesiredPosition(unsigned int p_PositionPercent, ControlOrigin const& p_Origin);
+
+		// Act on a desired action. Only the control thread may call this.
+		//
+		// p_DesiredAction:	The desired action.
+		// p_Mode:				The mode of the action.
+		// p_MovingDuration:	How long to move for.
+		//
+		void ApplyDesiredAction(Actions p_DesiredAction, Modes p_Mode, Duration p_MovingDuration);
+
+		// Act on a desired position. Only the control thread may call this.
+		//
+		// p_Action:				(Output) The action taken to get there.
+		// p_MovingDuration:		(Output) How long the action moves for, counted from the start of the
+		//								current movement.
+		// p_PositionPercent:	The desired position.
+		//
+		void ApplyDesiredPosition(Actions& p_Action, Duration& p_MovingDuration,
+			unsigned int p_PositionPercent);
+
+		// Get ready to move to a position when there is a motor free for it, stopping first if the 
+		// control is moving. Only the control thread may call this.
+		//
+		// p_PositionPercent:	The desired position.
+		//
+		void QueueDesiredPosition(unsigned int p_PositionPercent);
+
+		// Get ready to take a timed action when there is a motor free for it. Only the control thread
+		// may call this.
+		//
+		// p_DesiredAction:	The desired action.
+		// p_MovingDuration:	How long to move for, once it starts.
+		//
+		void QueueDesiredAction(Actions p_DesiredAction, Duration p_MovingDuration);
+
+		// Start the move the control is waiting for. Only the control thread may call this.
+		//
+		void StartPendingMove();
+
+		// Determine whether the motor is running. Only the control thread may call this.
+		//
+		bool IsMoving() const
+		{
+			return (m_State == STATE_MOVING_UP) || (m_State == STATE_MOVING_DOWN);
+		}
+
+		// Determine whether the control is ready to make a move it is waiting for. Only the control
+		// thread may call this.
+		//
+		bool IsWaitingToMove() const
+		{
+			return (m_HasPendingMove == true) && (m_State == STATE_IDLE);
+		}
+
+		// Estimate how long the motor needs to run for the move the control is waiting to make. Only
+		// the control thread may call this.
+		//
+		// Returns:	The total run time.
+		//
+		Duration GetPendingMoveDuration() const;
+
 		// Get the name.
 		//
 		char const* GetName() const
 		{
 			return m_Name;
 		}
-		
+
+		// Get where the control was when it last changed state. Only the main thread may call this.
+		//
+		// p_PositionPercent:	(Output) The estimated position, from 0 (all the way down) to 100
+		//								(all the way up) percent.
+		//
+		// Returns:					True if the position is known, false if the control hasn't reached an
+		//								end yet.
+		//
+		bool GetPosition(unsigned int& p_PositionPercent) const
+		{
+			p_PositionPercent = m_ReportedPositionPercent;
+			return m_ReportedPositionKnown;
+		}
+
+		// Get what the control is doing, as of the last report from the control thread. Only the 
+		// main thread may call this.
+		//
+		// p_Status:		(Output) The status.
+		// p_CurrentTime:	The current time, used to count down the current state and to move the
+		//						position along with a movement in progress.
+		//
+		void GetStatus(ControlStatus& p_Status, Time const& p_CurrentTime) const;
+
+		// Remember what the control thread said the control was doing. Only the main thread may call
+		// this.
+		//
+		// p_Event:	The state change or status change event from the control thread.
+		//
+		void SetReportedStatus(ControlEvent const& p_Event);
+
 		// Enable or disable all controls.
 		//
 		// p_Enable:	Whether to enable or disable all controls.
@@ -126,10 +345,27 @@ class Control
 		
 		// Set the durations.
 		//
-		// p_MovingDurationMS:		Duration of the moving state (in milliseconds).
-		// p_CoolDownDurationMS:	Duration of the cool down state (in milliseconds).
+		// p_MovingDuration:		Maximum duration of the moving state.
+		// p_CoolDownDuration:	Duration of the cool down state.
+		//
+		static void SetDurations(Duration p_MovingDuration, Duration p_CoolDownDuration);
+
+		// Set how many controls may make timed movements or move to positions at the same time, so
+		// that the power supply isn't overloaded. Held buttons aren't kept waiting, but do count. This
+		// must be called before the control thread starts.
 		//
-		static void SetDurations(unsigned int p_MovingDurationMS, unsigned int p_CoolDownDurationMS);
+		// p_MaxMovingControls:	The limit, or 0 for no limit.
+		//
+		static void SetMaxMovingControls(unsigned int p_MaxMovingControls);
+
+		// Get how many controls may make timed movements or move to positions at the same time.
+		//
+		// Returns:	The limit, or 0 for no limit.
+		//
+		static unsigned int GetMaxMovingControls()
+		{
+			return ms_MaxMovingControls;
+		}
 		
 		// Attempt to get the handle of a control based on its name.
 		//
@@ -152,21 +388,78 @@ class Control
 		// Constants.
 		static constexpr unsigned int ms_NameCapacity = 32;
 
-		// States a control may be in.
-		enum State
-		{
-			STATE_IDLE = 0,
-			STATE_MOVING_UP,
-			STATE_MOVING_DOWN,
-			STATE_COOL_DOWN,    // A delay after moving before moving can occur again.
-		};
+		// Arm the timer for the current state, so that it ends after a duration since the state 
+		// began.
+		//
+		// p_Duration:	The duration of the state.
+		//
+		void ArmStateTimer(Duration p_Duration);
+
+		// Switch on the pin for a movement. Timed movements are handed to the GPIO hardware if it can
+		// time them, so that they last exactly as long as they should.
+		//
+		// p_Pin:	The pin to switch on.
+		//
+		// Returns:	How long to wait before ending the movement in software.
+		//
+		Duration StartMoving(int p_Pin);
 
-		// Play a notification for the state.
+		// Take over timing the current movement in software, if the GPIO hardware was timing it.
+		//
+		// p_Pin:	The pin for the current movement.
+		//
+		void StopHardwareTiming(int p_Pin);
+
+		// Start keeping track of a new movement.
+		//
+		// p_CurrentTime:	The current time.
+		//
+		void StartTrackingMovement(Time const& p_CurrentTime);
+
+		// Move the estimated position along with however long the motor has run since it was last
+		// updated.
+		//
+		// p_CurrentTime:	The current time.
+		//
+		void UpdatePosition(Time const& p_CurrentTime);
+
+		// Get the estimated position as a percentage.
+		//
+		// Returns:	The position, from 0 (all the way down) to 100 (all the way up) percent.
+		//
+		unsigned int GetPositionPercent() const;
+
+		// Work out the movement that takes the control from its estimated position to a desired one.
+		//
+		// p_RunDuration:			(Output) How long to move for.
+		// p_PositionPercent:	The desired position.
 		//
-		void PlayNotification();
+		// Returns:					The action to take, or stopped if the control is close enough already.
+		//
+		Actions PlanMove(Duration& p_RunDuration, unsigned int p_PositionPercent) const;
+
+		// Let the main thread know that the state changed, so that it can be logged and notified.
+		//
+		// p_OldState:	The state before the change.
+		//
+		void PostStateChange(State p_OldState);
+
+		// Let the main thread know what the control is doing, when that changed without the state 
+		// changing.
+		//
+		void PostStatusChange();
+
+		// Fill in what the control is doing, for the main thread.
+		//
+		// p_Event:	(Output) The event to fill in.
+		//
+		void GetStatusEvent(ControlEvent& p_Event) const;
 		
 		// The name of the control.
 		char m_Name[ms_NameCapacity];
+
+		// The handle of this control.
+		ControlHandle m_Handle;
 		
 		// The control state.
 		State m_State;
@@ -174,6 +467,12 @@ class Control
 		// A record of when the state transition timer began.
 		Time m_StateStartTime;
 
+		// Fires when the time limit for the current state runs out.
+		TimerHandle m_StateTimer;
+
+		// When the time limit for the current state runs out.
+		Time m_StateEndTime;
+
 		// The desired action.
 		Actions m_DesiredAction;
 
@@ -184,17 +483,56 @@ class Control
 		int m_UpGPIOPin;
 		int m_DownGPIOPin;
 		
-		// The current duration of the moving state (in milliseconds) for this control.
-		unsigned int m_MovingDurationMS;
+		// The current duration of the moving state for this control.
+		Duration m_MovingDuration;
+
+		// Whether the GPIO hardware is timing the current movement.
+		bool m_PulseInHardware = false;
 		
-		// The standard duration of the moving state (in milliseconds) for this control.
-		unsigned int m_StandardMovingDurationMS;
+		// The standard duration of the moving state for this control, which is also how long it takes
+		// to travel from one end to the other.
+		Duration m_StandardMovingDuration;
 
-		// Maximum duration of the moving state (in milliseconds).
-		static unsigned int ms_MaxMovingDurationMS;
+		// The estimated position, as how long the motor would need to run up from the bottom to get
+		// there.
+		Duration m_Position = Duration::zero();
+
+		// Whether the position has been found by reaching an end, rather than guessed.
+		bool m_PositionKnown = false;
+
+		// When the position was last updated.
+		Time m_PositionTime;
+
+		// How long the current movement has run in the same direction, as of the last update.
+		Duration m_MovementRunDuration = Duration::zero();
+
+		// A move to make once there is a motor free and the current movement and cool down are over.
+		// It is a timed action if there is one, or a position as a percentage otherwise.
+		bool m_HasPendingMove = false;
+		unsigned int m_PendingPositionPercent = 0;
+		Actions m_PendingAction = ACTION_STOPPED;
+		Duration m_PendingMovingDuration = Duration::zero();
+
+		// What the control thread last reported, for the main thread.
+		State m_ReportedState = STATE_IDLE;
+		Actions m_ReportedDesiredAction = ACTION_STOPPED;
+		Modes m_ReportedMode = MODE_MANUAL;
+		Time m_ReportedStateEndTime;
+
+		// The position the control thread last reported, and when it was estimated.
+		unsigned int m_ReportedPositionPercent = 0;
+		bool m_ReportedPositionKnown = false;
+		Time m_ReportedPositionTime;
+
+		// Maximum duration of the moving state.
+		static Duration ms_MaxMovingDuration;
 		
-		// Maximum duration of the cool down state (in milliseconds).
-		static unsigned int ms_CoolDownDurationMS;	
+		// Maximum duration of the cool down state.
+		static Duration ms_CoolDownDuration;	
+
+		// How many controls may make timed movements or move to positions at the same time, or 0 for
+		// no limit.
+		static unsigned int ms_MaxMovingControls;
 };
 
 // Enough information to trigger a specific control action.
@@ -242,24 +580,107 @@ struct ControlAction
 	ControlHandle		m_ControlHandle;
 };
 
+// What a control is doing, for status queries.
+struct ControlStatus
+{
+	// The control state.
+	Control::State		m_State = Control::STATE_IDLE;
+
+	// The desired action.
+	Control::Actions	m_DesiredAction = Control::ACTION_STOPPED;
+
+	// The movement mode.
+	Control::Modes		m_Mode = Control::MODE_MANUAL;
+
+	// How long until the current state runs out, or zero when idle.
+	Duration				m_StateRemainingDuration = Duration::zero();
+
+	// The estimated position, from 0 (all the way down) to 100 (all the way up) percent, and 
+	// whether it is known.
+	unsigned int		m_PositionPercent = 0;
+	bool					m_PositionKnown = false;
+};
+
+// A function to call on the main thread for each command the control thread has applied. Moves that
+// wait for a motor to be free start later without one, like the moves of a posture.
+//
+// p_Control:			The control the command was for, or null if it was for all of them.
+// p_Action:			The action that was applied.
+// p_Mode:				The mode of the action.
+// p_MovingDuration:	How long the control was asked to move for.
+// p_Origin:			Where the command came from.
+//
+using ControlCommandAppliedCallback = std::function<void(Control const* p_Control, 
+	Control::Actions p_Action, Control::Modes p_Mode, Duration p_MovingDuration, 
+	ControlOrigin const& p_Origin)>;
+
 
 // Functions
 //
 
 // Initialize all of the controls.
 //
+// p_Configs:				Configuration parameters for the controls to add.
+// p_RealtimeConfig:	How to configure the control thread for real-time.
+//
+// Returns:					True if successful, false otherwise.
+//
+bool ControlsInitialize(std::vector<ControlConfig> const& p_Configs, 
+	RealtimeConfig const& p_RealtimeConfig);
+
+// Initialize all of the controls without a control thread. The caller does the control thread's 
+// work by calling ControlsStep instead, so that the controls can run on virtual time.
+//
 // p_Configs:	Configuration parameters for the controls to add.
 //
-void ControlsInitialize(std::vector<ControlConfig> const& p_Configs);
+void ControlsInitializeStepped(std::vector<ControlConfig> const& p_Configs);
 
 // Uninitialize all of the controls.
 //
 void ControlsUninitialize();
 
-// Process all of the controls.
+// Do the control thread's work on the calling thread, then handle everything it reported back. This
+// is only for controls initialized with ControlsInitializeStepped.
+//
+void ControlsStep();
+
+// Get when ControlsStep next needs to be called for a state to end. This is only for controls 
+// initialized with ControlsInitializeStepped.
+//
+// p_Deadline:	(Output) The earliest deadline.
+//
+// Returns:		True if any control is waiting on a deadline, false otherwise.
+//
+bool ControlsGetNextDeadline(Time& p_Deadline);
+
+// Set the function to call for each command the control thread has applied.
+//
+// p_Callback:	The function, or an empty one for none.
+//
+void ControlsSetCommandAppliedCallback(ControlCommandAppliedCallback const& p_Callback);
+
+// Determine which pins are switched on.
+//
+// p_Pins:		The pins.
+// p_Levels:	The level of each pin, high if its bit is set and low otherwise.
+//
+// Returns:		The pins that are switched on.
+//
+GPIOPinSet ControlsGetOnPins(GPIOPinSet p_Pins, GPIOPinSet p_Levels);
+
+// Handle everything the control thread has reported back, such as state changes.
 //
 void ControlsProcess();
 
+// Wait for the control thread to handle every command sent so far, then handle everything it 
+// reported back, so that what the controls report includes those commands. The control thread 
+// normally takes microseconds, but this gives up after a while rather than stall the main thread.
+// Only the main thread may call this.
+//
+// Returns:	True if every command was handled, false if it gave up waiting.
+//
+bool ControlsFlushCommands();
+
 // Create a new control with the provided config. Control names must be unique.
 //
 // p_Config:	Configuration parameters for the control.
@@ -268,6 +689,71 @@ void ControlsProcess();
 //
 bool ControlsCreateControl(ControlConfig const& p_Config);
 
-// Stop all of the controls.
+// Start a batch of commands. Commands sent until the batch ends are held back, then handed to the 
+// control thread together, so that it acts on all of them at once. Batches may be nested.
+//
+void ControlsBeginCommandBatch();
+
+// End a batch of commands, waking the control thread for them if it was the outermost batch.
+//
+// Returns:	True if every command sent since the outermost batch began was sent, false if any were
+//				dropped.
+//
+bool ControlsEndCommandBatch();
+
+// Stop all of the controls. This waits for the control thread to make room for the stop, if it has
+// to.
+//
+// p_Origin:	Where the request came from.
+//
+// Returns:		True if the stop was sent, false if there is no control thread to take it.
+//
+bool ControlsStopAll(ControlOrigin const& p_Origin);
+
+// Set the postures that the controls can be moved to.
+//
+// p_Configs:	The postures.
+//
+void ControlsSetPostures(std::vector<ControlPostureConfig> const& p_Configs);
+
+// Look up a posture by name, regardless of case.
+//
+// p_Name:	The name of the posture.
+//
+// Returns:	The index of the posture, or -1 if there isn't one with that name.
+//
+int ControlsGetPostureIndex(std::string_view p_Name);
+
+// Move every control in a posture to its position. The controls that have the furthest to go start
+// first, and as many move at once as the limit allows, so that the posture is reached as soon as
+// possible.
+//
+// p_PostureIndex:	The index of the posture.
+// p_Origin:			Where the request came from.
+//
+// Returns:				True if the posture exists and was sent, false otherwise.
+//
+bool ControlsMoveToPosture(int p_PostureIndex, ControlOrigin const& p_Origin);
+
+// Get how many controls there are.
+//
+// Returns:	The number of controls.
+//
+unsigned int ControlsGetCount();
+
+// Get a control by its index, so that every control can be listed.
+//
+// p_Index:	The index of the control.
+//
+// Returns:	The control, or null if there isn't one at that index.
+//
+Control const* ControlsGetControl(unsigned int p_Index);
+
+// Get how much work is waiting to be picked up between the threads. Any thread may call this.
+//
+// p_CommandCount:		(Output) Commands from the main thread waiting for the control thread.
+// p_InputCommandCount:	(Output) Commands from the input thread waiting for the control thread.
+// p_EventCount:			(Output) Events from the control thread waiting for the main thread.
 //
-void ControlsStopAll();
+void ControlsGetQueueDepths(unsigned int& p_CommandCount, unsigned int& p_InputCommandCount,
+	unsigned int& p_EventCount);
@@ -0,0 +1,346 @@
+#include "gpio.h"
+
+#include <atomic>
+#include <string.h>
+
+#include "logger.h"
+#include "xml.h"
+
+// Types
+//
+
+// Keeps the pins in memory, so that everything else can run without GPIO hardware.
+class GPIOSimulatedBackend : public GPIOBackend
+{
+	public:
+
+		// Get the name of the backend, for logging.
+		//
+		char const* GetName() const override
+		{
+			return "simulated";
+		}
+
+		// Get ready to drive pins.
+		//
+		// p_Config:	The GPIO configuration.
+		//
+		// Returns:		True if successful, false otherwise.
+		//
+		bool Initialize(GPIOConfig const& p_Config) override
+		{
+			m_Outputs.store(0, std::memory_order_relaxed);
+			m_Levels.store(0, std::memory_order_relaxed);
+			return true;
+		}
+
+		// Stop driving pins.
+		//
+		void Uninitialize() override
+		{
+		}
+
+		// Make pins into outputs.
+		//
+		// p_Pins:		The pins.
+		// p_Levels:	The level to start each pin at, high if its bit is set and low otherwise.
+		//
+		// Returns:		True if successful, false otherwise.
+		//
+		bool SetOutputs(GPIOPinSet p_Pins, GPIOPinSet p_Levels) override
+		{
+			Write(p_Pins, p_Levels);
+			m_Outputs.fetch_or(p_Pins, std::memory_order_relaxed);
+			return true;
+		}
+
+		// Make pins back into inputs, so that they are no longer driven.
+		//
+		// p_Pins:	The pins.
+		//
+		void SetInputs(GPIOPinSet p_Pins) override
+		{
+			m_Outputs.fetch_and(~p_Pins, std::memory_order_relaxed);
+		}
+
+		// Change the levels of output pins.
+		//
+		// p_Pins:		The pins to change.
+		// p_Levels:	The new level of each pin, high if its bit is set and low otherwise.
+		//
+		// Returns:		True if successful, false otherwise.
+		//
+		bool Write(GPIOPinSet p_Pins, GPIOPinSet p_Levels) override
+		{
+			// Only the control thread writes, but others may read.
+			auto const l_OldLevels = m_Levels.load(std::memory_order_relaxed);
+			m_Levels.store((l_OldLevels & ~p_Pins) | (p_Levels & p_Pins), std::memory_order_release);
+			return true;
+		}
+
+		// Get the levels of the output pins.
+		//
+		// p_Levels:	(Output) The level of each output pin, high if its bit is set and low otherwise.
+		//
+		// Returns:		True if successful, false otherwise.
+		//
+		bool Read(GPIOPinSet& p_Levels) override
+		{
+			p_Levels = m_Levels.load(std::memory_order_acquire) & 
+				m_Outputs.load(std::memory_order_relaxed);
+			return true;
+		}
+
+	private:
+
+		// The pins that are outputs.
+		std::atomic<GPIOPinSet> m_Outputs{0};
+
+		// The level of each pin.
+		std::atomic<GPIOPinSet> m_Levels{0};
+};
+
+// Locals
+//
+
+// The names of the backends, as they appear in the config.
+static char const* const s_GPIOBackendNames[] =
+{
+	"pigpio",		// BACKEND_PIGPIO
+	"gpiod",			// BACKEND_GPIOD
+	"simulated",	// BACKEND_SIMULATED
+};
+
+static_assert(sizeof(s_GPIOBackendNames) / sizeof(s_GPIOBackendNames[0]) ==
+	GPIOConfig::NUM_BACKENDS, "Every backend needs a name.");
+
+// The backend in use.
+static std::unique_ptr<GPIOBackend> s_GPIOBackend;
+
+// Functions
+//
+
+// GPIOConfig members
+
+// Read a GPIO config from XML. Any settings that are missing keep their defaults.
+//
+// p_Document:	The XML document that the node belongs to.
+// p_Node:		The XML node to read the GPIO config from.
+//
+// Returns:		True if the config was read successfully, false otherwise.
+//
+bool GPIOConfig::ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node)
+{
+	// Get the backend.
+	static auto const* s_BackendNodeName = "Backend";
+	auto* l_BackendNode = XMLFindNextNodeByName(p_Node->xmlChildrenNode, s_BackendNodeName);
+
+	if (l_BackendNode != nullptr)
+	{
+		static constexpr unsigned int l_BackendTextCapacity = 32;
+		char l_BackendText[l_BackendTextCapacity];
+
+		if (XMLCopyNodeText(l_BackendText, l_BackendTextCapacity, p_Document, l_BackendNode) == false)
+		{
+			return false;
+		}
+
+		auto l_FoundBackend = false;
+
+		for (unsigned int l_BackendIndex = 0; l_BackendIndex < NUM_BACKENDS; l_BackendIndex++)
+		{
+			if (strcmp(l_BackendText, s_GPIOBackendNames[l_BackendIndex]) != 0)
+			{
+				continue;
+			}
+
+			m_Backend = static_cast<Backends>(l_BackendIndex);
+			l_FoundBackend = true;
+			break;
+		}
+
+		if (l_FoundBackend == false)
+		{
+			LoggerAddMessage("Unknown GPIO backend \"%s\".", l_BackendText);
+			return false;
+		}
+	}
+
+	// Get the chip.
+	static auto const* s_ChipNodeName = "Chip";
+	auto* l_ChipNode = XMLFindNextNodeByName(p_Node->xmlChildrenNode, s_ChipNodeName);
+
+	if (l_ChipNode != nullptr)
+	{
+		if (XMLCopyNodeText(m_ChipName, ms_ChipNameCapacity, p_Document, l_ChipNode) == false)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Create the backend for a config.
+//
+// p_Backend:	Which backend to create.
+//
+// Returns:		The backend, or null if it isn't available in this build.
+//
+static std::unique_ptr<GPIOBackend> GPIOCreateBackend(GPIOConfig::Backends p_Backend)
+{
+	switch (p_Backend)
+	{
+#if defined(HAVE_PIGPIO)
+		case GPIOConfig::BACKEND_PIGPIO:
+		{
+			return GPIOCreatePigpioBackend();
+		}
+#endif // defined(HAVE_PIGPIO)
+
+#if defined(HAVE_GPIOD)
+		case GPIOConfig::BACKEND_GPIOD:
+		{
+			return GPIOCreateGpiodBackend();
+		}
+#endif // defined(HAVE_GPIOD)
+
+		case GPIOConfig::BACKEND_SIMULATED:
+		{
+			return std::unique_ptr<GPIOBackend>(new GPIOSimulatedBackend());
+		}
+
+		default:
+		{
+			return nullptr;
+		}
+	}
+}
+
+// Create and initialize the configured backend.
+//
+// p_Config:	The GPIO configuration.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool GPIOInitialize(GPIOConfig const& p_Config)
+{
+	auto const* l_BackendName = s_GPIOBackendNames[p_Config.m_Backend];
+
+	s_GPIOBackend = GPIOCreateBackend(p_Config.m_Backend);
+
+	if (s_GPIOBackend == nullptr)
+	{
+		LoggerAddMessage("GPIO backend \"%s\" isn't available in this build.", l_BackendName);
+		return false;
+	}
+
+	if (s_GPIOBackend->Initialize(p_Config) == false)
+	{
+		LoggerAddMessage("Failed to initialize GPIO backend \"%s\".", l_BackendName);
+		s_GPIOBackend.reset();
+		return false;
+	}
+
+	LoggerAddMessage("Using GPIO backend \"%s\".", s_GPIOBackend->GetName());
+	return true;
+}
+
+// Uninitialize and destroy the backend.
+//
+void GPIOUninitialize()
+{
+	if (s_GPIOBackend == nullptr)
+	{
+		return;
+	}
+
+	s_GPIOBackend->Uninitialize();
+	s_GPIOBackend.reset();
+}
+
+// Make pins into outputs.
+//
+// p_Pins:		The pins.
+// p_Levels:	The level to start each pin at, high if its bit is set and low otherwise.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool GPIOSetOutputs(GPIOPinSet p_Pins, GPIOPinSet p_Levels)
+{
+	if (s_GPIOBackend == nullptr)
+	{
+		return false;
+	}
+
+	return s_GPIOBackend->SetOutputs(p_Pins, p_Levels);
+}
+
+// Make pins back into inputs, so that they are no longer driven.
+//
+// p_Pins:	The pins.
+//
+void GPIOSetInputs(GPIOPinSet p_Pins)
+{
+	if (s_GPIOBackend == nullptr)
+	{
+		return;
+	}
+
+	s_GPIOBackend->SetInputs(p_Pins);
+}
+
+// Change the levels of output pins together.
+//
+// p_Pins:		The pins to change.
+// p_Levels:	The new level of each pin, high if its bit is set and low otherwise.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool GPIOWrite(GPIOPinSet p_Pins, GPIOPinSet p_Levels)
+{
+	if (s_GPIOBackend == nullptr)
+	{
+		return false;
+	}
+
+	return s_GPIOBackend->Write(p_Pins, p_Levels);
+}
+
+// Get the levels of the output pins.
+//
+// p_Levels:	(Output) The level of each output pin, high if its bit is set and low otherwise.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool GPIORead(GPIOPinSet& p_Levels)
+{
+	if (s_GPIOBackend == nullptr)
+	{
+		return false;
+	}
+
+	return s_GPIOBackend->Read(p_Levels);
+}
+
+// Hold output pins at some levels for a while, then return them to others, with the timing enforced
+// by hardware. Any write to the same pins cuts the pulse short.
+//
+// p_Pins:				The pins to pulse.
+// p_ActiveLevels:	The level of each pin during the pulse.
+// p_RestingLevels:	The level of each pin after the pulse.
+// p_Width:				How long the pulse lasts.
+//
+// Returns:				True if the pulse started, false if it can't be timed by hardware right now and 
+//							the caller needs to time it instead.
+//
+bool GPIOStartPulse(GPIOPinSet p_Pins, GPIOPinSet p_ActiveLevels, GPIOPinSet p_RestingLevels,
+	Duration p_Width)
+{
+	if (s_GPIOBackend == nullptr)
+	{
+		return false;
+	}
+
+	return s_GPIOBackend->StartPulse(p_Pins, p_ActiveLevels, p_RestingLevels, p_Width);
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <assert.h>
+#include <memory>
+#include <stdint.h>
+
+#include <libxml/parser.h>
+
+#include "timer.h"
+
+// Types
+//
+
+// A set of GPIO pins, with one bit for each Broadcom pin number.
+using GPIOPinSet = uint32_t;
+
+// Configuration parameters for the GPIO backend.
+struct GPIOConfig
+{
+	// Read a GPIO config from XML. Any settings that are missing keep their defaults.
+	//
+	// p_Document:	The XML document that the node belongs to.
+	// p_Node:		The XML node to read the GPIO config from.
+	//
+	// Returns:		True if the config was read successfully, false otherwise.
+	//
+	bool ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node);
+
+	// The ways that the pins can be driven.
+	enum Backends
+	{
+		BACKEND_PIGPIO = 0,	// The pigpio library, which only runs on a Raspberry Pi.
+		BACKEND_GPIOD,			// The kernel's GPIO character device, through libgpiod.
+		BACKEND_SIMULATED,	// Nothing but memory, for running anywhere.
+
+		NUM_BACKENDS,
+	};
+
+	// Constants.
+	static constexpr unsigned int ms_ChipNameCapacity = 32;
+
+	// The backend to use.
+	Backends m_Backend = BACKEND_PIGPIO;
+
+	// The GPIO chip to use with the character device backend.
+	char m_ChipName[ms_ChipNameCapacity] = "gpiochip0";
+};
+
+// Something that can drive GPIO pins. Every pin in a set is changed together, in a single write if
+// the hardware allows it.
+class GPIOBackend
+{
+	public:
+
+		virtual ~GPIOBackend() = default;
+
+		// Get the name of the backend, for logging.
+		//
+		virtual char const* GetName() const = 0;
+
+		// Get ready to drive pins.
+		//
+		// p_Config:	The GPIO configuration.
+		//
+		// Returns:		True if successful, false otherwise.
+		//
+		virtual bool Initialize(GPIOConfig const& p_Config) = 0;
+
+		// Stop driving pins.
+		//
+		virtual void Uninitialize() = 0;
+
+		// Make pins into outputs.
+		//
+		// p_Pins:		The pins.
+		// p_Levels:	The level to start each pin at, high if its bit is set and low otherwise.
+		//
+		// Returns:		True if successful, false otherwise.
+		//
+		virtual bool SetOutputs(GPIOPinSet p_Pins, GPIOPinSet p_Levels) = 0;
+
+		// Make pins back into inputs, so that they are no longer driven.
+		//
+		// p_Pins:	The pins.
+		//
+		virtual void SetInputs(GPIOPinSet p_Pins) = 0;
+
+		// Change the levels of output pins.
+		//
+		// p_Pins:		The pins to change.
+		// p_Levels:	The new level of each pin, high if its bit is set and low otherwise.
+		//
+		// Returns:		True if successful, false otherwise.
+		//
+		virtual bool Write(GPIOPinSet p_Pins, GPIOPinSet p_Levels) = 0;
+
+		// Get the levels of the output pins.
+		//
+		// p_Levels:	(Output) The level of each output pin, high if its bit is set and low otherwise.
+		//
+		// Returns:		True if successful, false otherwise.
+		//
+		virtual bool Read(GPIOPinSet& p_Levels) = 0;
+
+		// Hold output pins at some levels for a while, then return them to others, with the timing
+		// enforced by hardware. Any write to the same pins cuts the pulse short.
+		//
+		// p_Pins:				The pins to pulse.
+		// p_ActiveLevels:	The level of each pin during the pulse.
+		// p_RestingLevels:	The level of each pin after the pulse.
+		// p_Width:				How long the pulse lasts.
+		//
+		// Returns:				True if the pulse started, false if it can't be timed by hardware right 
+		//							now and the caller needs to time it instead.
+		//
+		virtual bool StartPulse(GPIOPinSet p_Pins, GPIOPinSet p_ActiveLevels, 
+			GPIOPinSet p_RestingLevels, Duration p_Width)
+		{
+			return false;
+		}
+};
+
+// Functions
+//
+
+// Determine whether a pin number fits in a pin set.
+//
+// p_Pin:	The Broadcom pin number.
+//
+// Returns:	True if the pin fits, false otherwise.
+//
+inline bool GPIOIsValidPin(int p_Pin)
+{
+	return (p_Pin >= 0) && (p_Pin < static_cast<int>(sizeof(GPIOPinSet) * 8));
+}
+
+// Get the set containing a single pin.
+//
+// p_Pin:	The Broadcom pin number, which must fit in a pin set.
+//
+// Returns:	The pin set.
+//
+inline GPIOPinSet GPIOGetPinSet(int p_Pin)
+{
+	// Shifting by anything else is undefined, and could drive a different pin.
+	assert(GPIOIsValidPin(p_Pin) == true);
+
+	return static_cast<GPIOPinSet>(1) << p_Pin;
+}
+
+// Create and initialize the configured backend.
+//
+// p_Config:	The GPIO configuration.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool GPIOInitialize(GPIOConfig const& p_Config);
+
+// Uninitialize and destroy the backend.
+//
+void GPIOUninitialize();
+
+// Make pins into outputs.
+//
+// p_Pins:		The pins.
+// p_Levels:	The level to start each pin at, high if its bit is set and low otherwise.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool GPIOSetOutputs(GPIOPinSet p_Pins, GPIOPinSet p_Levels);
+
+// Make pins back into inputs, so that they are no longer driven.
+//
+// p_Pins:	The pins.
+//
+void GPIOSetInputs(GPIOPinSet p_Pins);
+
+// Change the levels of output pins together.
+//
+// p_Pins:		The pins to change.
+// p_Levels:	The new level of each pin, high if its bit is set and low otherwise.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool GPIOWrite(GPIOPinSet p_Pins, GPIOPinSet p_Levels);
+
+// Get the levels of the output pins.
+//
+// p_Levels:	(Output) The level of each output pin, high if its bit is set and low otherwise.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool GPIORead(GPIOPinSet& p_Levels);
+
+// Hold output pins at some levels for a while, then return them to others, with the timing enforced
+// by hardware. Any write to the same pins cuts the pulse short.
+//
+// p_Pins:				The pins to pulse.
+// p_ActiveLevels:	The level of each pin during the pulse.
+// p_RestingLevels:	The level of each pin after the pulse.
+// p_Width:				How long the pulse lasts.
+//
+// Returns:				True if the pulse started, false if it can't be timed by hardware right now and 
+//							the caller needs to time it instead.
+//
+bool GPIOStartPulse(GPIOPinSet p_Pins, GPIOPinSet p_ActiveLevels, GPIOPinSet p_RestingLevels,
+	Duration p_Width);
+
+// Create a backend that uses pigpio. This is only available if pigpio was found when configuring.
+//
+// Returns:	The backend.
+//
+std::unique_ptr<GPIOBackend> GPIOCreatePigpioBackend();
+
+// Create a backend that uses the GPIO character device. This is only available if libgpiod was
+// found when configuring.
+//
+// Returns:	The backend.
+//
+std::unique_ptr<GPIOBackend> GPIOCreateGpiodBackend();
@@ -0,0 +1,290 @@
+#include "gpio.h"
+
+#include <errno.h>
+
+#include <gpiod.h>
+
+#include "logger.h"
+
+// Constants
+//
+
+// How the lines are labeled as being in use.
+#define GPIO_GPIOD_CONSUMER_NAME		"sandman"
+
+// How many pins a set can have.
+#define GPIO_GPIOD_MAX_PIN_COUNT		(32)
+
+// Types
+//
+
+// Drives the pins through the kernel's GPIO character device. All of the outputs are held in a
+// single line request, so that every write changes them together in one call.
+class GPIOGpiodBackend : public GPIOBackend
+{
+	public:
+
+		// Get the name of the backend, for logging.
+		//
+		char const* GetName() const override
+		{
+			return "gpiod";
+		}
+
+		// Get ready to drive pins.
+		//
+		// p_Config:	The GPIO configuration.
+		//
+		// Returns:		True if successful, false otherwise.
+		//
+		bool Initialize(GPIOConfig const& p_Config) override
+		{
+			m_Chip = gpiod_chip_open_by_name(p_Config.m_ChipName);
+
+			if (m_Chip == nullptr)
+			{
+				LoggerAddMessage("Failed to open GPIO chip \"%s\" with error %d.", p_Config.m_ChipName,
+					errno);
+				return false;
+			}
+
+			return true;
+		}
+
+		// Stop driving pins.
+		//
+		void Uninitialize() override
+		{
+			ReleaseOutputs();
+
+			if (m_Chip != nullptr)
+			{
+				gpiod_chip_close(m_Chip);
+				m_Chip = nullptr;
+			}
+		}
+
+		// Make pins into outputs.
+		//
+		// p_Pins:		The pins.
+		// p_Levels:	The level to start each pin at, high if its bit is set and low otherwise.
+		//
+		// Returns:		True if successful, false otherwise.
+		//
+		bool SetOutputs(GPIOPinSet p_Pins, GPIOPinSet p_Levels) override
+		{
+			m_Levels = (m_Levels & ~p_Pins) | (p_Levels & p_Pins);
+
+			// The request can't grow, so replace it with one for all of the outputs.
+			ReleaseOutputs();
+			m_Outputs |= p_Pins;
+
+			return RequestOutputs();
+		}
+
+		// Make pins back into inputs, so that they are no longer driven.
+		//
+		// p_Pins:	The pins.
+		//
+		void SetInputs(GPIOPinSet p_Pins) override
+		{
+			ReleaseOutputs();
+			m_Outputs &= ~p_Pins;
+
+			// Briefly request the pins as inputs so that they stop being driven.
+			unsigned int l_Offsets[GPIO_GPIOD_MAX_PIN_COUNT];
+			auto const l_PinCount = GetOffsets(l_Offsets, p_Pins);
+
+			gpiod_line_bulk l_InputLines;
+			gpiod_line_bulk_init(&l_InputLines);
+
+			if ((l_PinCount > 0) &&
+				(gpiod_chip_get_lines(m_Chip, l_Offsets, l_PinCount, &l_InputLines) == 0) &&
+				(gpiod_line_request_bulk_input(&l_InputLines, GPIO_GPIOD_CONSUMER_NAME) == 0))
+			{
+				gpiod_line_release_bulk(&l_InputLines);
+			}
+
+			RequestOutputs();
+		}
+
+		// Change the levels of output pins.
+		//
+		// p_Pins:		The pins to change.
+		// p_Levels:	The new level of each pin, high if its bit is set and low otherwise.
+		//
+		// Returns:		True if successful, false otherwise.
+		//
+		bool Write(GPIOPinSet p_Pins, GPIOPinSet p_Levels) override
+		{
+			m_Levels = (m_Levels & ~p_Pins) | (p_Levels & p_Pins);
+
+			if (m_HasOutputLines == false)
+			{
+				return false;
+			}
+
+			int l_Values[GPIO_GPIOD_MAX_PIN_COUNT];
+			GetValues(l_Values, m_Outputs);
+
+			return (gpiod_line_set_value_bulk(&m_OutputLines, l_Values) == 0);
+		}
+
+		// Get the levels of the output pins.
+		//
+		// p_Levels:	(Output) The level of each output pin, high if its bit is set and low otherwise.
+		//
+		// Returns:		True if successful, false otherwise.
+		//
+		bool Read(GPIOPinSet& p_Levels) override
+		{
+			if (m_HasOutputLines == false)
+			{
+				return false;
+			}
+
+			int l_Values[GPIO_GPIOD_MAX_PIN_COUNT];
+
+			if (gpiod_line_get_value_bulk(&m_OutputLines, l_Values) < 0)
+			{
+				return false;
+			}
+
+			// The values are in pin order.
+			p_Levels = 0;
+			unsigned int l_Count = 0;
+
+			for (unsigned int l_Pin = 0; l_Pin < GPIO_GPIOD_MAX_PIN_COUNT; l_Pin++)
+			{
+				if ((m_Outputs & GPIOGetPinSet(l_Pin)) == 0)
+				{
+					continue;
+				}
+
+				if (l_Values[l_Count++] != 0)
+				{
+					p_Levels |= GPIOGetPinSet(l_Pin);
+				}
+			}
+
+			return true;
+		}
+
+	private:
+
+		// Get the line offsets for a set of pins, in pin order.
+		//
+		// p_Offsets:	(Output) The line offsets.
+		// p_Pins:		The pins.
+		//
+		// Returns:		The number of offsets.
+		//
+		static unsigned int GetOffsets(unsigned int* p_Offsets, GPIOPinSet p_Pins)
+		{
+			unsigned int l_Count = 0;
+
+			for (unsigned int l_Pin = 0; l_Pin < GPIO_GPIOD_MAX_PIN_COUNT; l_Pin++)
+			{
+				if ((p_Pins & GPIOGetPinSet(l_Pin)) != 0)
+				{
+					p_Offsets[l_Count++] = l_Pin;
+				}
+			}
+
+			return l_Count;
+		}
+
+		// Get the values of a set of pins, in pin order.
+		//
+		// p_Values:	(Output) The value of each pin.
+		// p_Pins:		The pins.
+		//
+		void GetValues(int* p_Values, GPIOPinSet p_Pins) const
+		{
+			unsigned int l_Count = 0;
+
+			for (unsigned int l_Pin = 0; l_Pin < GPIO_GPIOD_MAX_PIN_COUNT; l_Pin++)
+			{
+				if ((p_Pins & GPIOGetPinSet(l_Pin)) != 0)
+				{
+					p_Values[l_Count++] = ((m_Levels & GPIOGetPinSet(l_Pin)) != 0) ? 1 : 0;
+				}
+			}
+		}
+
+		// Request all of the outputs as a single set of lines, at their current levels.
+		//
+		// Returns:		True if successful, false otherwise.
+		//
+		bool RequestOutputs()
+		{
+			unsigned int l_Offsets[GPIO_GPIOD_MAX_PIN_COUNT];
+			auto const l_PinCount = GetOffsets(l_Offsets, m_Outputs);
+
+			if (l_PinCount == 0)
+			{
+				return true;
+			}
+
+			int l_Values[GPIO_GPIOD_MAX_PIN_COUNT];
+			GetValues(l_Values, m_Outputs);
+
+			gpiod_line_bulk_init(&m_OutputLines);
+
+			if (gpiod_chip_get_lines(m_Chip, l_Offsets, l_PinCount, &m_OutputLines) < 0)
+			{
+				LoggerAddMessage("Failed to get GPIO lines with error %d.", errno);
+				return false;
+			}
+
+			if (gpiod_line_request_bulk_output(&m_OutputLines, GPIO_GPIOD_CONSUMER_NAME, l_Values) < 0)
+			{
+				LoggerAddMessage("Failed to request GPIO lines as outputs with error %d.", errno);
+				return false;
+			}
+
+			m_HasOutputLines = true;
+			return true;
+		}
+
+		// Give up the current request for the outputs.
+		//
+		void ReleaseOutputs()
+		{
+			if (m_HasOutputLines == false)
+			{
+				return;
+			}
+
+			gpiod_line_release_bulk(&m_OutputLines);
+			m_HasOutputLines = false;
+		}
+
+		// The GPIO chip.
+		gpiod_chip* m_Chip = nullptr;
+
+		// The request for all of the outputs.
+		gpiod_line_bulk m_OutputLines;
+
+		// Whether the outputs are currently requested.
+		bool m_HasOutputLines = false;
+
+		// The pins that are outputs.
+		GPIOPinSet m_Outputs = 0;
+
+		// The level of each output.
+		GPIOPinSet m_Levels = 0;
+};
+
+// Functions
+//
+
+// Create a backend that uses the GPIO character device. This is only available if libgpiod was
+// found when configuring.
+//
+// Returns:	The backend.
+//
+std::unique_ptr<GPIOBackend> GPIOCreateGpiodBackend()
+{
+	return std::unique_ptr<GPIOBackend>(new GPIOGpiodBackend());
+}
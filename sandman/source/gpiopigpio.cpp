@@ -0,0 +1,263 @@
+#include "gpio.h"
+
+#include <algorithm>
+
+#include <pigpio.h>
+
+#include "logger.h"
+
+// Types
+//
+
+// Drives the pins through pigpio, which writes the Raspberry Pi's GPIO registers directly. Pulses
+// are sent as DMA-timed waveforms.
+class GPIOPigpioBackend : public GPIOBackend
+{
+	public:
+
+		// Get the name of the backend, for logging.
+		//
+		char const* GetName() const override
+		{
+			return "pigpio";
+		}
+
+		// Get ready to drive pins.
+		//
+		// p_Config:	The GPIO configuration.
+		//
+		// Returns:		True if successful, false otherwise.
+		//
+		bool Initialize(GPIOConfig const& p_Config) override
+		{
+			if (gpioInitialise() < 0)
+			{
+				LoggerAddMessage("Failed to initialize GPIO.");
+				return false;
+			}
+
+			return true;
+		}
+
+		// Stop driving pins.
+		//
+		void Uninitialize() override
+		{
+			StopPulse();
+			DeleteWave();
+
+			gpioTerminate();
+		}
+
+		// Make pins into outputs.
+		//
+		// p_Pins:		The pins.
+		// p_Levels:	The level to start each pin at, high if its bit is set and low otherwise.
+		//
+		// Returns:		True if successful, false otherwise.
+		//
+		bool SetOutputs(GPIOPinSet p_Pins, GPIOPinSet p_Levels) override
+		{
+			// Set the levels first, so that the pins don't glitch when they start being driven.
+			Write(p_Pins, p_Levels);
+
+			auto l_Succeeded = true;
+
+			for (unsigned int l_Pin = 0; l_Pin <= PI_MAX_USER_GPIO; l_Pin++)
+			{
+				if ((p_Pins & GPIOGetPinSet(l_Pin)) == 0)
+				{
+					continue;
+				}
+
+				if (gpioSetMode(l_Pin, PI_OUTPUT) < 0)
+				{
+					LoggerAddMessage("Failed to make GPIO pin %u an output.", l_Pin);
+					l_Succeeded = false;
+				}
+			}
+
+			return l_Succeeded;
+		}
+
+		// Make pins back into inputs, so that they are no longer driven.
+		//
+		// p_Pins:	The pins.
+		//
+		void SetInputs(GPIOPinSet p_Pins) override
+		{
+			for (unsigned int l_Pin = 0; l_Pin <= PI_MAX_USER_GPIO; l_Pin++)
+			{
+				if ((p_Pins & GPIOGetPinSet(l_Pin)) == 0)
+				{
+					continue;
+				}
+
+				gpioSetMode(l_Pin, PI_INPUT);
+			}
+		}
+
+		// Change the levels of output pins. Each of the set and clear registers changes all of its
+		// pins at once, but the two are written one after the other. Pins go high first, which
+		// switches off active-low relays before any others are switched on.
+		//
+		// p_Pins:		The pins to change.
+		// p_Levels:	The new level of each pin, high if its bit is set and low otherwise.
+		//
+		// Returns:		True if successful, false otherwise.
+		//
+		bool Write(GPIOPinSet p_Pins, GPIOPinSet p_Levels) override
+		{
+			// Don't let a pulse change these pins later.
+			if ((p_Pins & m_PulsePins) != 0)
+			{
+				StopPulse();
+			}
+
+			auto const l_HighPins = p_Pins & p_Levels;
+			auto const l_LowPins = p_Pins & ~p_Levels;
+
+			if ((l_HighPins != 0) && (gpioWrite_Bits_0_31_Set(l_HighPins) < 0))
+			{
+				return false;
+			}
+
+			if ((l_LowPins != 0) && (gpioWrite_Bits_0_31_Clear(l_LowPins) < 0))
+			{
+				return false;
+			}
+
+			return true;
+		}
+
+		// Get the levels of the output pins.
+		//
+		// p_Levels:	(Output) The level of each output pin, high if its bit is set and low otherwise.
+		//
+		// Returns:		True if successful, false otherwise.
+		//
+		bool Read(GPIOPinSet& p_Levels) override
+		{
+			// This reads every pin in the bank at once, inputs included.
+			p_Levels = gpioRead_Bits_0_31();
+			return true;
+		}
+
+		// Hold output pins at some levels for a while, then return them to others, with the timing
+		// enforced by hardware. Any write to the same pins cuts the pulse short.
+		//
+		// p_Pins:				The pins to pulse.
+		// p_ActiveLevels:	The level of each pin during the pulse.
+		// p_RestingLevels:	The level of each pin after the pulse.
+		// p_Width:				How long the pulse lasts.
+		//
+		// Returns:				True if the pulse started, false if it can't be timed by hardware right 
+		//							now and the caller needs to time it instead.
+		//
+		bool StartPulse(GPIOPinSet p_Pins, GPIOPinSet p_ActiveLevels, GPIOPinSet p_RestingLevels, 
+			Duration p_Width) override
+		{
+			// Only one waveform can be sent at a time, and sending another would cut the current one
+			// short, leaving its pins active. So leave overlapping pulses to be timed by the caller.
+			if (gpioWaveTxBusy() != 0)
+			{
+				return false;
+			}
+
+			DeleteWave();
+			m_PulsePins = 0;
+
+			auto const l_WidthUS = std::max(std::chrono::duration_cast<std::chrono::microseconds>(
+				p_Width).count(), static_cast<std::chrono::microseconds::rep>(1));
+
+			if (l_WidthUS > UINT32_MAX)
+			{
+				return false;
+			}
+
+			// Set the active levels, wait, then set the resting levels.
+			gpioPulse_t l_Pulses[2];
+
+			l_Pulses[0].gpioOn = p_Pins & p_ActiveLevels;
+			l_Pulses[0].gpioOff = p_Pins & ~p_ActiveLevels;
+			l_Pulses[0].usDelay = static_cast<uint32_t>(l_WidthUS);
+
+			l_Pulses[1].gpioOn = p_Pins & p_RestingLevels;
+			l_Pulses[1].gpioOff = p_Pins & ~p_RestingLevels;
+			l_Pulses[1].usDelay = 0;
+
+			gpioWaveAddNew();
+
+			if (gpioWaveAddGeneric(2, l_Pulses) < 0)
+			{
+				return false;
+			}
+
+			auto const l_WaveID = gpioWaveCreate();
+
+			if (l_WaveID < 0)
+			{
+				LoggerAddMessage("Failed to create a GPIO waveform with error %d.", l_WaveID);
+				return false;
+			}
+
+			m_WaveID = l_WaveID;
+
+			if (gpioWaveTxSend(m_WaveID, PI_WAVE_MODE_ONE_SHOT) < 0)
+			{
+				DeleteWave();
+				return false;
+			}
+
+			m_PulsePins = p_Pins;
+			return true;
+		}
+
+	private:
+
+		// Constants.
+		static constexpr int ms_InvalidWaveID = -1;
+
+		// Stop sending the current pulse, if it hasn't finished, leaving its pins where they are.
+		//
+		void StopPulse()
+		{
+			if ((m_PulsePins != 0) && (gpioWaveTxBusy() != 0))
+			{
+				gpioWaveTxStop();
+			}
+
+			m_PulsePins = 0;
+		}
+
+		// Free the waveform of the last pulse.
+		//
+		void DeleteWave()
+		{
+			if (m_WaveID == ms_InvalidWaveID)
+			{
+				return;
+			}
+
+			gpioWaveDelete(m_WaveID);
+			m_WaveID = ms_InvalidWaveID;
+		}
+
+		// The waveform of the last pulse.
+		int m_WaveID = ms_InvalidWaveID;
+
+		// The pins of the pulse that may still be being sent.
+		GPIOPinSet m_PulsePins = 0;
+};
+
+// Functions
+//
+
+// Create a backend that uses pigpio. This is only available if pigpio was found when configuring.
+//
+// Returns:	The backend.
+//
+std::unique_ptr<GPIOBackend> GPIOCreatePigpioBackend()
+{
+	return std::unique_ptr<GPIOBackend>(new GPIOPigpioBackend());
+}
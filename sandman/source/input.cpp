@@ -1,20 +1,30 @@
 #include "input.h"
 
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/input.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "logger.h"
 #include "notification.h"
+#include "queue.h"
+#include "reactor.h"
 #include "timer.h"
+#include "trace.h"
 #include "xml.h"
 
 #define DATADIR		AM_DATADIR
@@ -22,18 +32,118 @@
 // Constants
 //
 
+// Where input devices appear, and what the names of their event device files start with.
+#define INPUT_DEVICE_DIRECTORY			"/dev/input"
+#define INPUT_EVENT_DEVICE_PREFIX		"event"
+
+// How many messages from the input thread can be waiting to be logged, and how long each can be.
+#define INPUT_LOG_QUEUE_CAPACITY		(16)
+#define INPUT_LOG_MESSAGE_CAPACITY		(256)
 
 // Types
 //
 
+// A message from the input thread, waiting for the main thread to log it.
+struct InputLogMessage
+{
+	char	m_Text[INPUT_LOG_MESSAGE_CAPACITY];
+};
 
 // Locals
 //
 
+// The input thread never logs itself, since logging takes a lock and writes the file, and a button
+// being let go mustn't wait on either. Its messages wait here for the main thread instead.
+static SPSCQueue<InputLogMessage, INPUT_LOG_QUEUE_CAPACITY> s_InputLogQueue;
+
+// Counts messages that didn't fit, so the main thread can say so.
+static std::atomic<unsigned int> s_InputDroppedLogMessageCount(0);
+
+// Wakes the main thread when there are messages to log.
+static int s_InputLogWakeFileHandle = -1;
 
 // Functions
 //
 
+// Hand a message to the main thread to log. Only the input thread may call this.
+//
+// p_Format:	Standard printf format string.
+// ...:			Standard printf arguments.
+//
+static void InputPostLogMessage(char const* p_Format, ...)
+{
+	InputLogMessage l_Message;
+
+	va_list l_Arguments;
+	va_start(l_Arguments, p_Format);
+	vsnprintf(l_Message.m_Text, sizeof(l_Message.m_Text), p_Format, l_Arguments);
+	va_end(l_Arguments);
+
+	if (s_InputLogQueue.Push(l_Message) == false)
+	{
+		s_InputDroppedLogMessageCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	if (s_InputLogWakeFileHandle >= 0)
+	{
+		uint64_t const l_Increment = 1;
+		write(s_InputLogWakeFileHandle, &l_Increment, sizeof(l_Increment));
+	}
+}
+
+// Log the messages that the input thread has handed over. Only the main thread may call this.
+//
+static void InputLogPostedMessages()
+{
+	InputLogMessage l_Message;
+
+	while (s_InputLogQueue.Pop(l_Message) == true)
+	{
+		LoggerAddMessage("%s", l_Message.m_Text);
+	}
+
+	auto const l_DroppedMessageCount = s_InputDroppedLogMessageCount.exchange(0, 
+		std::memory_order_relaxed);
+
+	if (l_DroppedMessageCount > 0)
+	{
+		LoggerAddMessage("Dropped %u input messages because the log queue was full.", 
+			l_DroppedMessageCount);
+	}
+}
+
+// Read a vendor or product ID from XML. These are usually given in hexadecimal, so either base is
+// accepted.
+//
+// p_ID:			(Output) The ID.
+// p_Document:	The XML document that the node belongs to.
+// p_Node:		The XML node to read the ID from.
+//	
+// Returns:		True if the ID was read successfully, false otherwise.
+//
+static bool InputReadIDFromXML(unsigned short& p_ID, xmlDocPtr p_Document, xmlNodePtr p_Node)
+{
+	static constexpr unsigned int s_TextCapacity = 16;
+	char l_Text[s_TextCapacity];
+
+	if (XMLCopyNodeText(l_Text, s_TextCapacity, p_Document, p_Node) == false)
+	{
+		return false;
+	}
+
+	char* l_End = nullptr;
+	auto const l_ID = strtoul(l_Text, &l_End, 0);
+
+	if ((l_End == l_Text) || (*l_End != '\0') || (l_ID == 0) || (l_ID > USHRT_MAX))
+	{
+		LoggerAddMessage("Input device ID \"%s\" isn't valid.", l_Text);
+		return false;
+	}
+
+	p_ID = static_cast<unsigned short>(l_ID);
+	return true;
+}
+
 
 // InputBinding members
 
@@ -57,6 +167,16 @@ bool InputBinding::ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node)
 	
 	// Read the key code from the node.
 	m_KeyCode = XMLGetNodeTextAsInteger(p_Document, l_KeyCodeNode);
+
+	// There may be a modifier.
+	static auto const* s_ModifierKeyCodeNodeName = "ModifierKeyCode";
+	auto* l_ModifierKeyCodeNode = XMLFindNextNodeByName(p_Node->xmlChildrenNode, 
+		s_ModifierKeyCodeNodeName);
+
+	if (l_ModifierKeyCodeNode != nullptr)
+	{
+		m_ModifierKeyCode = XMLGetNodeTextAsInteger(p_Document, l_ModifierKeyCodeNode);
+	}
 	
 	// We must also have a control action.
 	static auto const* s_ControlActionNodeName = "ControlAction";
@@ -76,114 +196,337 @@ bool InputBinding::ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node)
 	return true;
 }
 	
-// Input members
+// InputDeviceConfig members
 
-// Handle initialization.
+// Read an input device config from XML. 
 //
-// p_DeviceName:	The name of the input device that this will manage.
-// p_Bindings:		A list of input bindings.
+// p_Document:	The XML document that the node belongs to.
+// p_Node:		The XML node to read the input device config from.
+//	
+// Returns:		True if the config was read successfully, false otherwise.
 //
-void Input::Initialize(char const* p_DeviceName, std::vector<InputBinding> const& p_Bindings)
+bool InputDeviceConfig::ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node)
 {
-	// Copy the device name.
-	strncpy(m_DeviceName, p_DeviceName, ms_DeviceNameCapacity - 1);
-	m_DeviceName[ms_DeviceNameCapacity - 1] = '\0';
-	
-	// Populate the input bindings.
-	m_Bindings = p_Bindings;
-	
-	// Use the bindings to populate the input to action mapping.
-	for (const auto& l_Binding : m_Bindings) 
+	// Let's go through the input device settings and try to load those in.
+	auto l_SettingNode = p_Node->xmlChildrenNode;
+	for (; l_SettingNode != nullptr; l_SettingNode = l_SettingNode->next)
+	{
+		// See if this is the device file.
+		static auto const* s_DeviceNameNodeName = "DeviceName";
+		if (XMLIsNodeNamed(l_SettingNode, s_DeviceNameNodeName) == true)
+		{			
+			XMLCopyNodeText(m_DeviceName, ms_DeviceNameCapacity, p_Document, l_SettingNode);
+			continue;
+		}
+
+		// See if this is the name the device reports.
+		static auto const* s_NameNodeName = "Name";
+		if (XMLIsNodeNamed(l_SettingNode, s_NameNodeName) == true)
+		{			
+			XMLCopyNodeText(m_Name, ms_NameCapacity, p_Document, l_SettingNode);
+			continue;
+		}
+
+		// See if these are the IDs the device reports.
+		static auto const* s_VendorIDNodeName = "VendorID";
+		if (XMLIsNodeNamed(l_SettingNode, s_VendorIDNodeName) == true)
+		{
+			if (InputReadIDFromXML(m_VendorID, p_Document, l_SettingNode) == false)
+			{
+				return false;
+			}
+
+			continue;
+		}
+
+		static auto const* s_ProductIDNodeName = "ProductID";
+		if (XMLIsNodeNamed(l_SettingNode, s_ProductIDNodeName) == true)
+		{
+			if (InputReadIDFromXML(m_ProductID, p_Document, l_SettingNode) == false)
+			{
+				return false;
+			}
+
+			continue;
+		}
+		
+		// See if this is a set of input bindings.
+		static auto const* s_BindingsNodeName = "Bindings";
+		if (XMLIsNodeNamed(l_SettingNode, s_BindingsNodeName) == true)
+		{
+			// Clear the list so that if there are multiple sets of bindings, we always take the 
+			// last ones.
+			m_Bindings.clear();
+
+			// Let's go through the bindings and try to load those in.
+			static auto const* s_BindingNodeName = "Binding";
+			XMLForEachNodeNamed(l_SettingNode->xmlChildrenNode, s_BindingNodeName, 
+				[&](xmlNodePtr p_BindingNode)
+			{						
+				// Try to read the binding.
+				InputBinding l_Binding;
+				if (l_Binding.ReadFromXML(p_Document, p_BindingNode) == false)
+				{
+					return;
+				}
+				
+				// If we successfully read a binding, add it to the list.
+				m_Bindings.push_back(l_Binding);
+			});				
+
+			continue;
+		}
+	}
+
+	// Without anything to match, we would grab whatever got plugged in first.
+	if ((m_DeviceName[0] == '\0') && (m_Name[0] == '\0') && (m_VendorID == 0) && (m_ProductID == 0))
 	{
-		// Blindly insert. If the same key is bound more than once, the mapping will get overwritten 
-		// with the last occurrence.
-		m_InputToActionMap[l_Binding.m_KeyCode] = l_Binding.m_ControlAction;
+		LoggerAddMessage("Input device doesn't say which device to read.");
+		return false;
 	}
+
+	return true;
+}
+
+// InputDevice members
+
+// Handle initialization.
+//
+// p_Config:	Which device to read and what its inputs do.
+//
+void InputDevice::Initialize(InputDeviceConfig const& p_Config)
+{
+	m_Config = p_Config;
+
+	// The dispatch table is all that is needed of the bindings from here on.
+	m_Config.m_Bindings.clear();
+	m_Config.m_Bindings.shrink_to_fit();
 	
 	// Display what we initialized.
-	LoggerAddMessage("Initialized input device \'%s\' with input bindings:", m_DeviceName);
-	
-	for (auto const& l_Binding : m_Bindings) 
+	LoggerAddMessage("Initialized input device matching:");
+
+	if (m_Config.m_DeviceName[0] != '\0')
 	{
-		auto* const l_ActionText = 
-			(l_Binding.m_ControlAction.m_Action == Control::Actions::ACTION_MOVING_UP) ? "up" : "down";
-		
-		LoggerAddMessage("\tCode %i -> %s, %s", l_Binding.m_KeyCode, 
-			l_Binding.m_ControlAction.m_ControlName, l_ActionText);
+		LoggerAddMessage("\tDevice file \'%s\'", m_Config.m_DeviceName);
+	}
+
+	if (m_Config.m_Name[0] != '\0')
+	{
+		LoggerAddMessage("\tName \'%s\'", m_Config.m_Name);
 	}
+
+	if (m_Config.m_VendorID != 0)
+	{
+		LoggerAddMessage("\tVendor 0x%x", m_Config.m_VendorID);
+	}
+
+	if (m_Config.m_ProductID != 0)
+	{
+		LoggerAddMessage("\tProduct 0x%x", m_Config.m_ProductID);
+	}
+
+	LoggerAddMessage("With input bindings:");
+
+	CompileBindings(p_Config.m_Bindings);
 	
 	LoggerAddMessage("");
 }
 
+// Turn the bindings into the dispatch table, so that nothing has to be looked up when a key changes.
+//
+// p_Bindings:	The bindings.
+//
+void InputDevice::CompileBindings(std::vector<InputBinding> const& p_Bindings)
+{
+	static_assert(KEY_CNT <= ms_KeyCodeCapacity, "There are more key codes than can be bound.");
+
+	memset(m_KeyModifierBits, 0, sizeof(m_KeyModifierBits));
+	memset(m_HeldKeyLayers, ms_NotHeldLayer, sizeof(m_HeldKeyLayers));
+	m_HeldModifiers = 0;
+	m_HeldKeyCount = 0;
+
+	// Give each modifier a layer of its own, in the order they first appear.
+	unsigned int l_ModifierCount = 0;
+
+	for (auto const& l_Binding : p_Bindings) 
+	{
+		auto const l_ModifierKeyCode = l_Binding.m_ModifierKeyCode;
+
+		if ((l_ModifierKeyCode == 0) || (l_ModifierKeyCode >= ms_KeyCodeCapacity) || 
+			(m_KeyModifierBits[l_ModifierKeyCode] != 0))
+		{
+			continue;
+		}
+
+		if (l_ModifierCount == ms_ModifierCapacity)
+		{
+			LoggerAddMessage("\tModifier %i is ignored, since there can only be %u.", 
+				l_ModifierKeyCode, ms_ModifierCapacity);
+			continue;
+		}
+
+		m_KeyModifierBits[l_ModifierKeyCode] = static_cast<unsigned char>(1 << l_ModifierCount);
+		l_ModifierCount++;
+	}
+
+	m_DispatchTable.assign((l_ModifierCount + 1) * ms_KeyCodeCapacity, InputDispatchEntry());
+
+	for (auto const& l_Binding : p_Bindings) 
+	{
+		auto const l_KeyCode = l_Binding.m_KeyCode;
+		auto const l_ModifierKeyCode = l_Binding.m_ModifierKeyCode;
+		auto const& l_ControlAction = l_Binding.m_ControlAction;
+
+		if ((l_KeyCode >= ms_KeyCodeCapacity) || (l_ModifierKeyCode >= ms_KeyCodeCapacity))
+		{
+			LoggerAddMessage("\tCode %i is out of range.", 
+				(l_KeyCode >= ms_KeyCodeCapacity) ? l_KeyCode : l_ModifierKeyCode);
+			continue;
+		}
+
+		if (m_KeyModifierBits[l_KeyCode] != 0)
+		{
+			LoggerAddMessage("\tCode %i is a modifier, so it can't also be bound.", l_KeyCode);
+			continue;
+		}
+
+		// The modifier may have been one too many.
+		auto const l_ModifierBit = m_KeyModifierBits[l_ModifierKeyCode];
+
+		if ((l_ModifierKeyCode != 0) && (l_ModifierBit == 0))
+		{
+			continue;
+		}
+
+		// Look the control up now, rather than every time the key changes.
+		auto* const l_Control = Control::GetFromHandle(Control::GetHandle(
+			l_ControlAction.m_ControlName));
+
+		if (l_Control == nullptr)
+		{
+			LoggerAddMessage("\tCouldn't find control \'%s\' mapped to key code %i.", 
+				l_ControlAction.m_ControlName, l_KeyCode);
+			continue;
+		}
+
+		auto const l_Layer = (l_ModifierBit == 0) ? 0 : __builtin_ctz(l_ModifierBit) + 1;
+
+		// If the same key is bound more than once in a layer, the last occurrence wins.
+		auto& l_Entry = m_DispatchTable[(l_Layer * ms_KeyCodeCapacity) + l_KeyCode];
+		l_Entry.m_Control = l_Control;
+		l_Entry.m_Action = l_ControlAction.m_Action;
+
+		auto* const l_ActionText = 
+			(l_ControlAction.m_Action == Control::Actions::ACTION_MOVING_UP) ? "up" : "down";
+
+		if (l_ModifierKeyCode == 0)
+		{
+			LoggerAddMessage("\tCode %i -> %s, %s", l_KeyCode, l_ControlAction.m_ControlName, 
+				l_ActionText);
+		}
+		else
+		{
+			LoggerAddMessage("\tCode %i with %i held -> %s, %s", l_KeyCode, l_ModifierKeyCode, 
+				l_ControlAction.m_ControlName, l_ActionText);
+		}
+	}
+}
+
 // Handle uninitialization.
 //
-void Input::Uninitialize()
+void InputDevice::Uninitialize()
 {
 	// Make sure the device file is closed.
-	CloseDevice(false, nullptr);
+	CloseDevice();
 }
 
-// Process a tick.
+// Determine whether a device is the one that this should read.
+//
+// p_DeviceName:	The device file.
+// p_Name:			The name that the device reports.
+// p_VendorID:		The vendor ID that the device reports.
+// p_ProductID:	The product ID that the device reports.
 //
-void Input::Process()
+// Returns:			True if the device matches, false otherwise.
+//
+bool InputDevice::Matches(char const* p_DeviceName, char const* p_Name, unsigned short p_VendorID, 
+	unsigned short p_ProductID) const
 {
-	// See if we need to open the device.
-	if (m_DeviceFileHandle == ms_InvalidFileHandle) {
-		
-		// If we have failed before, see whether we have waited long enough before trying to open 
-		// again.
-		if (m_DeviceOpenHasFailed == true)
-		{		
-			// Get elapsed time since the last failure.
-			Time l_CurrentTime;
-			TimerGetCurrent(l_CurrentTime);
-
-			auto const l_ElapsedTimeMS = TimerGetElapsedMilliseconds(m_LastDeviceOpenFailTime, 
-				l_CurrentTime);
-			
-			if (l_ElapsedTimeMS < ms_DeviceOpenRetryDelayMS)
-			{
-				return;
-			}
+	if (m_Config.m_DeviceName[0] != '\0')
+	{
+		// The configured file may be a link, such as one under /dev/input/by-id, so compare where it 
+		// leads now rather than its name.
+		char l_ResolvedName[PATH_MAX];
+		if (realpath(m_Config.m_DeviceName, l_ResolvedName) == nullptr)
+		{
+			return false;
 		}
 
-		// We open in nonblocking mode so that we don't hang waiting for input.
-		m_DeviceFileHandle = open(m_DeviceName, O_RDONLY | O_NONBLOCK);
-		
-		if (m_DeviceFileHandle < 0) 
+		if (strcmp(l_ResolvedName, p_DeviceName) != 0)
 		{
-			// Record the time of the last open failure.
-			TimerGetCurrent(m_LastDeviceOpenFailTime);
-			
-			CloseDevice(true, "Failed to open input device \'%s\'", m_DeviceName);						
-			return;
-		}
-		
-		// Try to get the name.
-		char l_Name[256];
-		if (ioctl(m_DeviceFileHandle, EVIOCGNAME(sizeof(l_Name)), l_Name) < 0)
-		{	
-			// Record the time of the last open failure.
-			TimerGetCurrent(m_LastDeviceOpenFailTime);
-					
-			CloseDevice(true, "Failed to get name for input device \'%s\'", m_DeviceName);
+			return false;
 		}
-		
-		LoggerAddMessage("Input device \'%s\' is a \'%s\'", m_DeviceName, l_Name);
-		
-		// More device information.
-		unsigned short l_DeviceID[4];
-		ioctl(m_DeviceFileHandle, EVIOCGID, l_DeviceID);
-		
-		LoggerAddMessage("Input device bus 0x%x, vendor 0x%x, product 0x%x, version 0x%x.", 
-			l_DeviceID[ID_BUS], l_DeviceID[ID_VENDOR], l_DeviceID[ID_PRODUCT], l_DeviceID[ID_VERSION]);
-			
-		// Play controller connected notification.
-		NotificationPlay("control_connected");
-			
-		m_DeviceOpenHasFailed = false;
 	}
-	
+
+	if ((m_Config.m_Name[0] != '\0') && (strcmp(m_Config.m_Name, p_Name) != 0))
+	{
+		return false;
+	}
+
+	if ((m_Config.m_VendorID != 0) && (m_Config.m_VendorID != p_VendorID))
+	{
+		return false;
+	}
+
+	if ((m_Config.m_ProductID != 0) && (m_Config.m_ProductID != p_ProductID))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+// Start reading events from a device, taking it for ourselves so that nothing else acts on its 
+// buttons.
+//
+// p_DeviceName:		The device file.
+// p_FileHandle:		The open device file, which this now owns.
+//
+void InputDevice::Attach(char const* p_DeviceName, int p_FileHandle)
+{
+	CloseDevice();
+
+	strncpy(m_DeviceName, p_DeviceName, InputDeviceConfig::ms_DeviceNameCapacity - 1);
+	m_DeviceName[InputDeviceConfig::ms_DeviceNameCapacity - 1] = '\0';
+
+	m_DeviceFileHandle = p_FileHandle;
+	m_EventsWereDropped = false;
+	m_HeldModifiers = 0;
+
+	// Otherwise the console or a desktop might also act on the buttons. It still works without, so 
+	// carry on if something else already has it.
+	if (ioctl(m_DeviceFileHandle, EVIOCGRAB, 1) < 0)
+	{
+		InputPostLogMessage("Input device '%s' couldn't be taken for ourselves with error %i.", 
+			m_DeviceName, errno);
+	}
+
+	// Events are stamped with the wall clock by default, but we want to know how long ago they 
+	// happened by our own clock.
+	int l_ClockID = CLOCK_MONOTONIC;
+	m_EventTimesAreMonotonic = (ioctl(m_DeviceFileHandle, EVIOCSCLOCKID, &l_ClockID) == 0);
+
+	if (m_EventTimesAreMonotonic == false)
+	{
+		InputPostLogMessage("Input device '%s' can't use the monotonic clock for event times.", 
+			m_DeviceName);
+	}
+}
+
+// Read and handle any pending input events from the device.
+//
+void InputDevice::ReadEvents()
+{
 	// Read up to 64 input events at a time.
 	static unsigned int const s_EventsToReadCount = 64;
 	input_event l_Events[s_EventsToReadCount];
@@ -192,7 +535,7 @@ void Input::Process()
 	
 	auto const l_ReadCount = read(m_DeviceFileHandle, l_Events, s_EventBufferSize);
 	
-	// I think maybe this would happen if the device got disconnected?
+	// This is what happens when the device is unplugged.
 	if (l_ReadCount < 0)
 	{		
 		// When we are in nonblocking mode, this "error" means that there was no data and 
@@ -202,7 +545,10 @@ void Input::Process()
 			return;
 		}
 		
-		CloseDevice(true, "Failed to read from input device \'%s\'", m_DeviceName);
+		// It will be picked up again when it comes back.
+		InputPostLogMessage("Failed to read from input device \'%s\' with error %i.", m_DeviceName, 
+			errno);
+		CloseDevice();
 		return;
 	}
 	
@@ -211,89 +557,643 @@ void Input::Process()
 	for (unsigned int l_EventIndex = 0; l_EventIndex < l_EventCount; l_EventIndex++)
 	{
 		auto const& l_Event = l_Events[l_EventIndex];
-		
-		// We are only handling keys/buttons for now.
-		if (l_Event.type != EV_KEY)
+
+		// If the kernel ran out of room for events, everything up to the end of the report is 
+		// unreliable, and a release may have been lost.
+		if (l_Event.type == EV_SYN)
 		{
+			if (l_Event.code == SYN_DROPPED)
+			{
+				m_EventsWereDropped = true;
+			}
+			else if ((l_Event.code == SYN_REPORT) && (m_EventsWereDropped == true))
+			{
+				m_EventsWereDropped = false;
+				ResynchronizeKeys();
+			}
+
 			continue;
 		}
-		
-		//LoggerAddMessage("Input event type %i, code %i, value %i", l_Event.type, l_Event.code, 
-		//	l_Event.value);
-			
-		// Try to find a control action corresponding to this input.
-		auto l_Result = m_InputToActionMap.find(l_Event.code);
-		
-		if (l_Result == m_InputToActionMap.end())
+
+		if (m_EventsWereDropped == true)
 		{
 			continue;
 		}
 		
-		// The action is the second member of the pair.
-		auto& l_ControlAction = l_Result->second;
-	
-		// Try to find the corresponding control.
-		auto* l_Control = l_ControlAction.GetControl();
-		
-		if (l_Control == nullptr) {
-			
-			LoggerAddMessage("Couldn't find control \'%s\' mapped to key code %i.", 
-				l_ControlAction.m_ControlName, l_Event.code);
+		// We are only handling keys/buttons for now. Repeats of a held key change nothing.
+		if ((l_Event.type != EV_KEY) || (l_Event.value == 2))
+		{
 			continue;
 		}
 		
-		// Translate whether the key was pressed or not into the appropriate action.
-		auto const l_Action = (l_Event.value == 1) ? l_ControlAction.m_Action : 
-			Control::Actions::ACTION_STOPPED;
-			
-		// Manipulate the control.
-		l_Control->SetDesiredAction(l_Action, Control::Modes::MODE_MANUAL);
+		//LoggerAddMessage("Input event type %i, code %i, value %i", l_Event.type, l_Event.code, 
+		//	l_Event.value);
+
+		// Work out when the button was actually pressed, if we can, so that the time it takes to act
+		// on it can be measured from there.
+		Time l_EventTime;
+
+		if (m_EventTimesAreMonotonic == true)
+		{
+			// The macros work on 32-bit systems with a 64-bit time_t too, where the event has no 
+			// "time" member.
+			l_EventTime = Time(std::chrono::seconds(l_Event.input_event_sec) + 
+				std::chrono::microseconds(l_Event.input_event_usec));
+		}
+		else
+		{
+			TimerGetCurrent(l_EventTime);
+		}
+
+		HandleKey(l_Event.code, (l_Event.value == 1), l_EventTime);
 	}	
 }
 
-// Determine whether the input device is connected.
+// Act on a key being pressed or let go.
 //
-bool Input::IsConnected() const
-{
-	return (m_DeviceFileHandle != ms_InvalidFileHandle);
-}
-		
-// Close the input device.
-// 
-// p_WasFailure:	Whether the device is being closed due to a failure or not.
-// p_Format:		Standard printf format string.
-// ...:				Standard printf arguments.
+// p_KeyCode:		The key.
+// p_IsPressed:	Whether the key is now pressed.
+// p_EventTime:	When the key changed, according to the event.
 //
-void Input::CloseDevice(bool p_WasFailure, char const* p_Format, ...)
+void InputDevice::HandleKey(unsigned short p_KeyCode, bool p_IsPressed, Time const& p_EventTime)
 {
-	// Close the device.
-	if (m_DeviceFileHandle != ms_InvalidFileHandle)
+	if (p_KeyCode >= ms_KeyCodeCapacity)
 	{
-		close(m_DeviceFileHandle);
-		m_DeviceFileHandle = ms_InvalidFileHandle;
-	}
-			
-	// Only log a message/play sound on failure.
-	if (p_WasFailure == false) {
 		return;
 	}
-	
-	// And only if it was the first failure.
-	if (m_DeviceOpenHasFailed == true)
+
+	// Modifiers only pick the layer.
+	auto const l_ModifierBit = m_KeyModifierBits[p_KeyCode];
+
+	if (l_ModifierBit != 0)
 	{
+		if (p_IsPressed == true)
+		{
+			m_HeldModifiers |= l_ModifierBit;
+		}
+		else
+		{
+			m_HeldModifiers &= ~l_ModifierBit;
+		}
+
 		return;
 	}
-	
-	m_DeviceOpenHasFailed = true;	
-	
-	// Log the message.
-	va_list l_Arguments;
-	va_start(l_Arguments, p_Format);
 
-	LoggerAddMessage(p_Format, l_Arguments);	
-	
-	va_end(l_Arguments);
+	// Let go of whatever pressing the key did, even if its modifier has been let go since.
+	unsigned int l_Layer;
+
+	if (p_IsPressed == true)
+	{
+		l_Layer = (m_HeldModifiers == 0) ? 0 : __builtin_ctz(m_HeldModifiers) + 1;
+	}
+	else
+	{
+		l_Layer = m_HeldKeyLayers[p_KeyCode];
+
+		if (l_Layer == ms_NotHeldLayer)
+		{
+			return;
+		}
+	}
+
+	auto const& l_Entry = m_DispatchTable[(l_Layer * ms_KeyCodeCapacity) + p_KeyCode];
+
+	if (l_Entry.m_Control == nullptr)
+	{
+		return;
+	}
+
+	if (p_IsPressed == true)
+	{
+		if (m_HeldKeyLayers[p_KeyCode] == ms_NotHeldLayer)
+		{
+			m_HeldKeyCount++;
+		}
+
+		m_HeldKeyLayers[p_KeyCode] = static_cast<unsigned char>(l_Layer);
+	}
+	else
+	{
+		m_HeldKeyLayers[p_KeyCode] = ms_NotHeldLayer;
+		m_HeldKeyCount--;
+	}
+	
+	// Translate whether the key was pressed or not into the appropriate action.
+	auto const l_Action = (p_IsPressed == true) ? l_Entry.m_Action : Control::Actions::ACTION_STOPPED;
+
+	// Manipulate the control.
+	l_Entry.m_Control->SetHeldAction(l_Action, ControlOrigin(ControlOrigin::SOURCE_BUTTON, 
+		p_EventTime));
+}
+
+// Let go of any keys that aren't pressed any more, and forget any modifiers that aren't held, after 
+// events were dropped.
+//
+void InputDevice::ResynchronizeKeys()
+{
+	unsigned char l_KeyBits[ms_KeyCodeCapacity / 8] = {};
+
+	// If we can't tell, assume the worst.
+	if (ioctl(m_DeviceFileHandle, EVIOCGKEY(sizeof(l_KeyBits)), l_KeyBits) < 0)
+	{
+		ReleaseKeys();
+		return;
+	}
+
+	Time l_CurrentTime;
+	TimerGetCurrent(l_CurrentTime);
+
+	for (unsigned int l_KeyCode = 0; l_KeyCode < ms_KeyCodeCapacity; l_KeyCode++)
+	{
+		auto const l_IsPressed = ((l_KeyBits[l_KeyCode / 8] & (1 << (l_KeyCode % 8))) != 0);
+
+		if (l_IsPressed == true)
+		{
+			continue;
+		}
+
+		// Pressing something new could be a surprise, but letting go never is.
+		if ((m_KeyModifierBits[l_KeyCode] != 0) || (m_HeldKeyLayers[l_KeyCode] != ms_NotHeldLayer))
+		{
+			HandleKey(l_KeyCode, false, l_CurrentTime);
+		}
+	}
+}
+
+// Let go of every key that is held.
+//
+void InputDevice::ReleaseKeys()
+{
+	m_HeldModifiers = 0;
+
+	if (m_HeldKeyCount == 0)
+	{
+		return;
+	}
+
+	Time l_CurrentTime;
+	TimerGetCurrent(l_CurrentTime);
+
+	for (unsigned int l_KeyCode = 0; l_KeyCode < ms_KeyCodeCapacity; l_KeyCode++)
+	{
+		if (m_HeldKeyLayers[l_KeyCode] == ms_NotHeldLayer)
+		{
+			continue;
+		}
+
+		HandleKey(l_KeyCode, false, l_CurrentTime);
+	}
+}
+
+// Determine whether the input device is connected.
+//
+bool InputDevice::IsConnected() const
+{
+	return (m_DeviceFileHandle != ms_InvalidFileHandle);
+}
 		
-	// Play controller disconnected notification.
-	NotificationPlay("control_disconnected");
+// Close the input device, letting go of any keys that are held.
+//
+void InputDevice::CloseDevice()
+{
+	if (m_DeviceFileHandle == ms_InvalidFileHandle)
+	{
+		return;
+	}
+
+	// Nothing will tell us when the buttons are let go now, so don't leave anything moving.
+	ReleaseKeys();
+
+	// This also takes it out of the input thread's wait.
+	close(m_DeviceFileHandle);
+	m_DeviceFileHandle = ms_InvalidFileHandle;
+	m_DeviceName[0] = '\0';
+}
+
+// Input members
+
+// Handle initialization.
+//
+// p_DeviceConfigs:	The devices to look for.
+// p_RealtimeConfig:	The real-time settings, which the input thread shares with the control thread.
+//
+void Input::Initialize(std::vector<InputDeviceConfig> const& p_DeviceConfigs, 
+	RealtimeConfig const& p_RealtimeConfig)
+{
+	// The devices are known to the input thread by index, so they must not move once it starts.
+	m_Devices.clear();
+	m_Devices.resize(p_DeviceConfigs.size());
+	m_DevicesConnected = std::make_unique<std::atomic<bool>[]>(m_Devices.size());
+
+	for (unsigned int l_DeviceIndex = 0; l_DeviceIndex < p_DeviceConfigs.size(); l_DeviceIndex++)
+	{
+		m_Devices[l_DeviceIndex].Initialize(p_DeviceConfigs[l_DeviceIndex]);
+	}
+
+	if (m_Devices.empty() == true)
+	{
+		return;
+	}
+
+	m_EpollFileHandle = epoll_create1(EPOLL_CLOEXEC);
+	m_QuitFileHandle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	m_ConnectionFileHandle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if ((m_EpollFileHandle < 0) || (m_QuitFileHandle < 0) || (m_ConnectionFileHandle < 0))
+	{
+		LoggerAddMessage("Failed to create the input thread's file descriptors.");
+		return;
+	}
+
+	epoll_event l_Event;
+	memset(&l_Event, 0, sizeof(l_Event));
+	l_Event.events = EPOLLIN;
+	l_Event.data.u64 = ms_QuitWakeID;
+
+	epoll_ctl(m_EpollFileHandle, EPOLL_CTL_ADD, m_QuitFileHandle, &l_Event);
+
+	// Start watching before looking at what is already there, so that nothing plugged in between 
+	// gets missed. Device files are created before they are given their final permissions, so watch
+	// for both.
+	m_NotifyFileHandle = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (m_NotifyFileHandle < 0)
+	{
+		LoggerAddMessage("Failed to watch for input devices with error %i. Only devices already "
+			"plugged in will be read.", errno);
+	}
+	else if (inotify_add_watch(m_NotifyFileHandle, INPUT_DEVICE_DIRECTORY, IN_CREATE | IN_ATTRIB) < 0)
+	{
+		LoggerAddMessage("Failed to watch \'%s\' with error %i. Only devices already plugged in will "
+			"be read.", INPUT_DEVICE_DIRECTORY, errno);
+
+		close(m_NotifyFileHandle);
+		m_NotifyFileHandle = ms_InvalidFileHandle;
+	}
+	else
+	{
+		l_Event.data.u64 = ms_NotifyWakeID;
+		epoll_ctl(m_EpollFileHandle, EPOLL_CTL_ADD, m_NotifyFileHandle, &l_Event);
+	}
+
+	// Messages are logged and notifications are spoken from the main thread.
+	s_InputLogWakeFileHandle = m_ConnectionFileHandle;
+
+	ReactorAddFileDescriptor(m_ConnectionFileHandle, [this]()
+	{
+		uint64_t l_Count = 0;
+		read(m_ConnectionFileHandle, &l_Count, sizeof(l_Count));
+
+		InputLogPostedMessages();
+		PlayConnectionNotifications();
+	});
+
+	m_Thread = std::thread(&Input::ThreadMain, this);
+
+	if (p_RealtimeConfig.m_Enabled == true)
+	{
+		RealtimeConfigureThread(m_Thread.native_handle(), p_RealtimeConfig);
+	}
+}
+
+// Handle uninitialization.
+//
+void Input::Uninitialize()
+{
+	if (m_Thread.joinable() == true)
+	{
+		uint64_t const l_Increment = 1;
+		write(m_QuitFileHandle, &l_Increment, sizeof(l_Increment));
+
+		m_Thread.join();
+	}
+
+	// Log whatever the input thread said last.
+	s_InputLogWakeFileHandle = ms_InvalidFileHandle;
+	InputLogPostedMessages();
+
+	// Any held buttons are let go here, so the controls must still be running.
+	for (auto& l_Device : m_Devices)
+	{
+		l_Device.Uninitialize();
+	}
+
+	m_Devices.clear();
+	m_DevicesConnected.reset();
+	m_ConnectedCount.store(0, std::memory_order_relaxed);
+
+	if (m_ConnectionFileHandle != ms_InvalidFileHandle)
+	{
+		ReactorRemoveFileDescriptor(m_ConnectionFileHandle);
+	}
+
+	for (auto* l_FileHandle : { &m_NotifyFileHandle, &m_QuitFileHandle, &m_ConnectionFileHandle, 
+		&m_EpollFileHandle })
+	{
+		if (*l_FileHandle != ms_InvalidFileHandle)
+		{
+			close(*l_FileHandle);
+			*l_FileHandle = ms_InvalidFileHandle;
+		}
+	}
+}
+
+// Determine whether any input device is connected.
+//
+bool Input::IsConnected() const
+{
+	return (m_ConnectedCount.load(std::memory_order_relaxed) > 0);
+}
+
+// Determine whether a configured input device is connected. Any thread may call this.
+//
+// p_DeviceIndex:	The device.
+//
+// Returns:			True if the device is connected, false otherwise.
+//
+bool Input::IsDeviceConnected(unsigned int p_DeviceIndex) const
+{
+	if (p_DeviceIndex >= m_Devices.size())
+	{
+		return false;
+	}
+
+	return m_DevicesConnected[p_DeviceIndex].load(std::memory_order_relaxed);
+}
+
+// The input thread. It sleeps until a device has events or a device is plugged in.
+//
+void Input::ThreadMain()
+{
+	TraceSetThreadName("input");
+
+	ScanDevices();
+
+	static constexpr unsigned int s_MaxEventsPerWait = 8;
+	epoll_event l_Events[s_MaxEventsPerWait];
+
+	for (;;)
+	{
+		auto const l_EventCount = epoll_wait(m_EpollFileHandle, l_Events, s_MaxEventsPerWait, -1);
+
+		if (l_EventCount < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			InputPostLogMessage("The input thread failed to wait with error %i.", errno);
+			return;
+		}
+
+		for (int l_EventIndex = 0; l_EventIndex < l_EventCount; l_EventIndex++)
+		{
+			auto const l_WakeID = l_Events[l_EventIndex].data.u64;
+
+			if (l_WakeID == ms_QuitWakeID)
+			{
+				return;
+			}
+
+			if (l_WakeID == ms_NotifyWakeID)
+			{
+				ReadNotifications();
+				continue;
+			}
+
+			ReadDeviceEvents(static_cast<unsigned int>(l_WakeID - ms_FirstDeviceWakeID));
+		}
+	}
+}
+
+// Read the events from a device, noticing if that shows it has gone. Only the input thread may call
+// this.
+//
+// p_DeviceIndex:	The device.
+//
+void Input::ReadDeviceEvents(unsigned int p_DeviceIndex)
+{
+	if (p_DeviceIndex >= m_Devices.size())
+	{
+		return;
+	}
+
+	auto& l_Device = m_Devices[p_DeviceIndex];
+
+	// It may have been closed by an earlier event from the same wait.
+	if (l_Device.IsConnected() == false)
+	{
+		return;
+	}
+
+	l_Device.ReadEvents();
+
+	if (l_Device.IsConnected() == true)
+	{
+		return;
+	}
+
+	m_DevicesConnected[p_DeviceIndex].store(false, std::memory_order_relaxed);
+	m_ConnectedCount.fetch_sub(1, std::memory_order_relaxed);
+	m_DisconnectionCount.fetch_add(1, std::memory_order_relaxed);
+	PostConnectionChange();
+}
+
+// Let the main thread know that a device was connected or disconnected. Only the input thread may 
+// call this.
+//
+void Input::PostConnectionChange()
+{
+	uint64_t const l_Increment = 1;
+	write(m_ConnectionFileHandle, &l_Increment, sizeof(l_Increment));
+}
+
+// Play notifications for devices connected or disconnected since the last time. Only the main 
+// thread may call this.
+//
+void Input::PlayConnectionNotifications()
+{
+	auto const l_ConnectionCount = m_ConnectionCount.load(std::memory_order_relaxed);
+	auto const l_DisconnectionCount = m_DisconnectionCount.load(std::memory_order_relaxed);
+
+	if (l_DisconnectionCount != m_NotifiedDisconnectionCount)
+	{
+		m_NotifiedDisconnectionCount = l_DisconnectionCount;
+		NotificationPlay("control_disconnected");
+	}
+
+	if (l_ConnectionCount != m_NotifiedConnectionCount)
+	{
+		m_NotifiedConnectionCount = l_ConnectionCount;
+		NotificationPlay("control_connected");
+	}
+}
+
+// Look at every device that is already plugged in. Only the input thread may call this.
+//
+void Input::ScanDevices()
+{
+	auto* l_Directory = opendir(INPUT_DEVICE_DIRECTORY);
+
+	if (l_Directory == nullptr)
+	{
+		InputPostLogMessage("Failed to list input devices in \'%s\' with error %i.", 
+			INPUT_DEVICE_DIRECTORY, errno);
+		return;
+	}
+
+	static auto const s_PrefixLength = strlen(INPUT_EVENT_DEVICE_PREFIX);
+
+	for (auto* l_Entry = readdir(l_Directory); l_Entry != nullptr; l_Entry = readdir(l_Directory))
+	{
+		if (strncmp(l_Entry->d_name, INPUT_EVENT_DEVICE_PREFIX, s_PrefixLength) != 0)
+		{
+			continue;
+		}
+
+		char l_DeviceName[PATH_MAX];
+		snprintf(l_DeviceName, sizeof(l_DeviceName), INPUT_DEVICE_DIRECTORY "/%s", l_Entry->d_name);
+
+		TryDevice(l_DeviceName);
+	}
+
+	closedir(l_Directory);
+}
+
+// Read and handle notifications of devices being added or changed. Only the input thread may call 
+// this.
+//
+void Input::ReadNotifications()
+{
+	alignas(inotify_event) char l_Buffer[4096];
+
+	auto const l_ReadCount = read(m_NotifyFileHandle, l_Buffer, sizeof(l_Buffer));
+
+	if (l_ReadCount < 0)
+	{
+		if (errno != EAGAIN)
+		{
+			InputPostLogMessage("Failed to read input device notifications with error %i.", errno);
+		}
+
+		return;
+	}
+
+	static auto const s_PrefixLength = strlen(INPUT_EVENT_DEVICE_PREFIX);
+
+	for (ssize_t l_Offset = 0; l_Offset < l_ReadCount; )
+	{
+		auto const* l_Event = reinterpret_cast<inotify_event const*>(l_Buffer + l_Offset);
+		l_Offset += sizeof(inotify_event) + l_Event->len;
+
+		// If notifications were dropped, we don't know what changed, so look at everything.
+		if ((l_Event->mask & IN_Q_OVERFLOW) != 0)
+		{
+			ScanDevices();
+			continue;
+		}
+
+		if ((l_Event->len == 0) || 
+			(strncmp(l_Event->name, INPUT_EVENT_DEVICE_PREFIX, s_PrefixLength) != 0))
+		{
+			continue;
+		}
+
+		char l_DeviceName[PATH_MAX];
+		snprintf(l_DeviceName, sizeof(l_DeviceName), INPUT_DEVICE_DIRECTORY "/%s", l_Event->name);
+
+		TryDevice(l_DeviceName);
+	}
+}
+
+// Open a device and hand it to the first configured device that it matches that isn't connected 
+// yet. Only the input thread may call this.
+//
+// p_DeviceName:	The device file.
+//
+void Input::TryDevice(char const* p_DeviceName)
+{
+	// Don't bother opening anything if we aren't looking for any more devices, or if we already have 
+	// this one (its permissions changing, for example).
+	auto l_AnyDisconnected = false;
+
+	for (auto const& l_Device : m_Devices)
+	{
+		if (l_Device.IsConnected() == false)
+		{
+			l_AnyDisconnected = true;
+			continue;
+		}
+
+		if (strcmp(l_Device.GetDeviceName(), p_DeviceName) == 0)
+		{
+			return;
+		}
+	}
+
+	if (l_AnyDisconnected == false)
+	{
+		return;
+	}
+
+	// We open in nonblocking mode so that we don't hang waiting for input. If this fails, the device
+	// may not have its final permissions yet, and we will hear about it again when it does.
+	auto const l_FileHandle = open(p_DeviceName, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+	if (l_FileHandle < 0) 
+	{
+		return;
+	}
+	
+	// Find out what it is.
+	char l_Name[InputDeviceConfig::ms_NameCapacity] = "";
+	if (ioctl(l_FileHandle, EVIOCGNAME(sizeof(l_Name) - 1), l_Name) < 0)
+	{	
+		close(l_FileHandle);
+		return;
+	}
+	
+	input_id l_DeviceID = {};
+	ioctl(l_FileHandle, EVIOCGID, &l_DeviceID);
+
+	for (auto& l_Device : m_Devices)
+	{
+		if (l_Device.IsConnected() == true)
+		{
+			continue;
+		}
+
+		if (l_Device.Matches(p_DeviceName, l_Name, l_DeviceID.vendor, l_DeviceID.product) == false)
+		{
+			continue;
+		}
+
+		InputPostLogMessage("Input device \'%s\' is a \'%s\'", p_DeviceName, l_Name);
+		InputPostLogMessage("Input device bus 0x%x, vendor 0x%x, product 0x%x, version 0x%x.", 
+			l_DeviceID.bustype, l_DeviceID.vendor, l_DeviceID.product, l_DeviceID.version);
+
+		l_Device.Attach(p_DeviceName, l_FileHandle);
+
+		// Wake up for its events.
+		epoll_event l_Event;
+		memset(&l_Event, 0, sizeof(l_Event));
+		l_Event.events = EPOLLIN;
+		l_Event.data.u64 = ms_FirstDeviceWakeID + (&l_Device - m_Devices.data());
+
+		if (epoll_ctl(m_EpollFileHandle, EPOLL_CTL_ADD, l_FileHandle, &l_Event) < 0)
+		{
+			InputPostLogMessage("Failed to wait on input device \'%s\' with error %i.", p_DeviceName, 
+				errno);
+		}
+
+		m_DevicesConnected[&l_Device - m_Devices.data()].store(true, std::memory_order_relaxed);
+		m_ConnectedCount.fetch_add(1, std::memory_order_relaxed);
+		m_ConnectionCount.fetch_add(1, std::memory_order_relaxed);
+		PostConnectionChange();
+		return;
+	}
+
+	// Nobody wants it.
+	close(l_FileHandle);
 }
@@ -1,12 +1,14 @@
 #pragma once
 
-#include <map>
+#include <atomic>
+#include <memory>
+#include <thread>
 #include <vector>
 
 #include <libxml/parser.h>
 
 #include "control.h"
-#include "timer.h"
+#include "realtime.h"
 
 // Types
 //
@@ -35,72 +37,335 @@ struct InputBinding
 	
 	// The numeric code of the key that should trigger action.
 	unsigned short		m_KeyCode;
+
+	// The numeric code of a key that must be held down for the binding to apply, or 0 for none. 
+	// This lets a small remote do more than it has buttons for.
+	unsigned short		m_ModifierKeyCode = 0;
 	
 	// Action to perform when the input is given. 
 	ControlAction		m_ControlAction;
 };
 
-// Handles dealing with an input device.
+// Describes which input device to read and what its inputs do. A device matches if it has all of 
+// the properties given here.
+struct InputDeviceConfig
+{
+	// Read an input device config from XML. 
+	//
+	// p_Document:	The XML document that the node belongs to.
+	// p_Node:		The XML node to read the input device config from.
+	//	
+	// Returns:		True if the config was read successfully, false otherwise.
+	//
+	bool ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node);
+
+	// Constants.
+	static constexpr unsigned int ms_DeviceNameCapacity = 64;
+	static constexpr unsigned int ms_NameCapacity = 128;
+
+	// The device file to read from (or a link to it), or empty to match any device.
+	char m_DeviceName[ms_DeviceNameCapacity] = "";
+
+	// The name that the device reports, or empty to match any name.
+	char m_Name[ms_NameCapacity] = "";
+
+	// The vendor and product IDs that the device reports, or 0 to match any.
+	unsigned short m_VendorID = 0;
+	unsigned short m_ProductID = 0;
+
+	// The list of input bindings.
+	std::vector<InputBinding> m_Bindings;
+};
+
+// What a key does in one layer of an input device's dispatch table.
+struct InputDispatchEntry
+{
+	// The control to manipulate, or null if the key does nothing.
+	Control*				m_Control = nullptr;
+
+	// The action to perform while the key is held.
+	Control::Actions	m_Action = Control::ACTION_STOPPED;
+};
+
+// Reads events from one input device, once it has been found. Only the input thread may use this 
+// while the input thread is running.
 //
-class Input
+class InputDevice
 {
 	public:
-		
+
 		// Handle initialization.
 		//
-		// p_DeviceName:	The name of the input device that this will manage.
-		// p_Bindings:		A list of input bindings.
+		// p_Config:	Which device to read and what its inputs do.
 		//
-		void Initialize(char const* p_DeviceName, std::vector<InputBinding> const& p_Bindings);
+		void Initialize(InputDeviceConfig const& p_Config);
 
 		// Handle uninitialization.
 		//
 		void Uninitialize();
-		
-		// Process a tick.
+
+		// Determine whether a device is the one that this should read.
 		//
-		void Process();
-		
+		// p_DeviceName:	The device file.
+		// p_Name:			The name that the device reports.
+		// p_VendorID:		The vendor ID that the device reports.
+		// p_ProductID:	The product ID that the device reports.
+		//
+		// Returns:			True if the device matches, false otherwise.
+		//
+		bool Matches(char const* p_DeviceName, char const* p_Name, unsigned short p_VendorID, 
+			unsigned short p_ProductID) const;
+
+		// Start reading events from a device, taking it for ourselves so that nothing else acts on 
+		// its buttons.
+		//
+		// p_DeviceName:		The device file.
+		// p_FileHandle:		The open device file, which this now owns.
+		//
+		void Attach(char const* p_DeviceName, int p_FileHandle);
+
+		// Read and handle any pending input events from the device.
+		//
+		void ReadEvents();
+
 		// Determine whether the input device is connected.
 		//
 		bool IsConnected() const;
-		
+
+		// Get which device to read and what its inputs do. Any thread may call this, since it doesn't
+		// change once the device is initialized.
+		//
+		InputDeviceConfig const& GetConfig() const
+		{
+			return m_Config;
+		}
+
+		// Get the device file that is being read, if the device is connected.
+		//
+		char const* GetDeviceName() const
+		{
+			return m_DeviceName;
+		}
+
+		// Get the device file handle, if the device is connected.
+		//
+		int GetFileHandle() const
+		{
+			return m_DeviceFileHandle;
+		}
+
 	private:
 
 		// Constants.
 		
-		// The maximum length of the device name.
-		static constexpr unsigned int ms_DeviceNameCapacity = 64;
-		
 		// Used to detect when a file handle is invalid.
 		static constexpr int	ms_InvalidFileHandle = -1;
-		
-		// The amount of time to wait between failing to open the device.
-		static constexpr unsigned int ms_DeviceOpenRetryDelayMS = 1000;
-		
-		// Close the input device.
-		// 
-		// p_WasFailure:	Whether the device is being closed due to a failure or not.
-		// p_Format:		Standard printf format string.
-		// ...:				Standard printf arguments.
+
+		// The number of key codes there can be.
+		static constexpr unsigned int ms_KeyCodeCapacity = 0x300;
+
+		// The number of modifier keys there can be, each with a layer of its own.
+		static constexpr unsigned int ms_ModifierCapacity = 8;
+
+		// Marks a key that isn't held.
+		static constexpr unsigned char ms_NotHeldLayer = 0xFF;
+
+		// Turn the bindings into the dispatch table, so that nothing has to be looked up when a key
+		// changes.
 		//
-		void CloseDevice(bool p_WasFailure, char const* p_Format, ...);
+		// p_Bindings:	The bindings.
+		//
+		void CompileBindings(std::vector<InputBinding> const& p_Bindings);
+
+		// Act on a key being pressed or let go.
+		//
+		// p_KeyCode:		The key.
+		// p_IsPressed:	Whether the key is now pressed.
+		// p_EventTime:	When the key changed, according to the event.
+		//
+		void HandleKey(unsigned short p_KeyCode, bool p_IsPressed, Time const& p_EventTime);
+
+		// Let go of any keys that aren't pressed any more, and forget any modifiers that aren't held, 
+		// after events were dropped.
+		//
+		void ResynchronizeKeys();
+
+		// Let go of every key that is held.
+		//
+		void ReleaseKeys();
+
+		// Close the input device, letting go of any keys that are held.
+		//
+		void CloseDevice();
 		
-		// The name of the device to get input from.
-		char m_DeviceName[ms_DeviceNameCapacity];
+		// Which device to read.
+		InputDeviceConfig m_Config;
+
+		// The device file being read.
+		char m_DeviceName[InputDeviceConfig::ms_DeviceNameCapacity] = "";
 		
 		// The device file handle (file descriptor).
 		int m_DeviceFileHandle = ms_InvalidFileHandle;	
+
+		// Whether the device stamps its events with the monotonic clock, so that they can be compared 
+		// with our own times.
+		bool m_EventTimesAreMonotonic = false;
+
+		// Whether the device dropped events, so the rest of the current report should be ignored.
+		bool m_EventsWereDropped = false;
 		
-		// Indicates that the device open has failed before.
-		bool m_DeviceOpenHasFailed = false;
+		// What each key does in each layer, indexed by the layer times the key code capacity plus the
+		// key code. Layer 0 is for when no modifiers are held.
+		std::vector<InputDispatchEntry> m_DispatchTable;
+
+		// For each key, its bit in the modifier mask if it is a modifier, or 0 if it isn't. The layer
+		// of a modifier is its bit index plus 1.
+		unsigned char m_KeyModifierBits[ms_KeyCodeCapacity] = {};
+
+		// The modifiers that are held. The lowest one picks the layer.
+		unsigned char m_HeldModifiers = 0;
+
+		// The layer that each bound key was pressed in, so that letting go of it stops the same 
+		// control even if the modifier was let go first, or the not held marker.
+		unsigned char m_HeldKeyLayers[ms_KeyCodeCapacity];
+
+		// How many bound keys are held.
+		unsigned int m_HeldKeyCount = 0;
+};
+
+// Finds input devices as they are plugged in and hands them to whichever of the configured devices
+// they match, so that any number of them can be read at once. The devices are read on a thread of 
+// their own, which acts on buttons as soon as the kernel reports them.
+//
+class Input
+{
+	public:
 		
-		// A time, so we can tell how long to wait before trying to open the device again.
-		Time m_LastDeviceOpenFailTime;
-				
-		// The list of input bindings.
-		std::vector<InputBinding> m_Bindings;
+		// Handle initialization.
+		//
+		// p_DeviceConfigs:	The devices to look for.
+		// p_RealtimeConfig:	The real-time settings, which the input thread shares with the control
+		//							thread.
+		//
+		void Initialize(std::vector<InputDeviceConfig> const& p_DeviceConfigs, 
+			RealtimeConfig const& p_RealtimeConfig);
+
+		// Handle uninitialization.
+		//
+		void Uninitialize();
 		
-		// A mapping from input to action.
-		std::map<unsigned short, ControlAction> m_InputToActionMap;
+		// Determine whether any input device is connected.
+		//
+		bool IsConnected() const;
+
+		// Get how many input devices are configured.
+		//
+		// Returns:	The number of devices.
+		//
+		unsigned int GetDeviceCount() const
+		{
+			return static_cast<unsigned int>(m_Devices.size());
+		}
+
+		// Get a configured input device. Any thread may use its config, but only the input thread may
+		// use the rest of it.
+		//
+		// p_DeviceIndex:	The device.
+		//
+		// Returns:			The device.
+		//
+		InputDevice const& GetDevice(unsigned int p_DeviceIndex) const
+		{
+			return m_Devices[p_DeviceIndex];
+		}
+
+		// Determine whether a configured input device is connected. Any thread may call this.
+		//
+		// p_DeviceIndex:	The device.
+		//
+		// Returns:			True if the device is connected, false otherwise.
+		//
+		bool IsDeviceConnected(unsigned int p_DeviceIndex) const;
+		
+	private:
+
+		// Constants.
+		
+		// Used to detect when a file handle is invalid.
+		static constexpr int	ms_InvalidFileHandle = -1;
+
+		// What woke the input thread. Anything past these is a device.
+		static constexpr uint64_t ms_QuitWakeID = 0;
+		static constexpr uint64_t ms_NotifyWakeID = 1;
+		static constexpr uint64_t ms_FirstDeviceWakeID = 2;
+
+		// The input thread. It sleeps until a device has events or a device is plugged in.
+		//
+		void ThreadMain();
+
+		// Look at every device that is already plugged in. Only the input thread may call this.
+		//
+		void ScanDevices();
+
+		// Read and handle notifications of devices being added or changed. Only the input thread may
+		// call this.
+		//
+		void ReadNotifications();
+
+		// Open a device and hand it to the first configured device that it matches that isn't 
+		// connected yet. Only the input thread may call this.
+		//
+		// p_DeviceName:	The device file.
+		//
+		void TryDevice(char const* p_DeviceName);
+
+		// Read the events from a device, noticing if that shows it has gone. Only the input thread may
+		// call this.
+		//
+		// p_DeviceIndex:	The device.
+		//
+		void ReadDeviceEvents(unsigned int p_DeviceIndex);
+
+		// Let the main thread know that a device was connected or disconnected. Only the input thread
+		// may call this.
+		//
+		void PostConnectionChange();
+
+		// Play notifications for devices connected or disconnected since the last time. Only the 
+		// main thread may call this.
+		//
+		void PlayConnectionNotifications();
+
+		// The input thread.
+		std::thread m_Thread;
+
+		// What the input thread waits on.
+		int m_EpollFileHandle = ms_InvalidFileHandle;
+
+		// Wakes the input thread to tell it to exit.
+		int m_QuitFileHandle = ms_InvalidFileHandle;
+
+		// Watches the input device directory for devices being added.
+		int m_NotifyFileHandle = ms_InvalidFileHandle;
+
+		// Wakes the main thread when devices are connected or disconnected, or the input thread has 
+		// something to log.
+		int m_ConnectionFileHandle = ms_InvalidFileHandle;
+
+		// The configured devices.
+		std::vector<InputDevice> m_Devices;
+
+		// Whether each of the configured devices is connected, for other threads.
+		std::unique_ptr<std::atomic<bool>[]> m_DevicesConnected;
+
+		// How many devices are connected now, and how many times any have been connected or 
+		// disconnected, for the main thread.
+		std::atomic<unsigned int> m_ConnectedCount{0};
+		std::atomic<unsigned int> m_ConnectionCount{0};
+		std::atomic<unsigned int> m_DisconnectionCount{0};
+
+		// How many times devices had been connected or disconnected when the main thread last played
+		// notifications for them. Only the main thread may use these.
+		unsigned int m_NotifiedConnectionCount = 0;
+		unsigned int m_NotifiedDisconnectionCount = 0;
 };
@@ -1,6 +1,8 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <string>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -9,18 +11,25 @@
 #include <sys/un.h>
 
 #include <ncurses.h>
-#include <pigpio.h>
 
 #include "command.h"
 #include "config.h"
 #include "control.h"
+#include "gpio.h"
 #include "input.h"
 #include "logger.h"
 #include "mqtt.h"
 #include "notification.h"
+#include "reactor.h"
+#include "realtime.h"
 #include "reports.h"
 #include "schedule.h"
+#include "server.h"
+#include "simulation.h"
+#include "stats.h"
+#include "status.h"
 #include "timer.h"
+#include "trace.h"
 
 #define DATADIR	AM_DATADIR
 #define CONFIGDIR	AM_CONFIGDIR
@@ -36,18 +45,35 @@
 // Whether controls have been initialized.
 static bool s_ControlsInitialized = false;
 
-// The input device.
+// The input devices.
 static Input s_Input;
 
 // Whether to start as a daemon or terminal program.
 static bool s_DaemonMode = false;
 
-// Used to listen for connections.
-static int s_ListeningSocket = -1;
+// Whether to run in real-time mode, regardless of the config.
+static bool s_RealtimeMode = false;
+
+// The recorded command stream to simulate, if the program should simulate instead of running.
+static char const* s_SimulationCommandFileName = nullptr;
+
+// The schedule to simulate, if not the usual one.
+static char const* s_SimulationScheduleFileName = nullptr;
+
+// Whether the program should exit.
+static bool s_Done = false;
+
+// Store keyboard input here.
+static constexpr unsigned int s_KeyboardInputBufferCapacity = 128;
+static char s_KeyboardInputBuffer[s_KeyboardInputBufferCapacity];
+static unsigned int s_KeyboardInputBufferSize = 0;
 
 // Functions
 //
 
+static bool ProcessKeyboardInput(char* p_KeyboardInputBuffer, unsigned int& p_KeyboardInputBufferSize, 
+	unsigned int const p_KeyboardInputBufferCapacity);
+
 // Initialize program components.
 //
 // returns:		True for success, false otherwise.
@@ -110,51 +136,6 @@ static bool Initialize()
 		open("dev/null", O_RDWR);
 		open("dev/null", O_RDWR);
 		open("dev/null", O_RDWR);
-		
-		// Now that we are a daemon, set up Unix domain sockets for communication.
-		
-		// Create a listening socket.
-		s_ListeningSocket = socket(AF_UNIX, SOCK_STREAM, 0);
-		
-		if (s_ListeningSocket < 0)
-		{
-			LoggerAddMessage("Failed to create listening socket.");
-			return false;
-		}
-		
-		// Set to non-blocking.
-		if (fcntl(s_ListeningSocket, F_SETFL, O_NONBLOCK) < 0)
-		{
-			LoggerAddMessage("Failed to make listening socket non-blocking.");
-			return false;
-		}
-		
-		sockaddr_un l_ListeningAddress;
-		{
-			l_ListeningAddress.sun_family = AF_UNIX;
-			strncpy(l_ListeningAddress.sun_path, TEMPDIR "sandman.sock", 
-				sizeof(l_ListeningAddress.sun_path) - 1);
-		}
-		
-		// Unlink the file if needed.
-		unlink(l_ListeningAddress.sun_path);
-		
-		// Bind the socket to the file.
-		if (bind(s_ListeningSocket, reinterpret_cast<sockaddr*>(&l_ListeningAddress), 
-			sizeof(sockaddr_un)) < 0)
-		{
-			LoggerAddMessage("Failed to bind listening socket.");
-			return false;
-		}
-		
-		// Mark the socket for listening.
-		if (listen(s_ListeningSocket, 5) < 0)
-		{
-			LoggerAddMessage("Failed to mark listening socket to listen.");
-			return false;
-		}
-		
-		// Sockets setup!	
 	}
 	else
 	{
@@ -182,6 +163,37 @@ static bool Initialize()
 		LoggerEchoToScreen(true);
 	}
 				
+	// Start measuring how long things take.
+	StatsInitialize();
+	TraceSetThreadName("main");
+
+	// Initialize the reactor, which everything else will use to wait for work.
+	if (ReactorInitialize() == false)
+	{
+		return false;
+	}
+
+	if (s_DaemonMode == true)
+	{
+		// Now that we are a daemon, listen for clients on a Unix domain socket.
+		if (ServerInitialize(TEMPDIR "sandman.sock", []() { s_Done = true; }) == false)
+		{
+			return false;
+		}
+	}
+	else
+	{
+		// Handle keyboard input as it comes in.
+		ReactorAddFileDescriptor(STDIN_FILENO, []()
+		{
+			if (ProcessKeyboardInput(s_KeyboardInputBuffer, s_KeyboardInputBufferSize, 
+				s_KeyboardInputBufferCapacity) == true)
+			{
+				s_Done = true;
+			}
+		});
+	}
+
 	// Read the config.
 	Config l_Config;
 	if (l_Config.ReadFromFile(CONFIGDIR "sandman.conf") == false)
@@ -189,9 +201,27 @@ static bool Initialize()
 		return false;
 	}	
 
+	// Run the control path in real-time, if requested.
+	auto l_RealtimeConfig = l_Config.GetRealtimeConfig();
+
+	if (s_RealtimeMode == true)
+	{
+		l_RealtimeConfig.m_Enabled = true;
+	}
+
+	if (l_RealtimeConfig.m_Enabled == true)
+	{
+		LoggerAddMessage("Entering real-time mode...");
+
+		// The control thread gets configured when it starts.
+		RealtimeLockMemory();
+
+		LoggerAddMessage("");
+	}
+
 	LoggerAddMessage("Initializing GPIO support...");
 	
-	if (gpioInitialise() < 0)
+	if (GPIOInitialize(l_Config.GetGPIOConfig()) == false)
 	{
 		LoggerAddMessage("\tfailed");
 		return false;
@@ -200,18 +230,24 @@ static bool Initialize()
 	LoggerAddMessage("\tsucceeded");
 	LoggerAddMessage("");
 			
-	// Initialize MQTT.
-	if (MQTTInitialize() == false) 
+	// Set control durations and limits. This must happen before the control thread starts.
+	Control::SetDurations(std::chrono::milliseconds(l_Config.GetControlMaxMovingDurationMS()), 
+		std::chrono::milliseconds(l_Config.GetControlCoolDownDurationMS()));
+	Control::SetMaxMovingControls(l_Config.GetControlMaxMovingControls());
+
+	// Initialize controls.
+	LoggerAddMessage("Initializing controls...");
+
+	if (ControlsInitialize(l_Config.GetControlConfigs(), l_RealtimeConfig) == false)
 	{
+		LoggerAddMessage("\tfailed");
 		return false;
 	}
 
-	// Initialize controls.
-	ControlsInitialize(l_Config.GetControlConfigs());
+	LoggerAddMessage("\tsucceeded");
+	LoggerAddMessage("");
 
-	// Set control durations.
-	Control::SetDurations(l_Config.GetControlMaxMovingDurationMS(), 
-		l_Config.GetControlCoolDownDurationMS());
+	ControlsSetPostures(l_Config.GetControlPostureConfigs());
 	
 	// Enable all controls.
 	Control::Enable(true);
@@ -219,17 +255,25 @@ static bool Initialize()
 	// Controls have been initialized.
 	s_ControlsInitialized = true;
 	
-	// Initialize the input device.
-	s_Input.Initialize(l_Config.GetInputDeviceName(), l_Config.GetInputBindings());
+	// Start looking for the input devices.
+	s_Input.Initialize(l_Config.GetInputDeviceConfigs(), l_RealtimeConfig);
 	
 	// Initialize the schedule.
 	ScheduleInitialize();
 		
+	// Initialize MQTT. Only voice control and notifications need it, and it connects in the 
+	// background, so it comes after everything else.
+	if (MQTTInitialize() == false) 
+	{
+		return false;
+	}
+
 	// Initialize reports.
 	ReportsInitialize();
 
 	// Initialize the commands.
 	CommandInitialize(s_Input);
+	StatusInitialize(s_Input);
 
 	NotificationPlay("initialized");
 
@@ -240,13 +284,11 @@ static bool Initialize()
 //
 static void Uninitialize()
 {
-	// Close the listening socket, if there was one.
-	if (s_ListeningSocket >= 0)
-	{
-		close(s_ListeningSocket);
-	}
+	// Disconnect any clients and stop listening.
+	ServerUninitialize();
 	
-	// Uninitialize the commands.
+	// Uninitialize status queries and the commands.
+	StatusUninitialize();
 	CommandUninitialize();
 
 	// Uninitialize reports.
@@ -258,6 +300,9 @@ static void Uninitialize()
 	// Uninitialize MQTT.
 	MQTTUninitialize();
 
+	// Uninitialize the input. Any buttons still held are let go, so this comes before the controls.
+	s_Input.Uninitialize();
+
 	if (s_ControlsInitialized == true)
 	{
 		// Disable all controls.
@@ -267,11 +312,11 @@ static void Uninitialize()
 		ControlsUninitialize();
 	}
 		
-	// Uninitialize the input.
-	s_Input.Uninitialize();
-		
 	// Uninitialize GPIO support.
-	gpioTerminate();
+	GPIOUninitialize();
+
+	// Uninitialize the reactor.
+	ReactorUninitialize();
 	
 	// Uninitialize logging.
 	LoggerUninitialize();
@@ -283,34 +328,18 @@ static void Uninitialize()
 	}
 }
 
-// Get keyboard input.
+// Handle a complete command typed on the keyboard.
 //
 // p_KeyboardInputBuffer:			(input/output) The input buffer.
 // p_KeyboardInputBufferSize:		(input/output) How much of the input buffer is in use.
-// p_KeyboardInputBufferCapacity:	The capacity of the input buffer.
 //
 // returns:		True if the quit command was processed, false otherwise.
 //
-static bool ProcessKeyboardInput(char* p_KeyboardInputBuffer, unsigned int& p_KeyboardInputBufferSize, 
-	unsigned int const p_KeyboardInputBufferCapacity)
+static bool ProcessKeyboardCommand(char* p_KeyboardInputBuffer, unsigned int& p_KeyboardInputBufferSize)
 {
-	// Try to get keyboard commands.
-	auto const l_InputKey = getch();
-	if ((l_InputKey == ERR) || (isascii(l_InputKey) == false))
-	{
-		return false;
-	}
-	
-	// Get the character.
-	auto const l_NextChar = static_cast<char>(l_InputKey);
-
-	// Accumulate characters until we get a terminating character or we run out of space.
-	if ((l_NextChar != '\r') && (p_KeyboardInputBufferSize < (p_KeyboardInputBufferCapacity - 1)))
-	{
-		p_KeyboardInputBuffer[p_KeyboardInputBufferSize] = l_NextChar;
-		p_KeyboardInputBufferSize++;
-		return false;
-	}
+	// The command arrived when enter was pressed.
+	Time l_ArrivalTime;
+	TimerGetCurrent(l_ArrivalTime);
 
 	// Terminate the command.
 	p_KeyboardInputBuffer[p_KeyboardInputBufferSize] = '\0';
@@ -321,11 +350,11 @@ static bool ProcessKeyboardInput(char* p_KeyboardInputBuffer, unsigned int& p_Ke
 	// Parse a command.
 
 	// Tokenize the string.
-	std::vector<CommandToken> l_CommandTokens;
+	CommandTokenList l_CommandTokens;
 	CommandTokenizeString(l_CommandTokens, p_KeyboardInputBuffer);
 
 	// Parse command tokens.
-	CommandParseTokens(l_CommandTokens);
+	CommandParseTokens(ControlOrigin(ControlOrigin::SOURCE_KEYBOARD, l_ArrivalTime), l_CommandTokens);
 
 	// Prepare for a new command.
 	p_KeyboardInputBufferSize = 0;
@@ -338,72 +367,51 @@ static bool ProcessKeyboardInput(char* p_KeyboardInputBuffer, unsigned int& p_Ke
 	return false;
 }
 
-// Process socket communication.
+// Get keyboard input.
+//
+// p_KeyboardInputBuffer:			(input/output) The input buffer.
+// p_KeyboardInputBufferSize:		(input/output) How much of the input buffer is in use.
+// p_KeyboardInputBufferCapacity:	The capacity of the input buffer.
 //
-// returns:		True if the quit command was received, false otherwise.
+// returns:		True if the quit command was processed, false otherwise.
 //
-static bool ProcessSocketCommunication()
+static bool ProcessKeyboardInput(char* p_KeyboardInputBuffer, unsigned int& p_KeyboardInputBufferSize, 
+	unsigned int const p_KeyboardInputBufferCapacity)
 {
-	// Attempt to accept an incoming connection.
-	auto const l_ConnectionSocket = accept(s_ListeningSocket, nullptr, nullptr);
-	
-	if (l_ConnectionSocket < 0)
+	// Keep going until there are no more keys, because ncurses may have buffered several.
+	while (true)
 	{
-		return false;
-	}
-	
-	// Got a connection.
-	LoggerAddMessage("Got a new connection.");
-	
-	// Try to read data.
-	static constexpr unsigned int l_MessageBufferCapacity = 100;
-	char l_MessageBuffer[l_MessageBufferCapacity];
-	
-	auto const l_NumReceivedBytes = recv(l_ConnectionSocket, l_MessageBuffer, 
-		l_MessageBufferCapacity - 1, 0);
-	
-	if (l_NumReceivedBytes <= 0)
-	{
-		LoggerAddMessage("Connection closed, error receiving.");
-	
-		// Close the connection.
-		close(l_ConnectionSocket);
-		return false;
-	}
-	
-	// Terminate.
-	l_MessageBuffer[l_NumReceivedBytes] = '\0';
-	
-	LoggerAddMessage("Received \"%s\".", l_MessageBuffer);
-	
-	// Handle the message, if necessary.
-	auto l_Done = false;
-	
-	if (strcmp(l_MessageBuffer, "shutdown") == 0)
-	{
-		l_Done = true;
-	}
-	else
-	{
-		// Parse a command.
+		// Try to get keyboard commands.
+		auto const l_InputKey = getch();
+		if (l_InputKey == ERR)
+		{
+			return false;
+		}
 
-		// Tokenize the message.
-		std::vector<CommandToken> l_CommandTokens;
-		CommandTokenizeString(l_CommandTokens,	l_MessageBuffer);
+		if (isascii(l_InputKey) == false)
+		{
+			continue;
+		}
+
+		// Get the character.
+		auto const l_NextChar = static_cast<char>(l_InputKey);
+
+		// Accumulate characters until we get a terminating character or we run out of space.
+		if ((l_NextChar != '\r') && (p_KeyboardInputBufferSize < (p_KeyboardInputBufferCapacity - 1)))
+		{
+			p_KeyboardInputBuffer[p_KeyboardInputBufferSize] = l_NextChar;
+			p_KeyboardInputBufferSize++;
+			continue;
+		}
 
-		// Parse command tokens.
-		CommandParseTokens(l_CommandTokens);
+		if (ProcessKeyboardCommand(p_KeyboardInputBuffer, p_KeyboardInputBufferSize) == true)
+		{
+			return true;
+		}
 	}
-	
-	LoggerAddMessage("Connection closed.");
-	
-	// Close the connection.
-	close(l_ConnectionSocket);
-	
-	return l_Done;
 }
 
-// Send a message to the daemon process.
+// Send a message to the daemon process, and print its answer.
 //
 // p_Message:	The message to send.
 //
@@ -419,6 +427,7 @@ static void SendMessageToDaemon(char const* p_Message)
 	}
 	
 	sockaddr_un l_SendingAddress;
+	memset(&l_SendingAddress, 0, sizeof(l_SendingAddress));
 	{
 		l_SendingAddress.sun_family = AF_UNIX;
 		strncpy(l_SendingAddress.sun_path, TEMPDIR "sandman.sock", 
@@ -433,15 +442,41 @@ static void SendMessageToDaemon(char const* p_Message)
 		return;
 	}
 
-	// Send the message.
-	if (send(l_SendingSocket, p_Message, strlen(p_Message), 0) < 0)
+	// Send the message as a line.
+	std::string l_Request(p_Message);
+	l_Request += '\n';
+
+	if (send(l_SendingSocket, l_Request.c_str(), l_Request.size(), MSG_NOSIGNAL) < 0)
 	{
 		printf("Failed to send \"%s\" message to the daemon.\n", p_Message);
 		close(l_SendingSocket);
 		return;	
 	}
 	
-	printf("Sent \"%s\" message to the daemon.\n", p_Message);
+	// Print the answer, which is a line.
+	static constexpr unsigned int l_ResponseBufferCapacity = 1024;
+	char l_ResponseBuffer[l_ResponseBufferCapacity];
+
+	auto l_GotAnswer = false;
+
+	while (l_GotAnswer == false)
+	{
+		auto const l_NumReceivedBytes = recv(l_SendingSocket, l_ResponseBuffer, 
+			l_ResponseBufferCapacity, 0);
+
+		if (l_NumReceivedBytes <= 0)
+		{
+			break;
+		}
+
+		fwrite(l_ResponseBuffer, 1, l_NumReceivedBytes, stdout);
+		l_GotAnswer = (memchr(l_ResponseBuffer, '\n', l_NumReceivedBytes) != nullptr);
+	}
+
+	if (l_GotAnswer == false)
+	{
+		printf("The daemon didn't answer \"%s\".\n", p_Message);
+	}
 	
 	// Close the connection.
 	close(l_SendingSocket);
@@ -464,13 +499,29 @@ static bool HandleCommandLine(char** p_Arguments, int p_ArgumentCount)
 		if (strcmp(l_Argument, "--daemon") == 0)
 		{
 			s_DaemonMode = true;
-			break;
+		}
+		else if (strcmp(l_Argument, "--realtime") == 0)
+		{
+			s_RealtimeMode = true;
 		}
 		else if (strcmp(l_Argument, "--shutdown") == 0)
 		{
 			SendMessageToDaemon("shutdown");
 			return true;
 		}
+		else if (strcmp(l_Argument, "--stats") == 0)
+		{
+			SendMessageToDaemon("stats");
+			return true;
+		}
+		else if (strncmp(l_Argument, "--simulate=", strlen("--simulate=")) == 0)
+		{
+			s_SimulationCommandFileName = l_Argument + strlen("--simulate=");
+		}
+		else if (strncmp(l_Argument, "--schedule=", strlen("--schedule=")) == 0)
+		{
+			s_SimulationScheduleFileName = l_Argument + strlen("--schedule=");
+		}
 		else 
 		{
 			// We are going to see if there is a command to send to the daemon.
@@ -513,6 +564,41 @@ static bool HandleCommandLine(char** p_Arguments, int p_ArgumentCount)
 	return false;
 }
 
+// Replay a recorded command stream and the schedule on simulated hardware, instead of running.
+//
+// Returns:	The exit code for the program.
+//
+static int Simulate()
+{
+	if (LoggerInitialize(TEMPDIR "sandman.simulation.log") == false)
+	{
+		printf("Failed to open the simulation log.\n");
+		return 1;
+	}
+
+	StatsInitialize();
+
+	Config l_Config;
+	if (l_Config.ReadFromFile(CONFIGDIR "sandman.conf") == false)
+	{
+		printf("Failed to read the config.\n");
+		LoggerUninitialize();
+		return 1;
+	}
+
+	auto const l_Succeeded = SimulationRun(l_Config, s_SimulationCommandFileName, 
+		s_SimulationScheduleFileName);
+
+	if (l_Succeeded == false)
+	{
+		printf("Failed to run the simulation. See \"%s\" for details.\n", 
+			TEMPDIR "sandman.simulation.log");
+	}
+
+	LoggerUninitialize();
+	return (l_Succeeded == true) ? 0 : 1;
+}
+
 int main(int argc, char** argv)
 {		
 	// Deal with command line arguments.
@@ -520,6 +606,12 @@ int main(int argc, char** argv)
 	{
 		return 0;
 	}
+
+	// Simulate instead, if asked.
+	if (s_SimulationCommandFileName != nullptr)
+	{
+		return Simulate();
+	}
 	
 	// Initialization.
 	if (Initialize() == false)
@@ -528,69 +620,43 @@ int main(int argc, char** argv)
 		return 0;
 	}
 
-	// Store a keyboard input here.
-	static constexpr unsigned int l_KeyboardInputBufferCapacity = 128;
-	char l_KeyboardInputBuffer[l_KeyboardInputBufferCapacity];
-	unsigned int l_KeyboardInputBufferSize = 0;
-
-	auto l_Done = false;
-	while (l_Done == false)
+	while (s_Done == false)
 	{
-		// We're gonna track the framerate.
-		Time l_FrameStartTime;
-		TimerGetCurrent(l_FrameStartTime);
-		
-		if (s_DaemonMode == false)
-		{
-			// Process keyboard input.
-			l_Done = ProcessKeyboardInput(l_KeyboardInputBuffer, l_KeyboardInputBufferSize, 
-				l_KeyboardInputBufferCapacity);
-		}
+		// Sleep until there is something to do, handling any input that woke us up.
+		ReactorWait();
 
 		// Process command.
-		CommandProcess();
+		{
+			StatsScope l_Probe(STATS_PROBE_COMMAND);
+			CommandProcess();
+		}
 		
 		// Process controls.
-		ControlsProcess();
+		{
+			StatsScope l_Probe(STATS_PROBE_CONTROLS);
+			ControlsProcess();
+		}
 		
-		// Process the input.
-		s_Input.Process();
-
 		// Process MQTT.
-		MQTTProcess();
-		
-		// Process the schedule.
-		ScheduleProcess();
-		
-		// Process the reports.
-		ReportsProcess();
-		
-		if (s_DaemonMode == true)
 		{
-			// Process socket communication.
-			l_Done = ProcessSocketCommunication();
+			StatsScope l_Probe(STATS_PROBE_MQTT);
+			MQTTProcess();
 		}
-
-		// Get the duration of the frame in nanoseconds.
-		Time l_FrameEndTime;
-		TimerGetCurrent(l_FrameEndTime);
-		
-		float const l_FrameDurationMS = TimerGetElapsedMilliseconds(l_FrameStartTime, l_FrameEndTime);
-		auto const l_FrameDurationNS = static_cast<unsigned long>(l_FrameDurationMS * 1.0e6f);
 		
-		// If the frame is shorter than the duration corresponding to the desired framerate, sleep the
-		// difference off.
-		unsigned long const l_TargetFrameDurationNS = 1000000000 / 60;
-		
-		if (l_FrameDurationNS < l_TargetFrameDurationNS)
+		// Process the reports.
 		{
-			timespec l_SleepTime;
-			l_SleepTime.tv_sec = 0;
-			l_SleepTime.tv_nsec = l_TargetFrameDurationNS - l_FrameDurationNS;
-			
-			timespec l_RemainingTime;
-			nanosleep(&l_SleepTime, &l_RemainingTime);
+			StatsScope l_Probe(STATS_PROBE_REPORTS);
+			ReportsProcess();
 		}
+
+		// Measure everything since waking up, including handling whatever woke us.
+		Time l_WakeTime;
+		ReactorGetWakeTime(l_WakeTime);
+
+		Time l_CurrentTime;
+		TimerGetCurrent(l_CurrentTime);
+
+		StatsRecord(STATS_PROBE_FRAME, l_CurrentTime - l_WakeTime);
 	}
 
 	LoggerAddMessage("Uninitializing.");
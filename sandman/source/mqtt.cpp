@@ -1,46 +1,171 @@
 #include "mqtt.h"
 
-#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <random>
+#include <string_view>
 #include <unistd.h>
+#include <sys/eventfd.h>
 
 #include <mosquitto.h> 
-#include "rapidjson/document.h"
+#include "rapidjson/reader.h"
 
 #include "command.h"
 #include "logger.h"
+#include "queue.h"
+#include "reactor.h"
+#include "topic.h"
+#include "trace.h"
 
 #define DATADIR		AM_DATADIR
 
 // Constants
 //
 
+// How many received messages can be waiting for the main thread. This must be a power of two.
+#define MQTT_RECEIVED_MESSAGE_QUEUE_CAPACITY	(16)
+
+// The longest topic and payload of a received message, including their terminators. Intents with
+// many slots are the largest messages we keep, at a few kilobytes.
+#define MQTT_RECEIVED_TOPIC_CAPACITY			(128)
+#define MQTT_RECEIVED_PAYLOAD_CAPACITY			(16 * 1024)
+
+// Where the host is.
+#define MQTT_HOST										"localhost"
+#define MQTT_PORT										(12183)
+#define MQTT_KEEP_ALIVE_SECONDS						(60)
+
+// How long to wait between attempts to connect to the host. The wait grows after each failed 
+// attempt, up to the maximum, so that a host that is slow to start isn't hammered. The first wait 
+// is picked at random between the two shortest delays each time the connection is lost, so that
+// clients that lost the host together don't all come back at the same moment.
+#define MQTT_RECONNECT_MIN_DELAY_SECONDS			(1)
+#define MQTT_RECONNECT_JITTER_DELAY_SECONDS		(4)
+#define MQTT_RECONNECT_MAX_DELAY_SECONDS			(30)
+
 // Types
 //
 
-// A message that we received or need to send later.
+// A message that we need to send later.
 struct MessageInfo
 {
-	// The topic the message was or will be published to.
+	// The topic the message will be published to.
 	std::string	m_Topic;
 
 	// The message payload.
 	std::string	m_Payload;
 };
 
+struct MQTTReceivedMessage;
+
+// How messages on a topic that we subscribe to are handled.
+struct MQTTTopicRoute
+{
+	// The topic filter to subscribe to, which may use wildcards.
+	char const*		m_Filter;
+
+	// Called from the client library's thread as soon as a message arrives, or null. This must be
+	// quick and must only touch what is safe to touch from that thread.
+	void				(*m_ArrivalHandler)(Time const& p_ArrivalTime);
+
+	// Called from the main thread once a message has been handed over, or null if the message 
+	// doesn't need to be.
+	void				(*m_Handler)(MQTTReceivedMessage& p_Message);
+};
+
+// A message that we received, waiting for the main thread. The buffers are a fixed size, so that the
+// client library's thread never allocates, and the payload is parsed in place right where it is.
+struct MQTTReceivedMessage
+{
+	// How the message is handled, already matched from the topic.
+	MQTTTopicRoute const*	m_Route;
+
+	// The topic the message was published to.
+	char				m_Topic[MQTT_RECEIVED_TOPIC_CAPACITY];
+
+	// The message payload, terminated.
+	char				m_Payload[MQTT_RECEIVED_PAYLOAD_CAPACITY];
+
+	// When the message arrived.
+	Time				m_ArrivalTime;
+};
+
+// Reads a dialogue manager message as it is parsed, keeping only the session ID and the reason the
+// session ended. The message must be parsed in place, and must outlive the reader, since nothing is
+// copied out of it.
+class MQTTDialogueManagerReader : 
+	public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, MQTTDialogueManagerReader>
+{
+	public:
+
+		// Handlers called by the parser. Everything else is skipped by the base handler.
+
+		bool StartObject();
+		bool EndObject(rapidjson::SizeType p_MemberCount);
+		bool StartArray();
+		bool EndArray(rapidjson::SizeType p_ElementCount);
+		bool Key(char const* p_String, rapidjson::SizeType p_Length, bool p_Copy);
+		bool String(char const* p_String, rapidjson::SizeType p_Length, bool p_Copy);
+
+		// Accessors.
+
+		char const* GetSessionID() const
+		{
+			return m_SessionID;
+		}
+
+		char const* GetReason() const
+		{
+			return m_Reason;
+		}
+
+	private:
+
+		// The members we look for.
+		enum Keys
+		{
+			KEY_OTHER = 0,
+			KEY_SESSION_ID,	// The session ID of the message.
+			KEY_TERMINATION,	// The termination object of the message.
+			KEY_REASON,			// The reason, in the termination object.
+		};
+
+		// How many objects and arrays deep the parser is. The message itself is 1.
+		unsigned int	m_Depth = 0;
+
+		// The member of the message being read, and the member of the termination being read.
+		Keys				m_MessageKey = KEY_OTHER;
+		Keys				m_Key = KEY_OTHER;
+
+		// The session ID and the reason it ended, or null if they weren't found.
+		char const*		m_SessionID = nullptr;
+		char const*		m_Reason = nullptr;
+};
+
 // Locals
 //
 
 // The client instance.
 static mosquitto* s_MosquittoClient = nullptr;
 
-// Track whether we are connected to the host.
-static bool s_ConnectedToHost = false;
+// Track whether we are connected to the host. This is set from the client library's thread.
+static std::atomic<bool> s_ConnectedToHost(false);
+
+// Track whether we have ever connected to the host, to tell connecting from reconnecting. Only the 
+// client library's thread uses this once it has started.
+static bool s_EverConnectedToHost = false;
 
-// Keep track of whether we have ever seen text-to-speech finish.
-static bool s_FirstTextToSpeechFinished = false;
+// Picks how long to wait before reconnecting. Only the client library's thread uses this once it 
+// has started.
+static std::minstd_rand s_ReconnectDelayGenerator;
 
-// Keep track of the last time text-to-speech finished.
-static Time s_LastTextToSpeechFinishedTime;
+// Keep track of whether we have ever seen text-to-speech finish. This is set from the client 
+// library's thread.
+static std::atomic<bool> s_FirstTextToSpeechFinished(false);
+
+// Keep track of the last time text-to-speech finished. This is set from the client library's thread.
+static std::atomic<Time> s_LastTextToSpeechFinishedTime;
 
 // A list of messages to publish once we are able.
 static std::vector<MessageInfo> s_PendingMessageList;
@@ -48,17 +173,140 @@ static std::vector<MessageInfo> s_PendingMessageList;
 // A list of notifications to post once we are able.
 static std::vector<std::string> s_PendingNotificationList;
 
-// We need to protect access to the list of received messages.
-static std::mutex s_ReceivedMessagesMutex;
+// Messages we have received, from the client library's thread to the main thread.
+static MPSCQueue<MQTTReceivedMessage, MQTT_RECEIVED_MESSAGE_QUEUE_CAPACITY> s_ReceivedMessageQueue;
+
+// Counts received messages that didn't fit, so the main thread can say so.
+static std::atomic<unsigned int> s_DroppedMessageCount(0);
 
-// A list of messages we have received to process when we are able.
-static std::vector<MessageInfo> s_ReceivedMessageList;
+// Used to wake up the main thread when the client thread has something for it.
+static int s_WakeupEventFileDescriptor = -1;
 
 // Keep track of the current dialogue manager session ID.
 static std::string s_DialogueManagerSessionID;
 
+// We use this to tell not only when we are attempting the first notification for the very first 
+// time, but to prevent us from double posting the first notification after we succeed.
+static std::string s_FirstNotification;
+
+// Fires when it is time to reattempt the first notification.
+static TimerHandle s_FirstNotificationTimer;
+
 // If we have command tokens awaiting confirmation, store them here.
-static std::vector<CommandToken> s_CommandTokensPendingConfirmation;
+static CommandTokenList s_CommandTokensPendingConfirmation;
+
+static void MQTTHandleTextToSpeechFinished(Time const& p_ArrivalTime);
+static void MQTTHandleSessionStarted(MQTTReceivedMessage& p_Message);
+static void MQTTHandleSessionEnded(MQTTReceivedMessage& p_Message);
+static void MQTTHandleIntent(MQTTReceivedMessage& p_Message);
+
+// The topics that we subscribe to, and how messages on them are handled. To handle another topic,
+// add a route for it here.
+static MQTTTopicRoute const s_TopicRoutes[] =
+{
+	{ "hermes/tts/sayFinished", MQTTHandleTextToSpeechFinished, nullptr },
+	{ "hermes/dialogueManager/sessionStarted", nullptr, MQTTHandleSessionStarted },
+	{ "hermes/dialogueManager/sessionEnded", nullptr, MQTTHandleSessionEnded },
+	{ "hermes/intent/#", nullptr, MQTTHandleIntent },
+};
+
+// Finds the route for the topic of a message, walking its levels once. It is built before the client
+// library's thread starts, and not changed while it runs.
+static TopicTree<MQTTTopicRoute const*> s_TopicTree;
+
+// MQTTDialogueManagerReader members
+
+// Handle the start of an object.
+//
+// Returns:	True to keep parsing.
+//
+bool MQTTDialogueManagerReader::StartObject()
+{
+	m_Depth++;
+	return true;
+}
+
+// Handle the end of an object.
+//
+// p_MemberCount:	The number of members it had.
+//
+// Returns:	True to keep parsing.
+//
+bool MQTTDialogueManagerReader::EndObject(rapidjson::SizeType p_MemberCount)
+{
+	m_Depth--;
+	return true;
+}
+
+// Handle the start of an array.
+//
+// Returns:	True to keep parsing.
+//
+bool MQTTDialogueManagerReader::StartArray()
+{
+	m_Depth++;
+	return true;
+}
+
+// Handle the end of an array.
+//
+// p_ElementCount:	The number of elements it had.
+//
+// Returns:	True to keep parsing.
+//
+bool MQTTDialogueManagerReader::EndArray(rapidjson::SizeType p_ElementCount)
+{
+	m_Depth--;
+	return true;
+}
+
+// Handle the name of a member.
+//
+// p_String:	The name, which is terminated in place.
+// p_Length:	The length of the name.
+// p_Copy:		Whether the name has to be copied to be kept. It doesn't when parsing in place.
+//
+// Returns:	True to keep parsing.
+//
+bool MQTTDialogueManagerReader::Key(char const* p_String, rapidjson::SizeType p_Length, bool p_Copy)
+{
+	std::string_view const l_Name(p_String, p_Length);
+
+	if (m_Depth == 1)
+	{
+		m_MessageKey = (l_Name == "sessionId") ? KEY_SESSION_ID : (l_Name == "termination") ? 
+			KEY_TERMINATION : KEY_OTHER;
+	}
+	else if ((m_Depth == 2) && (m_MessageKey == KEY_TERMINATION))
+	{
+		m_Key = (l_Name == "reason") ? KEY_REASON : KEY_OTHER;
+	}
+
+	return true;
+}
+
+// Handle a string value.
+//
+// p_String:	The string, which is terminated in place.
+// p_Length:	The length of the string.
+// p_Copy:		Whether the string has to be copied to be kept. It doesn't when parsing in place.
+//
+// Returns:	True to keep parsing.
+//
+bool MQTTDialogueManagerReader::String(char const* p_String, rapidjson::SizeType p_Length, 
+	bool p_Copy)
+{
+	if ((m_Depth == 1) && (m_MessageKey == KEY_SESSION_ID))
+	{
+		m_SessionID = p_String;
+	}
+	else if ((m_Depth == 2) && (m_MessageKey == KEY_TERMINATION) && (m_Key == KEY_REASON))
+	{
+		m_Reason = p_String;
+	}
+
+	return true;
+}
 
 // Functions
 //
@@ -86,6 +334,34 @@ static bool MQTTSubscribeTopic(mosquitto* p_MosquittoClient, const char* p_Topic
 	return true;
 }
 
+// Wake up the main thread so that it will process MQTT. This is safe to call from any thread.
+//
+static void MQTTWakeMainThread()
+{
+	if (s_WakeupEventFileDescriptor < 0)
+	{
+		return;
+	}
+
+	uint64_t const l_Increment = 1;
+	write(s_WakeupEventFileDescriptor, &l_Increment, sizeof(l_Increment));
+}
+
+// Pick a new, random first wait before reconnecting to the host, after which the wait grows as
+// usual. Call this before the client library's thread starts, or from it.
+//
+// p_MosquittoClient:	The client instance.
+//
+static void MQTTRandomizeReconnectDelay(mosquitto* p_MosquittoClient)
+{
+	std::uniform_int_distribution<unsigned int> l_Distribution(MQTT_RECONNECT_MIN_DELAY_SECONDS,
+		MQTT_RECONNECT_JITTER_DELAY_SECONDS);
+
+	static constexpr bool l_ExponentialBackoff = true;
+	mosquitto_reconnect_delay_set(p_MosquittoClient, l_Distribution(s_ReconnectDelayGenerator),
+		MQTT_RECONNECT_MAX_DELAY_SECONDS, l_ExponentialBackoff);
+}
+
 // Handles acknowledgment of a connection.
 //
 // p_MosquittoClient:	The client instance that connected.
@@ -101,12 +377,41 @@ void OnConnectCallback(mosquitto* p_MosquittoClient, void* p_UserData, int p_Ret
 	}
 
 	s_ConnectedToHost = true;
-	LoggerAddMessage("Connected to MQTT host.");
+	LoggerAddMessage((s_EverConnectedToHost == true) ? "Reconnected to MQTT host." : 
+		"Connected to MQTT host.");
+	s_EverConnectedToHost = true;
+
+	// Callbacks come from the client library's thread.
+	TraceSetThreadName("mqtt");
 
-	// Subscribe to the relevant topics.
-	MQTTSubscribeTopic(p_MosquittoClient, "hermes/intent/#");
-	MQTTSubscribeTopic(p_MosquittoClient, "hermes/tts/#");
-	MQTTSubscribeTopic(p_MosquittoClient, "hermes/dialogueManager/#");
+	// Subscribe to the topics that we handle. The host forgets them when we disconnect, because the 
+	// session is clean, so this happens again every time we reconnect.
+	for (auto const& l_Route : s_TopicRoutes)
+	{
+		MQTTSubscribeTopic(p_MosquittoClient, l_Route.m_Filter);
+	}
+
+	// Now that we are connected, pending messages can be sent.
+	MQTTWakeMainThread();
+}
+
+// Handles losing the connection. The client library's thread keeps trying to reconnect on its own,
+// waiting longer after each failed attempt, starting from a random wait.
+//
+// p_MosquittoClient:	The client instance that disconnected.
+// p_UserData:				The user data associated with the client instance.
+// p_ReturnCode:			Zero if we asked to disconnect, otherwise the reason the connection was lost.
+//
+void OnDisconnectCallback(mosquitto* p_MosquittoClient, void* p_UserData, int p_ReturnCode)
+{
+	s_ConnectedToHost = false;
+
+	if (p_ReturnCode != MOSQ_ERR_SUCCESS)
+	{
+		LoggerAddMessage("Lost connection to MQTT host with return code %d. Reconnecting...", 
+			p_ReturnCode);
+		MQTTRandomizeReconnectDelay(p_MosquittoClient);
+	}
 }
 
 // Handles message for a subscribed topic.
@@ -118,48 +423,75 @@ void OnConnectCallback(mosquitto* p_MosquittoClient, void* p_UserData, int p_Ret
 void OnMessageCallback(mosquitto* p_MosquittoClient, void* p_UserData, 
 	const mosquitto_message* p_Message)
 {
+	TraceScope l_TraceScope("MQTT message received");
+
+	Time l_ArrivalTime;
+	TimerGetCurrent(l_ArrivalTime);
+
 	const auto* l_PayloadString = reinterpret_cast<char*>(p_Message->payload);
 	//LoggerAddMessage("Received MQTT message for topic \"%s\": %s", p_Message->topic, 
 	//	l_PayloadString);
 
-	std::string const l_Topic(p_Message->topic);
+	std::string_view const l_Topic(p_Message->topic);
 
-	// Keep track of whether the first text-to-speech finished.
-	if (l_Topic.find("hermes/tts/sayFinished") != std::string::npos)
-	{
-		s_FirstTextToSpeechFinished = true;
+	auto const* const l_FoundRoute = s_TopicTree.Find(l_Topic);
 
-		// Record this time.
-		TimerGetCurrent(s_LastTextToSpeechFinishedTime);
+	if (l_FoundRoute == nullptr)
+	{
+		return;
 	}
 
-	// Helper lambda to save a message to process later.
-	auto l_SaveMessage = [&]()
+	auto const* const l_Route = *l_FoundRoute;
+
+	if (l_Route->m_ArrivalHandler != nullptr)
 	{
-		// Acquire a lock to protect the received message list.
-		std::lock_guard<std::mutex> l_MessageGuard(s_ReceivedMessagesMutex);
+		l_Route->m_ArrivalHandler(l_ArrivalTime);
+	}
 
-		MessageInfo l_Message;
-		l_Message.m_Topic = l_Topic;
-		l_Message.m_Payload = l_PayloadString;
+	// Only messages that have a handler are saved to process later.
+	if (l_Route->m_Handler == nullptr)
+	{
+		return;
+	}
 
-		s_ReceivedMessageList.push_back(l_Message);
-	};
+	// Messages that are too big or arrive faster than the main thread can keep up are dropped rather
+	// than holding up this thread.
+	auto const l_PayloadSize = static_cast<size_t>(std::max(p_Message->payloadlen, 0));
 
-	// Only save certain messages to process later.
-	if (l_Topic.find("hermes/dialogueManager/") != std::string::npos)
+	if ((l_Topic.size() >= MQTT_RECEIVED_TOPIC_CAPACITY) || 
+		(l_PayloadSize >= MQTT_RECEIVED_PAYLOAD_CAPACITY))
 	{
-		l_SaveMessage();
+		s_DroppedMessageCount.fetch_add(1, std::memory_order_relaxed);
+		MQTTWakeMainThread();
 		return;
 	}
 
-	if (l_Topic.find("hermes/intent/") != std::string::npos) 
+	unsigned int l_Position = 0;
+	auto* const l_Message = s_ReceivedMessageQueue.BeginPush(l_Position);
+
+	if (l_Message == nullptr)
 	{
-		l_SaveMessage();
+		s_DroppedMessageCount.fetch_add(1, std::memory_order_relaxed);
+		MQTTWakeMainThread();
 		return;
 	}
+
+	l_Message->m_Route = l_Route;
+
+	memcpy(l_Message->m_Topic, l_Topic.data(), l_Topic.size());
+	l_Message->m_Topic[l_Topic.size()] = '\0';
+
+	memcpy(l_Message->m_Payload, l_PayloadString, l_PayloadSize);
+	l_Message->m_Payload[l_PayloadSize] = '\0';
+
+	l_Message->m_ArrivalTime = l_ArrivalTime;
+
+	s_ReceivedMessageQueue.EndPush(l_Position);
+	MQTTWakeMainThread();
 }
 
+static void MQTTProcessReceivedMessages();
+
 // Initialize MQTT.
 //
 bool MQTTInitialize()
@@ -167,7 +499,9 @@ bool MQTTInitialize()
 	LoggerAddMessage("Initializing MQTT support...");
 
 	s_ConnectedToHost = false;
+	s_EverConnectedToHost = false;
 	s_FirstTextToSpeechFinished = false;
+	s_FirstNotification = "";
 	s_DialogueManagerSessionID = "";
 	
 	if (mosquitto_lib_init() != MOSQ_ERR_SUCCESS)
@@ -179,6 +513,25 @@ bool MQTTInitialize()
 	LoggerAddMessage("\tsucceeded");
 	LoggerAddMessage("");
 
+	// The client thread will use this to wake up the main thread when messages arrive.
+	s_WakeupEventFileDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (s_WakeupEventFileDescriptor < 0)
+	{
+		LoggerAddMessage("Failed to create the MQTT wake up event.");
+		return false;
+	}
+
+	// Received messages are handled as soon as the reactor wakes for them, rather than waiting for
+	// the rest of the loop.
+	ReactorAddFileDescriptor(s_WakeupEventFileDescriptor, []()
+	{
+		uint64_t l_Count = 0;
+		read(s_WakeupEventFileDescriptor, &l_Count, sizeof(l_Count));
+
+		MQTTProcessReceivedMessages();
+	});
+
 	int l_MajorVersion = 0;
 	int l_MinorVersion = 0;
 	int l_Revision = 0;
@@ -200,73 +553,54 @@ bool MQTTInitialize()
 	LoggerAddMessage("\tsucceeded");
 	LoggerAddMessage("");
 
+	// Build the routes before the client library's thread can need them.
+	s_TopicTree.Clear();
+
+	for (auto const& l_Route : s_TopicRoutes)
+	{
+		s_TopicTree.Add(l_Route.m_Filter, &l_Route);
+	}
+
 	// Set some necessary callbacks.
 	mosquitto_connect_callback_set(s_MosquittoClient, OnConnectCallback);
+	mosquitto_disconnect_callback_set(s_MosquittoClient, OnDisconnectCallback);
 	mosquitto_message_callback_set(s_MosquittoClient, OnMessageCallback);
 
+	// The client library's thread reconnects whenever the connection is lost, including when the 
+	// first attempt fails.
+	s_ReconnectDelayGenerator.seed(std::random_device()());
+	MQTTRandomizeReconnectDelay(s_MosquittoClient);
+
+	// Connect in the background, so that nothing else has to wait for the host to start. Until we
+	// are connected, messages and notifications wait to be published.
 	LoggerAddMessage("Connecting to MQTT host...");
 
-	// We are going to repeatedly attempt to connect roughly every second for a 
-	// certain period of time.
-	auto l_Connected = false;
-	
-	Time l_ConnectStartTime;
-	TimerGetCurrent(l_ConnectStartTime);
-		
-	while (l_Connected == false)
-	{
-		static constexpr int l_Port = 12183;
-		static constexpr int l_KeepAliveSeconds = 60;
+	auto const l_ReturnCode = mosquitto_connect_async(s_MosquittoClient, MQTT_HOST, MQTT_PORT, 
+		MQTT_KEEP_ALIVE_SECONDS);
 
-		const auto l_ReturnCode = mosquitto_connect(s_MosquittoClient, "localhost", 
-			l_Port, l_KeepAliveSeconds);
-		
-		if (l_ReturnCode == MOSQ_ERR_SUCCESS)
-		{		
-			l_Connected = true;
-			break;
-		}
-	
-		// Figure out how long we have been attempting to connect.
-		Time l_ConnectCurrentTime;
-		TimerGetCurrent(l_ConnectCurrentTime);
-		
-		float const l_DurationMS = TimerGetElapsedMilliseconds(l_ConnectStartTime, 
-			l_ConnectCurrentTime);
-		auto const l_DurationSeconds = static_cast<unsigned long>(l_DurationMS) / 
-			1000;
-		
-		// Attempt for five minutes at most.
-		static constexpr unsigned long l_TimeoutDurationSeconds = 5 * 60;
-		
-		if (l_DurationSeconds >= l_TimeoutDurationSeconds)
-		{
-			break;
-		}
-		
-		// Sleep for one second.
-		sleep(1);
+	if (l_ReturnCode != MOSQ_ERR_SUCCESS)
+	{
+		LoggerAddMessage("\tnot yet, with return code %d; will keep trying", l_ReturnCode);
 	}
 
-	if (l_Connected == false) {
-		
-		LoggerAddMessage("\tfailed");
-		return false;
-	}
-	
-	LoggerAddMessage("\tsucceeded");
 	LoggerAddMessage("");
 
 	// Start processing in another thread.
-	mosquitto_loop_start(s_MosquittoClient);
+	if (mosquitto_loop_start(s_MosquittoClient) != MOSQ_ERR_SUCCESS)
+	{
+		LoggerAddMessage("Failed to start the MQTT client thread.");
+		return false;
+	}
 
-   return true;
+	return true;
 }
 
 // Uninitialize MQTT.
 //
 void MQTTUninitialize()
 {
+	ReactorGetTimerService().Cancel(s_FirstNotificationTimer);
+
 	if (s_MosquittoClient != nullptr)
 	{
 		// Stop any processing that may have been occurring in another thread.
@@ -275,9 +609,18 @@ void MQTTUninitialize()
 
 		mosquitto_disconnect(s_MosquittoClient);
 		mosquitto_destroy(s_MosquittoClient);
+		s_MosquittoClient = nullptr;
 	}
 	
 	mosquitto_lib_cleanup();
+
+	// Now that the client thread is gone, nothing else will signal the event.
+	if (s_WakeupEventFileDescriptor >= 0)
+	{
+		ReactorRemoveFileDescriptor(s_WakeupEventFileDescriptor);
+		close(s_WakeupEventFileDescriptor);
+		s_WakeupEventFileDescriptor = -1;
+	}
 }
 
 // Publishes a message to a given topic.
@@ -329,110 +672,134 @@ static void MQTTPublishMessage(char const* p_Topic, char const* p_Message)
 	}
 }
 
-// End the current dialogue manager session.
+// End a dialogue manager session.
+//
+// p_SessionID:	The ID of the session.
 //
-static void DialogueManagerEndSession()
+static void DialogueManagerEndSession(char const* p_SessionID)
 {
 	// Create a properly formatted message that will end the session.
 	static constexpr unsigned int l_MessageBufferCapacity = 500;
 	char l_MessageBuffer[l_MessageBufferCapacity];
 
 	snprintf(l_MessageBuffer, l_MessageBufferCapacity, "{\"sessionId\": \"%s\", \"text\": \"\"}", 
-		s_DialogueManagerSessionID.c_str());
+		p_SessionID);
 
 	// Actually publish to the topic.
 	char const* l_Topic = "hermes/dialogueManager/endSession";
 	MQTTPublishMessage(l_Topic, l_MessageBuffer);
 }
 
-// Handles processing a dialogue manager message.
+// Parse a dialogue manager message.
 //
-// p_Topic:					The topic of the message.
-// p_MessageDocument:	The JSON document for the message payload.
-// 
-static void ProcessDialogueManagerMessage(std::string const& p_Topic, 
-	rapidjson::Document const& p_MessageDocument)
+// p_MessageReader:	(Output) Reads the parts of the message that we need.
+// p_Payload:			The message payload, which is overwritten by parsing it.
+//
+// Returns:	True if the message was parsed and has a session ID, false otherwise.
+//
+static bool MQTTParseDialogueManagerMessage(MQTTDialogueManagerReader& p_MessageReader, 
+	char* p_Payload)
 {
-	// Technically we probably don't need to be able to access the session ID for all cases here, 
-	// but it's reasonable to expect and the code is cleanest this way.
-	auto const l_SessionIDIterator = p_MessageDocument.FindMember("sessionId");
+	TraceScope l_ParseTraceScope("MQTT JSON parsed");
+
+	rapidjson::InsituStringStream l_PayloadStream(p_Payload);
+	rapidjson::Reader l_Parser;
 
-	if (l_SessionIDIterator == p_MessageDocument.MemberEnd())
+	if (l_Parser.Parse<rapidjson::kParseInsituFlag>(l_PayloadStream, p_MessageReader).IsError() == 
+		true)
 	{
-		return;
+		return false;
 	}
-		
-	auto const l_SessionID = l_SessionIDIterator->value.GetString();
-	
-	if (p_Topic.find("sessionStarted") != std::string::npos)
+
+	// Technically we probably don't need to be able to access the session ID for all cases here, 
+	// but it's reasonable to expect and the code is cleanest this way.
+	return p_MessageReader.GetSessionID() != nullptr;
+}
+
+// Handles a dialogue manager session starting.
+//
+// p_Message:	The message. Its payload is overwritten by parsing it.
+//
+static void MQTTHandleSessionStarted(MQTTReceivedMessage& p_Message)
+{
+	MQTTDialogueManagerReader l_MessageReader;
+
+	if (MQTTParseDialogueManagerMessage(l_MessageReader, p_Message.m_Payload) == false)
 	{
-		LoggerAddMessage("Dialogue session started with ID: %s", l_SessionID);
-		s_DialogueManagerSessionID = l_SessionID;
 		return;
 	}
 
-	if (p_Topic.find("sessionEnded") != std::string::npos)
-	{
-		auto l_GetReason = [&]() -> char const*
-		{
-			auto const l_TerminationIterator = p_MessageDocument.FindMember("termination");
+	auto const* const l_SessionID = l_MessageReader.GetSessionID();
 
-			if (l_TerminationIterator == p_MessageDocument.MemberEnd())
-			{
-				return nullptr;
-			}
-
-			auto const l_ReasonIterator = l_TerminationIterator->value.FindMember("reason");
+	LoggerAddMessage("Dialogue session started with ID: %s", l_SessionID);
+	s_DialogueManagerSessionID = l_SessionID;
+}
 
-			if (l_ReasonIterator == p_MessageDocument.MemberEnd())
-			{
-				return nullptr;
-			}
+// Handles a dialogue manager session ending.
+//
+// p_Message:	The message. Its payload is overwritten by parsing it.
+//
+static void MQTTHandleSessionEnded(MQTTReceivedMessage& p_Message)
+{
+	MQTTDialogueManagerReader l_MessageReader;
 
-			return l_ReasonIterator->value.GetString();
-		};
+	if (MQTTParseDialogueManagerMessage(l_MessageReader, p_Message.m_Payload) == false)
+	{
+		return;
+	}
 
-		auto const l_Reason = l_GetReason();
+	auto const* const l_SessionID = l_MessageReader.GetSessionID();
+	auto const* const l_Reason = l_MessageReader.GetReason();
 
-		if (l_Reason != nullptr)
-		{
-			LoggerAddMessage("Dialogue session ended with ID: %s and reason: %s", l_SessionID, 
-				l_Reason);
-		}
-		else
-		{
-			LoggerAddMessage("Dialogue session ended with ID: %s", l_SessionID);
-		}	
-	
-		s_DialogueManagerSessionID = "";
-		return;
+	if (l_Reason != nullptr)
+	{
+		LoggerAddMessage("Dialogue session ended with ID: %s and reason: %s", l_SessionID, 
+			l_Reason);
 	}
+	else
+	{
+		LoggerAddMessage("Dialogue session ended with ID: %s", l_SessionID);
+	}	
+
+	s_DialogueManagerSessionID = "";
 }
 
 // Handles processing an intent message.
 //
-// p_IntentDocument:	The JSON document for the intent payload.
+// p_Payload:		The intent payload, which is overwritten by parsing it.
+// p_ArrivalTime:	When the intent message arrived.
 //
-static void ProcessIntentMessage(rapidjson::Document const& p_IntentDocument)
+static void ProcessIntentMessage(char* p_Payload, Time const& p_ArrivalTime)
 {
 	// Take into account tokens pending confirmation, but only once.
 	auto l_CommandTokens = s_CommandTokensPendingConfirmation;
-	s_CommandTokensPendingConfirmation.clear();
+	char const* l_IntentSessionID = nullptr;
+
+	if (CommandTokenizeIntentMessage(l_CommandTokens, l_IntentSessionID, p_Payload) == false)
+	{
+		return;
+	}
+
+	s_CommandTokensPendingConfirmation.Clear();
 
-	CommandTokenizeJSONDocument(l_CommandTokens, p_IntentDocument);
+	// Answer in the session the intent came from, if it says.
+	auto const* const l_SessionID = (l_IntentSessionID != nullptr) ? l_IntentSessionID : 
+		s_DialogueManagerSessionID.c_str();
 
-	if (l_CommandTokens.empty() == true)
+	if (l_CommandTokens.IsEmpty() == true)
 	{
-		DialogueManagerEndSession();
+		DialogueManagerEndSession(l_SessionID);
 		return;
 	}
 		
 	char const* l_ConfirmationText = nullptr;
-	auto const l_ReturnValue = CommandParseTokens(l_ConfirmationText, l_CommandTokens);
+	auto const l_ReturnValue = CommandParseTokens(l_ConfirmationText, 
+		ControlOrigin(ControlOrigin::SOURCE_VOICE, p_ArrivalTime), l_CommandTokens);
 
-	if (l_ReturnValue == CommandParseTokensReturnTypes::INVALID)
+	if ((l_ReturnValue == CommandParseTokensReturnTypes::INVALID) || 
+		(l_ReturnValue == CommandParseTokensReturnTypes::DROPPED))
 	{
-		DialogueManagerEndSession();
+		DialogueManagerEndSession(l_SessionID);
 		return;
 	}
 
@@ -450,42 +817,76 @@ static void ProcessIntentMessage(rapidjson::Document const& p_IntentDocument)
 	char l_MessageBuffer[l_MessageBufferCapacity];
 
 	snprintf(l_MessageBuffer, l_MessageBufferCapacity, "{\"sessionId\": \"%s\", \"text\": \"%s\"}", 
-		s_DialogueManagerSessionID.c_str(), l_ConfirmationText);
+		l_SessionID, l_ConfirmationText);
 
 	// Actually publish to the topic.
 	char const* l_Topic = "hermes/dialogueManager/continueSession";
 	MQTTPublishMessage(l_Topic, l_MessageBuffer);
 }
 
+// Handles an intent message.
+//
+// p_Message:	The message. Its payload is overwritten by parsing it.
+//
+static void MQTTHandleIntent(MQTTReceivedMessage& p_Message)
+{
+	LoggerAddMessage("Received MQTT message for topic \"%s\"", p_Message.m_Topic);
+
+	ProcessIntentMessage(p_Message.m_Payload, p_Message.m_ArrivalTime);
+}
+
+// Handles text-to-speech finishing. This is called from the client library's thread.
+//
+// p_ArrivalTime:	When the message arrived.
+//
+static void MQTTHandleTextToSpeechFinished(Time const& p_ArrivalTime)
+{
+	// Record this time, before saying it has finished, so the time is there for whoever sees that.
+	s_LastTextToSpeechFinishedTime.store(p_ArrivalTime);
+	s_FirstTextToSpeechFinished = true;
+
+	// Anything waiting on a notification to finish will want to know.
+	MQTTWakeMainThread();
+}
+
 // Process is a message that we have received.
 //
-// p_Message:	The message we have received.
+// p_Message:	The message we have received. Its payload is overwritten by parsing it.
 //
-static void MQTTProcessReceivedMessage(MessageInfo const& p_Message)
+static void MQTTProcessReceivedMessage(MQTTReceivedMessage& p_Message)
 {
-	// Parse the payload as JSON.
-	rapidjson::Document l_PayloadDocument;
-	l_PayloadDocument.Parse(p_Message.m_Payload.c_str());
+	TraceScope l_TraceScope("MQTT message processed");
 
-	if (l_PayloadDocument.HasParseError() == true)
-	{
-		return;
-	}
+	// The route was already found when the message arrived. Only the parts of the payload that are 
+	// needed are picked out as it is parsed in place, right in the queue, rather than building a 
+	// document.
+	p_Message.m_Route->m_Handler(p_Message);
+}
 
-	auto const& l_Topic = p_Message.m_Topic;
-	
-	if (l_Topic.find("hermes/dialogueManager/") != std::string::npos)
+// Process all of the messages that we have received. Only the main thread may call this.
+//
+static void MQTTProcessReceivedMessages()
+{
+	while (true)
 	{
-		ProcessDialogueManagerMessage(l_Topic, l_PayloadDocument);
-		return;
+		auto* const l_Message = s_ReceivedMessageQueue.BeginPop();
+
+		if (l_Message == nullptr)
+		{
+			break;
+		}
+
+		MQTTProcessReceivedMessage(*l_Message);
+		s_ReceivedMessageQueue.EndPop();
 	}
 
-	if (l_Topic.find("hermes/intent/") != std::string::npos) 
-	{
-		LoggerAddMessage("Received MQTT message for topic \"%s\"", p_Message.m_Topic.c_str());
+	// Mention it if the client library's thread couldn't give us everything.
+	auto const l_DroppedMessageCount = s_DroppedMessageCount.exchange(0, std::memory_order_relaxed);
 
-		ProcessIntentMessage(l_PayloadDocument);
-		return;
+	if (l_DroppedMessageCount > 0)
+	{
+		LoggerAddMessage("Dropped %u MQTT messages because they were too large or the queue was full.",
+			l_DroppedMessageCount);
 	}
 }
 
@@ -495,6 +896,8 @@ static void MQTTProcessReceivedMessage(MessageInfo const& p_Message)
 //
 static void MQTTPublishNotification(std::string const& p_Text)
 {
+	TraceScope l_TraceScope("Notification published");
+
 	// Create a properly formatted message that will trigger the notification.
 	static constexpr unsigned int l_MessageBufferCapacity = 500;
 	char l_MessageBuffer[l_MessageBufferCapacity];
@@ -508,23 +911,42 @@ static void MQTTPublishNotification(std::string const& p_Text)
 	MQTTPublishMessage(l_Topic, l_MessageBuffer);
 }
 
-// Process MQTT.
+static void MQTTArmFirstNotificationTimer();
+
+// Reattempt the first notification, until text-to-speech has finished at least once.
 //
-void MQTTProcess()
+static void MQTTReattemptFirstNotification()
 {
+	if (s_FirstTextToSpeechFinished == true)
 	{
-		// Acquire a lock to protect the received message list.
-		// NOTE: It is expected that this will be executed from the main thread.
-		std::lock_guard<std::mutex> l_MessageGuard(s_ReceivedMessagesMutex);
+		return;
+	}
 
-		for (auto const& l_Message : s_ReceivedMessageList)		
-		{
-			MQTTProcessReceivedMessage(l_Message);
-		}
+	MQTTPublishNotification(s_FirstNotification);
+	MQTTArmFirstNotificationTimer();
 
-		// Get rid of the messages.
-		s_ReceivedMessageList.clear();
-	}
+	LoggerAddMessage("Reattempted first notification.");
+}
+
+// Arm the timer to reattempt the first notification if it doesn't finish.
+//
+static void MQTTArmFirstNotificationTimer()
+{
+	static constexpr Duration l_ReattemptDuration = 5s;
+
+	Time l_CurrentTime;
+	TimerGetCurrent(l_CurrentTime);
+
+	ReactorGetTimerService().Arm(s_FirstNotificationTimer, l_CurrentTime + l_ReattemptDuration, 
+		MQTTReattemptFirstNotification);
+}
+
+// Process MQTT.
+//
+void MQTTProcess()
+{
+	// Usually these have already been handled when the reactor woke for them.
+	MQTTProcessReceivedMessages();
 
 	// If we are connected, send any pending messages.
 	if (s_ConnectedToHost == true) {
@@ -548,46 +970,17 @@ void MQTTProcess()
 			// Get rid of the pending notifications. 
 			s_PendingNotificationList.clear();
 		}
-		else
+		else if ((s_FirstNotification.compare("") == 0) && (s_PendingNotificationList.size() > 0))
 		{
-			// We use this to tell not only when we are attempting the first notification for the very 
-			// first time, but to prevent us from double posting the first notification after we 
-			//succeed.
-			static std::string s_FirstNotification = "";
-
-			static Time s_LastAttemptTime;
-
-			if ((s_FirstNotification.compare("") == 0) && (s_PendingNotificationList.size() > 0))
-			{
-				// Pull the first notification off and store it separately.
-				s_FirstNotification = s_PendingNotificationList[0];
-				s_PendingNotificationList.erase(s_PendingNotificationList.begin());
-
-				// Make our first attempt.
-				MQTTPublishNotification(s_FirstNotification);
-				TimerGetCurrent(s_LastAttemptTime);
-
-				LoggerAddMessage("Attempted first notification.");
-			}
-
-			// See if enough time has passed since our last attempt.
-			Time l_CurrentTime;
-			TimerGetCurrent(l_CurrentTime);
+			// Pull the first notification off and store it separately.
+			s_FirstNotification = s_PendingNotificationList[0];
+			s_PendingNotificationList.erase(s_PendingNotificationList.begin());
 
-			auto const l_DurationMS = TimerGetElapsedMilliseconds(s_LastAttemptTime, l_CurrentTime);
-			auto const l_DurationSeconds = static_cast<unsigned long>(l_DurationMS) / 1000;
-			
-			static constexpr unsigned long l_ReattemptTimeSeconds = 5;
+			// Make our first attempt.
+			MQTTPublishNotification(s_FirstNotification);
+			MQTTArmFirstNotificationTimer();
 
-			if ((s_FirstNotification.compare("") != 0) && 
-				(l_DurationSeconds >= l_ReattemptTimeSeconds))
-			{
-				// If so, reattempt the notification.
-				MQTTPublishNotification(s_FirstNotification);
-				TimerGetCurrent(s_LastAttemptTime);
-
-				LoggerAddMessage("Reattempted first notification.");
-			}
+			LoggerAddMessage("Attempted first notification.");
 		}
 	}
 }
@@ -598,6 +991,8 @@ void MQTTProcess()
 //
 void MQTTTextToSpeech(std::string const& p_Text)
 {
+	TraceScope l_TraceScope("Text-to-speech published");
+
 	// Create a properly formatted message that will trigger the text to be spoken.
 	static constexpr unsigned int l_MessageBufferCapacity = 500;
 	char l_MessageBuffer[l_MessageBufferCapacity];
@@ -626,5 +1021,17 @@ void MQTTNotification(std::string const& p_Text)
 //
 void MQTTGetLastTextToSpeechFinishedTime(Time& p_Time)
 {
-	p_Time = s_LastTextToSpeechFinishedTime;
+	p_Time = s_LastTextToSpeechFinishedTime.load();
+}
+
+// Get what MQTT is doing, for status queries.
+//
+// p_Status:	(Output) The status.
+//
+void MQTTGetStatus(MQTTStatus& p_Status)
+{
+	p_Status.m_Connected = s_ConnectedToHost.load();
+	p_Status.m_PendingMessageCount = static_cast<unsigned int>(s_PendingMessageList.size());
+	p_Status.m_PendingNotificationCount = static_cast<unsigned int>(s_PendingNotificationList.size());
+	p_Status.m_ReceivedMessageCount = s_ReceivedMessageQueue.GetSize();
 }
@@ -4,6 +4,23 @@
 
 #include "timer.h"
 
+// Types
+//
+
+// What MQTT is doing, for status queries.
+struct MQTTStatus
+{
+	// Whether we are connected to the host.
+	bool				m_Connected = false;
+
+	// Messages and notifications waiting to be published once we are able.
+	unsigned int	m_PendingMessageCount = 0;
+	unsigned int	m_PendingNotificationCount = 0;
+
+	// Messages that have been received but not processed yet.
+	unsigned int	m_ReceivedMessageCount = 0;
+};
+
 // Functions
 //
 
@@ -35,4 +52,10 @@ void MQTTNotification(std::string const& p_Text);
 //
 // p_Time:	(Output) The last time.
 //
-void MQTTGetLastTextToSpeechFinishedTime(Time& p_Time);
\ No newline at end of file
+void MQTTGetLastTextToSpeechFinishedTime(Time& p_Time);
+
+// Get what MQTT is doing, for status queries. Only the main thread may call this.
+//
+// p_Status:	(Output) The status.
+//
+void MQTTGetStatus(MQTTStatus& p_Status);
@@ -1,5 +1,6 @@
 #include "notification.h"
 
+#include <cctype>
 #include <map>
 
 #include "logger.h"
@@ -63,6 +64,49 @@ void NotificationPlay(std::string const& p_ID)
 	MQTTNotification(l_SpeechText);
 }
 
+// Play several notifications as one, joined with "and", so that things that happened together are
+// announced together.
+// 
+// p_IDs:	The IDs of the notifications to play, in order.
+// 
+void NotificationPlay(std::vector<std::string> const& p_IDs)
+{
+	std::string l_CombinedSpeechText;
+
+	for (auto const& l_ID : p_IDs)
+	{
+		// Try to find it in the map.
+		auto const l_ResultIterator = s_NotificationIDToSpeechTextMap.find(l_ID);
+
+		if (l_ResultIterator == s_NotificationIDToSpeechTextMap.end()) 
+		{
+			LoggerAddMessage("Tried to play an invalid notification \"%s\".", l_ID.c_str());
+			continue;
+		}
+
+		auto const& l_SpeechText = l_ResultIterator->second;
+
+		if (l_CombinedSpeechText.empty() == true)
+		{
+			l_CombinedSpeechText = l_SpeechText;
+			continue;
+		}
+
+		// Only the first part starts a sentence.
+		l_CombinedSpeechText += " and ";
+		l_CombinedSpeechText += static_cast<char>(std::tolower(l_SpeechText[0]));
+		l_CombinedSpeechText.append(l_SpeechText, 1, std::string::npos);
+	}
+
+	if (l_CombinedSpeechText.empty() == true)
+	{
+		return;
+	}
+
+	// Generate the notification.
+	MQTTNotification(l_CombinedSpeechText);
+}
+
 // Get the time that the last notification finished.
 //
 // p_Time:	(Output) The last time.
@@ -2,6 +2,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "timer.h"
 
@@ -17,6 +18,13 @@
 // 
 void NotificationPlay(std::string const& p_ID);
 
+// Play several notifications as one, joined with "and", so that things that happened together are
+// announced together.
+// 
+// p_IDs:	The IDs of the notifications to play, in order.
+// 
+void NotificationPlay(std::vector<std::string> const& p_IDs);
+
 // Get the time that the last notification finished.
 //
 // p_Time:	(Output) The last time.
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+
+// Types
+//
+
+// A fixed capacity queue that one thread can push onto while another thread pops off of, without 
+// either of them ever waiting on a lock.
+//
+// ElementType:	The type of the elements. They are copied in and out, so keep them small.
+// t_Capacity:		How many elements can be waiting at once. This must be a power of two.
+//
+template <typename ElementType, unsigned int t_Capacity>
+class SPSCQueue
+{
+	public:
+
+		// Add an element to the back of the queue. Only the producer thread may call this.
+		//
+		// p_Element:	The element to add.
+		//
+		// Returns:		True if the element was added, false if the queue was full.
+		//
+		bool Push(ElementType const& p_Element);
+
+		// Remove the element at the front of the queue. Only the consumer thread may call this.
+		//
+		// p_Element:	(Output) The element that was removed.
+		//
+		// Returns:		True if an element was removed, false if the queue was empty.
+		//
+		bool Pop(ElementType& p_Element);
+
+		// Get how many elements are waiting. Any thread may call this, though the answer may be out of
+		// date as soon as it is returned.
+		//
+		// Returns:		The number of elements.
+		//
+		unsigned int GetSize() const;
+
+	private:
+
+		static_assert((t_Capacity > 0) && ((t_Capacity & (t_Capacity - 1)) == 0), 
+			"The capacity must be a power of two.");
+
+		// Keep the indices on separate cache lines, so that the threads don't fight over them.
+		static constexpr unsigned int ms_CacheLineSize = 64;
+
+		// Storage for the elements.
+		ElementType m_Elements[t_Capacity];
+
+		// How many elements have ever been popped. Only the consumer writes this.
+		alignas(ms_CacheLineSize) std::atomic<unsigned int> m_PopCount{0};
+
+		// How many elements have ever been pushed. Only the producer writes this.
+		alignas(ms_CacheLineSize) std::atomic<unsigned int> m_PushCount{0};
+};
+
+// A fixed capacity queue that any number of threads can push onto while one thread pops off of,
+// without any of them ever waiting on a lock. Elements are filled in and read in place, so they can
+// be large, fixed size buffers that are never copied.
+//
+// ElementType:	The type of the elements.
+// t_Capacity:		How many elements can be waiting at once. This must be a power of two.
+//
+template <typename ElementType, unsigned int t_Capacity>
+class MPSCQueue
+{
+	public:
+
+		MPSCQueue();
+
+		// Claim the element at the back of the queue, to be filled in. Any thread may call this.
+		//
+		// p_Position:	(Output) Where the element is, to be given to EndPush.
+		//
+		// Returns:		The element, or null if the queue was full. If it isn't null, EndPush must be
+		//					called once it has been filled in.
+		//
+		ElementType* BeginPush(unsigned int& p_Position);
+
+		// Hand an element that has been filled in to the consumer.
+		//
+		// p_Position:	Where the element is, as given by BeginPush.
+		//
+		void EndPush(unsigned int p_Position);
+
+		// Get the element at the front of the queue. Only the consumer thread may call this.
+		//
+		// Returns:		The element, or null if the queue was empty. If it isn't null, EndPop must be
+		//					called once it has been used.
+		//
+		ElementType* BeginPop();
+
+		// Remove the element at the front of the queue, once it has been used. Only the consumer thread
+		// may call this.
+		//
+		void EndPop();
+
+		// Get how many elements are waiting, including those still being filled in. Any thread may call
+		// this, though the answer may be out of date as soon as it is returned.
+		//
+		// Returns:		The number of elements.
+		//
+		unsigned int GetSize() const;
+
+	private:
+
+		static_assert((t_Capacity > 0) && ((t_Capacity & (t_Capacity - 1)) == 0), 
+			"The capacity must be a power of two.");
+
+		// Keep the indices on separate cache lines, so that the threads don't fight over them.
+		static constexpr unsigned int ms_CacheLineSize = 64;
+
+		// An element, and which turn it is on. When it equals the push count that will claim it, it is
+		// free to fill in, and when it is one more than that, it is ready to be popped.
+		struct Slot
+		{
+			std::atomic<unsigned int>	m_Sequence{0};
+			ElementType						m_Element;
+		};
+
+		// Storage for the elements.
+		Slot m_Slots[t_Capacity];
+
+		// How many elements have ever been popped. Only the consumer writes this.
+		alignas(ms_CacheLineSize) std::atomic<unsigned int> m_PopCount{0};
+
+		// How many elements have ever been claimed. The producers race to advance this.
+		alignas(ms_CacheLineSize) std::atomic<unsigned int> m_PushCount{0};
+};
+
+#include "queue.inl"
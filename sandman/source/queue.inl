@@ -0,0 +1,181 @@
+
+// SPSCQueue members
+
+// Add an element to the back of the queue. Only the producer thread may call this.
+//
+// p_Element:	The element to add.
+//
+// Returns:		True if the element was added, false if the queue was full.
+//
+template <typename ElementType, unsigned int t_Capacity>
+bool SPSCQueue<ElementType, t_Capacity>::Push(ElementType const& p_Element)
+{
+	// The counts are allowed to wrap, because the capacity divides evenly into their range.
+	auto const l_PushCount = m_PushCount.load(std::memory_order_relaxed);
+	auto const l_PopCount = m_PopCount.load(std::memory_order_acquire);
+
+	if ((l_PushCount - l_PopCount) >= t_Capacity)
+	{
+		return false;
+	}
+
+	m_Elements[l_PushCount & (t_Capacity - 1)] = p_Element;
+
+	// Publish the element to the consumer.
+	m_PushCount.store(l_PushCount + 1, std::memory_order_release);
+	return true;
+}
+
+// Remove the element at the front of the queue. Only the consumer thread may call this.
+//
+// p_Element:	(Output) The element that was removed.
+//
+// Returns:		True if an element was removed, false if the queue was empty.
+//
+template <typename ElementType, unsigned int t_Capacity>
+bool SPSCQueue<ElementType, t_Capacity>::Pop(ElementType& p_Element)
+{
+	auto const l_PopCount = m_PopCount.load(std::memory_order_relaxed);
+	auto const l_PushCount = m_PushCount.load(std::memory_order_acquire);
+
+	if (l_PopCount == l_PushCount)
+	{
+		return false;
+	}
+
+	p_Element = m_Elements[l_PopCount & (t_Capacity - 1)];
+
+	// Give the slot back to the producer.
+	m_PopCount.store(l_PopCount + 1, std::memory_order_release);
+	return true;
+}
+
+// Get how many elements are waiting. Any thread may call this, though the answer may be out of date
+// as soon as it is returned.
+//
+// Returns:		The number of elements.
+//
+template <typename ElementType, unsigned int t_Capacity>
+unsigned int SPSCQueue<ElementType, t_Capacity>::GetSize() const
+{
+	// Read the pop count first, so that the push count can't be behind it.
+	auto const l_PopCount = m_PopCount.load(std::memory_order_acquire);
+	auto const l_PushCount = m_PushCount.load(std::memory_order_acquire);
+
+	return std::min(l_PushCount - l_PopCount, t_Capacity);
+}
+
+// MPSCQueue members
+
+template <typename ElementType, unsigned int t_Capacity>
+MPSCQueue<ElementType, t_Capacity>::MPSCQueue()
+{
+	for (unsigned int l_SlotIndex = 0; l_SlotIndex < t_Capacity; l_SlotIndex++)
+	{
+		m_Slots[l_SlotIndex].m_Sequence.store(l_SlotIndex, std::memory_order_relaxed);
+	}
+}
+
+// Claim the element at the back of the queue, to be filled in. Any thread may call this.
+//
+// p_Position:	(Output) Where the element is, to be given to EndPush.
+//
+// Returns:		The element, or null if the queue was full. If it isn't null, EndPush must be called
+//					once it has been filled in.
+//
+template <typename ElementType, unsigned int t_Capacity>
+ElementType* MPSCQueue<ElementType, t_Capacity>::BeginPush(unsigned int& p_Position)
+{
+	auto l_PushCount = m_PushCount.load(std::memory_order_relaxed);
+
+	while (true)
+	{
+		auto& l_Slot = m_Slots[l_PushCount & (t_Capacity - 1)];
+		auto const l_Sequence = l_Slot.m_Sequence.load(std::memory_order_acquire);
+
+		// The counts are allowed to wrap, so compare them by their difference.
+		auto const l_Difference = static_cast<int>(l_Sequence - l_PushCount);
+
+		if (l_Difference == 0)
+		{
+			// The slot is free, so try to claim it before another producer does.
+			if (m_PushCount.compare_exchange_weak(l_PushCount, l_PushCount + 1, 
+				std::memory_order_relaxed) == true)
+			{
+				p_Position = l_PushCount;
+				return &l_Slot.m_Element;
+			}
+		}
+		else if (l_Difference < 0)
+		{
+			// The consumer hasn't finished with the slot from the last time around.
+			return nullptr;
+		}
+		else
+		{
+			// Another producer claimed it first.
+			l_PushCount = m_PushCount.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+// Hand an element that has been filled in to the consumer.
+//
+// p_Position:	Where the element is, as given by BeginPush.
+//
+template <typename ElementType, unsigned int t_Capacity>
+void MPSCQueue<ElementType, t_Capacity>::EndPush(unsigned int p_Position)
+{
+	m_Slots[p_Position & (t_Capacity - 1)].m_Sequence.store(p_Position + 1, 
+		std::memory_order_release);
+}
+
+// Get the element at the front of the queue. Only the consumer thread may call this.
+//
+// Returns:		The element, or null if the queue was empty. If it isn't null, EndPop must be called 
+//					once it has been used.
+//
+template <typename ElementType, unsigned int t_Capacity>
+ElementType* MPSCQueue<ElementType, t_Capacity>::BeginPop()
+{
+	auto const l_PopCount = m_PopCount.load(std::memory_order_relaxed);
+	auto& l_Slot = m_Slots[l_PopCount & (t_Capacity - 1)];
+
+	// Elements are popped in the order they were claimed, so one that is still being filled in holds
+	// up the rest until it is done.
+	if (l_Slot.m_Sequence.load(std::memory_order_acquire) != (l_PopCount + 1))
+	{
+		return nullptr;
+	}
+
+	return &l_Slot.m_Element;
+}
+
+// Remove the element at the front of the queue, once it has been used. Only the consumer thread may
+// call this.
+//
+template <typename ElementType, unsigned int t_Capacity>
+void MPSCQueue<ElementType, t_Capacity>::EndPop()
+{
+	auto const l_PopCount = m_PopCount.load(std::memory_order_relaxed);
+
+	// Give the slot back to the producers, for when the push count comes around to it again.
+	m_Slots[l_PopCount & (t_Capacity - 1)].m_Sequence.store(l_PopCount + t_Capacity, 
+		std::memory_order_release);
+	m_PopCount.store(l_PopCount + 1, std::memory_order_release);
+}
+
+// Get how many elements are waiting, including those still being filled in. Any thread may call 
+// this, though the answer may be out of date as soon as it is returned.
+//
+// Returns:		The number of elements.
+//
+template <typename ElementType, unsigned int t_Capacity>
+unsigned int MPSCQueue<ElementType, t_Capacity>::GetSize() const
+{
+	// Read the pop count first, so that the push count can't be behind it.
+	auto const l_PopCount = m_PopCount.load(std::memory_order_acquire);
+	auto const l_PushCount = m_PushCount.load(std::memory_order_acquire);
+
+	return std::min(l_PushCount - l_PopCount, t_Capacity);
+}
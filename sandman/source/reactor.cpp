@@ -0,0 +1,289 @@
+#include "reactor.h"
+
+#include <errno.h>
+#include <map>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "logger.h"
+#include "stats.h"
+
+// Constants
+//
+
+// The maximum number of events to handle per wait.
+#define MAX_EVENTS_PER_WAIT	(16)
+
+// Locals
+//
+
+// The epoll instance used to wait on all of the file descriptors.
+static int s_EpollFileDescriptor = -1;
+
+// A timer used to wake up for the earliest timer deadline.
+static int s_TimerFileDescriptor = -1;
+
+// The timers that fire from the reactor.
+static TimerService s_TimerService;
+
+// The handlers for each of the watched file descriptors.
+static std::map<int, ReactorHandler> s_Handlers;
+
+// Whether to skip blocking during the next wait.
+static bool s_ImmediateWakeupRequested = false;
+
+// When we last woke up from waiting.
+static Time s_WakeTime;
+
+// Functions
+//
+
+// Initialize the reactor.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool ReactorInitialize()
+{
+	s_EpollFileDescriptor = epoll_create1(EPOLL_CLOEXEC);
+
+	if (s_EpollFileDescriptor < 0)
+	{
+		LoggerAddMessage("Failed to create the reactor epoll instance.");
+		return false;
+	}
+
+	// The timer uses the same clock as the timer functions so that deadlines line up.
+	s_TimerFileDescriptor = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if (s_TimerFileDescriptor < 0)
+	{
+		LoggerAddMessage("Failed to create the reactor timer.");
+		return false;
+	}
+
+	// The timer doesn't need to do anything but wake us up, so just drain it. Due timers get fired 
+	// after every wait anyway.
+	auto const l_DrainTimer = []()
+	{
+		uint64_t l_ExpirationCount = 0;
+		read(s_TimerFileDescriptor, &l_ExpirationCount, sizeof(l_ExpirationCount));
+	};
+
+	if (ReactorAddFileDescriptor(s_TimerFileDescriptor, l_DrainTimer) == false)
+	{
+		return false;
+	}
+
+	s_ImmediateWakeupRequested = false;
+
+	return true;
+}
+
+// Uninitialize the reactor.
+//
+void ReactorUninitialize()
+{
+	s_Handlers.clear();
+
+	if (s_TimerFileDescriptor >= 0)
+	{
+		close(s_TimerFileDescriptor);
+		s_TimerFileDescriptor = -1;
+	}
+
+	if (s_EpollFileDescriptor >= 0)
+	{
+		close(s_EpollFileDescriptor);
+		s_EpollFileDescriptor = -1;
+	}
+}
+
+// Start watching a file descriptor for input.
+//
+// p_FileDescriptor:	The file descriptor to watch.
+// p_Handler:			The function to call when the file descriptor is ready to be read.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool ReactorAddFileDescriptor(int p_FileDescriptor, ReactorHandler const& p_Handler)
+{
+	if (s_EpollFileDescriptor < 0)
+	{
+		return false;
+	}
+
+	epoll_event l_Event;
+	memset(&l_Event, 0, sizeof(l_Event));
+	l_Event.events = EPOLLIN;
+	l_Event.data.fd = p_FileDescriptor;
+
+	if (epoll_ctl(s_EpollFileDescriptor, EPOLL_CTL_ADD, p_FileDescriptor, &l_Event) < 0)
+	{
+		LoggerAddMessage("Failed to add file descriptor %d to the reactor with error %d.",
+			p_FileDescriptor, errno);
+		return false;
+	}
+
+	s_Handlers[p_FileDescriptor] = p_Handler;
+	return true;
+}
+
+// Change what a watched file descriptor's handler is called for. Watching for output is for output
+// that couldn't all be written at once. Hang-ups and errors are always reported.
+//
+// p_FileDescriptor:	The watched file descriptor.
+// p_WatchInput:		Whether to call the handler when the file descriptor is ready to be read.
+// p_WatchOutput:		Whether to call the handler when the file descriptor is ready to be written.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool ReactorWatchFileDescriptor(int p_FileDescriptor, bool p_WatchInput, bool p_WatchOutput)
+{
+	if (s_EpollFileDescriptor < 0)
+	{
+		return false;
+	}
+
+	epoll_event l_Event;
+	memset(&l_Event, 0, sizeof(l_Event));
+	l_Event.events = ((p_WatchInput == true) ? EPOLLIN : 0) | ((p_WatchOutput == true) ? EPOLLOUT : 0);
+	l_Event.data.fd = p_FileDescriptor;
+
+	if (epoll_ctl(s_EpollFileDescriptor, EPOLL_CTL_MOD, p_FileDescriptor, &l_Event) < 0)
+	{
+		LoggerAddMessage("Failed to change file descriptor %d in the reactor with error %d.",
+			p_FileDescriptor, errno);
+		return false;
+	}
+
+	return true;
+}
+
+// Stop watching a file descriptor. This must be done before the file descriptor is closed.
+//
+// p_FileDescriptor:	The file descriptor to stop watching.
+//
+void ReactorRemoveFileDescriptor(int p_FileDescriptor)
+{
+	if (s_EpollFileDescriptor < 0)
+	{
+		return;
+	}
+
+	epoll_ctl(s_EpollFileDescriptor, EPOLL_CTL_DEL, p_FileDescriptor, nullptr);
+	s_Handlers.erase(p_FileDescriptor);
+}
+
+// Get the timer service whose timers fire from the reactor. The reactor will wake up in time for
+// the earliest pending timer.
+//
+TimerService& ReactorGetTimerService()
+{
+	return s_TimerService;
+}
+
+// Request that the reactor not block the next time it waits, because there is more processing
+// to do.
+//
+void ReactorRequestImmediateWakeup()
+{
+	s_ImmediateWakeupRequested = true;
+}
+
+// Get the time that the reactor last woke up from waiting.
+//
+// p_Time:	(Output) The time.
+//
+void ReactorGetWakeTime(Time& p_Time)
+{
+	p_Time = s_WakeTime;
+}
+
+// Fire any timers that are due.
+//
+static void ReactorProcessTimers()
+{
+	StatsScope l_Probe(STATS_PROBE_TIMERS);
+	s_TimerService.Process();
+}
+
+// Block until a watched file descriptor is ready or the earliest timer is due, then call the 
+// handlers for any ready file descriptors and fire any due timers.
+//
+void ReactorWait()
+{
+	// Arm the timer for the earliest deadline, or disarm it if there are no pending timers.
+	itimerspec l_TimerSpec;
+	memset(&l_TimerSpec, 0, sizeof(l_TimerSpec));
+
+	Time l_Deadline;
+	auto const l_HasDeadline = s_TimerService.GetNextDeadline(l_Deadline);
+
+	if (l_HasDeadline == true)
+	{
+		auto const l_DeadlineNS = l_Deadline.time_since_epoch().count();
+		l_TimerSpec.it_value.tv_sec = l_DeadlineNS / 1000000000;
+		l_TimerSpec.it_value.tv_nsec = l_DeadlineNS % 1000000000;
+
+		// A zero value would disarm the timer instead of firing it right away.
+		if ((l_TimerSpec.it_value.tv_sec == 0) && (l_TimerSpec.it_value.tv_nsec == 0))
+		{
+			l_TimerSpec.it_value.tv_nsec = 1;
+		}
+	}
+
+	timerfd_settime(s_TimerFileDescriptor, TFD_TIMER_ABSTIME, &l_TimerSpec, nullptr);
+
+	auto const l_TimeoutMS = (s_ImmediateWakeupRequested == true) ? 0 : -1;
+
+	s_ImmediateWakeupRequested = false;
+
+	Time l_WaitTime;
+	TimerGetCurrent(l_WaitTime);
+
+	epoll_event l_Events[MAX_EVENTS_PER_WAIT];
+	auto const l_EventCount = epoll_wait(s_EpollFileDescriptor, l_Events, MAX_EVENTS_PER_WAIT,
+		l_TimeoutMS);
+
+	TimerGetCurrent(s_WakeTime);
+
+	// If we were sleeping until a timer, see how late we woke up for it.
+	if ((l_TimeoutMS != 0) && (l_HasDeadline == true) && (l_Deadline > l_WaitTime) && 
+		((l_Deadline > s_WakeTime) == false))
+	{
+		StatsRecord(STATS_PROBE_WAKE_LATENCY, s_WakeTime - l_Deadline);
+	}
+
+	if (l_EventCount < 0)
+	{
+		// Being interrupted by a signal is fine, everyone will just get processed.
+		if (errno != EINTR)
+		{
+			LoggerAddMessage("Reactor failed to wait with error %d.", errno);
+		}
+
+		ReactorProcessTimers();
+		return;
+	}
+
+	for (int l_EventIndex = 0; l_EventIndex < l_EventCount; l_EventIndex++)
+	{
+		// A previous handler may have removed this file descriptor.
+		auto const l_HandlerIterator = s_Handlers.find(l_Events[l_EventIndex].data.fd);
+
+		if (l_HandlerIterator == s_Handlers.end())
+		{
+			continue;
+		}
+
+		// Copy the handler, because it is allowed to remove itself.
+		auto const l_Handler = l_HandlerIterator->second;
+		l_Handler();
+	}
+
+	// Fire any timers that are due.
+	ReactorProcessTimers();
+}
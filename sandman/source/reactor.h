@@ -0,0 +1,71 @@
+#pragma once
+
+#include <functional>
+
+#include "timer.h"
+
+// Types
+//
+
+// A function that is called when a file descriptor is ready to be read.
+using ReactorHandler = std::function<void()>;
+
+// Functions
+//
+
+// Initialize the reactor.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool ReactorInitialize();
+
+// Uninitialize the reactor.
+//
+void ReactorUninitialize();
+
+// Start watching a file descriptor for input.
+//
+// p_FileDescriptor:	The file descriptor to watch.
+// p_Handler:			The function to call when the file descriptor is ready to be read.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool ReactorAddFileDescriptor(int p_FileDescriptor, ReactorHandler const& p_Handler);
+
+// Change what a watched file descriptor's handler is called for. Watching for output is for output
+// that couldn't all be written at once. Hang-ups and errors are always reported.
+//
+// p_FileDescriptor:	The watched file descriptor.
+// p_WatchInput:		Whether to call the handler when the file descriptor is ready to be read.
+// p_WatchOutput:		Whether to call the handler when the file descriptor is ready to be written.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool ReactorWatchFileDescriptor(int p_FileDescriptor, bool p_WatchInput, bool p_WatchOutput);
+
+// Stop watching a file descriptor. This must be done before the file descriptor is closed.
+//
+// p_FileDescriptor:	The file descriptor to stop watching.
+//
+void ReactorRemoveFileDescriptor(int p_FileDescriptor);
+
+// Get the timer service whose timers fire from the reactor. The reactor will wake up in time for
+// the earliest pending timer.
+//
+TimerService& ReactorGetTimerService();
+
+// Request that the reactor not block the next time it waits, because there is more processing
+// to do.
+//
+void ReactorRequestImmediateWakeup();
+
+// Get the time that the reactor last woke up from waiting.
+//
+// p_Time:	(Output) The time.
+//
+void ReactorGetWakeTime(Time& p_Time);
+
+// Block until a watched file descriptor is ready or the earliest timer is due, then call the 
+// handlers for any ready file descriptors and fire any due timers.
+//
+void ReactorWait();
@@ -0,0 +1,163 @@
+#include "realtime.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "xml.h"
+
+// Constants
+//
+
+// How much of the stack to touch up front.
+#define REALTIME_STACK_PREFAULT_SIZE	(256 * 1024)
+
+// The size of a page, or smaller, so that every page gets touched.
+#define REALTIME_PAGE_SIZE					(4096)
+
+// Functions
+//
+
+// RealtimeConfig members
+
+// Read a real-time config from XML. Any settings that are missing keep their defaults.
+//
+// p_Document:	The XML document that the node belongs to.
+// p_Node:		The XML node to read the real-time config from.
+//
+// Returns:		True if the config was read successfully, false otherwise.
+//
+bool RealtimeConfig::ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node)
+{
+	// See whether it is enabled.
+	static auto const* s_EnabledNodeName = "Enabled";
+	auto* l_EnabledNode = XMLFindNextNodeByName(p_Node->xmlChildrenNode, s_EnabledNodeName);
+
+	if (l_EnabledNode != nullptr)
+	{
+		m_Enabled = (XMLGetNodeTextAsInteger(p_Document, l_EnabledNode) != 0);
+	}
+
+	// Get the CPU.
+	static auto const* s_CPUNodeName = "CPU";
+	auto* l_CPUNode = XMLFindNextNodeByName(p_Node->xmlChildrenNode, s_CPUNodeName);
+
+	if (l_CPUNode != nullptr)
+	{
+		m_CPU = XMLGetNodeTextAsInteger(p_Document, l_CPUNode);
+	}
+
+	// Get the priority.
+	static auto const* s_PriorityNodeName = "Priority";
+	auto* l_PriorityNode = XMLFindNextNodeByName(p_Node->xmlChildrenNode, s_PriorityNodeName);
+
+	if (l_PriorityNode != nullptr)
+	{
+		m_Priority = XMLGetNodeTextAsInteger(p_Document, l_PriorityNode);
+	}
+
+	return true;
+}
+
+// Touch each page of a chunk of stack, so that it is already mapped when we need it.
+//
+static void __attribute__((noinline)) RealtimePrefaultStack()
+{
+	volatile unsigned char l_Stack[REALTIME_STACK_PREFAULT_SIZE];
+
+	for (unsigned int l_Offset = 0; l_Offset < REALTIME_STACK_PREFAULT_SIZE;
+		l_Offset += REALTIME_PAGE_SIZE)
+	{
+		l_Stack[l_Offset] = 0;
+	}
+
+	// Read something back so the compiler can't decide the stack is unused.
+	static_cast<void>(l_Stack[0]);
+}
+
+// Lock all of the process's memory, current and future, into RAM and touch enough stack so that
+// none of it has to be faulted in later.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool RealtimeLockMemory()
+{
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+	{
+		LoggerAddMessage("Failed to lock memory with error %d.", errno);
+		return false;
+	}
+
+	RealtimePrefaultStack();
+
+	LoggerAddMessage("Locked memory.");
+	return true;
+}
+
+// Pin a thread to the configured CPU and give it SCHED_FIFO priority.
+//
+// p_Thread:	The thread.
+// p_Config:	The real-time configuration.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool RealtimeConfigureThread(pthread_t p_Thread, RealtimeConfig const& p_Config)
+{
+	auto l_Succeeded = true;
+
+	if (p_Config.m_CPU != RealtimeConfig::ms_AnyCPU)
+	{
+		// CPU_SET doesn't check its argument, so make sure the CPU exists before using it.
+		auto const l_OnlineCPUCount = sysconf(_SC_NPROCESSORS_ONLN);
+
+		if ((p_Config.m_CPU < 0) || (p_Config.m_CPU >= CPU_SETSIZE) ||
+			((l_OnlineCPUCount > 0) && (p_Config.m_CPU >= l_OnlineCPUCount)))
+		{
+			LoggerAddMessage("Not pinning thread to CPU %d, which isn't one of the %ld online CPUs.",
+				p_Config.m_CPU, l_OnlineCPUCount);
+			l_Succeeded = false;
+		}
+		else
+		{
+			cpu_set_t l_CPUSet;
+			CPU_ZERO(&l_CPUSet);
+			CPU_SET(p_Config.m_CPU, &l_CPUSet);
+
+			auto const l_Result = pthread_setaffinity_np(p_Thread, sizeof(l_CPUSet), &l_CPUSet);
+
+			if (l_Result != 0)
+			{
+				LoggerAddMessage("Failed to pin thread to CPU %d with error %d.", p_Config.m_CPU,
+					l_Result);
+				l_Succeeded = false;
+			}
+			else
+			{
+				LoggerAddMessage("Pinned thread to CPU %d.", p_Config.m_CPU);
+			}
+		}
+	}
+
+	sched_param l_Parameters;
+	memset(&l_Parameters, 0, sizeof(l_Parameters));
+	l_Parameters.sched_priority = p_Config.m_Priority;
+
+	auto const l_Result = pthread_setschedparam(p_Thread, SCHED_FIFO, &l_Parameters);
+
+	if (l_Result != 0)
+	{
+		LoggerAddMessage("Failed to set SCHED_FIFO priority %d with error %d.", p_Config.m_Priority,
+			l_Result);
+		l_Succeeded = false;
+	}
+	else
+	{
+		LoggerAddMessage("Set thread to SCHED_FIFO priority %d.", p_Config.m_Priority);
+	}
+
+	return l_Succeeded;
+}
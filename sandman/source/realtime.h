@@ -0,0 +1,52 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <libxml/parser.h>
+
+// Types
+//
+
+// Configuration parameters for running the control path in real-time.
+struct RealtimeConfig
+{
+	// Read a real-time config from XML. Any settings that are missing keep their defaults.
+	//
+	// p_Document:	The XML document that the node belongs to.
+	// p_Node:		The XML node to read the real-time config from.
+	//
+	// Returns:		True if the config was read successfully, false otherwise.
+	//
+	bool ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node);
+
+	// Constants.
+	static constexpr int ms_AnyCPU = -1;
+
+	// Whether real-time mode is enabled.
+	bool m_Enabled = false;
+
+	// The CPU to run the control path on, or any CPU.
+	int m_CPU = ms_AnyCPU;
+
+	// The SCHED_FIFO priority for the control path (1 - 99).
+	int m_Priority = 50;
+};
+
+// Functions
+//
+
+// Lock all of the process's memory, current and future, into RAM and touch enough stack so that
+// none of it has to be faulted in later.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool RealtimeLockMemory();
+
+// Pin a thread to the configured CPU and give it SCHED_FIFO priority.
+//
+// p_Thread:	The thread.
+// p_Config:	The real-time configuration.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool RealtimeConfigureThread(pthread_t p_Thread, RealtimeConfig const& p_Config);
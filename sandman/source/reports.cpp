@@ -10,6 +10,8 @@
 #include "rapidjson/writer.h"
 
 #include "logger.h"
+#include "reactor.h"
+#include "timer.h"
 
 #define TEMPDIR	AM_TEMPDIR
 
@@ -50,6 +52,9 @@ static std::string s_ReportDateString;
 // A list of items to add to the report when we are able to.
 static std::vector<PendingItem> s_PendingItemList;
 
+// Fires when the effective date changes, so that we switch files even if nothing else is going on.
+static TimerHandle s_DateChangeTimer;
+
 // The names of the actions.
 static char const* const s_ControlActionNames[] =
 {
@@ -118,6 +123,34 @@ static std::string ReportsGetStartingDateTime()
 	return std::string(l_TimeStringBuffer);
 }
 
+// Determine how many seconds remain until the effective date changes.
+//
+static unsigned long ReportsGetSecondsUntilDateChange()
+{
+	// Get the current time.
+	auto const l_RawTime = time(nullptr);
+	auto* l_LocalTime = localtime(&l_RawTime);
+
+	// If the time is after the starting hour, the change happens tomorrow.
+	if (l_LocalTime->tm_hour >= REPORT_STARTING_HOUR)
+	{
+		l_LocalTime->tm_mday++;
+	}
+
+	l_LocalTime->tm_hour = REPORT_STARTING_HOUR;
+	l_LocalTime->tm_min = 0;
+	l_LocalTime->tm_sec = 0;
+
+	auto const l_RawChangeTime = mktime(l_LocalTime);
+
+	if (l_RawChangeTime <= l_RawTime)
+	{
+		return 0;
+	}
+
+	return static_cast<unsigned long>(l_RawChangeTime - l_RawTime);
+}
+
 // Opens the appropriate report file corresponding to the effective date.
 // 
 static void ReportsOpenFile()
@@ -213,6 +246,23 @@ static void ReportsOpenFile()
 	fputs("\n", s_ReportFile);
 }
 
+// Arm the timer for the next time the effective date changes.
+//
+static void ReportsArmDateChangeTimer()
+{
+	// The date follows the wall clock, but the timer doesn't, so this gets recalculated every time.
+	Time l_DateChangeTime;
+	TimerGetCurrent(l_DateChangeTime);
+	l_DateChangeTime += std::chrono::seconds(ReportsGetSecondsUntilDateChange());
+
+	// Processing will switch the file, then we wait for the next change.
+	ReactorGetTimerService().Arm(s_DateChangeTimer, l_DateChangeTime, []()
+	{
+		ReportsProcess();
+		ReportsArmDateChangeTimer();
+	});
+}
+
 // Initialize the reports.
 //
 void ReportsInitialize()
@@ -230,6 +280,8 @@ void ReportsInitialize()
 
 	// Open the correct file for now.
 	ReportsOpenFile();
+
+	ReportsArmDateChangeTimer();
 }
 
 // Uninitialize the reports.
@@ -239,6 +291,8 @@ void ReportsUninitialize()
 	// Acquire a lock for the rest of the function.
 	const std::lock_guard<std::mutex> l_ReportGuard(s_ReportMutex);
 
+	ReactorGetTimerService().Cancel(s_DateChangeTimer);
+
 	// Close the file.
 	if (s_ReportFile != nullptr)
 	{
@@ -349,9 +403,10 @@ static void ReportsAddItem(std::string const& p_EventString)
 // p_ControlName:	The name of the control.
 // p_Action:		The action performed on the control.
 // p_SourceName:	An identifier for where this item comes from.
+// p_Latency:		How long it took from the request arriving to the control acting on it.
 // 
 void ReportsAddControlItem(std::string const& p_ControlName, Control::Actions const p_Action,
-	std::string const& p_SourceName)
+	std::string const& p_SourceName, Duration p_Latency)
 {
 	if ((p_Action < 0) || (p_Action >= Control::NUM_ACTIONS))
 	{
@@ -379,6 +434,9 @@ void ReportsAddControlItem(std::string const& p_ControlName, Control::Actions co
 
 	l_ItemDocument.AddMember("source", 
 		rapidjson::Value(rapidjson::StringRef(p_SourceName.c_str())), l_ItemAllocator);
+
+	l_ItemDocument.AddMember("latencyUS", static_cast<int64_t>(
+		std::chrono::duration_cast<std::chrono::microseconds>(p_Latency).count()), l_ItemAllocator);
 	
 	// Write this into a string.
 	rapidjson::StringBuffer l_ItemBuffer;
@@ -27,9 +27,10 @@ void ReportsProcess();
 // p_ControlName:	The name of the control.
 // p_Action:		The action performed on the control.
 // p_SourceName:	An identifier for where this item comes from.
+// p_Latency:		How long it took from the request arriving to the control acting on it.
 // 
 void ReportsAddControlItem(std::string const& p_ControlName, Control::Actions const p_Action, 
-	std::string const& p_SourceName);
+	std::string const& p_SourceName, Duration p_Latency);
 
 // Add an item to the report corresponding to a schedule event.
 // 
@@ -0,0 +1,386 @@
+// A small client for sending requests to Sandman running as a daemon, for scripts and home
+// automation. It links against none of the full program's libraries, so it starts much faster.
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define TEMPDIR	AM_TEMPDIR
+
+// Constants
+//
+
+// How much is read at a time, from the daemon or from standard input.
+#define CTL_RECEIVE_CHUNK_SIZE	(4096)
+
+// Exit codes.
+#define CTL_EXIT_OK					(0)	// Every request succeeded.
+#define CTL_EXIT_FAILED				(1)	// At least one request didn't succeed.
+#define CTL_EXIT_NO_DAEMON			(2)	// The daemon couldn't be reached, or went away.
+
+// Types
+//
+
+using CtlClock = std::chrono::steady_clock;
+
+// Locals
+//
+
+// The socket the daemon listens on.
+static char const* s_CtlSocketFileName = TEMPDIR "sandman.sock";
+
+// Whether to report how long each request took to be answered.
+static bool s_CtlReportLatency = false;
+
+// Requests that have been sent and not answered yet, with when they were sent, in order.
+static std::vector<std::string> s_CtlPendingRequests;
+static std::vector<CtlClock::time_point> s_CtlPendingSendTimes;
+static unsigned int s_CtlFirstPendingIndex = 0;
+
+// Requests waiting to be written to the socket.
+static std::string s_CtlOutput;
+
+// Whether any request didn't succeed.
+static bool s_CtlAnyFailed = false;
+
+// Functions
+//
+
+// Print how to use the program.
+//
+static void CtlPrintUsage()
+{
+	printf("Usage: sandmanctl [--socket=FILE] [--latency] [REQUEST...]\n"
+		"\n"
+		"Sends each request to the Sandman daemon and prints its answer as a line of JSON. Underscores\n"
+		"in requests stand for spaces, so \"legs_raise\" and \"--command=legs_raise\" both send\n"
+		"\"legs raise\". With no requests, or with \"-\", requests are read from standard input, one\n"
+		"per line. Requests are sent without waiting for the answers, which come back in order.\n"
+		"\n"
+		"  --socket=FILE  The daemon's socket (default %s).\n"
+		"  --latency      Report how long each request took to be answered, on standard error.\n"
+		"\n"
+		"Exits with 0 if every request succeeded, 1 if any didn't, and 2 if the daemon couldn't be\n"
+		"reached.\n", s_CtlSocketFileName);
+}
+
+// Queue a request to be sent to the daemon.
+//
+// p_Request:	The request, without a newline.
+//
+static void CtlQueueRequest(std::string_view p_Request)
+{
+	// Allow for lines that end with a carriage return.
+	if ((p_Request.empty() == false) && (p_Request.back() == '\r'))
+	{
+		p_Request.remove_suffix(1);
+	}
+
+	// The daemon doesn't answer blank lines.
+	if (p_Request.empty() == true)
+	{
+		return;
+	}
+
+	s_CtlPendingRequests.emplace_back(p_Request);
+	s_CtlPendingSendTimes.push_back(CtlClock::now());
+
+	s_CtlOutput.append(p_Request);
+	s_CtlOutput += '\n';
+}
+
+// Handle the answer to the oldest request that hasn't been answered.
+//
+// p_Answer:	The answer, without its newline.
+//
+static void CtlHandleAnswer(std::string_view p_Answer)
+{
+	auto const l_ReceiveTime = CtlClock::now();
+
+	fwrite(p_Answer.data(), 1, p_Answer.size(), stdout);
+	fputc('\n', stdout);
+
+	// The daemon always puts the status first, so there is no need to parse the whole answer.
+	static constexpr std::string_view s_SuccessPrefix = "{\"status\":\"ok\"";
+
+	if (p_Answer.substr(0, s_SuccessPrefix.size()) != s_SuccessPrefix)
+	{
+		s_CtlAnyFailed = true;
+	}
+
+	// Answers for connections that were refused don't belong to any request.
+	if (s_CtlFirstPendingIndex >= s_CtlPendingRequests.size())
+	{
+		return;
+	}
+
+	if (s_CtlReportLatency == true)
+	{
+		auto const l_Latency = std::chrono::duration<double, std::milli>(l_ReceiveTime -
+			s_CtlPendingSendTimes[s_CtlFirstPendingIndex]);
+
+		fprintf(stderr, "\"%s\" answered in %.3f ms.\n",
+			s_CtlPendingRequests[s_CtlFirstPendingIndex].c_str(), l_Latency.count());
+	}
+
+	s_CtlFirstPendingIndex++;
+}
+
+// Handle every complete line in a buffer, keeping any partial line.
+//
+// p_Buffer:		(Input/Output) The buffer.
+// p_HandleLine:	Called for each line, without its newline.
+//
+template <typename HandlerType>
+static void CtlHandleLines(std::string& p_Buffer, HandlerType p_HandleLine)
+{
+	std::string_view l_Remaining(p_Buffer);
+
+	while (true)
+	{
+		auto const l_LineEnd = l_Remaining.find('\n');
+
+		if (l_LineEnd == std::string_view::npos)
+		{
+			break;
+		}
+
+		p_HandleLine(l_Remaining.substr(0, l_LineEnd));
+		l_Remaining.remove_prefix(l_LineEnd + 1);
+	}
+
+	p_Buffer.erase(0, p_Buffer.size() - l_Remaining.size());
+}
+
+// Connect to the daemon.
+//
+// Returns:	The connected socket, or -1 if it failed.
+//
+static int CtlConnect()
+{
+	auto const l_Socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (l_Socket < 0)
+	{
+		fprintf(stderr, "Failed to create sending socket.\n");
+		return -1;
+	}
+
+	sockaddr_un l_Address;
+	memset(&l_Address, 0, sizeof(l_Address));
+	{
+		l_Address.sun_family = AF_UNIX;
+		strncpy(l_Address.sun_path, s_CtlSocketFileName, sizeof(l_Address.sun_path) - 1);
+	}
+
+	if (connect(l_Socket, reinterpret_cast<sockaddr*>(&l_Address), sizeof(sockaddr_un)) < 0)
+	{
+		fprintf(stderr, "Failed to connect to the daemon at \"%s\".\n", s_CtlSocketFileName);
+		close(l_Socket);
+		return -1;
+	}
+
+	return l_Socket;
+}
+
+// Send the requests and print the answers, reading more requests from standard input if asked.
+//
+// p_Socket:		The connection to the daemon.
+// p_ReadInput:	Whether to read requests from standard input.
+//
+// Returns:			True if every request was answered, false if the connection was lost.
+//
+static bool CtlExchange(int p_Socket, bool p_ReadInput)
+{
+	std::string l_Input;
+	std::string l_Answers;
+	auto l_InputDone = (p_ReadInput == false);
+	auto l_SentEverything = false;
+
+	while (true)
+	{
+		// Let the daemon know once there is nothing more to send.
+		if ((l_InputDone == true) && (s_CtlOutput.empty() == true) && (l_SentEverything == false))
+		{
+			shutdown(p_Socket, SHUT_WR);
+			l_SentEverything = true;
+		}
+
+		if ((l_SentEverything == true) && (s_CtlFirstPendingIndex >= s_CtlPendingRequests.size()))
+		{
+			return true;
+		}
+
+		pollfd l_PollFileDescriptors[2];
+		memset(l_PollFileDescriptors, 0, sizeof(l_PollFileDescriptors));
+
+		l_PollFileDescriptors[0].fd = p_Socket;
+		l_PollFileDescriptors[0].events = POLLIN | ((s_CtlOutput.empty() == false) ? POLLOUT : 0);
+
+		l_PollFileDescriptors[1].fd = (l_InputDone == false) ? STDIN_FILENO : -1;
+		l_PollFileDescriptors[1].events = POLLIN;
+
+		if (poll(l_PollFileDescriptors, 2, -1) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return false;
+		}
+
+		char l_ReceiveBuffer[CTL_RECEIVE_CHUNK_SIZE];
+
+		// Read more requests.
+		if ((l_PollFileDescriptors[1].revents & (POLLIN | POLLHUP | POLLERR)) != 0)
+		{
+			auto const l_ReadSize = read(STDIN_FILENO, l_ReceiveBuffer, sizeof(l_ReceiveBuffer));
+
+			if (l_ReadSize > 0)
+			{
+				l_Input.append(l_ReceiveBuffer, l_ReadSize);
+				CtlHandleLines(l_Input, CtlQueueRequest);
+			}
+			else if ((l_ReadSize == 0) || (errno != EINTR))
+			{
+				// A last line without a newline is still a request.
+				CtlQueueRequest(l_Input);
+				l_Input.clear();
+				l_InputDone = true;
+			}
+		}
+
+		// Send what we can.
+		if ((l_PollFileDescriptors[0].revents & POLLOUT) != 0)
+		{
+			auto const l_SentSize = send(p_Socket, s_CtlOutput.data(), s_CtlOutput.size(),
+				MSG_NOSIGNAL | MSG_DONTWAIT);
+
+			if (l_SentSize > 0)
+			{
+				s_CtlOutput.erase(0, l_SentSize);
+			}
+			else if ((l_SentSize < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) &&
+				(errno != EINTR))
+			{
+				return false;
+			}
+		}
+
+		// Print the answers that have arrived.
+		if ((l_PollFileDescriptors[0].revents & (POLLIN | POLLHUP | POLLERR)) != 0)
+		{
+			auto const l_ReceivedSize = recv(p_Socket, l_ReceiveBuffer, sizeof(l_ReceiveBuffer),
+				MSG_DONTWAIT);
+
+			if (l_ReceivedSize > 0)
+			{
+				l_Answers.append(l_ReceiveBuffer, l_ReceivedSize);
+				CtlHandleLines(l_Answers, CtlHandleAnswer);
+			}
+			else if ((l_ReceivedSize == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK) &&
+				(errno != EINTR)))
+			{
+				// The daemon went away, or turned us away.
+				return (s_CtlFirstPendingIndex >= s_CtlPendingRequests.size()) &&
+					(s_CtlOutput.empty() == true) && (l_InputDone == true);
+			}
+		}
+	}
+}
+
+// Program entry point.
+//
+int main(int argc, char** argv)
+{
+	auto l_ReadInput = false;
+	std::vector<std::string> l_Requests;
+
+	for (int l_ArgumentIndex = 1; l_ArgumentIndex < argc; l_ArgumentIndex++)
+	{
+		std::string_view l_Argument(argv[l_ArgumentIndex]);
+
+		static constexpr std::string_view s_SocketPrefix = "--socket=";
+		static constexpr std::string_view s_CommandPrefix = "--command=";
+
+		if ((l_Argument == "--help") || (l_Argument == "-h"))
+		{
+			CtlPrintUsage();
+			return CTL_EXIT_OK;
+		}
+		else if (l_Argument == "--latency")
+		{
+			s_CtlReportLatency = true;
+		}
+		else if (l_Argument.substr(0, s_SocketPrefix.size()) == s_SocketPrefix)
+		{
+			s_CtlSocketFileName = argv[l_ArgumentIndex] + s_SocketPrefix.size();
+		}
+		else if (l_Argument == "-")
+		{
+			l_ReadInput = true;
+		}
+		else
+		{
+			// Accept the same form as the full program, so that it can be swapped in.
+			if (l_Argument.substr(0, s_CommandPrefix.size()) == s_CommandPrefix)
+			{
+				l_Argument.remove_prefix(s_CommandPrefix.size());
+			}
+
+			// Replace '_' with ' '.
+			std::string l_Request(l_Argument);
+
+			for (auto& l_Character : l_Request)
+			{
+				if (l_Character == '_')
+				{
+					l_Character = ' ';
+				}
+			}
+
+			l_Requests.push_back(l_Request);
+		}
+	}
+
+	if (l_Requests.empty() == true)
+	{
+		l_ReadInput = true;
+	}
+
+	auto const l_Socket = CtlConnect();
+
+	if (l_Socket < 0)
+	{
+		return CTL_EXIT_NO_DAEMON;
+	}
+
+	for (auto const& l_Request : l_Requests)
+	{
+		CtlQueueRequest(l_Request);
+	}
+
+	auto const l_Answered = CtlExchange(l_Socket, l_ReadInput);
+	close(l_Socket);
+
+	fflush(stdout);
+
+	if (l_Answered == false)
+	{
+		fprintf(stderr, "The daemon answered %u of %zu requests before the connection was lost.\n",
+			s_CtlFirstPendingIndex, s_CtlPendingRequests.size());
+		return CTL_EXIT_NO_DAEMON;
+	}
+
+	return (s_CtlAnyFailed == true) ? CTL_EXIT_FAILED : CTL_EXIT_OK;
+}
@@ -13,6 +13,7 @@
 #include "control.h"
 #include "logger.h"
 #include "notification.h"
+#include "reactor.h"
 #include "reports.h"
 #include "timer.h"
 
@@ -40,8 +41,14 @@ struct ScheduleEvent
 	// Delay in seconds before this entry occurs (since the last).
 	unsigned int	m_DelaySec;
 	
+	// Constants.
+	static constexpr unsigned int ms_PostureNameCapacity = 32;
+
 	// The control action to perform at the scheduled time.
 	ControlAction	m_ControlAction;
+
+	// The posture to move to at the scheduled time instead, if it isn't empty.
+	char				m_PostureName[ms_PostureNameCapacity] = "";
 };
 
 // Locals
@@ -59,6 +66,9 @@ static unsigned int s_ScheduleIndex = UINT_MAX;
 // The time the delay for the next event began.
 static Time s_ScheduleDelayStartTime;
 
+// Fires when it is time for the next event.
+static TimerHandle s_ScheduleTimer;
+
 // Functions
 //
 
@@ -88,7 +98,23 @@ bool ScheduleEvent::ReadFromJSON(rapidjson::Value::ConstObject const& p_Object)
 
 	m_DelaySec = l_DelayIterator->value.GetInt();
 
-	// We must also have a control action.
+	// We must also have either a posture or a control action.
+	auto const l_PostureIterator = p_Object.FindMember("posture");
+
+	if (l_PostureIterator != p_Object.MemberEnd())
+	{
+		if (l_PostureIterator->value.IsString() == false)
+		{
+			return false;
+		}
+
+		// Copy no more than the amount of text the buffer can hold.
+		strncpy(m_PostureName, l_PostureIterator->value.GetString(), ms_PostureNameCapacity - 1);
+		m_PostureName[ms_PostureNameCapacity - 1] = '\0';
+
+		return true;
+	}
+
 	auto const l_ControlActionIterator = p_Object.FindMember("controlAction");
 
 	if (l_ControlActionIterator == p_Object.MemberEnd())
@@ -114,12 +140,14 @@ bool ScheduleEvent::ReadFromJSON(rapidjson::Value::ConstObject const& p_Object)
 
 // Load the schedule from a file.
 // 
-static bool ScheduleLoad()
+// p_FileName:	The schedule file to load, or null for the usual one.
+//
+static bool ScheduleLoad(char const* p_FileName)
 {
 	// Open the schedule file.
 	static auto const* const s_ScheduleFileName = CONFIGDIR "sandman.sched";
 
-	auto* l_ScheduleFile = fopen(s_ScheduleFileName, "r");
+	auto* l_ScheduleFile = fopen((p_FileName != nullptr) ? p_FileName : s_ScheduleFileName, "r");
 
 	if (l_ScheduleFile == nullptr)
 	{
@@ -205,6 +233,13 @@ static void ScheduleLogLoaded()
 		auto const l_DelayMin = l_DelaySec / 60;
 		l_DelaySec %= 60;
 		
+		if (l_Event.m_PostureName[0] != '\0')
+		{
+			LoggerAddMessage("\t+%01ih %02im %02is -> posture %s", l_DelayHours, l_DelayMin, 
+				l_DelaySec, l_Event.m_PostureName);
+			continue;
+		}
+
 		auto const* l_ActionText = (l_Event.m_ControlAction.m_Action == Control::ACTION_MOVING_UP) ? 
 			"up" : "down";
 			
@@ -216,9 +251,87 @@ static void ScheduleLogLoaded()
 	LoggerAddMessage("");
 }
 
+static void ScheduleFireEvent();
+
+// Arm the timer for the current event, based on when its delay began.
+//
+static void ScheduleArmTimer()
+{
+	auto const l_EventTime = s_ScheduleDelayStartTime + 
+		std::chrono::seconds(s_ScheduleEvents[s_ScheduleIndex].m_DelaySec);
+
+	ReactorGetTimerService().Arm(s_ScheduleTimer, l_EventTime, ScheduleFireEvent);
+}
+
+// Perform the current event and move on to the next one.
+//
+static void ScheduleFireEvent()
+{
+	// Running?
+	if (ScheduleIsRunning() == false)
+	{
+		return;
+	}
+
+	auto const l_ScheduleEventCount = static_cast<unsigned int>(s_ScheduleEvents.size());
+	auto& l_Event = s_ScheduleEvents[s_ScheduleIndex];
+
+	// The event was due at the end of its delay, however late we are getting to it.
+	auto const l_DueTime = s_ScheduleDelayStartTime + std::chrono::seconds(l_Event.m_DelaySec);
+	
+	// Move to the next event.
+	s_ScheduleIndex = (s_ScheduleIndex + 1) % l_ScheduleEventCount;
+	
+	// Set the new delay start time.
+	TimerGetCurrent(s_ScheduleDelayStartTime);
+	ScheduleArmTimer();
+	
+	// Move to the posture, if that's what the event is for.
+	if (l_Event.m_PostureName[0] != '\0')
+	{
+		if (ControlsMoveToPosture(ControlsGetPostureIndex(l_Event.m_PostureName), 
+			ControlOrigin(ControlOrigin::SOURCE_SCHEDULE, l_DueTime)) == false)
+		{
+			LoggerAddMessage("Schedule couldn't move to posture \"%s\".", l_Event.m_PostureName);
+		}
+
+		LoggerAddMessage("Schedule moving to event %i.", s_ScheduleIndex);
+		return;
+	}
+
+	// Sanity check the event.
+	if (l_Event.m_ControlAction.m_Action >= Control::NUM_ACTIONS)
+	{
+		LoggerAddMessage("Schedule moving to event %i.", s_ScheduleIndex);
+		return;
+	}
+
+	// Try to find the control to perform the action.
+	auto* l_Control = l_Event.m_ControlAction.GetControl();
+	
+	if (l_Control == nullptr) {
+		
+		LoggerAddMessage("Schedule couldn't find control \"%s\". Moving to event %i.", 
+			l_Event.m_ControlAction.m_ControlName, s_ScheduleIndex);
+		return;
+	}
+		
+	// Perform the action.
+	if (l_Control->SetDesiredAction(l_Event.m_ControlAction.m_Action, Control::MODE_TIMED, 
+		ControlOrigin(ControlOrigin::SOURCE_SCHEDULE, l_DueTime)) == false)
+	{
+		LoggerAddMessage("Schedule couldn't move control \"%s\".", 
+			l_Event.m_ControlAction.m_ControlName);
+	}
+
+	LoggerAddMessage("Schedule moving to event %i.", s_ScheduleIndex);
+}
+
 // Initialize the schedule.
 //
-void ScheduleInitialize()
+// p_FileName:	(Optional) The schedule file to load, or null for the usual one.
+//
+void ScheduleInitialize(char const* p_FileName /* = nullptr */)
 {	
 	s_ScheduleIndex = UINT_MAX;
 	
@@ -227,7 +340,7 @@ void ScheduleInitialize()
 	LoggerAddMessage("Initializing the schedule...");
 
 	// Parse the schedule.
-	if (ScheduleLoad() == false)
+	if (ScheduleLoad(p_FileName) == false)
 	{
 		LoggerAddMessage("\tfailed");
 		return;
@@ -253,6 +366,9 @@ void ScheduleUninitialize()
 	
 	s_ScheduleInitialized = false;
 	
+	s_ScheduleIndex = UINT_MAX;
+	ReactorGetTimerService().Cancel(s_ScheduleTimer);
+
 	s_ScheduleEvents.clear();
 }
 
@@ -277,6 +393,12 @@ void ScheduleStart()
 	
 	s_ScheduleIndex = 0;
 	TimerGetCurrent(s_ScheduleDelayStartTime);
+
+	// No need to wait on anything for schedules with zero events.
+	if (s_ScheduleEvents.empty() == false)
+	{
+		ScheduleArmTimer();
+	}
 	
 	// Notify.
 	NotificationPlay("schedule_start");
@@ -304,6 +426,7 @@ void ScheduleStop()
 	}
 	
 	s_ScheduleIndex = UINT_MAX;
+	ReactorGetTimerService().Cancel(s_ScheduleTimer);
 	
 	// Notify.
 	NotificationPlay("schedule_stop");
@@ -318,71 +441,23 @@ bool ScheduleIsRunning()
 	return (s_ScheduleIndex != UINT_MAX);
 }
 
-// Process the schedule.
+// Get the event the schedule will perform next.
+//
+// p_EventIndex:	(Output) The index of the event in the schedule.
+// p_EventTime:	(Output) When the event is due.
 //
-void ScheduleProcess()
+// Returns:			True if there is an event to perform, false if the schedule isn't running or
+//						has no events.
+//
+bool ScheduleGetNextEvent(unsigned int& p_EventIndex, Time& p_EventTime)
 {
-	// Make sure it's initialized.
-	if (s_ScheduleInitialized == false)
+	if ((ScheduleIsRunning() == false) || (s_ScheduleEvents.empty() == true))
 	{
-		return;
-	}
-	
-	// Running?
-	if (ScheduleIsRunning() == false)
-	{
-		return;
-	}
-
-	// No need to do anything for schedules with zero events.
-	auto const l_ScheduleEventCount = static_cast<unsigned int>(s_ScheduleEvents.size());
-	if (l_ScheduleEventCount == 0)
-	{
-		return;
-	}
-
-	// Get elapsed time since delay start.
-	Time l_CurrentTime;
-	TimerGetCurrent(l_CurrentTime);
-
-	auto const l_ElapsedTimeSec = 
-		TimerGetElapsedMilliseconds(s_ScheduleDelayStartTime, l_CurrentTime) / 1000.0f;
-
-	// Time up?
-	auto& l_Event = s_ScheduleEvents[s_ScheduleIndex];
-	
-	if (l_ElapsedTimeSec < l_Event.m_DelaySec)
-	{
-		return;
-	}
-	
-	// Move to the next event.
-	s_ScheduleIndex = (s_ScheduleIndex + 1) % l_ScheduleEventCount;
-	
-	// Set the new delay start time.
-	TimerGetCurrent(s_ScheduleDelayStartTime);
-	
-	// Sanity check the event.
-	if (l_Event.m_ControlAction.m_Action >= Control::NUM_ACTIONS)
-	{
-		LoggerAddMessage("Schedule moving to event %i.", s_ScheduleIndex);
-		return;
-	}
-
-	// Try to find the control to perform the action.
-	auto* l_Control = l_Event.m_ControlAction.GetControl();
-	
-	if (l_Control == nullptr) {
-		
-		LoggerAddMessage("Schedule couldn't find control \"%s\". Moving to event %i.", 
-			l_Event.m_ControlAction.m_ControlName, s_ScheduleIndex);
-		return;
+		return false;
 	}
-		
-	// Perform the action.
-	l_Control->SetDesiredAction(l_Event.m_ControlAction.m_Action, Control::MODE_TIMED);
-	
-	ReportsAddControlItem(l_Control->GetName(), l_Event.m_ControlAction.m_Action, "schedule");
 
-	LoggerAddMessage("Schedule moving to event %i.", s_ScheduleIndex);
+	p_EventIndex = s_ScheduleIndex;
+	p_EventTime = s_ScheduleDelayStartTime + 
+		std::chrono::seconds(s_ScheduleEvents[s_ScheduleIndex].m_DelaySec);
+	return true;
 }
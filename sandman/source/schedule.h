@@ -1,5 +1,7 @@
 #pragma once
 
+#include "timer.h"
+
 // Types
 //
 
@@ -9,7 +11,9 @@
 
 // Initialize the schedule.
 //
-void ScheduleInitialize();
+// p_FileName:	(Optional) The schedule file to load, or null for the usual one.
+//
+void ScheduleInitialize(char const* p_FileName = nullptr);
 
 // Uninitialize the schedule.
 // 
@@ -27,7 +31,12 @@ void ScheduleStop();
 //
 bool ScheduleIsRunning();
 
-// Process the schedule.
+// Get the event the schedule will perform next.
 //
-void ScheduleProcess();
-
+// p_EventIndex:	(Output) The index of the event in the schedule.
+// p_EventTime:	(Output) When the event is due.
+//
+// Returns:			True if there is an event to perform, false if the schedule isn't running or
+//						has no events.
+//
+bool ScheduleGetNextEvent(unsigned int& p_EventIndex, Time& p_EventTime);
@@ -0,0 +1,241 @@
+// Checks that the pieces of Sandman that are easy to get subtly wrong still behave, without needing
+// the bed, the config, or any of the threads. Build and run it with "make selfcheck" and then
+// "./selfcheck". It prints each check that fails, and exits with a nonzero status if any did.
+
+#include <stdio.h>
+
+#include "command.h"
+#include "queue.h"
+#include "topic.h"
+
+// Constants
+//
+
+// How many elements the queues being checked can hold.
+#define CHECK_QUEUE_CAPACITY	(4)
+
+// Locals
+//
+
+// How many checks have failed so far.
+static unsigned int s_CheckFailureCount = 0;
+
+// Functions
+//
+
+// Record the result of a check, printing it if it failed.
+//
+// p_Passed:		Whether the check passed.
+// p_Description:	What was checked.
+//
+static void CheckExpect(bool p_Passed, char const* p_Description)
+{
+	if (p_Passed == true)
+	{
+		return;
+	}
+
+	printf("FAILED: %s\n", p_Description);
+	s_CheckFailureCount++;
+}
+
+// Check that commands are tokenized, and that a command with more words than fit is rejected as a
+// whole rather than partly carried out.
+//
+static void CheckCommandTokenizer()
+{
+	CommandTokenList l_Tokens;
+	CommandTokenizeString(l_Tokens, "Back  RAISE 50");
+
+	CheckExpect(l_Tokens.GetCount() == 3, "A short command is split into words.");
+	CheckExpect((l_Tokens[0].m_Type == CommandToken::TYPE_BACK) &&
+		(l_Tokens[1].m_Type == CommandToken::TYPE_RAISE) &&
+		(l_Tokens[2].m_Type == CommandToken::TYPE_INTEGER) && (l_Tokens[2].m_Parameter == 50),
+		"Words are matched without regard to case, and numbers become parameters.");
+	CheckExpect(l_Tokens.HasOverflowed() == false, "A short command doesn't overflow.");
+
+	// Exactly as many words as fit.
+	l_Tokens.Clear();
+	CommandTokenizeString(l_Tokens, "back raise back raise back raise back raise back raise back "
+		"raise back raise back raise");
+
+	CheckExpect(l_Tokens.GetCount() == CommandTokenList::ms_Capacity,
+		"A command that just fits keeps every word.");
+	CheckExpect(l_Tokens.HasOverflowed() == false, "A command that just fits doesn't overflow.");
+
+	// One word too many.
+	l_Tokens.Clear();
+	CommandTokenizeString(l_Tokens, "back raise back raise back raise back raise back raise back "
+		"raise back raise back raise legs");
+
+	CheckExpect(l_Tokens.GetCount() == CommandTokenList::ms_Capacity,
+		"An overflowing command keeps only what fits.");
+	CheckExpect(l_Tokens.HasOverflowed() == true, "An overflowing command is marked as overflowed.");
+	CheckExpect(l_Tokens.Add(CommandToken()) == false, "Nothing can be added to a full list.");
+
+	auto const l_Result = CommandParseTokens(ControlOrigin(), l_Tokens);
+	CheckExpect(l_Result == CommandParseTokensReturnTypes::INVALID,
+		"An overflowing command is rejected.");
+
+	// Clearing the list makes it usable again.
+	l_Tokens.Clear();
+	CheckExpect((l_Tokens.IsEmpty() == true) && (l_Tokens.HasOverflowed() == false),
+		"Clearing a list forgets that it overflowed.");
+}
+
+// Check that the single producer queue hands elements back in order, and refuses to push when
+// full or pop when empty.
+//
+static void CheckSPSCQueue()
+{
+	SPSCQueue<unsigned int, CHECK_QUEUE_CAPACITY> l_Queue;
+	unsigned int l_Element = 0;
+
+	CheckExpect(l_Queue.Pop(l_Element) == false, "An empty SPSC queue has nothing to pop.");
+	CheckExpect(l_Queue.GetSize() == 0, "An empty SPSC queue has no elements.");
+
+	// Go around more than once, so that the indices wrap.
+	unsigned int l_NextPush = 0;
+	unsigned int l_NextPop = 0;
+
+	for (unsigned int l_Round = 0; l_Round < 3; l_Round++)
+	{
+		while (l_Queue.Push(l_NextPush) == true)
+		{
+			l_NextPush++;
+		}
+
+		CheckExpect(l_Queue.GetSize() == CHECK_QUEUE_CAPACITY,
+			"A full SPSC queue holds its capacity.");
+
+		while (l_Queue.Pop(l_Element) == true)
+		{
+			CheckExpect(l_Element == l_NextPop, "An SPSC queue pops in the order it was pushed.");
+			l_NextPop++;
+		}
+
+		CheckExpect(l_NextPop == l_NextPush, "An SPSC queue gives back everything that was pushed.");
+		CheckExpect(l_Queue.GetSize() == 0, "A drained SPSC queue has no elements.");
+	}
+
+	CheckExpect(l_NextPush == 3 * CHECK_QUEUE_CAPACITY,
+		"An SPSC queue refuses pushes only when full.");
+}
+
+// Check that the multiple producer queue hands elements back in order, and refuses to push when
+// full or pop when empty.
+//
+static void CheckMPSCQueue()
+{
+	MPSCQueue<unsigned int, CHECK_QUEUE_CAPACITY> l_Queue;
+	unsigned int l_Position = 0;
+
+	CheckExpect(l_Queue.BeginPop() == nullptr, "An empty MPSC queue has nothing to pop.");
+	CheckExpect(l_Queue.GetSize() == 0, "An empty MPSC queue has no elements.");
+
+	// An element that has been claimed but not yet filled in can't be popped.
+	auto* l_Element = l_Queue.BeginPush(l_Position);
+	CheckExpect(l_Element != nullptr, "An empty MPSC queue has room to push.");
+	CheckExpect(l_Queue.GetSize() == 1, "An MPSC queue counts elements still being filled in.");
+	CheckExpect(l_Queue.BeginPop() == nullptr,
+		"An MPSC queue doesn't pop an element being filled in.");
+
+	*l_Element = 0;
+	l_Queue.EndPush(l_Position);
+
+	unsigned int l_NextPush = 1;
+	unsigned int l_NextPop = 0;
+
+	// Go around more than once, so that the sequence numbers wrap.
+	for (unsigned int l_Round = 0; l_Round < 3; l_Round++)
+	{
+		while ((l_Element = l_Queue.BeginPush(l_Position)) != nullptr)
+		{
+			*l_Element = l_NextPush;
+			l_Queue.EndPush(l_Position);
+			l_NextPush++;
+		}
+
+		CheckExpect(l_Queue.GetSize() == CHECK_QUEUE_CAPACITY,
+			"A full MPSC queue holds its capacity.");
+
+		while ((l_Element = l_Queue.BeginPop()) != nullptr)
+		{
+			CheckExpect(*l_Element == l_NextPop, "An MPSC queue pops in the order it was pushed.");
+			l_Queue.EndPop();
+			l_NextPop++;
+		}
+
+		CheckExpect(l_NextPop == l_NextPush, "An MPSC queue gives back everything that was pushed.");
+		CheckExpect(l_Queue.GetSize() == 0, "A drained MPSC queue has no elements.");
+	}
+
+	CheckExpect(l_NextPush == 3 * CHECK_QUEUE_CAPACITY,
+		"An MPSC queue refuses pushes only when full.");
+}
+
+// Check that topics are matched against filters with exact levels, "+" and "#", and that the most
+// specific filter wins.
+//
+static void CheckTopicTree()
+{
+	TopicTree<int> l_Tree;
+
+	CheckExpect(l_Tree.Find("sandman/command") == nullptr, "An empty tree matches nothing.");
+
+	l_Tree.Add("sandman/command", 1);
+	l_Tree.Add("sandman/+/status", 2);
+	l_Tree.Add("sandman/#", 3);
+	l_Tree.Add("hermes/intent/+", 4);
+
+	auto const l_FindValue = [&l_Tree](char const* p_Topic)
+	{
+		auto const* l_Value = l_Tree.Find(p_Topic);
+		return (l_Value != nullptr) ? *l_Value : 0;
+	};
+
+	CheckExpect(l_FindValue("sandman/command") == 1, "A topic matches a filter exactly.");
+	CheckExpect(l_FindValue("sandman/back/status") == 2, "\"+\" matches any one level.");
+	CheckExpect(l_FindValue("hermes/intent/move") == 4, "\"+\" matches the last level.");
+	CheckExpect(l_FindValue("hermes/intent") == 0, "\"+\" doesn't match a missing level.");
+	CheckExpect(l_FindValue("hermes/intent/move/back") == 0,
+		"\"+\" doesn't match more than one level.");
+	CheckExpect(l_FindValue("sandman/back/status/extra") == 3,
+		"\"#\" matches any number of levels.");
+	CheckExpect(l_FindValue("sandman/command/") == 3, "\"#\" matches an empty last level.");
+	CheckExpect(l_FindValue("sandman") == 3, "\"#\" matches the level before it.");
+	CheckExpect(l_FindValue("other/command") == 0, "A topic that no filter covers matches nothing.");
+	CheckExpect(l_FindValue("Sandman/command") == 0, "Topics are matched with regard to case.");
+
+	// An exact level beats "+", which beats "#".
+	l_Tree.Add("sandman/back/status", 5);
+
+	CheckExpect(l_FindValue("sandman/back/status") == 5, "An exact level beats \"+\".");
+	CheckExpect(l_FindValue("sandman/legs/status") == 2, "\"+\" beats \"#\".");
+
+	// Adding a filter again replaces its value.
+	l_Tree.Add("sandman/command", 6);
+	CheckExpect(l_FindValue("sandman/command") == 6, "Adding a filter again replaces its value.");
+
+	l_Tree.Clear();
+	CheckExpect(l_Tree.Find("sandman/command") == nullptr, "A cleared tree matches nothing.");
+}
+
+// Program entry point.
+//
+int main()
+{
+	CheckCommandTokenizer();
+	CheckSPSCQueue();
+	CheckMPSCQueue();
+	CheckTopicTree();
+
+	if (s_CheckFailureCount > 0)
+	{
+		printf("%u checks failed.\n", s_CheckFailureCount);
+		return 1;
+	}
+
+	printf("All checks passed.\n");
+	return 0;
+}
@@ -0,0 +1,621 @@
+#include "server.h"
+
+#include <errno.h>
+#include <string>
+#include <string.h>
+#include <string_view>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+#include "command.h"
+#include "logger.h"
+#include "reactor.h"
+#include "stats.h"
+#include "status.h"
+#include "timer.h"
+#include "trace.h"
+
+#define TEMPDIR	AM_TEMPDIR
+
+// Constants
+//
+
+// How many clients can be connected at once.
+#define SERVER_CLIENT_CAPACITY			(16)
+
+// How many connections can be waiting to be accepted.
+#define SERVER_LISTEN_BACKLOG				(16)
+
+// How much is read from a client at a time.
+#define SERVER_RECEIVE_CHUNK_SIZE		(4096)
+
+// The longest request that will be handled, not counting the newline.
+#define SERVER_REQUEST_CAPACITY			(1024)
+
+// How many bytes of answers can be waiting for a client to read them before it is disconnected.
+#define SERVER_OUTPUT_CAPACITY			(1024 * 1024)
+
+// Types
+//
+
+// A connected client.
+struct ServerClient
+{
+	// The connection, or -1 if this client isn't in use.
+	int				m_Socket = -1;
+
+	// What has been received but not handled yet, which is at most a partial request.
+	std::string		m_Input;
+
+	// Answers that haven't been sent yet.
+	std::string		m_Output;
+
+	// Whether the client has closed its end, so it should be disconnected once it has its answers.
+	bool				m_InputClosed = false;
+
+	// Whether the reactor is watching for the connection to be ready to send more.
+	bool				m_WatchingOutput = false;
+};
+
+// Locals
+//
+
+// Used to listen for connections.
+static int s_ServerListeningSocket = -1;
+
+// The file the listening socket is bound to.
+static std::string s_ServerSocketFileName;
+
+// The clients. Their buffers are kept from one connection to the next, so that busy clients don't
+// allocate.
+static ServerClient s_ServerClients[SERVER_CLIENT_CAPACITY];
+
+// Called when a client asks for the program to shut down.
+static ServerShutdownHandler s_ServerShutdownHandler;
+
+// Answers are written here before being added to a client's output.
+static rapidjson::StringBuffer s_ServerAnswerBuffer;
+
+// Functions
+//
+
+// Get the name of a result of parsing a command, for an answer.
+//
+// p_Result:	The result.
+//
+// Returns:		The name.
+//
+static char const* ServerGetResultName(CommandParseTokensReturnTypes p_Result)
+{
+	switch (p_Result)
+	{
+		case CommandParseTokensReturnTypes::SUCCESS:
+		{
+			return "success";
+		}
+
+		case CommandParseTokensReturnTypes::MISSING_CONFIRMATION:
+		{
+			return "missing_confirmation";
+		}
+
+		case CommandParseTokensReturnTypes::DROPPED:
+		{
+			return "dropped";
+		}
+
+		default:
+		{
+		}
+		break;
+	}
+
+	return "invalid";
+}
+
+// Handle a request and write the answer for it.
+//
+// p_Writer:		Writes the answer, which is an object that has been started. The status has to be
+//						written.
+// p_Request:		The request, without its newline.
+// p_ArrivalTime:	When the request arrived.
+//
+static void ServerHandleRequest(rapidjson::Writer<rapidjson::StringBuffer>& p_Writer,
+	std::string_view p_Request, Time const& p_ArrivalTime)
+{
+	LoggerAddMessage("Received \"%.*s\".", static_cast<int>(p_Request.size()), p_Request.data());
+
+	if (p_Request == "shutdown")
+	{
+		p_Writer.Key("status");
+		p_Writer.String("ok");
+
+		if (s_ServerShutdownHandler)
+		{
+			s_ServerShutdownHandler();
+		}
+
+		return;
+	}
+
+	if (p_Request == "stats")
+	{
+		// Answer with the stats.
+		std::string l_StatsJSON;
+		StatsGetJSON(l_StatsJSON);
+
+		p_Writer.Key("status");
+		p_Writer.String("ok");
+		p_Writer.Key("stats");
+		p_Writer.RawValue(l_StatsJSON.c_str(), l_StatsJSON.size(), rapidjson::kObjectType);
+		return;
+	}
+
+	if (p_Request == "status")
+	{
+		// Answer with a snapshot of what everything is doing, rather than speaking the status as the
+		// command does, since this is meant to be polled.
+		p_Writer.Key("status");
+		p_Writer.String("ok");
+		p_Writer.Key("snapshot");
+		StatusWriteJSON(p_Writer);
+		return;
+	}
+
+	if (p_Request == "trace dump")
+	{
+		// Write out the recent trace events from every thread.
+		static char const* s_TraceFileName = TEMPDIR "sandman.trace.json";
+
+		if (TraceDump(s_TraceFileName) == false)
+		{
+			LoggerAddMessage("Failed to write trace to \"%s\".", s_TraceFileName);
+
+			p_Writer.Key("status");
+			p_Writer.String("error");
+			p_Writer.Key("error");
+			p_Writer.String("Failed to write the trace.");
+			return;
+		}
+
+		LoggerAddMessage("Wrote trace to \"%s\".", s_TraceFileName);
+
+		p_Writer.Key("status");
+		p_Writer.String("ok");
+		p_Writer.Key("file");
+		p_Writer.String(s_TraceFileName);
+		return;
+	}
+
+	// Parse a command.
+
+	// Tokenize the request.
+	CommandTokenList l_CommandTokens;
+	CommandTokenizeString(l_CommandTokens, p_Request);
+
+	// Parse command tokens.
+	char const* l_ConfirmationText = nullptr;
+	auto const l_Result = CommandParseTokens(l_ConfirmationText,
+		ControlOrigin(ControlOrigin::SOURCE_SOCKET, p_ArrivalTime), l_CommandTokens);
+
+	p_Writer.Key("status");
+	p_Writer.String((l_Result == CommandParseTokensReturnTypes::SUCCESS) ? "ok" : "error");
+	p_Writer.Key("result");
+	p_Writer.String(ServerGetResultName(l_Result));
+
+	if ((l_Result == CommandParseTokensReturnTypes::MISSING_CONFIRMATION) &&
+		(l_ConfirmationText != nullptr))
+	{
+		p_Writer.Key("confirmation");
+		p_Writer.String(l_ConfirmationText);
+	}
+}
+
+// Add an answer to a client's output.
+//
+// p_Client:		The client.
+// p_Request:		The request, without its newline, or empty if p_Error is given.
+// p_Error:			Why the request couldn't be handled, or null if it can be.
+// p_ArrivalTime:	When the request arrived.
+//
+static void ServerAddAnswer(ServerClient& p_Client, std::string_view p_Request, char const* p_Error,
+	Time const& p_ArrivalTime)
+{
+	s_ServerAnswerBuffer.Clear();
+
+	rapidjson::Writer<rapidjson::StringBuffer> l_AnswerWriter(s_ServerAnswerBuffer);
+	l_AnswerWriter.StartObject();
+
+	if (p_Error != nullptr)
+	{
+		l_AnswerWriter.Key("status");
+		l_AnswerWriter.String("error");
+		l_AnswerWriter.Key("error");
+		l_AnswerWriter.String(p_Error);
+	}
+	else
+	{
+		ServerHandleRequest(l_AnswerWriter, p_Request, p_ArrivalTime);
+	}
+
+	l_AnswerWriter.EndObject();
+
+	p_Client.m_Output.append(s_ServerAnswerBuffer.GetString(), s_ServerAnswerBuffer.GetSize());
+	p_Client.m_Output += '\n';
+}
+
+// Handle every complete request a client has sent.
+//
+// p_Client:		The client.
+// p_ArrivalTime:	When the requests arrived.
+//
+// Returns:			True if the client should stay connected, false if it sent something too long.
+//
+static bool ServerHandleInput(ServerClient& p_Client, Time const& p_ArrivalTime)
+{
+	std::string_view l_Input(p_Client.m_Input);
+
+	while (true)
+	{
+		auto const l_RequestEnd = l_Input.find('\n');
+
+		// Once the client has closed its end, whatever is left is the last request.
+		if ((l_RequestEnd == std::string_view::npos) &&
+			((p_Client.m_InputClosed == false) || (l_Input.empty() == true)))
+		{
+			break;
+		}
+
+		auto l_Request = l_Input.substr(0, l_RequestEnd);
+		l_Input.remove_prefix((l_RequestEnd != std::string_view::npos) ? (l_RequestEnd + 1) :
+			l_Input.size());
+
+		// Allow for clients that end lines with a carriage return too.
+		if ((l_Request.empty() == false) && (l_Request.back() == '\r'))
+		{
+			l_Request.remove_suffix(1);
+		}
+
+		// Blank lines don't need an answer.
+		if (l_Request.empty() == true)
+		{
+			continue;
+		}
+
+		if (l_Request.size() > SERVER_REQUEST_CAPACITY)
+		{
+			ServerAddAnswer(p_Client, std::string_view(), "Request is too long.", p_ArrivalTime);
+			continue;
+		}
+
+		ServerAddAnswer(p_Client, l_Request, nullptr, p_ArrivalTime);
+	}
+
+	// Keep any partial request for when the rest of it arrives.
+	p_Client.m_Input.erase(0, p_Client.m_Input.size() - l_Input.size());
+
+	if (p_Client.m_Input.size() > SERVER_REQUEST_CAPACITY)
+	{
+		ServerAddAnswer(p_Client, std::string_view(), "Request is too long.", p_ArrivalTime);
+		return false;
+	}
+
+	return true;
+}
+
+// Disconnect a client.
+//
+// p_Client:	The client.
+//
+static void ServerCloseClient(ServerClient& p_Client)
+{
+	ReactorRemoveFileDescriptor(p_Client.m_Socket);
+	close(p_Client.m_Socket);
+
+	p_Client.m_Socket = -1;
+	p_Client.m_Input.clear();
+	p_Client.m_Output.clear();
+	p_Client.m_InputClosed = false;
+	p_Client.m_WatchingOutput = false;
+
+	LoggerAddMessage("Connection closed.");
+}
+
+// Send as much of a client's output as it will take right now.
+//
+// p_Client:	The client.
+//
+// Returns:		True if the client is still connected, false if it failed.
+//
+static bool ServerSendOutput(ServerClient& p_Client)
+{
+	std::string::size_type l_SentSize = 0;
+
+	while (l_SentSize < p_Client.m_Output.size())
+	{
+		auto const l_Result = send(p_Client.m_Socket, p_Client.m_Output.data() + l_SentSize,
+			p_Client.m_Output.size() - l_SentSize, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+		if (l_Result >= 0)
+		{
+			l_SentSize += l_Result;
+			continue;
+		}
+
+		if (errno == EINTR)
+		{
+			continue;
+		}
+
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+		{
+			break;
+		}
+
+		LoggerAddMessage("Failed to send to a client with error %d.", errno);
+		return false;
+	}
+
+	p_Client.m_Output.erase(0, l_SentSize);
+
+	// A client that isn't reading its answers can't be allowed to use up all of the memory.
+	if (p_Client.m_Output.size() > SERVER_OUTPUT_CAPACITY)
+	{
+		LoggerAddMessage("Disconnecting a client that isn't reading its answers.");
+		return false;
+	}
+
+	// Wait to be able to send the rest, and stop reading from a client that has closed its end,
+	// since it would always be ready to be read.
+	auto const l_WatchOutput = (p_Client.m_Output.empty() == false);
+
+	if ((l_WatchOutput != p_Client.m_WatchingOutput) || (p_Client.m_InputClosed == true))
+	{
+		if (ReactorWatchFileDescriptor(p_Client.m_Socket, p_Client.m_InputClosed == false,
+			l_WatchOutput) == false)
+		{
+			return false;
+		}
+
+		p_Client.m_WatchingOutput = l_WatchOutput;
+	}
+
+	return true;
+}
+
+// Handle a client being ready to be read or written.
+//
+// p_Client:	The client.
+//
+static void ServerProcessClient(ServerClient& p_Client)
+{
+	StatsScope l_Probe(STATS_PROBE_SOCKET);
+
+	// Read everything that has arrived.
+	auto l_Received = false;
+
+	while (p_Client.m_InputClosed == false)
+	{
+		char l_ReceiveBuffer[SERVER_RECEIVE_CHUNK_SIZE];
+		auto const l_ReceivedSize = recv(p_Client.m_Socket, l_ReceiveBuffer, sizeof(l_ReceiveBuffer),
+			MSG_DONTWAIT);
+
+		if (l_ReceivedSize > 0)
+		{
+			p_Client.m_Input.append(l_ReceiveBuffer, l_ReceivedSize);
+			l_Received = true;
+			continue;
+		}
+
+		if (l_ReceivedSize == 0)
+		{
+			p_Client.m_InputClosed = true;
+			l_Received = true;
+			break;
+		}
+
+		if (errno == EINTR)
+		{
+			continue;
+		}
+
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+		{
+			break;
+		}
+
+		LoggerAddMessage("Connection closed, error receiving.");
+		ServerCloseClient(p_Client);
+		return;
+	}
+
+	auto l_StayConnected = true;
+
+	if (l_Received == true)
+	{
+		Time l_ArrivalTime;
+		TimerGetCurrent(l_ArrivalTime);
+
+		l_StayConnected = ServerHandleInput(p_Client, l_ArrivalTime);
+	}
+
+	if (ServerSendOutput(p_Client) == false)
+	{
+		ServerCloseClient(p_Client);
+		return;
+	}
+
+	// Disconnect once everything has been answered, if the client is done or has to go.
+	if (((p_Client.m_InputClosed == true) || (l_StayConnected == false)) &&
+		(p_Client.m_Output.empty() == true))
+	{
+		ServerCloseClient(p_Client);
+		return;
+	}
+
+	// Anything more from a client that has to go is ignored until its answers are sent.
+	if (l_StayConnected == false)
+	{
+		p_Client.m_InputClosed = true;
+		p_Client.m_Input.clear();
+
+		if (ServerSendOutput(p_Client) == false)
+		{
+			ServerCloseClient(p_Client);
+		}
+	}
+}
+
+// Accept every connection that is waiting.
+//
+static void ServerAcceptConnections()
+{
+	StatsScope l_Probe(STATS_PROBE_SOCKET);
+
+	while (true)
+	{
+		auto const l_ConnectionSocket = accept4(s_ServerListeningSocket, nullptr, nullptr,
+			SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (l_ConnectionSocket < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return;
+		}
+
+		// Find a free client.
+		unsigned int l_ClientIndex = 0;
+
+		while ((l_ClientIndex < SERVER_CLIENT_CAPACITY) &&
+			(s_ServerClients[l_ClientIndex].m_Socket >= 0))
+		{
+			l_ClientIndex++;
+		}
+
+		if (l_ClientIndex == SERVER_CLIENT_CAPACITY)
+		{
+			LoggerAddMessage("Refused a connection because there are already %u clients.",
+				SERVER_CLIENT_CAPACITY);
+
+			static char const* s_RefusalAnswer = "{\"status\":\"error\",\"error\":\"Too many clients.\"}\n";
+			send(l_ConnectionSocket, s_RefusalAnswer, strlen(s_RefusalAnswer),
+				MSG_NOSIGNAL | MSG_DONTWAIT);
+
+			close(l_ConnectionSocket);
+			continue;
+		}
+
+		auto& l_Client = s_ServerClients[l_ClientIndex];
+
+		if (ReactorAddFileDescriptor(l_ConnectionSocket, [l_ClientIndex]()
+			{
+				ServerProcessClient(s_ServerClients[l_ClientIndex]);
+			}) == false)
+		{
+			close(l_ConnectionSocket);
+			continue;
+		}
+
+		l_Client.m_Socket = l_ConnectionSocket;
+
+		// Got a connection.
+		LoggerAddMessage("Got a new connection.");
+	}
+}
+
+// Start listening for clients on a Unix domain socket. Any number of clients can stay connected at
+// once, and each can send as many requests as it likes without waiting for the answers. Each request
+// is a line, and is answered with a line of JSON in the same order. The answer has a "status" of
+// "ok" or "error", and for commands, the "result" of parsing the command and any "confirmation"
+// prompt. A client that closes its end without finishing its last line gets that line handled too.
+//
+// p_SocketFileName:		The file name to listen on.
+// p_ShutdownHandler:	Called when a client asks for the program to shut down.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool ServerInitialize(char const* p_SocketFileName, ServerShutdownHandler const& p_ShutdownHandler)
+{
+	s_ServerShutdownHandler = p_ShutdownHandler;
+
+	// Create a listening socket.
+	s_ServerListeningSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (s_ServerListeningSocket < 0)
+	{
+		LoggerAddMessage("Failed to create listening socket.");
+		return false;
+	}
+
+	sockaddr_un l_ListeningAddress;
+	memset(&l_ListeningAddress, 0, sizeof(l_ListeningAddress));
+	{
+		l_ListeningAddress.sun_family = AF_UNIX;
+		strncpy(l_ListeningAddress.sun_path, p_SocketFileName,
+			sizeof(l_ListeningAddress.sun_path) - 1);
+	}
+
+	// Unlink the file if needed.
+	unlink(l_ListeningAddress.sun_path);
+
+	// Bind the socket to the file.
+	if (bind(s_ServerListeningSocket, reinterpret_cast<sockaddr*>(&l_ListeningAddress),
+		sizeof(sockaddr_un)) < 0)
+	{
+		LoggerAddMessage("Failed to bind listening socket.");
+		return false;
+	}
+
+	s_ServerSocketFileName = l_ListeningAddress.sun_path;
+
+	// Mark the socket for listening.
+	if (listen(s_ServerListeningSocket, SERVER_LISTEN_BACKLOG) < 0)
+	{
+		LoggerAddMessage("Failed to mark listening socket to listen.");
+		return false;
+	}
+
+	// Handle connections as they come in.
+	if (ReactorAddFileDescriptor(s_ServerListeningSocket, ServerAcceptConnections) == false)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+// Disconnect all of the clients and stop listening.
+//
+void ServerUninitialize()
+{
+	for (auto& l_Client : s_ServerClients)
+	{
+		if (l_Client.m_Socket >= 0)
+		{
+			ServerCloseClient(l_Client);
+		}
+	}
+
+	if (s_ServerListeningSocket >= 0)
+	{
+		ReactorRemoveFileDescriptor(s_ServerListeningSocket);
+		close(s_ServerListeningSocket);
+		s_ServerListeningSocket = -1;
+	}
+
+	if (s_ServerSocketFileName.empty() == false)
+	{
+		unlink(s_ServerSocketFileName.c_str());
+		s_ServerSocketFileName.clear();
+	}
+
+	s_ServerShutdownHandler = nullptr;
+}
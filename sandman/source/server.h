@@ -0,0 +1,29 @@
+#pragma once
+
+#include <functional>
+
+// Types
+//
+
+// A function that is called when a client asks for the program to shut down.
+using ServerShutdownHandler = std::function<void()>;
+
+// Functions
+//
+
+// Start listening for clients on a Unix domain socket. Any number of clients can stay connected at
+// once, and each can send as many requests as it likes without waiting for the answers. Each request
+// is a line, and is answered with a line of JSON in the same order. The answer has a "status" of
+// "ok" or "error", and for commands, the "result" of parsing the command and any "confirmation"
+// prompt. A client that closes its end without finishing its last line gets that line handled too.
+//
+// p_SocketFileName:		The file name to listen on.
+// p_ShutdownHandler:	Called when a client asks for the program to shut down.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool ServerInitialize(char const* p_SocketFileName, ServerShutdownHandler const& p_ShutdownHandler);
+
+// Disconnect all of the clients and stop listening.
+//
+void ServerUninitialize();
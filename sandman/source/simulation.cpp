@@ -0,0 +1,881 @@
+#include "simulation.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "command.h"
+#include "config.h"
+#include "control.h"
+#include "gpio.h"
+#include "logger.h"
+#include "reactor.h"
+#include "schedule.h"
+#include "timer.h"
+#include "xml.h"
+
+// Constants
+//
+
+// How far a movement's run time can be from what was asked for before it counts as an error.
+#define SIMULATION_TIMING_ERROR_TOLERANCE		(1ms)
+
+// The longest line in a command stream.
+#define SIMULATION_COMMAND_LINE_CAPACITY		(256)
+
+// Types
+//
+
+// A command from a recorded command stream.
+struct SimulationCommand
+{
+	// When the command arrives, relative to the start of the simulation.
+	Duration		m_Offset;
+
+	// The command, as it would be typed.
+	std::string	m_Text;
+};
+
+// A command that a movement was asked to do, but hasn't been matched to the pins yet.
+struct SimulationRequest
+{
+	// Whether there is a request.
+	bool					m_Pending = false;
+
+	// The action that was applied.
+	Control::Actions	m_Action = Control::ACTION_STOPPED;
+
+	// The mode of the action.
+	Control::Modes		m_Mode = Control::MODE_MANUAL;
+
+	// How long the control was asked to move for.
+	Duration				m_MovingDuration;
+
+	// When the request arrived.
+	Time					m_ArrivalTime;
+};
+
+// The simulated state of an actuator. Positions are how long the motor would need to run up from
+// the bottom end stop to get there, so that moving is exact.
+struct SimulationActuator
+{
+	// Constants.
+	static constexpr unsigned int ms_NameCapacity = 32;
+
+	// The name of the control that drives the actuator.
+	char						m_Name[ms_NameCapacity];
+
+	// The pins that drive the motor up and down.
+	GPIOPinSet				m_UpPins = 0;
+	GPIOPinSet				m_DownPins = 0;
+
+	// How long it takes to travel from one end stop to the other.
+	Duration					m_TravelDuration;
+
+	// Where the actuator is.
+	Duration					m_Position;
+
+	// Which way the motor is running: 1 for up, -1 for down, or 0 if it is off.
+	int						m_Direction = 0;
+
+	// When the actuator was last moved to the current time.
+	Time						m_UpdateTime;
+
+	// When the current movement started.
+	Time						m_MoveStartTime;
+
+	// Whether the current movement was asked for with a timed command, and how long it should last.
+	bool						m_MoveIsTimed = false;
+	Duration					m_MoveRequestedDuration;
+
+	// The latest command applied to the control, until the pins have been checked against it.
+	SimulationRequest		m_Request;
+
+	// How long the motor has run in total.
+	Duration					m_MotorOnDuration = Duration::zero();
+
+	// How long the motor has run while the actuator was stuck against an end stop.
+	Duration					m_EndStopDuration = Duration::zero();
+
+	// How many movements there have been.
+	unsigned int			m_MoveCount = 0;
+
+	// How many times both pins were on at once.
+	unsigned int			m_ConflictCount = 0;
+
+	// Where the control thinks the actuator is at the end, as a percentage, and whether it knows.
+	unsigned int			m_EstimatePercent = 0;
+	bool						m_EstimateKnown = false;
+};
+
+// A movement that didn't run the way it was asked to.
+struct SimulationTimingError
+{
+	// Constants.
+	static constexpr unsigned int ms_NameCapacity = 32;
+
+	// The name of the control.
+	char						m_Name[ms_NameCapacity];
+
+	// When the movement was asked for.
+	Time						m_ArrivalTime;
+
+	// The action that was asked for.
+	Control::Actions		m_Action;
+
+	// How long the movement was asked to last.
+	Duration					m_RequestedDuration;
+
+	// How long the movement actually lasted.
+	Duration					m_ActualDuration;
+
+	// Whether the movement never happened at all.
+	bool						m_Dropped;
+};
+
+// Locals
+//
+
+// The simulated actuators.
+static std::vector<SimulationActuator> s_SimulationActuators;
+
+// Movements that didn't run the way they were asked to.
+static std::vector<SimulationTimingError> s_SimulationTimingErrors;
+
+// The number of timed movements that ran, and the worst of their timing.
+static unsigned int s_SimulationTimedMoveCount = 0;
+static Duration s_SimulationMaxRunTimeError = Duration::zero();
+static Duration s_SimulationMaxStartDelay = Duration::zero();
+
+// Functions
+//
+
+// SimulationActuatorConfig members
+
+// Read a simulated actuator config from XML. Any settings that are missing keep their defaults.
+//
+// p_Document:	The XML document that the node belongs to.
+// p_Node:		The XML node to read the actuator config from.
+//
+// Returns:		True if the config was read successfully, false otherwise.
+//
+bool SimulationActuatorConfig::ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node)
+{
+	// We must have a control name.
+	static auto const* s_ControlNameNodeName = "ControlName";
+	auto* l_ControlNameNode = XMLFindNextNodeByName(p_Node->xmlChildrenNode, s_ControlNameNodeName);
+
+	if (l_ControlNameNode == nullptr)
+	{
+		return false;
+	}
+
+	if (XMLCopyNodeText(m_ControlName, ms_ControlNameCapacity, p_Document, l_ControlNameNode) == false)
+	{
+		return false;
+	}
+
+	// Get the travel duration.
+	static auto const* s_TravelDurationNodeName = "TravelDurationMS";
+	auto* l_TravelDurationNode = XMLFindNextNodeByName(p_Node->xmlChildrenNode,
+		s_TravelDurationNodeName);
+
+	if (l_TravelDurationNode != nullptr)
+	{
+		m_TravelDurationMS = XMLGetNodeTextAsInteger(p_Document, l_TravelDurationNode);
+	}
+
+	// Get the starting position.
+	static auto const* s_StartPercentNodeName = "StartPercent";
+	auto* l_StartPercentNode = XMLFindNextNodeByName(p_Node->xmlChildrenNode, s_StartPercentNodeName);
+
+	if (l_StartPercentNode != nullptr)
+	{
+		m_StartPercent = std::min(XMLGetNodeTextAsInteger(p_Document, l_StartPercentNode), 100);
+	}
+
+	return true;
+}
+
+// SimulationConfig members
+
+// Read a simulation config from XML. Any settings that are missing keep their defaults.
+//
+// p_Document:	The XML document that the node belongs to.
+// p_Node:		The XML node to read the simulation config from.
+//
+// Returns:		True if the config was read successfully, false otherwise.
+//
+bool SimulationConfig::ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node)
+{
+	static auto const* s_ActuatorsNodeName = "Actuators";
+	auto* l_ActuatorsNode = XMLFindNextNodeByName(p_Node->xmlChildrenNode, s_ActuatorsNodeName);
+
+	if (l_ActuatorsNode == nullptr)
+	{
+		return true;
+	}
+
+	m_ActuatorConfigs.clear();
+
+	static auto const* s_ActuatorNodeName = "Actuator";
+	XMLForEachNodeNamed(l_ActuatorsNode->xmlChildrenNode, s_ActuatorNodeName, [&](xmlNodePtr p_Node)
+	{
+		// Try to read the actuator config.
+		SimulationActuatorConfig l_ActuatorConfig;
+		if (l_ActuatorConfig.ReadFromXML(p_Document, p_Node) == false)
+		{
+			return;
+		}
+
+		m_ActuatorConfigs.push_back(l_ActuatorConfig);
+	});
+
+	return true;
+}
+
+// Format a duration as hours, minutes, seconds and milliseconds.
+//
+// p_Buffer:			(Output) The formatted duration.
+// p_BufferCapacity:	The capacity of the buffer.
+// p_Duration:			The duration.
+//
+static void SimulationFormatDuration(char* p_Buffer, unsigned int p_BufferCapacity,
+	Duration p_Duration)
+{
+	auto const* l_Sign = (p_Duration < Duration::zero()) ? "-" : "";
+	auto l_DurationMS = static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+		(p_Duration < Duration::zero()) ? -p_Duration : p_Duration).count());
+
+	auto const l_Hours = l_DurationMS / 3600000;
+	l_DurationMS %= 3600000;
+
+	auto const l_Minutes = l_DurationMS / 60000;
+	l_DurationMS %= 60000;
+
+	snprintf(p_Buffer, p_BufferCapacity, "%s%lld:%02lld:%02lld.%03lld", l_Sign, l_Hours, l_Minutes,
+		l_DurationMS / 1000, l_DurationMS % 1000);
+}
+
+// Load a recorded command stream.
+//
+// p_Commands:		(Output) The commands, in order.
+// p_FileName:		The name of the command stream file.
+//
+// Returns:		True if successful, false otherwise.
+//
+static bool SimulationLoadCommands(std::vector<SimulationCommand>& p_Commands,
+	char const* p_FileName)
+{
+	auto* l_CommandFile = fopen(p_FileName, "r");
+
+	if (l_CommandFile == nullptr)
+	{
+		LoggerAddMessage("Failed to open the command stream \"%s\".", p_FileName);
+		return false;
+	}
+
+	char l_Line[SIMULATION_COMMAND_LINE_CAPACITY];
+	unsigned int l_LineNumber = 0;
+
+	while (fgets(l_Line, sizeof(l_Line), l_CommandFile) != nullptr)
+	{
+		l_LineNumber++;
+
+		// Skip blank lines and comments.
+		auto const* l_Text = l_Line;
+
+		while (isspace(*l_Text) != 0)
+		{
+			l_Text++;
+		}
+
+		if ((*l_Text == '\0') || (*l_Text == '#'))
+		{
+			continue;
+		}
+
+		// Get the time.
+		char* l_TimeEnd = nullptr;
+		auto const l_OffsetSec = strtod(l_Text, &l_TimeEnd);
+
+		if ((l_TimeEnd == l_Text) || (l_OffsetSec < 0.0))
+		{
+			LoggerAddMessage("Ignoring line %u of the command stream, which doesn't start with a time.",
+				l_LineNumber);
+			continue;
+		}
+
+		SimulationCommand l_Command;
+		l_Command.m_Offset = std::chrono::duration_cast<Duration>(
+			std::chrono::duration<double>(l_OffsetSec));
+
+		if ((p_Commands.empty() == false) && (l_Command.m_Offset < p_Commands.back().m_Offset))
+		{
+			LoggerAddMessage("Line %u of the command stream is earlier than the line before it.",
+				l_LineNumber);
+			fclose(l_CommandFile);
+			return false;
+		}
+
+		// The rest of the line is the command.
+		l_Text = l_TimeEnd;
+
+		while (isspace(*l_Text) != 0)
+		{
+			l_Text++;
+		}
+
+		l_Command.m_Text = l_Text;
+
+		while ((l_Command.m_Text.empty() == false) && (isspace(l_Command.m_Text.back()) != 0))
+		{
+			l_Command.m_Text.pop_back();
+		}
+
+		p_Commands.push_back(l_Command);
+	}
+
+	fclose(l_CommandFile);
+	return true;
+}
+
+// Set up an actuator for each control.
+//
+// p_Config:		The configuration.
+// p_StartTime:	When the simulation starts.
+//
+static void SimulationCreateActuators(Config const& p_Config, Time const& p_StartTime)
+{
+	s_SimulationActuators.clear();
+
+	for (auto const& l_ControlConfig : p_Config.GetControlConfigs())
+	{
+		// Look for settings for this control, or use the defaults.
+		SimulationActuatorConfig l_ActuatorConfig;
+
+		for (auto const& l_Candidate : p_Config.GetSimulationConfig().m_ActuatorConfigs)
+		{
+			if (strcmp(l_Candidate.m_ControlName, l_ControlConfig.m_Name) == 0)
+			{
+				l_ActuatorConfig = l_Candidate;
+				break;
+			}
+		}
+
+		SimulationActuator l_Actuator;
+		strncpy(l_Actuator.m_Name, l_ControlConfig.m_Name, SimulationActuator::ms_NameCapacity - 1);
+		l_Actuator.m_Name[SimulationActuator::ms_NameCapacity - 1] = '\0';
+
+		l_Actuator.m_UpPins = GPIOGetPinSet(l_ControlConfig.m_UpGPIOPin);
+		l_Actuator.m_DownPins = GPIOGetPinSet(l_ControlConfig.m_DownGPIOPin);
+		l_Actuator.m_TravelDuration = std::chrono::milliseconds((l_ActuatorConfig.m_TravelDurationMS > 0) ? 
+			l_ActuatorConfig.m_TravelDurationMS : l_ControlConfig.m_MovingDurationMS);
+		l_Actuator.m_Position = (l_Actuator.m_TravelDuration * l_ActuatorConfig.m_StartPercent) / 100;
+		l_Actuator.m_UpdateTime = p_StartTime;
+
+		s_SimulationActuators.push_back(l_Actuator);
+	}
+}
+
+// Move every actuator whose motor is running up to the current time.
+//
+// p_CurrentTime:	The current time.
+//
+static void SimulationMoveActuators(Time const& p_CurrentTime)
+{
+	for (auto& l_Actuator : s_SimulationActuators)
+	{
+		auto const l_ElapsedDuration = p_CurrentTime - l_Actuator.m_UpdateTime;
+		l_Actuator.m_UpdateTime = p_CurrentTime;
+
+		if (l_Actuator.m_Direction == 0)
+		{
+			continue;
+		}
+
+		l_Actuator.m_MotorOnDuration += l_ElapsedDuration;
+
+		// Stop at the end stops.
+		auto const l_OldPosition = l_Actuator.m_Position;
+		auto const l_NewPosition = l_OldPosition + (l_ElapsedDuration * l_Actuator.m_Direction);
+
+		l_Actuator.m_Position = std::max(Duration::zero(), std::min(l_NewPosition,
+			l_Actuator.m_TravelDuration));
+
+		auto const l_MovedDuration = (l_Actuator.m_Position > l_OldPosition) ?
+			(l_Actuator.m_Position - l_OldPosition) : (l_OldPosition - l_Actuator.m_Position);
+
+		l_Actuator.m_EndStopDuration += l_ElapsedDuration - l_MovedDuration;
+	}
+}
+
+// Remember a movement that didn't run the way it was asked to.
+//
+// p_Actuator:				The actuator.
+// p_ArrivalTime:			When the movement was asked for.
+// p_Action:				The action that was asked for.
+// p_RequestedDuration:	How long the movement was asked to last.
+// p_ActualDuration:		How long the movement actually lasted.
+// p_Dropped:				Whether the movement never happened at all.
+//
+static void SimulationAddTimingError(SimulationActuator const& p_Actuator,
+	Time const& p_ArrivalTime, Control::Actions p_Action, Duration p_RequestedDuration,
+	Duration p_ActualDuration, bool p_Dropped)
+{
+	SimulationTimingError l_Error;
+	strncpy(l_Error.m_Name, p_Actuator.m_Name, SimulationTimingError::ms_NameCapacity - 1);
+	l_Error.m_Name[SimulationTimingError::ms_NameCapacity - 1] = '\0';
+
+	l_Error.m_ArrivalTime = p_ArrivalTime;
+	l_Error.m_Action = p_Action;
+	l_Error.m_RequestedDuration = p_RequestedDuration;
+	l_Error.m_ActualDuration = p_ActualDuration;
+	l_Error.m_Dropped = p_Dropped;
+
+	s_SimulationTimingErrors.push_back(l_Error);
+}
+
+// Finish the current movement of an actuator.
+//
+// p_Actuator:		The actuator.
+// p_CurrentTime:	The current time.
+//
+static void SimulationEndMove(SimulationActuator& p_Actuator, Time const& p_CurrentTime)
+{
+	if (p_Actuator.m_MoveIsTimed == false)
+	{
+		return;
+	}
+
+	p_Actuator.m_MoveIsTimed = false;
+
+	auto const l_ActualDuration = p_CurrentTime - p_Actuator.m_MoveStartTime;
+	auto const l_Error = l_ActualDuration - p_Actuator.m_MoveRequestedDuration;
+	auto const l_AbsoluteError = (l_Error < Duration::zero()) ? -l_Error : l_Error;
+
+	s_SimulationTimedMoveCount++;
+	s_SimulationMaxRunTimeError = std::max(s_SimulationMaxRunTimeError, l_AbsoluteError);
+
+	if ((l_AbsoluteError > SIMULATION_TIMING_ERROR_TOLERANCE) == false)
+	{
+		return;
+	}
+
+	SimulationAddTimingError(p_Actuator, p_Actuator.m_MoveStartTime,
+		(p_Actuator.m_Direction > 0) ? Control::ACTION_MOVING_UP : Control::ACTION_MOVING_DOWN,
+		p_Actuator.m_MoveRequestedDuration, l_ActualDuration, false);
+}
+
+// Check a command that was applied to an actuator's control against what its pins are doing.
+//
+// p_Actuator:		The actuator.
+// p_CurrentTime:	The current time.
+//
+static void SimulationCheckRequest(SimulationActuator& p_Actuator, Time const& p_CurrentTime)
+{
+	auto& l_Request = p_Actuator.m_Request;
+
+	if (l_Request.m_Pending == false)
+	{
+		return;
+	}
+
+	l_Request.m_Pending = false;
+
+	// Stopping is always allowed.
+	if (l_Request.m_Action == Control::ACTION_STOPPED)
+	{
+		return;
+	}
+
+	auto const l_Direction = (l_Request.m_Action == Control::ACTION_MOVING_UP) ? 1 : -1;
+
+	// If the motor isn't running the right way, the request was ignored, like it is during cool down.
+	if (p_Actuator.m_Direction != l_Direction)
+	{
+		SimulationAddTimingError(p_Actuator, l_Request.m_ArrivalTime, l_Request.m_Action,
+			l_Request.m_MovingDuration, Duration::zero(), true);
+		return;
+	}
+
+	// Movements are timed from when they started, even if the request came later.
+	p_Actuator.m_MoveIsTimed = (l_Request.m_Mode == Control::MODE_TIMED);
+	p_Actuator.m_MoveRequestedDuration = l_Request.m_MovingDuration;
+
+	if (p_Actuator.m_MoveStartTime == p_CurrentTime)
+	{
+		s_SimulationMaxStartDelay = std::max(s_SimulationMaxStartDelay,
+			p_CurrentTime - l_Request.m_ArrivalTime);
+	}
+}
+
+// Read the pins and start or stop the actuators' motors to match.
+//
+// p_CurrentTime:	The current time.
+//
+static void SimulationReadPins(Time const& p_CurrentTime)
+{
+	GPIOPinSet l_Levels = 0;
+	GPIORead(l_Levels);
+
+	for (auto& l_Actuator : s_SimulationActuators)
+	{
+		auto const l_OnPins = ControlsGetOnPins(l_Actuator.m_UpPins | l_Actuator.m_DownPins, l_Levels);
+		auto const l_UpOn = ((l_OnPins & l_Actuator.m_UpPins) != 0);
+		auto const l_DownOn = ((l_OnPins & l_Actuator.m_DownPins) != 0);
+
+		auto l_Direction = 0;
+
+		if ((l_UpOn == true) && (l_DownOn == true))
+		{
+			// Driving both ways at once doesn't move the actuator, and shouldn't ever happen.
+			if (l_Actuator.m_Direction != 0)
+			{
+				l_Actuator.m_ConflictCount++;
+			}
+		}
+		else if (l_UpOn == true)
+		{
+			l_Direction = 1;
+		}
+		else if (l_DownOn == true)
+		{
+			l_Direction = -1;
+		}
+
+		if (l_Direction != l_Actuator.m_Direction)
+		{
+			if (l_Actuator.m_Direction != 0)
+			{
+				SimulationEndMove(l_Actuator, p_CurrentTime);
+			}
+
+			l_Actuator.m_Direction = l_Direction;
+
+			if (l_Direction != 0)
+			{
+				l_Actuator.m_MoveStartTime = p_CurrentTime;
+				l_Actuator.m_MoveCount++;
+			}
+		}
+
+		SimulationCheckRequest(l_Actuator, p_CurrentTime);
+	}
+}
+
+// Remember a command that the controls applied, so that it can be checked against the pins.
+//
+// p_Control:			The control the command was for, or null if it was for all of them.
+// p_Action:			The action that was applied.
+// p_Mode:				The mode of the action.
+// p_MovingDuration:	How long the control was asked to move for.
+// p_Origin:			Where the command came from.
+//
+static void SimulationHandleCommandApplied(Control const* p_Control, Control::Actions p_Action,
+	Control::Modes p_Mode, Duration p_MovingDuration, ControlOrigin const& p_Origin)
+{
+	if (p_Control == nullptr)
+	{
+		return;
+	}
+
+	for (auto& l_Actuator : s_SimulationActuators)
+	{
+		if (strcmp(l_Actuator.m_Name, p_Control->GetName()) != 0)
+		{
+			continue;
+		}
+
+		auto& l_Request = l_Actuator.m_Request;
+
+		// A movement that was replaced before the pins were even written never happened.
+		if ((l_Request.m_Pending == true) && (l_Request.m_Action != Control::ACTION_STOPPED))
+		{
+			SimulationAddTimingError(l_Actuator, l_Request.m_ArrivalTime, l_Request.m_Action,
+				l_Request.m_MovingDuration, Duration::zero(), true);
+		}
+
+		l_Request.m_Pending = true;
+		l_Request.m_Action = p_Action;
+		l_Request.m_Mode = p_Mode;
+		l_Request.m_MovingDuration = p_MovingDuration;
+		l_Request.m_ArrivalTime = p_Origin.m_ArrivalTime;
+		break;
+	}
+}
+
+// Send a command from the command stream, as if it had been typed.
+//
+// p_Command:		The command.
+// p_CurrentTime:	The current time.
+//
+static void SimulationSendCommand(SimulationCommand const& p_Command, Time const& p_CurrentTime)
+{
+	CommandTokenList l_CommandTokens;
+	CommandTokenizeString(l_CommandTokens, p_Command.m_Text);
+
+	// Rebooting for real in the middle of a simulation would be a surprise.
+	for (auto const& l_Token : l_CommandTokens)
+	{
+		if (l_Token.m_Type == CommandToken::TYPE_REBOOT)
+		{
+			LoggerAddMessage("Simulation is skipping command \"%s\".", p_Command.m_Text.c_str());
+			return;
+		}
+	}
+
+	auto const l_Result = CommandParseTokens(ControlOrigin(ControlOrigin::SOURCE_INTERNAL,
+		p_CurrentTime), l_CommandTokens);
+
+	if (l_Result != CommandParseTokensReturnTypes::SUCCESS)
+	{
+		LoggerAddMessage("Simulation couldn't run command \"%s\".", p_Command.m_Text.c_str());
+	}
+}
+
+// Get where each control thinks its actuator is, before the controls go away.
+//
+static void SimulationReadEstimates()
+{
+	for (auto& l_Actuator : s_SimulationActuators)
+	{
+		auto const* l_Control = Control::GetFromHandle(Control::GetHandle(l_Actuator.m_Name));
+
+		if (l_Control == nullptr)
+		{
+			continue;
+		}
+
+		l_Actuator.m_EstimateKnown = l_Control->GetPosition(l_Actuator.m_EstimatePercent);
+	}
+}
+
+// Print the results of the simulation.
+//
+// p_SimulatedDuration:	How much virtual time passed.
+// p_RealDuration:		How much real time it took.
+// p_StartTime:			When the simulation started, in virtual time.
+//
+static void SimulationPrintResults(Duration p_SimulatedDuration, Duration p_RealDuration,
+	Time const& p_StartTime)
+{
+	static constexpr unsigned int l_DurationTextCapacity = 32;
+	char l_DurationText[l_DurationTextCapacity];
+	char l_OtherDurationText[l_DurationTextCapacity];
+
+	SimulationFormatDuration(l_DurationText, l_DurationTextCapacity, p_SimulatedDuration);
+
+	printf("Simulated %s in %.3f ms.\n\n", l_DurationText,
+		std::chrono::duration<double, std::milli>(p_RealDuration).count());
+
+	printf("%-12s %9s %9s %15s %15s %7s\n", "Actuator", "Position", "Estimate", "Motor on", 
+		"At end stop", "Moves");
+
+	for (auto const& l_Actuator : s_SimulationActuators)
+	{
+		auto const l_PositionPercent = (l_Actuator.m_TravelDuration > Duration::zero()) ?
+			(100.0 * l_Actuator.m_Position.count()) / l_Actuator.m_TravelDuration.count() : 0.0;
+
+		SimulationFormatDuration(l_DurationText, l_DurationTextCapacity,
+			l_Actuator.m_MotorOnDuration);
+		SimulationFormatDuration(l_OtherDurationText, l_DurationTextCapacity,
+			l_Actuator.m_EndStopDuration);
+
+		// Compare with where the control thinks it is.
+		static constexpr unsigned int l_EstimateTextCapacity = 16;
+		char l_EstimateText[l_EstimateTextCapacity] = "-";
+
+		if (l_Actuator.m_EstimateKnown == true)
+		{
+			snprintf(l_EstimateText, l_EstimateTextCapacity, "%u%%", l_Actuator.m_EstimatePercent);
+		}
+
+		printf("%-12s %8.1f%% %9s %15s %15s %7u\n", l_Actuator.m_Name, l_PositionPercent, 
+			l_EstimateText, l_DurationText, l_OtherDurationText, l_Actuator.m_MoveCount);
+
+		if (l_Actuator.m_ConflictCount > 0)
+		{
+			printf("\t%s was driven up and down at once %u times!\n", l_Actuator.m_Name,
+				l_Actuator.m_ConflictCount);
+		}
+	}
+
+	printf("\n%u timed movements, largest run time error %.3f ms, largest start delay %.3f ms.\n",
+		s_SimulationTimedMoveCount,
+		std::chrono::duration<double, std::milli>(s_SimulationMaxRunTimeError).count(),
+		std::chrono::duration<double, std::milli>(s_SimulationMaxStartDelay).count());
+
+	if (s_SimulationTimingErrors.empty() == true)
+	{
+		return;
+	}
+
+	printf("\nMovements that didn't run as asked:\n");
+
+	for (auto const& l_Error : s_SimulationTimingErrors)
+	{
+		SimulationFormatDuration(l_DurationText, l_DurationTextCapacity,
+			l_Error.m_ArrivalTime - p_StartTime);
+
+		auto const* l_ActionText = (l_Error.m_Action == Control::ACTION_MOVING_UP) ? "up" : "down";
+		auto const l_RequestedSec = std::chrono::duration<double>(l_Error.m_RequestedDuration).count();
+
+		if (l_Error.m_Dropped == true)
+		{
+			printf("\t+%s %s %s: dropped (asked for %.3f s).\n", l_DurationText, l_Error.m_Name,
+				l_ActionText, l_RequestedSec);
+			continue;
+		}
+
+		printf("\t+%s %s %s: ran %.3f s of %.3f s.\n", l_DurationText, l_Error.m_Name, l_ActionText,
+			std::chrono::duration<double>(l_Error.m_ActualDuration).count(), l_RequestedSec);
+	}
+}
+
+// Replay the schedule and a recorded command stream against simulated GPIO and actuators, on a
+// virtual clock that skips straight to whatever is due next, then print where the actuators ended
+// up, how long their motors ran, and any movements that didn't run as asked.
+//
+// p_Config:					The configuration.
+// p_CommandFileName:		The recorded command stream. Each line has the number of seconds since
+//									the start, then a command as it would be typed.
+// p_ScheduleFileName:		The schedule to load, or null for the usual one.
+//
+// Returns:		True if the simulation ran, false otherwise.
+//
+bool SimulationRun(Config const& p_Config, char const* p_CommandFileName,
+	char const* p_ScheduleFileName)
+{
+	std::vector<SimulationCommand> l_Commands;
+
+	if (SimulationLoadCommands(l_Commands, p_CommandFileName) == false)
+	{
+		return false;
+	}
+
+	if (l_Commands.empty() == true)
+	{
+		LoggerAddMessage("The command stream is empty, so there is nothing to simulate.");
+		return false;
+	}
+
+	// Everything from here on runs on virtual time.
+	auto const l_RealStartTime = std::chrono::steady_clock::now();
+
+	Time l_StartTime;
+	TimerGetCurrent(l_StartTime);
+	TimerStartVirtualClock(l_StartTime);
+
+	GPIOConfig l_GPIOConfig;
+	l_GPIOConfig.m_Backend = GPIOConfig::BACKEND_SIMULATED;
+
+	if (GPIOInitialize(l_GPIOConfig) == false)
+	{
+		TimerStopVirtualClock();
+		return false;
+	}
+
+	s_SimulationTimingErrors.clear();
+	s_SimulationTimedMoveCount = 0;
+	s_SimulationMaxRunTimeError = Duration::zero();
+	s_SimulationMaxStartDelay = Duration::zero();
+
+	SimulationCreateActuators(p_Config, l_StartTime);
+
+	Control::SetDurations(std::chrono::milliseconds(p_Config.GetControlMaxMovingDurationMS()),
+		std::chrono::milliseconds(p_Config.GetControlCoolDownDurationMS()));
+	Control::SetMaxMovingControls(p_Config.GetControlMaxMovingControls());
+
+	ControlsInitializeStepped(p_Config.GetControlConfigs());
+	ControlsSetPostures(p_Config.GetControlPostureConfigs());
+	ControlsSetCommandAppliedCallback(SimulationHandleCommandApplied);
+
+	ScheduleInitialize(p_ScheduleFileName);
+
+	// The schedule repeats forever, so stop it with the last command, but let the controls settle.
+	auto const l_EndTime = l_StartTime + l_Commands.back().m_Offset;
+	auto& l_TimerService = ReactorGetTimerService();
+
+	unsigned int l_CommandIndex = 0;
+	auto const l_CommandCount = static_cast<unsigned int>(l_Commands.size());
+
+	while (true)
+	{
+		// Skip ahead to whatever is due next.
+		auto l_HasNextTime = false;
+		Time l_NextTime;
+
+		if (l_CommandIndex < l_CommandCount)
+		{
+			l_NextTime = l_StartTime + l_Commands[l_CommandIndex].m_Offset;
+			l_HasNextTime = true;
+		}
+
+		Time l_Deadline;
+
+		if ((l_TimerService.GetNextDeadline(l_Deadline) == true) && ((l_Deadline > l_EndTime) == false) &&
+			((l_HasNextTime == false) || (l_Deadline < l_NextTime)))
+		{
+			l_NextTime = l_Deadline;
+			l_HasNextTime = true;
+		}
+
+		if ((ControlsGetNextDeadline(l_Deadline) == true) &&
+			((l_HasNextTime == false) || (l_Deadline < l_NextTime)))
+		{
+			l_NextTime = l_Deadline;
+			l_HasNextTime = true;
+		}
+
+		if (l_HasNextTime == false)
+		{
+			break;
+		}
+
+		TimerAdvanceVirtualClock(l_NextTime);
+
+		Time l_CurrentTime;
+		TimerGetCurrent(l_CurrentTime);
+
+		SimulationMoveActuators(l_CurrentTime);
+
+		// Send any commands that are due.
+		while ((l_CommandIndex < l_CommandCount) &&
+			((l_StartTime + l_Commands[l_CommandIndex].m_Offset > l_CurrentTime) == false))
+		{
+			SimulationSendCommand(l_Commands[l_CommandIndex], l_CurrentTime);
+			l_CommandIndex++;
+		}
+
+		if ((l_CurrentTime > l_EndTime) == false)
+		{
+			l_TimerService.Process();
+		}
+
+		ControlsStep();
+		SimulationReadPins(l_CurrentTime);
+	}
+
+	Time l_FinishTime;
+	TimerGetCurrent(l_FinishTime);
+
+	SimulationReadEstimates();
+
+	ScheduleUninitialize();
+	ControlsSetCommandAppliedCallback(nullptr);
+	ControlsUninitialize();
+	GPIOUninitialize();
+
+	TimerStopVirtualClock();
+
+	SimulationPrintResults(l_FinishTime - l_StartTime,
+		std::chrono::steady_clock::now() - l_RealStartTime, l_StartTime);
+
+	s_SimulationActuators.clear();
+	return true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+
+#include <libxml/parser.h>
+
+// Types
+//
+
+// How a simulated actuator moves.
+struct SimulationActuatorConfig
+{
+	// Read a simulated actuator config from XML. Any settings that are missing keep their defaults.
+	//
+	// p_Document:	The XML document that the node belongs to.
+	// p_Node:		The XML node to read the actuator config from.
+	//
+	// Returns:		True if the config was read successfully, false otherwise.
+	//
+	bool ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node);
+
+	// Constants.
+	static constexpr unsigned int ms_ControlNameCapacity = 32;
+
+	// The name of the control that drives the actuator.
+	char m_ControlName[ms_ControlNameCapacity] = "";
+
+	// How long the actuator takes to travel from one end stop to the other (in milliseconds), or 0 
+	// for the control's moving duration.
+	unsigned int m_TravelDurationMS = 0;
+
+	// Where the actuator starts, from 0 (all the way down) to 100 (all the way up) percent.
+	unsigned int m_StartPercent = 0;
+};
+
+// Configuration parameters for simulating the bed.
+struct SimulationConfig
+{
+	// Read a simulation config from XML. Any settings that are missing keep their defaults.
+	//
+	// p_Document:	The XML document that the node belongs to.
+	// p_Node:		The XML node to read the simulation config from.
+	//
+	// Returns:		True if the config was read successfully, false otherwise.
+	//
+	bool ReadFromXML(xmlDocPtr p_Document, xmlNodePtr p_Node);
+
+	// The actuators, for any controls that shouldn't use the defaults.
+	std::vector<SimulationActuatorConfig> m_ActuatorConfigs;
+};
+
+// Functions
+//
+
+// Replay the schedule and a recorded command stream against simulated GPIO and actuators, on a
+// virtual clock that skips straight to whatever is due next, then print where the actuators ended
+// up and where the controls think they are, how long their motors ran, and any movements that 
+// didn't run as asked.
+//
+// p_Config:					The configuration.
+// p_CommandFileName:		The recorded command stream. Each line has the number of seconds since
+//									the start, then a command as it would be typed.
+// p_ScheduleFileName:		The schedule to load, or null for the usual one.
+//
+// Returns:		True if the simulation ran, false otherwise.
+//
+bool SimulationRun(class Config const& p_Config, char const* p_CommandFileName,
+	char const* p_ScheduleFileName);
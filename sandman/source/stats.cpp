@@ -0,0 +1,285 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <initializer_list>
+#include <math.h>
+
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+// Constants
+//
+
+// The loop used to run at 60 Hz, so anything taking longer than a frame at that rate is too slow.
+#define STATS_FRAME_BUDGET				(16667us)
+
+// Timed movements should be honored to within a millisecond.
+#define STATS_WAKE_LATENCY_BUDGET	(1ms)
+
+// Anything slower than this between asking the bed to move and it moving feels sluggish.
+#define STATS_COMMAND_LATENCY_BUDGET	(100ms)
+
+// Locals
+//
+
+// The names of the probes.
+static char const* const s_StatsProbeNames[] =
+{
+	"frame",				// STATS_PROBE_FRAME
+	"command",			// STATS_PROBE_COMMAND
+	"controls",			// STATS_PROBE_CONTROLS
+	"mqtt",				// STATS_PROBE_MQTT
+	"reports",			// STATS_PROBE_REPORTS
+	"timers",			// STATS_PROBE_TIMERS
+	"socket",			// STATS_PROBE_SOCKET
+	"wakeLatency",		// STATS_PROBE_WAKE_LATENCY
+	"controlWakeLatency",	// STATS_PROBE_CONTROL_WAKE_LATENCY
+	"voiceLatency",		// STATS_PROBE_VOICE_LATENCY
+	"buttonLatency",		// STATS_PROBE_BUTTON_LATENCY
+	"socketLatency",		// STATS_PROBE_SOCKET_LATENCY
+	"keyboardLatency",	// STATS_PROBE_KEYBOARD_LATENCY
+	"scheduleLatency",	// STATS_PROBE_SCHEDULE_LATENCY
+};
+
+static_assert(sizeof(s_StatsProbeNames) / sizeof(s_StatsProbeNames[0]) == NUM_STATS_PROBES,
+	"Every probe needs a name.");
+
+// A histogram for each of the probes.
+static StatsHistogram s_StatsHistograms[NUM_STATS_PROBES];
+
+// Functions
+//
+
+// StatsHistogram members
+
+// Record a duration.
+//
+// p_Duration:	The duration to record.
+//
+void StatsHistogram::Record(Duration p_Duration)
+{
+	// Clocks only go forward, but be safe.
+	auto const l_Duration = std::max(p_Duration, Duration::zero());
+
+	m_Buckets[GetBucketIndex(l_Duration.count())]++;
+	m_Count++;
+
+	if (l_Duration > m_Budget)
+	{
+		m_OverrunCount++;
+	}
+
+	m_Max = std::max(m_Max, l_Duration);
+}
+
+// Set the budget that durations are expected to stay within.
+//
+// p_Budget:	The budget.
+//
+void StatsHistogram::SetBudget(Duration p_Budget)
+{
+	m_Budget = p_Budget;
+}
+
+// Forget all recorded durations.
+//
+void StatsHistogram::Reset()
+{
+	std::fill(m_Buckets, m_Buckets + ms_BucketCount, 0);
+	m_Count = 0;
+	m_OverrunCount = 0;
+	m_Max = Duration::zero();
+}
+
+// Get the duration that a given percentage of recorded durations are at or below.
+//
+// p_Percentile:	The percentage, from 0 to 100.
+//
+// Returns:		The duration, or zero if nothing has been recorded.
+//
+Duration StatsHistogram::GetValueAtPercentile(double p_Percentile) const
+{
+	if (m_Count == 0)
+	{
+		return Duration::zero();
+	}
+
+	// Figure out how many durations need to be at or below the answer.
+	auto const l_Fraction = std::min(std::max(p_Percentile, 0.0), 100.0) / 100.0;
+	auto const l_TargetCount = std::max(static_cast<uint64_t>(ceil(l_Fraction * m_Count)),
+		static_cast<uint64_t>(1));
+
+	uint64_t l_CumulativeCount = 0;
+
+	for (unsigned int l_BucketIndex = 0; l_BucketIndex < ms_BucketCount; l_BucketIndex++)
+	{
+		l_CumulativeCount += m_Buckets[l_BucketIndex];
+
+		if (l_CumulativeCount < l_TargetCount)
+		{
+			continue;
+		}
+
+		// Buckets are approximate, but the max is exact, so don't go over it.
+		auto const l_Value = Duration(static_cast<Duration::rep>(std::min(
+			GetBucketHighestValue(l_BucketIndex), static_cast<uint64_t>(m_Max.count()))));
+
+		return l_Value;
+	}
+
+	return m_Max;
+}
+
+// Get the bucket that a value falls into.
+//
+// p_Value:	The value, in nanoseconds.
+//
+unsigned int StatsHistogram::GetBucketIndex(uint64_t p_Value)
+{
+	// Small values get their own buckets.
+	if (p_Value < ms_SubBucketCount)
+	{
+		return static_cast<unsigned int>(p_Value);
+	}
+
+	// Otherwise, shift the value down so that only its top 5 bits remain, which picks one of the
+	// buckets for its power of two.
+	auto const l_HighestBit = 63 - __builtin_clzll(p_Value);
+	auto const l_Shift = static_cast<unsigned int>(l_HighestBit) - 4;
+	auto const l_SubBucketIndex = static_cast<unsigned int>(p_Value >> l_Shift) -
+		ms_HalfSubBucketCount;
+
+	return ms_SubBucketCount + ((l_Shift - 1) * ms_HalfSubBucketCount) + l_SubBucketIndex;
+}
+
+// Get the largest value that falls into a bucket.
+//
+// p_BucketIndex:	The index of the bucket.
+//
+uint64_t StatsHistogram::GetBucketHighestValue(unsigned int p_BucketIndex)
+{
+	if (p_BucketIndex < ms_SubBucketCount)
+	{
+		return p_BucketIndex;
+	}
+
+	// Undo the mapping in GetBucketIndex().
+	auto const l_Offset = p_BucketIndex - ms_SubBucketCount;
+	auto const l_Shift = (l_Offset / ms_HalfSubBucketCount) + 1;
+	auto const l_SubBucketValue = static_cast<uint64_t>((l_Offset % ms_HalfSubBucketCount) +
+		ms_HalfSubBucketCount);
+
+	return ((l_SubBucketValue + 1) << l_Shift) - 1;
+}
+
+// StatsScope members
+
+// Start measuring.
+//
+// p_Probe:	The probe to record the duration for.
+//
+StatsScope::StatsScope(StatsProbes p_Probe)
+	: m_Probe(p_Probe)
+{
+	TimerGetCurrent(m_StartTime);
+}
+
+// Stop measuring and record the duration.
+//
+StatsScope::~StatsScope()
+{
+	Time l_EndTime;
+	TimerGetCurrent(l_EndTime);
+
+	StatsRecord(m_Probe, l_EndTime - m_StartTime);
+}
+
+// Convert a duration to microseconds for display.
+//
+// p_Duration:	The duration.
+//
+// Returns:		The duration in microseconds.
+//
+static double StatsGetMicroseconds(Duration p_Duration)
+{
+	return std::chrono::duration<double, std::micro>(p_Duration).count();
+}
+
+// Initialize the stats.
+//
+void StatsInitialize()
+{
+	for (auto& l_Histogram : s_StatsHistograms)
+	{
+		l_Histogram.Reset();
+		l_Histogram.SetBudget(STATS_FRAME_BUDGET);
+	}
+
+	s_StatsHistograms[STATS_PROBE_WAKE_LATENCY].SetBudget(STATS_WAKE_LATENCY_BUDGET);
+	s_StatsHistograms[STATS_PROBE_CONTROL_WAKE_LATENCY].SetBudget(STATS_WAKE_LATENCY_BUDGET);
+
+	for (auto const l_Probe : { STATS_PROBE_VOICE_LATENCY, STATS_PROBE_BUTTON_LATENCY, 
+		STATS_PROBE_SOCKET_LATENCY, STATS_PROBE_KEYBOARD_LATENCY, STATS_PROBE_SCHEDULE_LATENCY })
+	{
+		s_StatsHistograms[l_Probe].SetBudget(STATS_COMMAND_LATENCY_BUDGET);
+	}
+}
+
+// Record a duration for a probe.
+//
+// p_Probe:		The probe.
+// p_Duration:	The duration.
+//
+void StatsRecord(StatsProbes p_Probe, Duration p_Duration)
+{
+	if (p_Probe >= NUM_STATS_PROBES)
+	{
+		return;
+	}
+
+	s_StatsHistograms[p_Probe].Record(p_Duration);
+}
+
+// Write all of the stats as a JSON document.
+//
+// p_JSON:	(Output) The JSON document.
+//
+void StatsGetJSON(std::string& p_JSON)
+{
+	rapidjson::Document l_StatsDocument;
+	l_StatsDocument.SetObject();
+
+	auto& l_StatsAllocator = l_StatsDocument.GetAllocator();
+
+	rapidjson::Value l_ProbesObject(rapidjson::kObjectType);
+
+	for (unsigned int l_ProbeIndex = 0; l_ProbeIndex < NUM_STATS_PROBES; l_ProbeIndex++)
+	{
+		auto const& l_Histogram = s_StatsHistograms[l_ProbeIndex];
+
+		rapidjson::Value l_ProbeObject(rapidjson::kObjectType);
+
+		l_ProbeObject.AddMember("count", l_Histogram.GetCount(), l_StatsAllocator);
+		l_ProbeObject.AddMember("p50US", StatsGetMicroseconds(l_Histogram.GetValueAtPercentile(50.0)),
+			l_StatsAllocator);
+		l_ProbeObject.AddMember("p99US", StatsGetMicroseconds(l_Histogram.GetValueAtPercentile(99.0)),
+			l_StatsAllocator);
+		l_ProbeObject.AddMember("maxUS", StatsGetMicroseconds(l_Histogram.GetMax()),
+			l_StatsAllocator);
+		l_ProbeObject.AddMember("overruns", l_Histogram.GetOverrunCount(), l_StatsAllocator);
+		l_ProbeObject.AddMember("budgetUS", StatsGetMicroseconds(l_Histogram.GetBudget()),
+			l_StatsAllocator);
+
+		l_ProbesObject.AddMember(rapidjson::StringRef(s_StatsProbeNames[l_ProbeIndex]),
+			l_ProbeObject, l_StatsAllocator);
+	}
+
+	l_StatsDocument.AddMember("probes", l_ProbesObject, l_StatsAllocator);
+
+	rapidjson::StringBuffer l_StatsBuffer;
+	rapidjson::Writer<rapidjson::StringBuffer> l_StatsWriter(l_StatsBuffer);
+	l_StatsDocument.Accept(l_StatsWriter);
+
+	p_JSON = l_StatsBuffer.GetString();
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include "timer.h"
+
+// Types
+//
+
+// The parts of the program whose durations are measured.
+enum StatsProbes
+{
+	STATS_PROBE_FRAME = 0,		// Everything done after waking up, until waiting again.
+	STATS_PROBE_COMMAND,			// CommandProcess().
+	STATS_PROBE_CONTROLS,		// ControlsProcess().
+	STATS_PROBE_MQTT,				// MQTTProcess().
+	STATS_PROBE_REPORTS,			// ReportsProcess().
+	STATS_PROBE_TIMERS,			// Firing due timers (control states, schedule events, etc.).
+	STATS_PROBE_SOCKET,			// Handling socket clients and their requests.
+	STATS_PROBE_WAKE_LATENCY,	// How late the reactor woke up for the earliest timer.
+	STATS_PROBE_CONTROL_WAKE_LATENCY,	// How late the control thread woke up for a state timer.
+	STATS_PROBE_VOICE_LATENCY,		// From a voice intent arriving to the relays acting on it.
+	STATS_PROBE_BUTTON_LATENCY,	// From a button event to the relays acting on it.
+	STATS_PROBE_SOCKET_LATENCY,	// From a socket command arriving to the relays acting on it.
+	STATS_PROBE_KEYBOARD_LATENCY,	// From a typed command to the relays acting on it.
+	STATS_PROBE_SCHEDULE_LATENCY,	// From a schedule event being due to the relays acting on it.
+
+	NUM_STATS_PROBES,
+};
+
+// Counts durations in buckets whose width grows with the duration, so that every duration is
+// recorded with about the same relative precision (around 3%) in a fixed amount of memory.
+class StatsHistogram
+{
+	public:
+
+		// Record a duration.
+		//
+		// p_Duration:	The duration to record.
+		//
+		void Record(Duration p_Duration);
+
+		// Set the budget that durations are expected to stay within.
+		//
+		// p_Budget:	The budget.
+		//
+		void SetBudget(Duration p_Budget);
+
+		// Forget all recorded durations.
+		//
+		void Reset();
+
+		// Get the number of recorded durations.
+		//
+		uint64_t GetCount() const
+		{
+			return m_Count;
+		}
+
+		// Get the number of recorded durations that were over the budget.
+		//
+		uint64_t GetOverrunCount() const
+		{
+			return m_OverrunCount;
+		}
+
+		// Get the budget that durations are expected to stay within.
+		//
+		Duration GetBudget() const
+		{
+			return m_Budget;
+		}
+
+		// Get the largest recorded duration.
+		//
+		Duration GetMax() const
+		{
+			return m_Max;
+		}
+
+		// Get the duration that a given percentage of recorded durations are at or below.
+		//
+		// p_Percentile:	The percentage, from 0 to 100.
+		//
+		// Returns:		The duration, or zero if nothing has been recorded.
+		//
+		Duration GetValueAtPercentile(double p_Percentile) const;
+
+	private:
+
+		// Values below this are counted exactly.
+		static constexpr unsigned int ms_SubBucketCount = 32;
+
+		// Each power of two above that is split into this many buckets.
+		static constexpr unsigned int ms_HalfSubBucketCount = ms_SubBucketCount / 2;
+
+		// Enough buckets for every 64-bit value, given that the sub-buckets cover the first 5 bits.
+		static constexpr unsigned int ms_BucketCount = ms_SubBucketCount +
+			((64 - 5) * ms_HalfSubBucketCount);
+
+		// Get the bucket that a value falls into.
+		//
+		// p_Value:	The value, in nanoseconds.
+		//
+		static unsigned int GetBucketIndex(uint64_t p_Value);
+
+		// Get the largest value that falls into a bucket.
+		//
+		// p_BucketIndex:	The index of the bucket.
+		//
+		static uint64_t GetBucketHighestValue(unsigned int p_BucketIndex);
+
+		// The number of durations in each bucket.
+		uint64_t m_Buckets[ms_BucketCount] = {};
+
+		// The total number of recorded durations.
+		uint64_t m_Count = 0;
+
+		// The number of recorded durations over the budget.
+		uint64_t m_OverrunCount = 0;
+
+		// The largest recorded duration.
+		Duration m_Max = Duration::zero();
+
+		// Durations over this count as overruns.
+		Duration m_Budget = Duration::max();
+};
+
+// Measures the time from its construction to its destruction and records it for a probe.
+class StatsScope
+{
+	public:
+
+		// Start measuring.
+		//
+		// p_Probe:	The probe to record the duration for.
+		//
+		explicit StatsScope(StatsProbes p_Probe);
+
+		// Stop measuring and record the duration.
+		//
+		~StatsScope();
+
+		StatsScope(StatsScope const&) = delete;
+		StatsScope& operator=(StatsScope const&) = delete;
+
+	private:
+
+		// The probe to record the duration for.
+		StatsProbes m_Probe;
+
+		// When measuring started.
+		Time m_StartTime;
+};
+
+// Functions
+//
+
+// Initialize the stats.
+//
+void StatsInitialize();
+
+// Record a duration for a probe.
+//
+// p_Probe:		The probe.
+// p_Duration:	The duration.
+//
+void StatsRecord(StatsProbes p_Probe, Duration p_Duration);
+
+// Write all of the stats as a JSON document.
+//
+// p_JSON:	(Output) The JSON document.
+//
+void StatsGetJSON(std::string& p_JSON);
@@ -0,0 +1,301 @@
+#include "status.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "control.h"
+#include "input.h"
+#include "logger.h"
+#include "mqtt.h"
+#include "schedule.h"
+#include "timer.h"
+
+// Constants
+//
+
+// Types
+//
+
+// Locals
+//
+
+// The names of the states. Like the other names here, these are identifiers for clients to match 
+// on, so they are written differently from the names the controls log with.
+static char const* const s_StatusStateNames[] =
+{
+	"idle",			// STATE_IDLE
+	"movingUp",		// STATE_MOVING_UP
+	"movingDown",	// STATE_MOVING_DOWN
+	"coolDown",		// STATE_COOL_DOWN
+};
+
+static_assert(sizeof(s_StatusStateNames) / sizeof(s_StatusStateNames[0]) == Control::NUM_STATES,
+	"Every state needs a name.");
+
+// The names of the actions.
+static char const* const s_StatusActionNames[] =
+{
+	"stopped",		// ACTION_STOPPED
+	"movingUp",		// ACTION_MOVING_UP
+	"movingDown",	// ACTION_MOVING_DOWN
+};
+
+static_assert(sizeof(s_StatusActionNames) / sizeof(s_StatusActionNames[0]) == Control::NUM_ACTIONS,
+	"Every action needs a name.");
+
+// The names of the modes.
+static char const* const s_StatusModeNames[] =
+{
+	"manual",		// MODE_MANUAL
+	"timed",			// MODE_TIMED
+};
+
+static_assert(sizeof(s_StatusModeNames) / sizeof(s_StatusModeNames[0]) == Control::NUM_MODES,
+	"Every mode needs a name.");
+
+// Keep a handle to the input.
+static Input const* s_StatusInput = nullptr;
+
+// Functions
+//
+
+// Get a duration in whole milliseconds.
+//
+// p_Duration:	The duration.
+//
+// Returns:		The duration in milliseconds.
+//
+static int64_t StatusGetMilliseconds(Duration p_Duration)
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(p_Duration).count();
+}
+
+// Write what each control is doing.
+//
+// p_Writer:		Writes the controls, as an array.
+// p_CurrentTime:	The current time.
+//
+static void StatusWriteControls(rapidjson::Writer<rapidjson::StringBuffer>& p_Writer,
+	Time const& p_CurrentTime)
+{
+	p_Writer.StartArray();
+
+	auto const l_ControlCount = ControlsGetCount();
+
+	for (unsigned int l_ControlIndex = 0; l_ControlIndex < l_ControlCount; l_ControlIndex++)
+	{
+		auto const* l_Control = ControlsGetControl(l_ControlIndex);
+
+		ControlStatus l_Status;
+		l_Control->GetStatus(l_Status, p_CurrentTime);
+
+		p_Writer.StartObject();
+
+		p_Writer.Key("name");
+		p_Writer.String(l_Control->GetName());
+
+		p_Writer.Key("state");
+		p_Writer.String(s_StatusStateNames[l_Status.m_State]);
+
+		p_Writer.Key("desiredAction");
+		p_Writer.String(s_StatusActionNames[l_Status.m_DesiredAction]);
+
+		p_Writer.Key("mode");
+		p_Writer.String(s_StatusModeNames[l_Status.m_Mode]);
+
+		p_Writer.Key("remainingMS");
+		p_Writer.Int64(StatusGetMilliseconds(l_Status.m_StateRemainingDuration));
+
+		p_Writer.Key("positionPercent");
+		p_Writer.Uint(l_Status.m_PositionPercent);
+
+		p_Writer.Key("positionKnown");
+		p_Writer.Bool(l_Status.m_PositionKnown);
+
+		p_Writer.EndObject();
+	}
+
+	p_Writer.EndArray();
+}
+
+// Write where the schedule is.
+//
+// p_Writer:		Writes the schedule, as an object.
+// p_CurrentTime:	The current time.
+//
+static void StatusWriteSchedule(rapidjson::Writer<rapidjson::StringBuffer>& p_Writer,
+	Time const& p_CurrentTime)
+{
+	p_Writer.StartObject();
+
+	p_Writer.Key("running");
+	p_Writer.Bool(ScheduleIsRunning());
+
+	unsigned int l_EventIndex = 0;
+	Time l_EventTime;
+
+	if (ScheduleGetNextEvent(l_EventIndex, l_EventTime) == true)
+	{
+		p_Writer.Key("eventIndex");
+		p_Writer.Uint(l_EventIndex);
+
+		auto const l_TimeUntilEvent = std::max(l_EventTime - p_CurrentTime, Duration::zero());
+
+		p_Writer.Key("nextEventInMS");
+		p_Writer.Int64(StatusGetMilliseconds(l_TimeUntilEvent));
+
+		// Also give the time on the wall clock, as milliseconds since the Unix epoch.
+		auto const l_WallEventTime = std::chrono::system_clock::now() +
+			std::chrono::duration_cast<std::chrono::system_clock::duration>(l_TimeUntilEvent);
+
+		p_Writer.Key("nextEventTimeMS");
+		p_Writer.Int64(std::chrono::duration_cast<std::chrono::milliseconds>(
+			l_WallEventTime.time_since_epoch()).count());
+	}
+
+	p_Writer.EndObject();
+}
+
+// Write which input devices are connected.
+//
+// p_Writer:	Writes the input devices, as an array.
+//
+static void StatusWriteInputDevices(rapidjson::Writer<rapidjson::StringBuffer>& p_Writer)
+{
+	p_Writer.StartArray();
+
+	auto const l_DeviceCount = (s_StatusInput != nullptr) ? s_StatusInput->GetDeviceCount() : 0;
+
+	for (unsigned int l_DeviceIndex = 0; l_DeviceIndex < l_DeviceCount; l_DeviceIndex++)
+	{
+		auto const& l_Config = s_StatusInput->GetDevice(l_DeviceIndex).GetConfig();
+
+		p_Writer.StartObject();
+
+		// Describe the device the way it was configured.
+		if (l_Config.m_Name[0] != '\0')
+		{
+			p_Writer.Key("name");
+			p_Writer.String(l_Config.m_Name);
+		}
+
+		if (l_Config.m_DeviceName[0] != '\0')
+		{
+			p_Writer.Key("deviceName");
+			p_Writer.String(l_Config.m_DeviceName);
+		}
+
+		p_Writer.Key("connected");
+		p_Writer.Bool(s_StatusInput->IsDeviceConnected(l_DeviceIndex));
+
+		p_Writer.EndObject();
+	}
+
+	p_Writer.EndArray();
+}
+
+// Write what MQTT is doing.
+//
+// p_Writer:	Writes MQTT, as an object.
+//
+static void StatusWriteMQTT(rapidjson::Writer<rapidjson::StringBuffer>& p_Writer)
+{
+	MQTTStatus l_Status;
+	MQTTGetStatus(l_Status);
+
+	p_Writer.StartObject();
+
+	p_Writer.Key("connected");
+	p_Writer.Bool(l_Status.m_Connected);
+
+	p_Writer.Key("pendingMessages");
+	p_Writer.Uint(l_Status.m_PendingMessageCount);
+
+	p_Writer.Key("pendingNotifications");
+	p_Writer.Uint(l_Status.m_PendingNotificationCount);
+
+	p_Writer.Key("receivedMessages");
+	p_Writer.Uint(l_Status.m_ReceivedMessageCount);
+
+	p_Writer.EndObject();
+}
+
+// Write how much work is waiting between the threads.
+//
+// p_Writer:	Writes the queues, as an object.
+//
+static void StatusWriteQueues(rapidjson::Writer<rapidjson::StringBuffer>& p_Writer)
+{
+	unsigned int l_CommandCount = 0;
+	unsigned int l_InputCommandCount = 0;
+	unsigned int l_EventCount = 0;
+	ControlsGetQueueDepths(l_CommandCount, l_InputCommandCount, l_EventCount);
+
+	p_Writer.StartObject();
+
+	p_Writer.Key("commands");
+	p_Writer.Uint(l_CommandCount);
+
+	p_Writer.Key("inputCommands");
+	p_Writer.Uint(l_InputCommandCount);
+
+	p_Writer.Key("events");
+	p_Writer.Uint(l_EventCount);
+
+	p_Writer.EndObject();
+}
+
+// Initialize status queries.
+//
+// p_Input:	The input devices.
+//
+void StatusInitialize(Input const& p_Input)
+{
+	s_StatusInput = &p_Input;
+}
+
+// Uninitialize status queries.
+//
+void StatusUninitialize()
+{
+	s_StatusInput = nullptr;
+}
+
+// Write a snapshot of what every control, the schedule, the input devices, MQTT and the queues
+// between the threads are doing. Only the main thread may call this. Every command sent to the 
+// controls before this is called has been handled by the time the snapshot is taken, so a status 
+// query that follows commands sees what they did.
+//
+// p_Writer:	Writes the snapshot, as an object.
+//
+void StatusWriteJSON(rapidjson::Writer<rapidjson::StringBuffer>& p_Writer)
+{
+	// Catch up with the control thread first, so that the snapshot doesn't contradict the answers to
+	// commands that came before it.
+	if (ControlsFlushCommands() == false)
+	{
+		LoggerAddMessage("The control thread didn't catch up before a status snapshot.");
+	}
+
+	Time l_CurrentTime;
+	TimerGetCurrent(l_CurrentTime);
+
+	p_Writer.StartObject();
+
+	p_Writer.Key("controls");
+	StatusWriteControls(p_Writer, l_CurrentTime);
+
+	p_Writer.Key("schedule");
+	StatusWriteSchedule(p_Writer, l_CurrentTime);
+
+	p_Writer.Key("inputDevices");
+	StatusWriteInputDevices(p_Writer);
+
+	p_Writer.Key("mqtt");
+	StatusWriteMQTT(p_Writer);
+
+	p_Writer.Key("queues");
+	StatusWriteQueues(p_Writer);
+
+	p_Writer.EndObject();
+}
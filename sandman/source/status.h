@@ -0,0 +1,27 @@
+#pragma once
+
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+// Functions
+//
+
+// Initialize status queries.
+//
+// p_Input:	The input devices.
+//
+void StatusInitialize(class Input const& p_Input);
+
+// Uninitialize status queries.
+//
+void StatusUninitialize();
+
+// Write a snapshot of what every control, the schedule, the input devices, MQTT and the queues
+// between the threads are doing. Only the main thread may call this. Every command sent to the 
+// controls before this is called has been handled by the time the snapshot is taken, so a status 
+// query that follows commands sees what they did. Nothing is allocated apart from the writer's 
+// buffer, so it is cheap enough to be polled several times a second.
+//
+// p_Writer:	Writes the snapshot, as an object.
+//
+void StatusWriteJSON(rapidjson::Writer<rapidjson::StringBuffer>& p_Writer);
@@ -4,17 +4,32 @@
 	#include <Windows.h>
 #endif // defined (_WIN32)
 
+#include <atomic>
 #include <time.h>
+#include <utility>
 
-// Functions
+// Locals
 //
 
+// Whether the clock is running on virtual time.
+static std::atomic<bool> s_TimerVirtualClockEnabled(false);
+
+// The virtual time, in nanoseconds.
+static std::atomic<MonotonicClock::rep> s_TimerVirtualTimeNS(0);
+
+// MonotonicClock members
+
 // Get the current time.
 //
-// p_Time:	(Output) The current time.
+// Returns:		The current time.
 //
-void TimerGetCurrent(Time& p_Time)
+MonotonicClock::time_point MonotonicClock::now()
 {
+	if (s_TimerVirtualClockEnabled.load(std::memory_order_relaxed) == true)
+	{
+		return time_point(duration(s_TimerVirtualTimeNS.load(std::memory_order_relaxed)));
+	}
+
 	#if defined (_WIN32)
 
 		// NOTE - STL 2011/10/31 - This can fail.
@@ -28,57 +43,292 @@ void TimerGetCurrent(Time& p_Time)
 		QueryPerformanceFrequency(&l_Frequency);
 	
 		// Convert to our form.
-		p_Time.m_Seconds = l_Ticks.QuadPart / l_Frequency.QuadPart;
-		p_Time.m_Nanoseconds = ((l_Ticks.QuadPart % l_Frequency.QuadPart) * 1000000000) / 
+		auto const l_Seconds = l_Ticks.QuadPart / l_Frequency.QuadPart;
+		auto const l_Nanoseconds = ((l_Ticks.QuadPart % l_Frequency.QuadPart) * 1000000000) / 
 			l_Frequency.QuadPart;
 		
 	#elif defined (__linux__)
 
 		// NOTE - STL 2012/09/23 - This can fail.
 		timespec l_Time;
-		clock_gettime(CLOCK_REALTIME, &l_Time);
+		clock_gettime(CLOCK_MONOTONIC, &l_Time);
 
-		p_Time.m_Seconds = l_Time.tv_sec;
-		p_Time.m_Nanoseconds = l_Time.tv_nsec;
+		auto const l_Seconds = l_Time.tv_sec;
+		auto const l_Nanoseconds = l_Time.tv_nsec;
 
 	#endif // defined (_WIN32)
+
+	return time_point(std::chrono::seconds(l_Seconds) + std::chrono::nanoseconds(l_Nanoseconds));
 }
 
-// Get the elapsed time in milliseconds between to times.
-// Note: Will return -1 if the end time is less than the start time.
+// Functions
+//
+
+// Get the current time.
 //
-// p_StartTime:	Start time.
-// p_EndTime:		End time.
+// p_Time:	(Output) The current time.
 //
-float TimerGetElapsedMilliseconds(Time const& p_StartTime, Time const& p_EndTime)
+void TimerGetCurrent(Time& p_Time)
 {
-	// For now just return a negative sentinel if the end time is before the start time.
-	if (p_EndTime < p_StartTime)
+	p_Time = MonotonicClock::now();
+}
+
+// Switch the clock over to virtual time, which only moves when it is advanced, so that a simulation
+// can run much faster than real time.
+//
+// p_StartTime:	The time to start the virtual clock at.
+//
+void TimerStartVirtualClock(Time const& p_StartTime)
+{
+	s_TimerVirtualTimeNS.store(p_StartTime.time_since_epoch().count(), std::memory_order_relaxed);
+	s_TimerVirtualClockEnabled.store(true, std::memory_order_relaxed);
+}
+
+// Switch the clock back to real time.
+//
+void TimerStopVirtualClock()
+{
+	s_TimerVirtualClockEnabled.store(false, std::memory_order_relaxed);
+}
+
+// Move the virtual clock forward. It never moves backward.
+//
+// p_Time:	The new time.
+//
+void TimerAdvanceVirtualClock(Time const& p_Time)
+{
+	auto const l_TimeNS = p_Time.time_since_epoch().count();
+
+	if (l_TimeNS > s_TimerVirtualTimeNS.load(std::memory_order_relaxed))
 	{
-		return -1.0f;
+		s_TimerVirtualTimeNS.store(l_TimeNS, std::memory_order_relaxed);
 	}
+}
 
-	// Calculate the elapsed time.
-	Time l_ElapsedTime;
-	
-	l_ElapsedTime.m_Seconds = p_EndTime.m_Seconds - p_StartTime.m_Seconds;
-	
-	// Did the nanoseconds wrap into seconds?
-	if (p_EndTime.m_Nanoseconds < p_StartTime.m_Nanoseconds)
+// TimerService members
+
+// Arm a timer. If the handle refers to a pending timer, that timer is moved to the new deadline 
+// instead.
+//
+// p_Handle:	(Input/Output) The handle of the timer.
+// p_Deadline:	When the timer should fire.
+// p_Callback:	The function to call when the timer fires.
+//
+void TimerService::Arm(TimerHandle& p_Handle, Time const& p_Deadline, TimerCallback const& p_Callback)
+{
+	// Reuse the timer if it is still pending.
+	if (IsPending(p_Handle) == true)
 	{
-		// Borrow a second.
-		l_ElapsedTime.m_Seconds--;
-		
-		// Add a billion nanoseconds in exchange.
-		l_ElapsedTime.m_Nanoseconds = p_EndTime.m_Nanoseconds + (1000000000 - p_StartTime.m_Nanoseconds);
+		auto& l_Timer = m_Timers[p_Handle.m_Index];
+		l_Timer.m_Deadline = p_Deadline;
+		l_Timer.m_Callback = p_Callback;
+
+		Reorder(l_Timer.m_HeapIndex);
+		return;
+	}
+
+	// Otherwise, grab a free timer, or make a new one.
+	unsigned int l_TimerIndex = 0;
+
+	if (m_FreeTimerIndices.empty() == false)
+	{
+		l_TimerIndex = m_FreeTimerIndices.back();
+		m_FreeTimerIndices.pop_back();
 	}
 	else
 	{
-		l_ElapsedTime.m_Nanoseconds = p_EndTime.m_Nanoseconds - p_StartTime.m_Nanoseconds;
+		l_TimerIndex = static_cast<unsigned int>(m_Timers.size());
+		m_Timers.emplace_back(Timer());
 	}
-	
-	// Convert to milliseconds.
-	float const l_ElapsedTimeMS = (1.0e3f * l_ElapsedTime.m_Seconds) + 
-		(l_ElapsedTime.m_Nanoseconds / 1.0e6f);
-	return l_ElapsedTimeMS;
+
+	auto& l_Timer = m_Timers[l_TimerIndex];
+	l_Timer.m_Deadline = p_Deadline;
+	l_Timer.m_Callback = p_Callback;
+
+	// Put it at the end of the heap and let it rise to where it belongs.
+	l_Timer.m_HeapIndex = static_cast<unsigned int>(m_Heap.size());
+	m_Heap.push_back(l_TimerIndex);
+
+	Reorder(l_Timer.m_HeapIndex);
+
+	p_Handle.m_Index = l_TimerIndex;
+	p_Handle.m_Generation = l_Timer.m_Generation;
 }
+
+// Cancel a timer, if it is pending.
+//
+// p_Handle:	(Input/Output) The handle of the timer.
+//
+void TimerService::Cancel(TimerHandle& p_Handle)
+{
+	if (IsPending(p_Handle) == false)
+	{
+		return;
+	}
+
+	Remove(m_Timers[p_Handle.m_Index].m_HeapIndex);
+}
+
+// Determine whether a timer is waiting to fire.
+//
+// p_Handle:	The handle of the timer.
+//
+bool TimerService::IsPending(TimerHandle const& p_Handle) const
+{
+	if (p_Handle.m_Index >= m_Timers.size())
+	{
+		return false;
+	}
+
+	auto const& l_Timer = m_Timers[p_Handle.m_Index];
+
+	return ((l_Timer.m_Generation == p_Handle.m_Generation) && (l_Timer.m_HeapIndex != ms_NotInHeap));
+}
+
+// Get the earliest deadline of all of the pending timers.
+//
+// p_Deadline:	(Output) The earliest deadline.
+//
+// Returns:		True if there are any pending timers, false otherwise.
+//
+bool TimerService::GetNextDeadline(Time& p_Deadline) const
+{
+	if (m_Heap.empty() == true)
+	{
+		return false;
+	}
+
+	p_Deadline = m_Timers[m_Heap[0]].m_Deadline;
+	return true;
+}
+
+// Fire all of the timers whose deadlines have passed.
+//
+void TimerService::Process()
+{
+	if (m_Heap.empty() == true)
+	{
+		return;
+	}
+
+	Time l_CurrentTime;
+	TimerGetCurrent(l_CurrentTime);
+
+	// Keep firing the earliest timer until we get to one that isn't due.
+	while ((m_Heap.empty() == false) && ((m_Timers[m_Heap[0]].m_Deadline > l_CurrentTime) == false))
+	{
+		// Take the callback before releasing the timer, since the callback may arm timers of its own.
+		auto const l_Callback = std::move(m_Timers[m_Heap[0]].m_Callback);
+		Remove(0);
+
+		l_Callback();
+	}
+}
+
+// Determine whether one timer in the heap should fire before another.
+//
+// p_LeftHeapIndex:	The heap index of the first timer.
+// p_RightHeapIndex:	The heap index of the second timer.
+//
+bool TimerService::IsEarlier(unsigned int p_LeftHeapIndex, unsigned int p_RightHeapIndex) const
+{
+	return (m_Timers[m_Heap[p_LeftHeapIndex]].m_Deadline < m_Timers[m_Heap[p_RightHeapIndex]].m_Deadline);
+}
+
+// Swap two timers in the heap.
+//
+// p_LeftHeapIndex:	The heap index of the first timer.
+// p_RightHeapIndex:	The heap index of the second timer.
+//
+void TimerService::Swap(unsigned int p_LeftHeapIndex, unsigned int p_RightHeapIndex)
+{
+	std::swap(m_Heap[p_LeftHeapIndex], m_Heap[p_RightHeapIndex]);
+
+	m_Timers[m_Heap[p_LeftHeapIndex]].m_HeapIndex = p_LeftHeapIndex;
+	m_Timers[m_Heap[p_RightHeapIndex]].m_HeapIndex = p_RightHeapIndex;
+}
+
+// Restore the heap order after the timer at the given heap index changed.
+//
+// p_HeapIndex:	The heap index of the timer that changed.
+//
+void TimerService::Reorder(unsigned int p_HeapIndex)
+{
+	// Rise while earlier than the parent.
+	auto l_HeapIndex = p_HeapIndex;
+
+	while (l_HeapIndex > 0)
+	{
+		auto const l_ParentHeapIndex = (l_HeapIndex - 1) / 2;
+
+		if (IsEarlier(l_HeapIndex, l_ParentHeapIndex) == false)
+		{
+			break;
+		}
+
+		Swap(l_HeapIndex, l_ParentHeapIndex);
+		l_HeapIndex = l_ParentHeapIndex;
+	}
+
+	// Then sink while later than either child.
+	auto const l_HeapSize = static_cast<unsigned int>(m_Heap.size());
+
+	while (true)
+	{
+		auto const l_LeftChildHeapIndex = (2 * l_HeapIndex) + 1;
+		auto const l_RightChildHeapIndex = l_LeftChildHeapIndex + 1;
+
+		auto l_EarliestHeapIndex = l_HeapIndex;
+
+		if ((l_LeftChildHeapIndex < l_HeapSize) && 
+			(IsEarlier(l_LeftChildHeapIndex, l_EarliestHeapIndex) == true))
+		{
+			l_EarliestHeapIndex = l_LeftChildHeapIndex;
+		}
+
+		if ((l_RightChildHeapIndex < l_HeapSize) && 
+			(IsEarlier(l_RightChildHeapIndex, l_EarliestHeapIndex) == true))
+		{
+			l_EarliestHeapIndex = l_RightChildHeapIndex;
+		}
+
+		if (l_EarliestHeapIndex == l_HeapIndex)
+		{
+			break;
+		}
+
+		Swap(l_HeapIndex, l_EarliestHeapIndex);
+		l_HeapIndex = l_EarliestHeapIndex;
+	}
+}
+
+// Remove the timer at the given heap index and release it.
+//
+// p_HeapIndex:	The heap index of the timer to remove.
+//
+void TimerService::Remove(unsigned int p_HeapIndex)
+{
+	auto const l_TimerIndex = m_Heap[p_HeapIndex];
+	auto const l_LastHeapIndex = static_cast<unsigned int>(m_Heap.size()) - 1;
+
+	// Move the last timer into the hole and fix up the order around it.
+	if (p_HeapIndex != l_LastHeapIndex)
+	{
+		Swap(p_HeapIndex, l_LastHeapIndex);
+	}
+
+	m_Heap.pop_back();
+
+	if (p_HeapIndex < m_Heap.size())
+	{
+		Reorder(p_HeapIndex);
+	}
+
+	// Release the timer, invalidating any handles to it.
+	auto& l_Timer = m_Timers[l_TimerIndex];
+	l_Timer.m_HeapIndex = ms_NotInHeap;
+	l_Timer.m_Callback = nullptr;
+	l_Timer.m_Generation++;
+
+	m_FreeTimerIndices.push_back(l_TimerIndex);
+}
\ No newline at end of file
@@ -1,34 +1,167 @@
 #pragma once
 
+#include <chrono>
+#include <functional>
 #include <stdint.h>
+#include <vector>
 
 // Types
 //
 
+// A clock that only ever moves forward at a steady rate, so that elapsed times are not affected by
+// adjustments to the wall clock. Wall clock time is only for display, in logs and reports.
+struct MonotonicClock
+{
+	using duration = std::chrono::nanoseconds;
+	using rep = duration::rep;
+	using period = duration::period;
+	using time_point = std::chrono::time_point<MonotonicClock>;
+
+	static constexpr bool is_steady = true;
+
+	// Get the current time.
+	//
+	// Returns:		The current time.
+	//
+	static time_point now();
+};
+
 // Represents a point in time useful for elapsed time.
-struct Time
+using Time = MonotonicClock::time_point;
+
+// An amount of time, in integer nanoseconds.
+using Duration = MonotonicClock::duration;
+
+// Allow durations to be written as literals, like 700ms or 5s.
+using namespace std::chrono_literals;
+
+// A handle to a timer in a timer service.
+class TimerHandle
 {
-	// The portion of the time in seconds.
-	uint64_t m_Seconds = 0;
-	
-	// The portion of the time in nanoseconds.
-	uint64_t m_Nanoseconds = 0;	
-
-	friend auto operator<(const Time& p_Left, const Time& p_Right)
-	{
-		if (p_Left.m_Seconds != p_Right.m_Seconds)
+	public:
+
+		// Only allow non-friends to construct invalid handles.
+		TimerHandle() = default;
+
+		// Determine whether the handle has ever been armed. Note that a valid handle may refer to a 
+		// timer which has since fired or been canceled.
+		//
+		bool IsValid() const
 		{
-			return p_Left.m_Seconds < p_Right.m_Seconds;
+			return (m_Index != ms_InvalidIndex);
 		}
 
-		return p_Left.m_Nanoseconds < p_Right.m_Nanoseconds;
-	}
+	private:
+
+		friend class TimerService;
+
+		// The invalid index for a timer.
+		static constexpr unsigned int ms_InvalidIndex = 0xFFFFFFFF;
+
+		// The index of the timer in the service.
+		unsigned int m_Index = ms_InvalidIndex;
+
+		// Which use of the timer slot this handle refers to, so that stale handles can be detected.
+		unsigned int m_Generation = 0;
+};
+
+// A function to call when a timer fires.
+using TimerCallback = std::function<void()>;
+
+// Keeps track of timers by deadline, so that nothing has to check the time just to find out that 
+// it isn't time yet.
+class TimerService
+{
+	public:
+
+		// Arm a timer. If the handle refers to a pending timer, that timer is moved to the new 
+		// deadline instead.
+		//
+		// p_Handle:	(Input/Output) The handle of the timer.
+		// p_Deadline:	When the timer should fire.
+		// p_Callback:	The function to call when the timer fires.
+		//
+		void Arm(TimerHandle& p_Handle, Time const& p_Deadline, TimerCallback const& p_Callback);
+
+		// Cancel a timer, if it is pending.
+		//
+		// p_Handle:	(Input/Output) The handle of the timer.
+		//
+		void Cancel(TimerHandle& p_Handle);
 
-	friend auto operator>(const Time& p_Left, const Time& p_Right)
-	{
-		return p_Right < p_Left;
-	}
+		// Determine whether a timer is waiting to fire.
+		//
+		// p_Handle:	The handle of the timer.
+		//
+		bool IsPending(TimerHandle const& p_Handle) const;
 
+		// Get the earliest deadline of all of the pending timers.
+		//
+		// p_Deadline:	(Output) The earliest deadline.
+		//
+		// Returns:		True if there are any pending timers, false otherwise.
+		//
+		bool GetNextDeadline(Time& p_Deadline) const;
+
+		// Fire all of the timers whose deadlines have passed.
+		//
+		void Process();
+
+	private:
+
+		// A single timer.
+		struct Timer
+		{
+			// When the timer should fire.
+			Time				m_Deadline;
+
+			// The function to call when the timer fires.
+			TimerCallback	m_Callback;
+
+			// Incremented every time the timer is released, to invalidate old handles.
+			unsigned int	m_Generation = 0;
+
+			// Where the timer is in the heap, if it is pending.
+			unsigned int	m_HeapIndex = ms_NotInHeap;
+		};
+
+		// Signifies that a timer is not in the heap.
+		static constexpr unsigned int ms_NotInHeap = 0xFFFFFFFF;
+
+		// Determine whether one timer in the heap should fire before another.
+		//
+		// p_LeftHeapIndex:	The heap index of the first timer.
+		// p_RightHeapIndex:	The heap index of the second timer.
+		//
+		bool IsEarlier(unsigned int p_LeftHeapIndex, unsigned int p_RightHeapIndex) const;
+
+		// Swap two timers in the heap.
+		//
+		// p_LeftHeapIndex:	The heap index of the first timer.
+		// p_RightHeapIndex:	The heap index of the second timer.
+		//
+		void Swap(unsigned int p_LeftHeapIndex, unsigned int p_RightHeapIndex);
+
+		// Restore the heap order after the timer at the given heap index changed.
+		//
+		// p_HeapIndex:	The heap index of the timer that changed.
+		//
+		void Reorder(unsigned int p_HeapIndex);
+
+		// Remove the timer at the given heap index and release it.
+		//
+		// p_HeapIndex:	The heap index of the timer to remove.
+		//
+		void Remove(unsigned int p_HeapIndex);
+
+		// Storage for all of the timers, pending or not.
+		std::vector<Timer> m_Timers;
+
+		// The indices of timers that are free to be reused.
+		std::vector<unsigned int> m_FreeTimerIndices;
+
+		// A binary min-heap of the indices of the pending timers, ordered by deadline.
+		std::vector<unsigned int> m_Heap;
 };
 
 // Functions
@@ -40,10 +173,19 @@ struct Time
 //
 void TimerGetCurrent(Time& p_Time);
 
-// Get the elapsed time in milliseconds between two times.
-// Note: Will return -1 if the end time is less than the start time.
+// Switch the clock over to virtual time, which only moves when it is advanced, so that a simulation
+// can run much faster than real time.
+//
+// p_StartTime:	The time to start the virtual clock at.
+//
+void TimerStartVirtualClock(Time const& p_StartTime);
+
+// Switch the clock back to real time.
+//
+void TimerStopVirtualClock();
+
+// Move the virtual clock forward. It never moves backward.
 //
-// p_StartTime:	Start time.
-// p_EndTime:		End time.
+// p_Time:	The new time.
 //
-float TimerGetElapsedMilliseconds(Time const& p_StartTime, Time const& p_EndTime);
+void TimerAdvanceVirtualClock(Time const& p_Time);
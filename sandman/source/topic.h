@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Types
+//
+
+// Maps MQTT topic filters to values, so that a topic can be matched against all of them at once by
+// walking its levels. Filters may use "+" for any one level, and "#" as their last level for any
+// number of levels, including none. Looking up a topic doesn't allocate.
+//
+// ValueType:	The type of the values. Keep them small, such as a pointer.
+//
+template <typename ValueType>
+class TopicTree
+{
+	public:
+
+		TopicTree();
+
+		// Remove every filter.
+		//
+		void Clear();
+
+		// Add a filter. A filter that was already added gets the new value.
+		//
+		// p_Filter:	The filter, with levels separated by "/".
+		// p_Value:		The value for topics that match it.
+		//
+		void Add(std::string_view p_Filter, ValueType const& p_Value);
+
+		// Find the value for a topic. When several filters match, a level that matches exactly beats
+		// "+", which beats "#".
+		//
+		// p_Topic:	The topic, with levels separated by "/".
+		//
+		// Returns:	The value of the filter that matched, or null if none did.
+		//
+		ValueType const* Find(std::string_view p_Topic) const;
+
+	private:
+
+		// A level of the filters that share everything up to it.
+		struct Node
+		{
+			// The level, or "+".
+			std::string						m_Level;
+
+			// The nodes for the levels that follow, by index.
+			std::vector<unsigned int>	m_Children;
+
+			// The value for filters that end here, if there is one.
+			bool								m_HasValue = false;
+			ValueType						m_Value{};
+
+			// The value for filters that continue with "#", if there is one.
+			bool								m_HasMultiLevelValue = false;
+			ValueType						m_MultiLevelValue{};
+		};
+
+		// Find the value for the rest of a topic.
+		//
+		// p_NodeIndex:	The node that matched the levels before.
+		// p_Topic:			The rest of the topic.
+		// p_Ended:			Whether the topic has no more levels, since an empty level is still a level.
+		//
+		// Returns:	The value of the filter that matched, or null if none did.
+		//
+		ValueType const* FindFrom(unsigned int p_NodeIndex, std::string_view p_Topic, 
+			bool p_Ended) const;
+
+		// Every node, with the root, which comes before the first level, at the start.
+		std::vector<Node>	m_Nodes;
+};
+
+#include "topic.inl"
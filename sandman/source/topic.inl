@@ -0,0 +1,161 @@
+// TopicTree members
+
+template <typename ValueType>
+TopicTree<ValueType>::TopicTree()
+{
+	Clear();
+}
+
+// Remove every filter.
+//
+template <typename ValueType>
+void TopicTree<ValueType>::Clear()
+{
+	m_Nodes.clear();
+
+	// Keep the root.
+	m_Nodes.emplace_back();
+}
+
+// Add a filter. A filter that was already added gets the new value.
+//
+// p_Filter:	The filter, with levels separated by "/".
+// p_Value:		The value for topics that match it.
+//
+template <typename ValueType>
+void TopicTree<ValueType>::Add(std::string_view p_Filter, ValueType const& p_Value)
+{
+	unsigned int l_NodeIndex = 0;
+
+	while (true)
+	{
+		auto const l_LevelEnd = p_Filter.find('/');
+		auto const l_Level = p_Filter.substr(0, l_LevelEnd);
+
+		// Anything else after "#" would never be reached.
+		if (l_Level == "#")
+		{
+			m_Nodes[l_NodeIndex].m_HasMultiLevelValue = true;
+			m_Nodes[l_NodeIndex].m_MultiLevelValue = p_Value;
+			return;
+		}
+
+		// Find the node for this level, or make one.
+		unsigned int l_ChildIndex = 0;
+
+		for (auto const l_Index : m_Nodes[l_NodeIndex].m_Children)
+		{
+			if (m_Nodes[l_Index].m_Level == l_Level)
+			{
+				l_ChildIndex = l_Index;
+				break;
+			}
+		}
+
+		if (l_ChildIndex == 0)
+		{
+			// The nodes may move as this grows, so only hold on to indices.
+			l_ChildIndex = static_cast<unsigned int>(m_Nodes.size());
+			m_Nodes.emplace_back();
+			m_Nodes[l_ChildIndex].m_Level = l_Level;
+			m_Nodes[l_NodeIndex].m_Children.push_back(l_ChildIndex);
+		}
+
+		l_NodeIndex = l_ChildIndex;
+
+		if (l_LevelEnd == std::string_view::npos)
+		{
+			break;
+		}
+
+		p_Filter.remove_prefix(l_LevelEnd + 1);
+	}
+
+	m_Nodes[l_NodeIndex].m_HasValue = true;
+	m_Nodes[l_NodeIndex].m_Value = p_Value;
+}
+
+// Find the value for a topic. When several filters match, a level that matches exactly beats "+", 
+// which beats "#".
+//
+// p_Topic:	The topic, with levels separated by "/".
+//
+// Returns:	The value of the filter that matched, or null if none did.
+//
+template <typename ValueType>
+ValueType const* TopicTree<ValueType>::Find(std::string_view p_Topic) const
+{
+	return FindFrom(0, p_Topic, false);
+}
+
+// Find the value for the rest of a topic.
+//
+// p_NodeIndex:	The node that matched the levels before.
+// p_Topic:			The rest of the topic.
+// p_Ended:			Whether the topic has no more levels, since an empty level is still a level.
+//
+// Returns:	The value of the filter that matched, or null if none did.
+//
+template <typename ValueType>
+ValueType const* TopicTree<ValueType>::FindFrom(unsigned int p_NodeIndex, 
+	std::string_view p_Topic, bool p_Ended) const
+{
+	auto const& l_Node = m_Nodes[p_NodeIndex];
+
+	if (p_Ended == true)
+	{
+		// "#" also matches the level before it, so "a/#" matches "a".
+		if (l_Node.m_HasValue == true)
+		{
+			return &l_Node.m_Value;
+		}
+
+		return (l_Node.m_HasMultiLevelValue == true) ? &l_Node.m_MultiLevelValue : nullptr;
+	}
+
+	auto const l_LevelEnd = p_Topic.find('/');
+	auto const l_Level = p_Topic.substr(0, l_LevelEnd);
+	auto const l_Rest = (l_LevelEnd != std::string_view::npos) ? p_Topic.substr(l_LevelEnd + 1) : 
+		std::string_view();
+	auto const l_RestEnded = (l_LevelEnd == std::string_view::npos);
+
+	// Try the level itself before "+", falling back if the rest of the topic doesn't match below it.
+	unsigned int l_ExactIndex = 0;
+	unsigned int l_SingleLevelIndex = 0;
+
+	for (auto const l_ChildIndex : l_Node.m_Children)
+	{
+		auto const& l_ChildLevel = m_Nodes[l_ChildIndex].m_Level;
+
+		if (l_ChildLevel == "+")
+		{
+			l_SingleLevelIndex = l_ChildIndex;
+		}
+		else if (l_ChildLevel == l_Level)
+		{
+			l_ExactIndex = l_ChildIndex;
+		}
+	}
+
+	if (l_ExactIndex != 0)
+	{
+		auto const* l_Value = FindFrom(l_ExactIndex, l_Rest, l_RestEnded);
+
+		if (l_Value != nullptr)
+		{
+			return l_Value;
+		}
+	}
+
+	if (l_SingleLevelIndex != 0)
+	{
+		auto const* l_Value = FindFrom(l_SingleLevelIndex, l_Rest, l_RestEnded);
+
+		if (l_Value != nullptr)
+		{
+			return l_Value;
+		}
+	}
+
+	return (l_Node.m_HasMultiLevelValue == true) ? &l_Node.m_MultiLevelValue : nullptr;
+}
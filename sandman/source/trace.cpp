@@ -0,0 +1,341 @@
+#include "trace.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "rapidjson/filewritestream.h"
+#include "rapidjson/writer.h"
+
+// Constants
+//
+
+// How many of the most recent events each thread keeps. This must be a power of two.
+#define TRACE_BUFFER_CAPACITY		(4096)
+
+// Types
+//
+
+// A span or moment in a trace.
+struct TraceEvent
+{
+	// Odd while the event is being written, and twice the event's index plus two once it is done,
+	// so that a reader can tell whether it got a torn copy.
+	std::atomic<uint64_t>	m_Sequence{0};
+
+	// The name of the event.
+	char const*					m_Name = nullptr;
+
+	// When the event started.
+	Time							m_StartTime;
+
+	// How long the event lasted.
+	Duration						m_Duration;
+
+	// Whether this is a moment rather than a span.
+	bool							m_IsInstant = false;
+};
+
+// The recent events for one thread. Only the owning thread writes events, but any thread may read
+// them.
+struct TraceBuffer
+{
+	// Constants.
+	static constexpr unsigned int ms_ThreadNameCapacity = 32;
+
+	// Identifies the thread in the trace.
+	unsigned int				m_ThreadID = 0;
+
+	// The name of the thread, protected by the buffer list mutex.
+	char							m_ThreadName[ms_ThreadNameCapacity] = {};
+
+	// How many events have ever been written.
+	std::atomic<uint64_t>	m_WriteCount{0};
+
+	// The events, used as a ring.
+	TraceEvent					m_Events[TRACE_BUFFER_CAPACITY];
+};
+
+// What a dump needs from a buffer, copied while the buffer list is locked.
+struct TraceBufferSnapshot
+{
+	// The buffer. Buffers are never freed, so this stays valid after the lock is released.
+	TraceBuffer const*	m_Buffer = nullptr;
+
+	// The name of the thread when the dump started.
+	char						m_ThreadName[TraceBuffer::ms_ThreadNameCapacity] = {};
+};
+
+// Locals
+//
+
+// Protects the list of buffers.
+static std::mutex s_TraceBuffersMutex;
+
+// Every thread's buffer. These are never freed, so that the events of threads that have exited can
+// still be dumped.
+static std::vector<std::unique_ptr<TraceBuffer>> s_TraceBuffers;
+
+// The calling thread's buffer.
+static thread_local TraceBuffer* s_ThreadTraceBuffer = nullptr;
+
+// Functions
+//
+
+// Get the calling thread's buffer, creating it if needed.
+//
+// Returns:		The buffer.
+//
+static TraceBuffer& TraceGetThreadBuffer()
+{
+	if (s_ThreadTraceBuffer != nullptr)
+	{
+		return *s_ThreadTraceBuffer;
+	}
+
+	std::lock_guard<std::mutex> l_BuffersGuard(s_TraceBuffersMutex);
+
+	s_TraceBuffers.emplace_back(new TraceBuffer());
+	s_ThreadTraceBuffer = s_TraceBuffers.back().get();
+	s_ThreadTraceBuffer->m_ThreadID = static_cast<unsigned int>(s_TraceBuffers.size());
+
+	return *s_ThreadTraceBuffer;
+}
+
+// Record an event in the calling thread's buffer.
+//
+// p_Name:			The name of the event.
+// p_StartTime:	When the event started.
+// p_Duration:		How long the event lasted.
+// p_IsInstant:	Whether this is a moment rather than a span.
+//
+static void TraceAddEvent(char const* p_Name, Time const& p_StartTime, Duration p_Duration,
+	bool p_IsInstant)
+{
+	auto& l_Buffer = TraceGetThreadBuffer();
+
+	auto const l_EventIndex = l_Buffer.m_WriteCount.load(std::memory_order_relaxed);
+	auto& l_Event = l_Buffer.m_Events[l_EventIndex & (TRACE_BUFFER_CAPACITY - 1)];
+
+	// Mark the event as being written before touching it.
+	l_Event.m_Sequence.store((2 * l_EventIndex) + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	l_Event.m_Name = p_Name;
+	l_Event.m_StartTime = p_StartTime;
+	l_Event.m_Duration = p_Duration;
+	l_Event.m_IsInstant = p_IsInstant;
+
+	l_Event.m_Sequence.store((2 * l_EventIndex) + 2, std::memory_order_release);
+	l_Buffer.m_WriteCount.store(l_EventIndex + 1, std::memory_order_release);
+}
+
+// TraceScope members
+
+// Start the span.
+//
+// p_Name:	The name of the span. This must be a string literal, because only the pointer is kept.
+//
+TraceScope::TraceScope(char const* p_Name)
+	: m_Name(p_Name)
+{
+	TimerGetCurrent(m_StartTime);
+}
+
+// End the span and record it.
+//
+TraceScope::~TraceScope()
+{
+	Time l_EndTime;
+	TimerGetCurrent(l_EndTime);
+
+	TraceAddEvent(m_Name, m_StartTime, l_EndTime - m_StartTime, false);
+}
+
+// Name the calling thread in the trace.
+//
+// p_Name:	The name of the thread.
+//
+void TraceSetThreadName(char const* p_Name)
+{
+	auto& l_Buffer = TraceGetThreadBuffer();
+
+	std::lock_guard<std::mutex> l_BuffersGuard(s_TraceBuffersMutex);
+
+	strncpy(l_Buffer.m_ThreadName, p_Name, TraceBuffer::ms_ThreadNameCapacity - 1);
+	l_Buffer.m_ThreadName[TraceBuffer::ms_ThreadNameCapacity - 1] = '\0';
+}
+
+// Record a span in the calling thread's trace buffer.
+//
+// p_Name:			The name of the span. This must be a string literal, because only the pointer is
+//						kept.
+// p_StartTime:	When the span started.
+// p_EndTime:		When the span ended.
+//
+void TraceAddSpan(char const* p_Name, Time const& p_StartTime, Time const& p_EndTime)
+{
+	TraceAddEvent(p_Name, p_StartTime, p_EndTime - p_StartTime, false);
+}
+
+// Record a moment in the calling thread's trace buffer.
+//
+// p_Name:	The name of the moment. This must be a string literal, because only the pointer is kept.
+//
+void TraceAddInstant(char const* p_Name)
+{
+	Time l_CurrentTime;
+	TimerGetCurrent(l_CurrentTime);
+
+	TraceAddEvent(p_Name, l_CurrentTime, Duration::zero(), true);
+}
+
+// Convert a time or duration to the microseconds that the trace format uses.
+//
+// p_Duration:	The duration.
+//
+// Returns:		The duration in microseconds.
+//
+static double TraceGetMicroseconds(Duration p_Duration)
+{
+	return std::chrono::duration<double, std::micro>(p_Duration).count();
+}
+
+// Write the recent contents of every thread's trace buffer to a file in Chrome Trace Event format,
+// which can be opened in chrome://tracing or Perfetto.
+//
+// p_FileName:	The name of the file to write.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool TraceDump(char const* p_FileName)
+{
+	// Copy the list of buffers, so that threads starting up or naming themselves don't wait on the
+	// file.
+	std::vector<TraceBufferSnapshot> l_Snapshots;
+
+	{
+		std::lock_guard<std::mutex> l_BuffersGuard(s_TraceBuffersMutex);
+
+		l_Snapshots.resize(s_TraceBuffers.size());
+
+		for (unsigned int l_BufferIndex = 0; l_BufferIndex < s_TraceBuffers.size(); l_BufferIndex++)
+		{
+			auto& l_Snapshot = l_Snapshots[l_BufferIndex];
+
+			l_Snapshot.m_Buffer = s_TraceBuffers[l_BufferIndex].get();
+			memcpy(l_Snapshot.m_ThreadName, l_Snapshot.m_Buffer->m_ThreadName,
+				sizeof(l_Snapshot.m_ThreadName));
+		}
+	}
+
+	auto* l_TraceFile = fopen(p_FileName, "w");
+
+	if (l_TraceFile == nullptr)
+	{
+		return false;
+	}
+
+	static constexpr unsigned int l_WriteBufferCapacity = 65536;
+	char l_WriteBuffer[l_WriteBufferCapacity];
+	rapidjson::FileWriteStream l_TraceFileStream(l_TraceFile, l_WriteBuffer, sizeof(l_WriteBuffer));
+	rapidjson::Writer<rapidjson::FileWriteStream> l_TraceWriter(l_TraceFileStream);
+
+	auto const l_ProcessID = static_cast<int>(getpid());
+
+	l_TraceWriter.StartObject();
+	l_TraceWriter.Key("displayTimeUnit");
+	l_TraceWriter.String("ms");
+	l_TraceWriter.Key("traceEvents");
+	l_TraceWriter.StartArray();
+
+	for (auto const& l_Snapshot : l_Snapshots)
+	{
+		auto const* l_Buffer = l_Snapshot.m_Buffer;
+
+		// Name the thread.
+		if (l_Snapshot.m_ThreadName[0] != '\0')
+		{
+			l_TraceWriter.StartObject();
+			l_TraceWriter.Key("name");
+			l_TraceWriter.String("thread_name");
+			l_TraceWriter.Key("ph");
+			l_TraceWriter.String("M");
+			l_TraceWriter.Key("pid");
+			l_TraceWriter.Int(l_ProcessID);
+			l_TraceWriter.Key("tid");
+			l_TraceWriter.Uint(l_Buffer->m_ThreadID);
+			l_TraceWriter.Key("args");
+			l_TraceWriter.StartObject();
+			l_TraceWriter.Key("name");
+			l_TraceWriter.String(l_Snapshot.m_ThreadName);
+			l_TraceWriter.EndObject();
+			l_TraceWriter.EndObject();
+		}
+
+		// Write whatever events are still in the ring.
+		auto const l_WriteCount = l_Buffer->m_WriteCount.load(std::memory_order_acquire);
+		auto const l_FirstEventIndex = (l_WriteCount > TRACE_BUFFER_CAPACITY) ?
+			(l_WriteCount - TRACE_BUFFER_CAPACITY) : 0;
+
+		for (auto l_EventIndex = l_FirstEventIndex; l_EventIndex < l_WriteCount; l_EventIndex++)
+		{
+			auto const& l_Event = l_Buffer->m_Events[l_EventIndex & (TRACE_BUFFER_CAPACITY - 1)];
+
+			// Copy the event, then make sure the owning thread didn't overwrite it while we did.
+			auto const l_Sequence = l_Event.m_Sequence.load(std::memory_order_acquire);
+
+			auto const* l_Name = l_Event.m_Name;
+			auto const l_StartTime = l_Event.m_StartTime;
+			auto const l_Duration = l_Event.m_Duration;
+			auto const l_IsInstant = l_Event.m_IsInstant;
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			if ((l_Sequence != ((2 * l_EventIndex) + 2)) ||
+				(l_Event.m_Sequence.load(std::memory_order_relaxed) != l_Sequence))
+			{
+				continue;
+			}
+
+			l_TraceWriter.StartObject();
+			l_TraceWriter.Key("name");
+			l_TraceWriter.String(l_Name);
+			l_TraceWriter.Key("cat");
+			l_TraceWriter.String("sandman");
+			l_TraceWriter.Key("ph");
+			l_TraceWriter.String((l_IsInstant == true) ? "i" : "X");
+			l_TraceWriter.Key("ts");
+			l_TraceWriter.Double(TraceGetMicroseconds(l_StartTime.time_since_epoch()));
+
+			if (l_IsInstant == true)
+			{
+				l_TraceWriter.Key("s");
+				l_TraceWriter.String("t");
+			}
+			else
+			{
+				l_TraceWriter.Key("dur");
+				l_TraceWriter.Double(TraceGetMicroseconds(l_Duration));
+			}
+
+			l_TraceWriter.Key("pid");
+			l_TraceWriter.Int(l_ProcessID);
+			l_TraceWriter.Key("tid");
+			l_TraceWriter.Uint(l_Buffer->m_ThreadID);
+			l_TraceWriter.EndObject();
+		}
+	}
+
+	l_TraceWriter.EndArray();
+	l_TraceWriter.EndObject();
+
+	l_TraceFileStream.Flush();
+	fclose(l_TraceFile);
+
+	return true;
+}
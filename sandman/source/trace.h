@@ -0,0 +1,67 @@
+#pragma once
+
+#include "timer.h"
+
+// Types
+//
+
+// Records the time from its construction to its destruction as a span in the trace.
+class TraceScope
+{
+	public:
+
+		// Start the span.
+		//
+		// p_Name:	The name of the span. This must be a string literal, because only the pointer is
+		//				kept.
+		//
+		explicit TraceScope(char const* p_Name);
+
+		// End the span and record it.
+		//
+		~TraceScope();
+
+		TraceScope(TraceScope const&) = delete;
+		TraceScope& operator=(TraceScope const&) = delete;
+
+	private:
+
+		// The name of the span.
+		char const* m_Name;
+
+		// When the span started.
+		Time m_StartTime;
+};
+
+// Functions
+//
+
+// Name the calling thread in the trace.
+//
+// p_Name:	The name of the thread.
+//
+void TraceSetThreadName(char const* p_Name);
+
+// Record a span in the calling thread's trace buffer.
+//
+// p_Name:			The name of the span. This must be a string literal, because only the pointer is
+//						kept.
+// p_StartTime:	When the span started.
+// p_EndTime:		When the span ended.
+//
+void TraceAddSpan(char const* p_Name, Time const& p_StartTime, Time const& p_EndTime);
+
+// Record a moment in the calling thread's trace buffer.
+//
+// p_Name:	The name of the moment. This must be a string literal, because only the pointer is kept.
+//
+void TraceAddInstant(char const* p_Name);
+
+// Write the recent contents of every thread's trace buffer to a file in Chrome Trace Event format,
+// which can be opened in chrome://tracing or Perfetto.
+//
+// p_FileName:	The name of the file to write.
+//
+// Returns:		True if successful, false otherwise.
+//
+bool TraceDump(char const* p_FileName);